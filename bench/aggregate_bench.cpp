@@ -0,0 +1,224 @@
+//
+// Created by wyz on 2022/6/25.
+//
+#include "bench.hpp"
+#include <random>
+#include "factory/accelerator.hpp"
+#include "factory/material.hpp"
+#include "factory/medium.hpp"
+#include "factory/primivite.hpp"
+#include "factory/shape.hpp"
+#include "factory/texture.hpp"
+#include "core/intersection.hpp"
+#include "core/medium.hpp"
+#include "utility/logger.hpp"
+#include "utility/transform.hpp"
+
+TRACER_BEGIN
+
+namespace bench{
+
+    namespace{
+        //all scenes fill [0,scene_size]^3
+        constexpr real scene_size = 10;
+        constexpr int ray_count = 1 << 16;
+
+        struct Context{
+            RC<Material> material;
+            MediumInterface mi;
+        };
+
+        void add_mesh(const Context& ctx,const mesh_t& mesh,const Transform& local_to_world,
+                      std::vector<RC<Primitive>>& primitives){
+            for(auto& triangle:create_triangle_mesh(mesh,local_to_world))
+                primitives.emplace_back(create_geometric_primitive(triangle,ctx.material,ctx.mi,Spectrum()));
+        }
+
+        void push_triangle(mesh_t& mesh,const Point3f& a,const Point3f& b,const Point3f& c){
+            Vector3f n = cross(b - a,c - a);
+            n = !n ? Vector3f(0,0,1) : n.normalize();
+            const int base = static_cast<int>(mesh.vertices.size());
+            mesh.vertices.push_back({a,Normal3f(n.x,n.y,n.z),Point2f(0,0)});
+            mesh.vertices.push_back({b,Normal3f(n.x,n.y,n.z),Point2f(1,0)});
+            mesh.vertices.push_back({c,Normal3f(n.x,n.y,n.z),Point2f(0,1)});
+            mesh.indices.insert(mesh.indices.end(),{base,base + 1,base + 2});
+            mesh.materials.push_back(0);
+        }
+
+        //small random triangles, the worst case for sah splits
+        std::vector<RC<Primitive>> create_triangle_soup(const Context& ctx,int count){
+            std::mt19937 rng(1);
+            std::uniform_real_distribution<real> pos(0,scene_size);
+            std::uniform_real_distribution<real> offset(-0.15f,0.15f);
+            mesh_t mesh;
+            for(int i = 0; i < count; ++i){
+                const Point3f c(pos(rng),pos(rng),pos(rng));
+                push_triangle(mesh,
+                              c + Vector3f(offset(rng),offset(rng),offset(rng)),
+                              c + Vector3f(offset(rng),offset(rng),offset(rng)),
+                              c + Vector3f(offset(rng),offset(rng),offset(rng)));
+            }
+            std::vector<RC<Primitive>> primitives;
+            add_mesh(ctx,mesh,Transform(),primitives);
+            return primitives;
+        }
+
+        std::vector<RC<Primitive>> create_sphere_grid(const Context& ctx,int n){
+            std::vector<RC<Primitive>> primitives;
+            const real spacing = scene_size / n;
+            for(int z = 0; z < n; ++z)
+                for(int y = 0; y < n; ++y)
+                    for(int x = 0; x < n; ++x){
+                        const Vector3f center((x + 0.5f) * spacing,(y + 0.5f) * spacing,(z + 0.5f) * spacing);
+                        primitives.emplace_back(create_geometric_primitive(
+                                create_sphere(spacing * 0.4f,translate(center)),ctx.material,ctx.mi,Spectrum()));
+                    }
+            return primitives;
+        }
+
+        //a bumpy unit sphere placed n^3 times with random rotation and scale
+        //shapes keep world space vertices, so instances cost the same as unique meshes
+        std::vector<RC<Primitive>> create_instanced_meshes(const Context& ctx,int n){
+            constexpr int segments_u = 48, segments_v = 24;
+            auto vertex = [](int i,int j){
+                const real phi = 2 * PI_r * i / segments_u;
+                const real theta = PI_r * j / segments_v;
+                const real r = 1 + 0.1f * std::sin(5 * phi) * std::sin(4 * theta);
+                return Point3f(r * std::sin(theta) * std::cos(phi),r * std::sin(theta) * std::sin(phi),r * std::cos(theta));
+            };
+            mesh_t mesh;
+            for(int j = 0; j < segments_v; ++j){
+                for(int i = 0; i < segments_u; ++i){
+                    const auto p00 = vertex(i,j), p10 = vertex(i + 1,j);
+                    const auto p01 = vertex(i,j + 1), p11 = vertex(i + 1,j + 1);
+                    if(j > 0) push_triangle(mesh,p00,p01,p10);
+                    if(j < segments_v - 1) push_triangle(mesh,p10,p01,p11);
+                }
+            }
+            std::mt19937 rng(2);
+            std::uniform_real_distribution<real> u(0,1);
+            std::vector<RC<Primitive>> primitives;
+            const real spacing = scene_size / n;
+            for(int z = 0; z < n; ++z)
+                for(int y = 0; y < n; ++y)
+                    for(int x = 0; x < n; ++x){
+                        const Vector3f center((x + 0.5f) * spacing,(y + 0.5f) * spacing,(z + 0.5f) * spacing);
+                        const Transform rotation = rotate_z(2 * PI_r * u(rng)) * rotate_y(2 * PI_r * u(rng)) * rotate_x(2 * PI_r * u(rng));
+                        const real s = spacing * (0.25f + 0.2f * u(rng));
+                        add_mesh(ctx,mesh,translate(center) * rotation * scale(s,s,s),primitives);
+                    }
+            return primitives;
+        }
+
+        struct Rays{
+            //from outside towards random points of the scene
+            std::vector<Ray> incoherent;
+            //pinhole camera rays in scanline order
+            std::vector<Ray> coherent;
+            //between two random points inside the scene, some are occluded
+            std::vector<Ray> shadow;
+        };
+
+        Rays create_rays(){
+            std::mt19937 rng(3);
+            std::uniform_real_distribution<real> u(0,1);
+            const Point3f center(scene_size / 2,scene_size / 2,scene_size / 2);
+            auto inside = [&](){
+                return Point3f(u(rng) * scene_size,u(rng) * scene_size,u(rng) * scene_size);
+            };
+            Rays rays;
+            for(int i = 0; i < ray_count; ++i){
+                const real z = 1 - 2 * u(rng), phi = 2 * PI_r * u(rng);
+                const real r = std::sqrt((std::max)(real(0),1 - z * z));
+                const Point3f o = center + Vector3f(r * std::cos(phi),r * std::sin(phi),z) * scene_size * 1.2f;
+                rays.incoherent.emplace_back(o,inside() - o,eps);
+            }
+            const int res = static_cast<int>(std::sqrt(ray_count));
+            const Point3f eye(scene_size / 2,scene_size / 2,-scene_size);
+            for(int y = 0; y < res; ++y){
+                for(int x = 0; x < res; ++x){
+                    const Vector3f d((x + 0.5f) / res - 0.5f,(y + 0.5f) / res - 0.5f,1);
+                    rays.coherent.emplace_back(eye,d,eps);
+                }
+            }
+            for(int i = 0; i < ray_count; ++i){
+                const Point3f a = inside(), b = inside();
+                rays.shadow.emplace_back(a,b - a,eps,(b - a).length() - eps);
+            }
+            return rays;
+        }
+
+        void run_scene(Bench& bench,const std::string& name,std::vector<RC<Primitive>> primitives,const Rays& rays){
+            //build logs its node count every time
+            auto build = [](std::vector<RC<Primitive>> primitives){
+                auto bvh = create_bvh_accel(3);
+                SET_LOG_LEVEL_ERROR
+                bvh->build(std::move(primitives));
+                SET_LOG_LEVEL_INFO
+                return bvh;
+            };
+            bench.run(name + "/build",primitives.size(),[&](){
+                return build(primitives)->world_bound().high.x;
+            });
+            auto bvh = build(std::move(primitives));
+            //intersect_p shrinks ray.t_max, so every call starts from a copy
+            auto closest_hit = [&](const std::vector<Ray>& batch){
+                real sum = 0;
+                SurfaceIntersection isect;
+                for(auto ray:batch){
+                    if(bvh->intersect_p(ray,&isect))
+                        sum += ray.t_max;
+                }
+                return sum;
+            };
+            bench.run(name + "/closest_hit",rays.incoherent.size(),[&](){
+                return closest_hit(rays.incoherent);
+            });
+            bench.run(name + "/closest_hit_coherent",rays.coherent.size(),[&](){
+                return closest_hit(rays.coherent);
+            });
+            bench.run(name + "/any_hit",rays.shadow.size(),[&](){
+                int occluded = 0;
+                for(const auto& ray:rays.shadow)
+                    occluded += bvh->intersect(ray);
+                return occluded;
+            });
+        }
+    }
+
+    void run_aggregate_benchmarks(Bench& bench){
+        if(!bench.enabled("aggregate/") && !bench.enabled("transform/"))
+            return;
+        const auto rays = create_rays();
+        if(bench.enabled("aggregate/")){
+            Context ctx;
+            ctx.material = create_phong_material(create_constant_texture2d(Spectrum(0)),
+                                                 create_constant_texture2d(Spectrum(0.5)),
+                                                 create_constant_texture2d(Spectrum(0)),
+                                                 create_constant_texture2d(Spectrum(1)));
+            auto vacuum = create_vacuum();
+            ctx.mi.inside = vacuum;
+            ctx.mi.outside = vacuum;
+            if(bench.enabled("aggregate/triangle_soup/"))
+                run_scene(bench,"aggregate/triangle_soup",create_triangle_soup(ctx,100000),rays);
+            if(bench.enabled("aggregate/sphere_grid/"))
+                run_scene(bench,"aggregate/sphere_grid",create_sphere_grid(ctx,16),rays);
+            if(bench.enabled("aggregate/instanced_mesh/"))
+                run_scene(bench,"aggregate/instanced_mesh",create_instanced_meshes(ctx,5),rays);
+        }
+        //the per ray work of transformed shapes such as spheres
+        const Transform world_to_local = inverse(translate(Vector3f(1,2,3)) * rotate_x(0.3f) * scale(2,2,2));
+        bench.run("transform/to_local",rays.incoherent.size(),[&](){
+            real sum = 0;
+            for(const auto& ray:rays.incoherent){
+                const Point3f o = world_to_local(ray.o);
+                const Vector3f d = world_to_local(ray.d);
+                sum += o.x + d.y;
+            }
+            return sum;
+        });
+    }
+
+}
+
+TRACER_END
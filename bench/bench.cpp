@@ -0,0 +1,138 @@
+//
+// Created by wyz on 2022/6/25.
+//
+#include "bench.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <unordered_map>
+#include "utility/logger.hpp"
+
+TRACER_BEGIN
+
+namespace bench{
+
+    namespace{
+        double median(std::vector<double> values){
+            std::sort(values.begin(),values.end());
+            const size_t n = values.size();
+            return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+        }
+
+        const char* compiler_name(){
+#if defined(__clang__)
+            return "clang " __clang_version__;
+#elif defined(__GNUC__)
+            return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+            return "msvc";
+#else
+            return "unknown";
+#endif
+        }
+    }
+
+    Bench::Bench(const BenchParams& params)
+    :params(params)
+    {
+        if(this->params.repetitions < 1)
+            throw std::runtime_error("bench repetitions should be at least 1");
+    }
+
+    bool Bench::enabled(const std::string& name) const{
+        return name.compare(0,params.filter.size(),params.filter) == 0
+            || params.filter.compare(0,name.size(),name) == 0;
+    }
+
+    void Bench::add_result(const std::string& name,size_t ops,std::vector<double>& samples){
+        BenchResult ret;
+        ret.name = name;
+        ret.ops = ops;
+        ret.ns_per_op = median(samples);
+        ret.ns_per_op_min = *std::min_element(samples.begin(),samples.end());
+        std::vector<double> deviations;
+        for(auto s:samples)
+            deviations.push_back(std::abs(s - ret.ns_per_op));
+        ret.spread = ret.ns_per_op > 0 ? median(deviations) / ret.ns_per_op : 0;
+        LOG_INFO("{:<48} {:>12.2f} ns/op {:>14.0f} op/s  +-{:.1f}%",
+                 name,ret.ns_per_op,ret.ns_per_op > 0 ? 1e9 / ret.ns_per_op : 0.0,ret.spread * 100);
+        results.push_back(ret);
+    }
+
+    std::string Bench::to_json() const{
+        std::ostringstream out;
+        out << "{\n  \"config\": {"
+            << "\n    \"label\": \"" << params.label << "\","
+            << "\n    \"compiler\": \"" << compiler_name() << "\","
+#ifdef TRACER_SIMD
+            << "\n    \"simd\": true,"
+#else
+            << "\n    \"simd\": false,"
+#endif
+#ifdef TRACER_STATS
+            << "\n    \"stats\": true,"
+#else
+            << "\n    \"stats\": false,"
+#endif
+#ifdef NDEBUG
+            << "\n    \"debug\": false,"
+#else
+            << "\n    \"debug\": true,"
+#endif
+            << "\n    \"repetitions\": " << params.repetitions << ","
+            << "\n    \"min_time_ms\": " << params.min_time_ms
+            << "\n  },\n  \"benchmarks\": [";
+        //one benchmark per line so compare() does not need a json parser
+        for(size_t i = 0; i < results.size(); ++i){
+            const auto& r = results[i];
+            out << (i ? "," : "") << "\n    {\"name\": \"" << r.name << "\""
+                << ", \"ns_per_op\": " << r.ns_per_op
+                << ", \"ns_per_op_min\": " << r.ns_per_op_min
+                << ", \"ops_per_sec\": " << (r.ns_per_op > 0 ? 1e9 / r.ns_per_op : 0.0)
+                << ", \"spread\": " << r.spread
+                << ", \"ops\": " << r.ops << "}";
+        }
+        out << "\n  ]\n}\n";
+        return out.str();
+    }
+
+    bool Bench::compare(const std::string& baseline_filename,double max_regression) const{
+        std::ifstream in(baseline_filename);
+        if(!in.is_open())
+            throw std::runtime_error("open baseline failed: " + baseline_filename);
+        const std::regex pattern(R"re("name": "([^"]+)", "ns_per_op": [-+0-9.eE]+, "ns_per_op_min": ([-+0-9.eE]+))re");
+        std::unordered_map<std::string,double> baseline;
+        std::string line;
+        std::smatch match;
+        while(std::getline(in,line)){
+            if(std::regex_search(line,match,pattern))
+                baseline[match[1].str()] = std::stod(match[2].str());
+        }
+        bool ok = true;
+        LOG_INFO("compare with {}",baseline_filename);
+        for(const auto& r:results){
+            auto it = baseline.find(r.name);
+            if(it == baseline.end() || it->second <= 0){
+                LOG_INFO("{:<48} no baseline",r.name);
+                continue;
+            }
+            //min over repetitions is compared, it is much less noisy than the median
+            //> 1 is faster than the baseline
+            const double speedup = it->second / r.ns_per_op_min;
+            const bool regressed = r.ns_per_op_min > it->second * (1 + max_regression);
+            if(regressed){
+                ok = false;
+                LOG_ERROR("{:<48} {:>10.2f} -> {:>10.2f} ns/op  x{:.3f}",r.name,it->second,r.ns_per_op_min,speedup);
+            }
+            else{
+                LOG_INFO("{:<48} {:>10.2f} -> {:>10.2f} ns/op  x{:.3f}",r.name,it->second,r.ns_per_op_min,speedup);
+            }
+        }
+        return ok;
+    }
+
+}
+
+TRACER_END
@@ -0,0 +1,115 @@
+//
+// Created by wyz on 2022/6/25.
+//
+
+#ifndef TRACER_BENCH_HPP
+#define TRACER_BENCH_HPP
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "common.hpp"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+TRACER_BEGIN
+
+namespace bench{
+
+    struct BenchParams{
+        //only benchmarks whose name starts with filter are run, e.g. "aggregate/" or "material/disney"
+        std::string filter;
+        //each repetition calls the kernel until at least min_time_ms elapsed
+        int repetitions = 7;
+        double min_time_ms = 50;
+        //stored in the report to tell runs apart, e.g. a commit hash
+        std::string label;
+    };
+
+    struct BenchResult{
+        std::string name;
+        //median over repetitions, min is the least noisy estimate
+        double ns_per_op = 0;
+        double ns_per_op_min = 0;
+        //median absolute deviation relative to the median
+        double spread = 0;
+        //operations timed in each repetition
+        size_t ops = 0;
+    };
+
+    //keeps the compiler from hoisting a kernel out of the timing loop when it only reads memory
+    inline void clobber_memory() noexcept{
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : : "memory");
+#elif defined(_MSC_VER)
+        _ReadWriteBarrier();
+#endif
+    }
+
+    class Bench{
+    public:
+        explicit Bench(const BenchParams& params);
+
+        //true if a benchmark named name or starting with it will run
+        //check it before building inputs of benchmarks that will be skipped
+        bool enabled(const std::string& name) const;
+
+        //f does ops operations per call and returns a value that depends on all of them
+        //so the work can not be optimized away
+        template<typename F>
+        void run(const std::string& name,size_t ops,F&& f){
+            if(!enabled(name)) return;
+            using clock = std::chrono::steady_clock;
+            //warm up caches and find how many calls fill min_time_ms
+            double acc = 0;
+            auto t0 = clock::now();
+            acc += static_cast<double>(f());
+            double once = std::chrono::duration<double,std::milli>(clock::now() - t0).count();
+            const size_t calls = once > 0 ? (std::max)(size_t(1),static_cast<size_t>(params.min_time_ms / once)) : 1;
+            std::vector<double> samples;
+            samples.reserve(params.repetitions);
+            for(int r = 0; r < params.repetitions; ++r){
+                t0 = clock::now();
+                for(size_t c = 0; c < calls; ++c){
+                    acc += static_cast<double>(f());
+                    clobber_memory();
+                }
+                const double ns = std::chrono::duration<double,std::nano>(clock::now() - t0).count();
+                samples.push_back(ns / double(calls * ops));
+            }
+            sink = acc;
+            add_result(name,ops * calls,samples);
+        }
+
+        const std::vector<BenchResult>& get_results() const noexcept{
+            return results;
+        }
+
+        std::string to_json() const;
+
+        //print ratios of min ns per op against a report written by an earlier run
+        //return false if any benchmark got slower than max_regression, e.g. 0.05 for 5%
+        bool compare(const std::string& baseline_filename,double max_regression) const;
+
+    private:
+        void add_result(const std::string& name,size_t ops,std::vector<double>& samples);
+
+        BenchParams params;
+        std::vector<BenchResult> results;
+        volatile double sink = 0;
+    };
+
+    //each suite builds its procedural inputs with fixed seeds so runs are comparable
+    void run_aggregate_benchmarks(Bench& bench);
+
+    void run_material_benchmarks(Bench& bench);
+
+    void run_sampling_benchmarks(Bench& bench);
+
+    void run_texture_benchmarks(Bench& bench);
+}
+
+TRACER_END
+
+#endif //TRACER_BENCH_HPP
@@ -0,0 +1,70 @@
+//
+// Created by wyz on 2022/6/25.
+//
+#include "bench.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "utility/logger.hpp"
+using namespace tracer;
+
+namespace{
+    void print_usage(){
+        std::cout << "usage: TracerBench [options]\n"
+                  << "  --filter <prefix>        run benchmarks whose name starts with prefix\n"
+                  << "  --repetitions <n>        timed repetitions per benchmark, default 7\n"
+                  << "  --min-time <ms>          minimum time of one repetition, default 50\n"
+                  << "  --label <text>           stored in the report, e.g. a commit hash\n"
+                  << "  --out <file>             write the report as json\n"
+                  << "  --baseline <file>        compare with a report of an earlier run\n"
+                  << "  --max-regression <r>     fail if a benchmark is slower than baseline by r, default 0.05\n";
+    }
+}
+
+int main(int argc,char** argv){
+    try{
+        bench::BenchParams params;
+        std::string out_filename;
+        std::string baseline_filename;
+        double max_regression = 0.05;
+        for(int i = 1; i < argc; ++i){
+            auto value = [&]() -> std::string{
+                if(i + 1 >= argc){
+                    print_usage();
+                    throw std::runtime_error(std::string("missing value of ") + argv[i]);
+                }
+                return argv[++i];
+            };
+            if(!std::strcmp(argv[i],"--filter")) params.filter = value();
+            else if(!std::strcmp(argv[i],"--repetitions")) params.repetitions = std::stoi(value());
+            else if(!std::strcmp(argv[i],"--min-time")) params.min_time_ms = std::stod(value());
+            else if(!std::strcmp(argv[i],"--label")) params.label = value();
+            else if(!std::strcmp(argv[i],"--out")) out_filename = value();
+            else if(!std::strcmp(argv[i],"--baseline")) baseline_filename = value();
+            else if(!std::strcmp(argv[i],"--max-regression")) max_regression = std::stod(value());
+            else{
+                print_usage();
+                return std::strcmp(argv[i],"--help") ? 1 : 0;
+            }
+        }
+        bench::Bench bench(params);
+        bench::run_aggregate_benchmarks(bench);
+        bench::run_material_benchmarks(bench);
+        bench::run_sampling_benchmarks(bench);
+        bench::run_texture_benchmarks(bench);
+        if(!out_filename.empty()){
+            std::ofstream out(out_filename);
+            if(!out.is_open())
+                throw std::runtime_error("open bench report failed: " + out_filename);
+            out << bench.to_json();
+            LOG_INFO("write bench report to {}",out_filename);
+        }
+        if(!baseline_filename.empty() && !bench.compare(baseline_filename,max_regression))
+            return 2;
+    }
+    catch(const std::exception& err){
+        LOG_CRITICAL("bench failed: {}",err.what());
+        return 1;
+    }
+    return 0;
+}
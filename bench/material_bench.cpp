@@ -0,0 +1,123 @@
+//
+// Created by wyz on 2022/6/25.
+//
+#include "bench.hpp"
+#include <random>
+#include "factory/material.hpp"
+#include "factory/texture.hpp"
+#include "core/bsdf.hpp"
+#include "core/bssrdf.hpp"
+#include "core/intersection.hpp"
+#include "utility/memory.hpp"
+
+TRACER_BEGIN
+
+namespace bench{
+
+    namespace{
+        constexpr int direction_count = 4096;
+
+        RC<const Texture2D> constant(real v){
+            return create_constant_texture2d(Spectrum(v));
+        }
+
+        RC<const Texture2D> constant(const Spectrum& s){
+            return create_constant_texture2d(s);
+        }
+
+        std::vector<std::pair<std::string,RC<Material>>> create_materials(){
+            const Spectrum base_color(0.8f,0.5f,0.3f);
+            std::vector<std::pair<std::string,RC<Material>>> materials;
+            materials.emplace_back("phong",create_phong_material(
+                    constant(0),constant(base_color),constant(0.2f),constant(20)));
+            materials.emplace_back("glass",create_glass(constant(1),constant(1),constant(1.5f)));
+            materials.emplace_back("metal",create_metal(
+                    constant(base_color),constant(Spectrum(0.2f,0.9f,1.1f)),constant(Spectrum(3.9f,2.4f,2.2f)),
+                    constant(0.3f),constant(0.2f),newBox<NormalMapper>()));
+            materials.emplace_back("disney",create_disney(
+                    constant(base_color),constant(0.3f),constant(0.4f),constant(0.1f),constant(0.2f),
+                    constant(1.5f),constant(1),constant(0.2f),constant(0.3f),constant(0.2f),constant(0.5f),
+                    constant(0.3f),constant(0.6f),newBox<const NormalMapper>(),newRC<BSSRDFSurface>()));
+            materials.emplace_back("disney_brdf",create_disney_brdf(
+                    constant(base_color),constant(0.1f),constant(0.3f),constant(0.5f),constant(0.2f),
+                    constant(0.4f),constant(0.3f),constant(0.2f),constant(0.5f),constant(0.3f),constant(0.6f)));
+            materials.emplace_back("disney_bsdf",create_disney_bsdf(
+                    constant(base_color),constant(0.3f),constant(1.5f),constant(0.4f),constant(0.5f),
+                    constant(0.2f),constant(0.3f),constant(0.2f),constant(0.5f),constant(0.3f),constant(0.6f),
+                    constant(0.2f),constant(0),false,constant(0),constant(0),newBox<const NormalMapper>()));
+            return materials;
+        }
+    }
+
+    void run_material_benchmarks(Bench& bench){
+        if(!bench.enabled("material/"))
+            return;
+        std::mt19937 rng(4);
+        std::uniform_real_distribution<real> u(0,1);
+        auto sphere_dir = [&](){
+            const real z = 1 - 2 * u(rng), phi = 2 * PI_r * u(rng);
+            const real r = std::sqrt((std::max)(real(0),1 - z * z));
+            return Vector3f(r * std::cos(phi),r * std::sin(phi),z);
+        };
+        //wo above the surface, wi on both sides for transmission
+        std::vector<Vector3f> wo(direction_count), wi(direction_count);
+        std::vector<Sample3> samples(direction_count);
+        std::vector<Point2f> uvs(direction_count);
+        for(int i = 0; i < direction_count; ++i){
+            wo[i] = sphere_dir();
+            wo[i].z = std::abs(wo[i].z) + eps;
+            wo[i] = wo[i].normalize();
+            wi[i] = sphere_dir();
+            samples[i] = {u(rng),u(rng),u(rng)};
+            uvs[i] = Point2f(u(rng),u(rng));
+        }
+
+        SurfaceIntersection isect{};
+        isect.geometry_coord = Coord(Vector3f(1,0,0),Vector3f(0,1,0),Vector3f(0,0,1));
+        isect.shading_coord = isect.geometry_coord;
+        isect.wo = wo[0];
+        MemoryArena arena;
+        for(auto& [name,material]:create_materials()){
+            const std::string prefix = "material/" + name;
+            if(!bench.enabled(prefix + "/"))
+                continue;
+            isect.material = material.get();
+            bench.run(prefix + "/shading",direction_count,[&](){
+                real sum = 0;
+                auto p = isect;
+                for(int i = 0; i < direction_count; ++i){
+                    p.uv = uvs[i];
+                    sum += material->shading(p,arena).shading_n.z;
+                }
+                arena.reset();
+                return sum;
+            });
+            const auto shd = material->shading(isect,arena);
+            const BSDF* bsdf = shd.bsdf;
+            bench.run(prefix + "/eval",direction_count,[&](){
+                Spectrum sum;
+                for(int i = 0; i < direction_count; ++i)
+                    sum += bsdf->eval(wi[i],wo[i],TransportMode::Radiance);
+                return sum.lum();
+            });
+            bench.run(prefix + "/sample",direction_count,[&](){
+                real sum = 0;
+                for(int i = 0; i < direction_count; ++i){
+                    const auto ret = bsdf->sample(wo[i],TransportMode::Radiance,samples[i]);
+                    sum += ret.pdf + ret.wi.z;
+                }
+                return sum;
+            });
+            bench.run(prefix + "/pdf",direction_count,[&](){
+                real sum = 0;
+                for(int i = 0; i < direction_count; ++i)
+                    sum += bsdf->pdf(wi[i],wo[i]);
+                return sum;
+            });
+            arena.reset();
+        }
+    }
+
+}
+
+TRACER_END
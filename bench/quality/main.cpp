@@ -0,0 +1,385 @@
+//
+// Created by wyz on 2022/6/26.
+//
+#include "scenes.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <unordered_map>
+#include "core/renderer.hpp"
+#include "factory/filter.hpp"
+#include "factory/renderer.hpp"
+#include "utility/logger.hpp"
+using namespace tracer;
+using namespace tracer::quality;
+
+namespace{
+
+    struct HarnessParams{
+        std::vector<std::string> scenes = get_quality_scene_names();
+        std::vector<std::string> renderers = {"pt","bdpt","sppm","vcm","mlt"};
+        int width = 128;
+        int height = 128;
+        //budget doubles per level
+        int levels = 6;
+        int worker_count = 0;
+        std::string reference_dir = "quality_references";
+        int reference_spp = 8192;
+        bool update_reference = false;
+        std::string out_filename;
+        std::string csv_filename;
+        std::string baseline_filename;
+        double max_regression = 0.2;
+    };
+
+    struct Measurement{
+        std::string scene;
+        std::string renderer;
+        int budget = 0;
+        double seconds = 0;
+        double rmse = 0;
+        double relmse = 0;
+        //1 / (relmse * seconds), independent of the budget for an unbiased integrator
+        double efficiency = 0;
+        int invalid_pixels = 0;
+    };
+
+    const char* budget_unit(const std::string& renderer){
+        if(renderer == "sppm" || renderer == "vcm") return "iterations";
+        if(renderer == "mlt") return "mutations_per_pixel";
+        return "spp";
+    }
+
+    //sppm starts higher since its first iterations only shrink the radius
+    int budget_of(const std::string& renderer,int level){
+        return (renderer == "sppm" ? 4 : 1) << level;
+    }
+
+    RC<Renderer> create_renderer(const std::string& name,int budget,const QualityScene& scene,const HarnessParams& params){
+        if(name == "pt"){
+            PTRendererParams p;
+            p.worker_count = params.worker_count;
+            p.spp = budget;
+            return create_pt_renderer(p);
+        }
+        if(name == "bdpt"){
+            BDPTRendererParams p;
+            p.worker_count = params.worker_count;
+            p.spp = budget;
+            return create_bdpt_renderer(p);
+        }
+        if(name == "sppm"){
+            SPPMRendererParams p;
+            p.init_search_radius = scene.sppm_radius;
+            p.worker_count = params.worker_count;
+            p.iteration_count = budget;
+            p.photons_per_iteration = params.width * params.height;
+            return create_sppm_renderer(p);
+        }
+        if(name == "vcm"){
+            VCMRendererParams p;
+            p.init_search_radius = scene.vcm_radius;
+            p.worker_count = params.worker_count;
+            p.iteration_count = budget;
+            return create_vcm_renderer(p);
+        }
+        if(name == "mlt"){
+            MLTRendererParams p;
+            p.worker_count = params.worker_count;
+            p.bootstrap_count = params.width * params.height;
+            p.chain_count = 256;
+            p.mutations_per_pixel = budget;
+            return create_mlt_renderer(p);
+        }
+        throw std::runtime_error("unknown renderer: " + name);
+    }
+
+    Image2D<Spectrum> render(Renderer& renderer,const QualityScene& scene,const HarnessParams& params,double* seconds){
+        auto filter = create_gaussin_filter(0.5,0.6);
+        //renderers log progress per tile
+        SET_LOG_LEVEL_ERROR
+        const auto t0 = std::chrono::steady_clock::now();
+        auto target = renderer.render(*scene.scene,Film({params.width,params.height},filter));
+        *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        SET_LOG_LEVEL_INFO
+        return std::move(target.color);
+    }
+
+    //pfm keeps full float precision, rows are stored bottom to top
+    void write_pfm(const Image2D<Spectrum>& image,const std::string& filename){
+        std::ofstream out(filename,std::ios::binary);
+        if(!out.is_open())
+            throw std::runtime_error("open reference failed: " + filename);
+        out << "PF\n" << image.width() << " " << image.height() << "\n-1.0\n";
+        for(int y = image.height() - 1; y >= 0; --y){
+            for(int x = 0; x < image.width(); ++x){
+                const auto& c = image.at(x,y);
+                const float rgb[3] = {float(c.r),float(c.g),float(c.b)};
+                out.write(reinterpret_cast<const char*>(rgb),sizeof(rgb));
+            }
+        }
+    }
+
+    bool read_pfm(const std::string& filename,Image2D<Spectrum>& image){
+        std::ifstream in(filename,std::ios::binary);
+        if(!in.is_open())
+            return false;
+        std::string magic;
+        int w = 0, h = 0;
+        float scale = 0;
+        in >> magic >> w >> h >> scale;
+        in.get();
+        //only little endian rgb as written by write_pfm
+        if(magic != "PF" || w <= 0 || h <= 0 || scale >= 0)
+            throw std::runtime_error("invalid reference: " + filename);
+        image = Image2D<Spectrum>(w,h);
+        for(int y = h - 1; y >= 0; --y){
+            for(int x = 0; x < w; ++x){
+                float rgb[3];
+                in.read(reinterpret_cast<char*>(rgb),sizeof(rgb));
+                image.at(x,y) = Spectrum(rgb[0],rgb[1],rgb[2]);
+            }
+        }
+        if(!in)
+            throw std::runtime_error("truncated reference: " + filename);
+        return true;
+    }
+
+    Image2D<Spectrum> get_reference(const QualityScene& scene,const HarnessParams& params){
+        namespace fs = std::filesystem;
+        const auto filename = (fs::path(params.reference_dir) /
+                (scene.name + "_" + std::to_string(params.width) + "x" + std::to_string(params.height) + ".pfm")).string();
+        Image2D<Spectrum> reference;
+        if(!params.update_reference && read_pfm(filename,reference)){
+            LOG_INFO("load reference {}",filename);
+            return reference;
+        }
+        LOG_INFO("render reference of {} with pt at {} spp",scene.name,params.reference_spp);
+        auto renderer = create_renderer("pt",params.reference_spp,scene,params);
+        double seconds;
+        reference = render(*renderer,scene,params,&seconds);
+        fs::create_directories(params.reference_dir);
+        write_pfm(reference,filename);
+        LOG_INFO("write reference {} in {:.1f}s",filename,seconds);
+        return reference;
+    }
+
+    void measure_error(const Image2D<Spectrum>& image,const Image2D<Spectrum>& reference,Measurement& m){
+        if(image.width() != reference.width() || image.height() != reference.height())
+            throw std::runtime_error("reference size does not match the render of " + m.scene);
+        double se = 0, rel_se = 0;
+        for(int y = 0; y < image.height(); ++y){
+            for(int x = 0; x < image.width(); ++x){
+                const auto& c = image.at(x,y);
+                const auto& r = reference.at(x,y);
+                //nan or inf counts as black and is reported
+                const bool valid = std::isfinite(c.r) && std::isfinite(c.g) && std::isfinite(c.b);
+                if(!valid) ++m.invalid_pixels;
+                for(int i = 0; i < SPECTRUM_COMPONET_COUNT; ++i){
+                    const double d = (valid ? c[i] : 0) - double(r[i]);
+                    se += d * d;
+                    //the offset keeps dark pixels from dominating
+                    rel_se += d * d / (double(r[i]) * r[i] + 1e-2);
+                }
+            }
+        }
+        const double n = double(image.width()) * image.height() * SPECTRUM_COMPONET_COUNT;
+        m.rmse = std::sqrt(se / n);
+        m.relmse = rel_se / n;
+        m.efficiency = m.relmse > 0 && m.seconds > 0 ? 1 / (m.relmse * m.seconds) : 0;
+    }
+
+    //geometric mean keeps a single noisy level from dominating
+    double mean_efficiency(const std::vector<Measurement>& ms,const std::string& scene,const std::string& renderer){
+        double log_sum = 0;
+        int count = 0;
+        for(const auto& m:ms){
+            if(m.scene == scene && m.renderer == renderer && m.efficiency > 0){
+                log_sum += std::log(m.efficiency);
+                ++count;
+            }
+        }
+        return count ? std::exp(log_sum / count) : 0;
+    }
+
+    std::string to_json(const std::vector<Measurement>& ms,const HarnessParams& params){
+        std::ostringstream out;
+        out << "{\n  \"config\": {\"width\": " << params.width << ", \"height\": " << params.height
+            << ", \"levels\": " << params.levels << ", \"reference_spp\": " << params.reference_spp << "},"
+            << "\n  \"measurements\": [";
+        for(size_t i = 0; i < ms.size(); ++i){
+            const auto& m = ms[i];
+            out << (i ? "," : "") << "\n    {\"scene\": \"" << m.scene << "\", \"renderer\": \"" << m.renderer
+                << "\", \"" << budget_unit(m.renderer) << "\": " << m.budget
+                << ", \"seconds\": " << m.seconds << ", \"rmse\": " << m.rmse << ", \"relmse\": " << m.relmse
+                << ", \"efficiency\": " << m.efficiency << ", \"invalid_pixels\": " << m.invalid_pixels << "}";
+        }
+        //one summary per line so compare() does not need a json parser
+        out << "\n  ],\n  \"summary\": [";
+        bool first = true;
+        for(const auto& scene:params.scenes){
+            for(const auto& renderer:params.renderers){
+                out << (first ? "" : ",") << "\n    {\"scene\": \"" << scene << "\", \"renderer\": \"" << renderer
+                    << "\", \"mean_efficiency\": " << mean_efficiency(ms,scene,renderer) << "}";
+                first = false;
+            }
+        }
+        out << "\n  ]\n}\n";
+        return out.str();
+    }
+
+    std::string to_csv(const std::vector<Measurement>& ms){
+        std::ostringstream out;
+        out << "scene,renderer,budget,seconds,rmse,relmse,efficiency,invalid_pixels\n";
+        for(const auto& m:ms)
+            out << m.scene << "," << m.renderer << "," << m.budget << "," << m.seconds << "," << m.rmse << ","
+                << m.relmse << "," << m.efficiency << "," << m.invalid_pixels << "\n";
+        return out.str();
+    }
+
+    bool compare(const std::vector<Measurement>& ms,const HarnessParams& params){
+        std::ifstream in(params.baseline_filename);
+        if(!in.is_open())
+            throw std::runtime_error("open baseline failed: " + params.baseline_filename);
+        const std::regex pattern(R"re("scene": "([^"]+)", "renderer": "([^"]+)", "mean_efficiency": ([-+0-9.eE]+))re");
+        std::unordered_map<std::string,double> baseline;
+        std::string line;
+        std::smatch match;
+        while(std::getline(in,line)){
+            if(std::regex_search(line,match,pattern))
+                baseline[match[1].str() + "/" + match[2].str()] = std::stod(match[3].str());
+        }
+        bool ok = true;
+        LOG_INFO("compare with {}",params.baseline_filename);
+        for(const auto& scene:params.scenes){
+            for(const auto& renderer:params.renderers){
+                const auto key = scene + "/" + renderer;
+                const double current = mean_efficiency(ms,scene,renderer);
+                auto it = baseline.find(key);
+                if(it == baseline.end() || it->second <= 0){
+                    LOG_INFO("{:<24} no baseline",key);
+                    continue;
+                }
+                //> 1 reaches the same error in less time than the baseline
+                const double ratio = current / it->second;
+                if(ratio < 1 - params.max_regression){
+                    ok = false;
+                    LOG_ERROR("{:<24} efficiency {:.4g} -> {:.4g}  x{:.3f}",key,it->second,current,ratio);
+                }
+                else{
+                    LOG_INFO("{:<24} efficiency {:.4g} -> {:.4g}  x{:.3f}",key,it->second,current,ratio);
+                }
+            }
+        }
+        return ok;
+    }
+
+    std::vector<std::string> split(const std::string& s){
+        std::vector<std::string> ret;
+        std::stringstream ss(s);
+        std::string item;
+        while(std::getline(ss,item,','))
+            if(!item.empty()) ret.push_back(item);
+        return ret;
+    }
+
+    void write_file(const std::string& filename,const std::string& content){
+        std::ofstream out(filename);
+        if(!out.is_open())
+            throw std::runtime_error("open output failed: " + filename);
+        out << content;
+        LOG_INFO("write {}",filename);
+    }
+
+    void print_usage(){
+        std::cout << "usage: TracerQuality [options]\n"
+                  << "  --scenes <a,b>           default all: cornell_box,caustic_box,indirect_box,fog_box\n"
+                  << "  --renderers <a,b>        default all: pt,bdpt,sppm,vcm,mlt\n"
+                  << "  --size <w> <h>           film resolution, default 128 128\n"
+                  << "  --levels <n>             budgets 1,2,4.. per renderer, default 6\n"
+                  << "  --workers <n>            render threads, 0 uses all cores\n"
+                  << "  --reference-dir <dir>    where references are stored, default quality_references\n"
+                  << "  --reference-spp <n>      pt spp of missing references, default 8192\n"
+                  << "  --update-reference       render references even if stored\n"
+                  << "  --out <file>             write measurements and summary as json\n"
+                  << "  --csv <file>             write error versus time curves as csv\n"
+                  << "  --baseline <file>        compare mean efficiency with an earlier json report\n"
+                  << "  --max-regression <r>     fail if efficiency drops by more than r, default 0.2\n";
+    }
+}
+
+int main(int argc,char** argv){
+    try{
+        HarnessParams params;
+        for(int i = 1; i < argc; ++i){
+            auto value = [&]() -> std::string{
+                if(i + 1 >= argc){
+                    print_usage();
+                    throw std::runtime_error(std::string("missing value of ") + argv[i]);
+                }
+                return argv[++i];
+            };
+            if(!std::strcmp(argv[i],"--scenes")) params.scenes = split(value());
+            else if(!std::strcmp(argv[i],"--renderers")) params.renderers = split(value());
+            else if(!std::strcmp(argv[i],"--size")){
+                params.width = std::stoi(value());
+                params.height = std::stoi(value());
+            }
+            else if(!std::strcmp(argv[i],"--levels")) params.levels = std::stoi(value());
+            else if(!std::strcmp(argv[i],"--workers")) params.worker_count = std::stoi(value());
+            else if(!std::strcmp(argv[i],"--reference-dir")) params.reference_dir = value();
+            else if(!std::strcmp(argv[i],"--reference-spp")) params.reference_spp = std::stoi(value());
+            else if(!std::strcmp(argv[i],"--update-reference")) params.update_reference = true;
+            else if(!std::strcmp(argv[i],"--out")) params.out_filename = value();
+            else if(!std::strcmp(argv[i],"--csv")) params.csv_filename = value();
+            else if(!std::strcmp(argv[i],"--baseline")) params.baseline_filename = value();
+            else if(!std::strcmp(argv[i],"--max-regression")) params.max_regression = std::stod(value());
+            else{
+                print_usage();
+                return std::strcmp(argv[i],"--help") ? 1 : 0;
+            }
+        }
+        if(params.width <= 0 || params.height <= 0 || params.levels <= 0)
+            throw std::runtime_error("size and levels should be positive");
+
+        std::vector<Measurement> measurements;
+        for(const auto& scene_name:params.scenes){
+            const auto scene = create_quality_scene(scene_name,params.width,params.height);
+            const auto reference = get_reference(scene,params);
+            for(const auto& renderer_name:params.renderers){
+                for(int level = 0; level < params.levels; ++level){
+                    Measurement m;
+                    m.scene = scene_name;
+                    m.renderer = renderer_name;
+                    m.budget = budget_of(renderer_name,level);
+                    auto renderer = create_renderer(renderer_name,m.budget,scene,params);
+                    const auto image = render(*renderer,scene,params,&m.seconds);
+                    measure_error(image,reference,m);
+                    LOG_INFO("{:<14} {:<5} {:>6} {:<10} {:>8.3f}s  rmse {:.4g}  relmse {:.4g}  efficiency {:.4g}{}",
+                             scene_name,renderer_name,m.budget,budget_unit(renderer_name),m.seconds,
+                             m.rmse,m.relmse,m.efficiency,
+                             m.invalid_pixels ? fmt::format("  {} invalid pixels",m.invalid_pixels) : std::string());
+                    measurements.push_back(m);
+                }
+                LOG_INFO("{:<14} {:<5} mean efficiency {:.4g}",scene_name,renderer_name,
+                         mean_efficiency(measurements,scene_name,renderer_name));
+            }
+        }
+        if(!params.out_filename.empty())
+            write_file(params.out_filename,to_json(measurements,params));
+        if(!params.csv_filename.empty())
+            write_file(params.csv_filename,to_csv(measurements));
+        if(!params.baseline_filename.empty() && !compare(measurements,params))
+            return 2;
+    }
+    catch(const std::exception& err){
+        LOG_CRITICAL("quality harness failed: {}",err.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+//
+// Created by wyz on 2022/6/26.
+//
+#include "scenes.hpp"
+#include "factory/accelerator.hpp"
+#include "factory/camera.hpp"
+#include "factory/material.hpp"
+#include "factory/medium.hpp"
+#include "factory/primivite.hpp"
+#include "factory/scene.hpp"
+#include "factory/shape.hpp"
+#include "factory/texture.hpp"
+#include "core/light.hpp"
+#include "core/medium.hpp"
+#include "core/primitive.hpp"
+#include "utility/transform.hpp"
+
+TRACER_BEGIN
+
+namespace quality{
+
+    namespace{
+
+        struct SceneBuilder{
+            std::vector<RC<Primitive>> primitives;
+            Span<const Light*> lights;
+            MediumInterface mi;
+
+            //counter clockwise seen from the side the normal points to
+            void add_quad(const Point3f& p0,const Point3f& p1,const Point3f& p2,const Point3f& p3,
+                          const RC<Material>& material,const Spectrum& emission = Spectrum()){
+                const Vector3f n = cross(p1 - p0,p2 - p0).normalize();
+                const Normal3f vn(n.x,n.y,n.z);
+                mesh_t mesh;
+                mesh.vertices = {{p0,vn,Point2f(0,0)},{p1,vn,Point2f(1,0)},
+                                 {p2,vn,Point2f(1,1)},{p3,vn,Point2f(0,1)}};
+                mesh.indices = {0,1,2,0,2,3};
+                mesh.materials = {0,0};
+                for(auto& triangle:create_triangle_mesh(mesh,Transform())){
+                    primitives.emplace_back(create_geometric_primitive(triangle,material,mi,emission));
+                    if(!emission.is_back())
+                        lights.emplace_back(primitives.back()->as_area_light());
+                }
+            }
+
+            void add_sphere(const Point3f& center,real radius,const RC<Material>& material){
+                primitives.emplace_back(create_geometric_primitive(
+                        create_sphere(radius,translate(Vector3f(center.x,center.y,center.z))),material,mi,Spectrum()));
+            }
+
+            //unit box [-1,1]^3 open at z = 1, walls face inwards
+            void add_cornell_walls(){
+                auto white = diffuse(Spectrum(0.73f));
+                auto red = diffuse(Spectrum(0.65f,0.05f,0.05f));
+                auto green = diffuse(Spectrum(0.12f,0.45f,0.15f));
+                add_quad({-1,-1,1},{1,-1,1},{1,-1,-1},{-1,-1,-1},white);
+                add_quad({-1,1,-1},{1,1,-1},{1,1,1},{-1,1,1},white);
+                add_quad({-1,-1,-1},{1,-1,-1},{1,1,-1},{-1,1,-1},white);
+                add_quad({-1,-1,1},{-1,-1,-1},{-1,1,-1},{-1,1,1},red);
+                add_quad({1,-1,-1},{1,-1,1},{1,1,1},{1,1,-1},green);
+            }
+
+            //square light of half size s below the ceiling facing down
+            void add_ceiling_light(real s,const Spectrum& radiance){
+                const real y = 1 - 1e-3f;
+                add_quad({-s,y,-s},{s,y,-s},{s,y,s},{-s,y,s},diffuse(Spectrum(0)),radiance);
+            }
+
+            static RC<Material> diffuse(const Spectrum& albedo){
+                return create_phong_material(create_constant_texture2d(Spectrum(0)),
+                                             create_constant_texture2d(albedo),
+                                             create_constant_texture2d(Spectrum(0)),
+                                             create_constant_texture2d(Spectrum(1)));
+            }
+
+            RC<Scene> build(int width,int height){
+                auto bvh = create_bvh_accel(3);
+                bvh->build(std::move(primitives));
+                auto scene = create_general_scene(bvh);
+                scene->lights = lights;
+                scene->set_camera(create_thin_lens_camera((real)width / height,
+                                                          {0,0,3.9f},{0,0,0},{0,1,0},
+                                                          PI_r * 40 / 180,0,1));
+                scene->prepare_to_render();
+                return scene;
+            }
+        };
+
+        RC<Material> create_rough_metal(){
+            return create_metal(create_constant_texture2d(Spectrum(0.9f)),
+                                create_constant_texture2d(Spectrum(0.2f,0.9f,1.1f)),
+                                create_constant_texture2d(Spectrum(3.9f,2.4f,2.2f)),
+                                create_constant_texture2d(Spectrum(0.2f)),
+                                create_constant_texture2d(Spectrum(0)),
+                                newBox<NormalMapper>());
+        }
+    }
+
+    std::vector<std::string> get_quality_scene_names(){
+        return {"cornell_box","caustic_box","indirect_box","fog_box"};
+    }
+
+    QualityScene create_quality_scene(const std::string& name,int width,int height){
+        SceneBuilder builder;
+        auto vacuum = create_vacuum();
+        builder.mi.inside = vacuum;
+        builder.mi.outside = vacuum;
+        if(name == "fog_box"){
+            //walls face inwards, so their outside is the box
+            builder.mi.outside = create_homogeneous_medium({0.05f,0.05f,0.05f},{0.4f,0.4f,0.4f},0.5f,25);
+        }
+
+        if(name == "cornell_box" || name == "fog_box"){
+            builder.add_cornell_walls();
+            builder.add_ceiling_light(0.25f,Spectrum(17,12,4));
+            builder.add_sphere({-0.4f,-0.65f,-0.3f},0.35f,SceneBuilder::diffuse(Spectrum(0.73f)));
+            builder.add_sphere({0.45f,-0.65f,0.2f},0.35f,create_rough_metal());
+        }
+        else if(name == "caustic_box"){
+            builder.add_cornell_walls();
+            builder.add_ceiling_light(0.15f,Spectrum(40));
+            auto one = create_constant_texture2d(Spectrum(1));
+            builder.add_sphere({0,-0.55f,0},0.45f,create_glass(one,one,create_constant_texture2d(Spectrum(1.5f))));
+        }
+        else if(name == "indirect_box"){
+            builder.add_cornell_walls();
+            //light faces the ceiling and a panel hides it from below
+            const real y = 0.5f, s = 0.2f, p = 0.4f;
+            builder.add_quad({-s,y,s},{s,y,s},{s,y,-s},{-s,y,-s},SceneBuilder::diffuse(Spectrum(0)),Spectrum(40));
+            builder.add_quad({-p,y - 0.01f,-p},{p,y - 0.01f,-p},{p,y - 0.01f,p},{-p,y - 0.01f,p},
+                             SceneBuilder::diffuse(Spectrum(0.73f)));
+            builder.add_sphere({0,-0.65f,0},0.35f,SceneBuilder::diffuse(Spectrum(0.73f)));
+        }
+        else{
+            throw std::runtime_error("unknown quality scene: " + name);
+        }
+
+        QualityScene ret;
+        ret.name = name;
+        ret.scene = builder.build(width,height);
+        ret.sppm_radius = real(0.05);
+        ret.vcm_radius = real(0.02);
+        return ret;
+    }
+}
+
+TRACER_END
@@ -0,0 +1,36 @@
+//
+// Created by wyz on 2022/6/26.
+//
+
+#ifndef TRACER_QUALITY_SCENES_HPP
+#define TRACER_QUALITY_SCENES_HPP
+
+#include <string>
+#include <vector>
+#include "core/scene.hpp"
+
+TRACER_BEGIN
+
+namespace quality{
+
+    struct QualityScene{
+        std::string name;
+        RC<Scene> scene;
+        //initial gather radius of sppm and vcm for the scene scale
+        real sppm_radius = 0;
+        real vcm_radius = 0;
+    };
+
+    //small closed scenes built in code so references stay valid without asset files
+    //cornell_box: diffuse walls, a ceiling light and a diffuse and a glossy sphere
+    //caustic_box: a glass sphere below a small light, hard for path tracing
+    //indirect_box: the light faces the ceiling behind a panel, so everything is indirect
+    //fog_box: cornell box filled with a homogeneous medium
+    std::vector<std::string> get_quality_scene_names();
+
+    QualityScene create_quality_scene(const std::string& name,int width,int height);
+}
+
+TRACER_END
+
+#endif //TRACER_QUALITY_SCENES_HPP
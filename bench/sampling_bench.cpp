@@ -0,0 +1,96 @@
+//
+// Created by wyz on 2022/6/25.
+//
+#include "bench.hpp"
+#include <random>
+#include "utility/distribution.hpp"
+
+TRACER_BEGIN
+
+namespace bench{
+
+    namespace{
+        constexpr int sample_count = 1 << 14;
+
+        //peaked like an environment map with a sun
+        std::vector<real> create_func(int nu,int nv,std::mt19937& rng){
+            std::uniform_real_distribution<real> u(0,1);
+            std::vector<real> func(static_cast<size_t>(nu) * nv);
+            for(int v = 0; v < nv; ++v){
+                for(int x = 0; x < nu; ++x){
+                    const real dx = real(x) / nu - 0.3f, dv = real(v) / nv - 0.2f;
+                    func[static_cast<size_t>(v) * nu + x] = u(rng) + 100 * std::exp(-(dx * dx + dv * dv) * 400);
+                }
+            }
+            return func;
+        }
+    }
+
+    void run_sampling_benchmarks(Bench& bench){
+        if(!bench.enabled("sampling/"))
+            return;
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<real> u(0,1);
+        std::vector<real> us(sample_count), vs(sample_count);
+        for(int i = 0; i < sample_count; ++i){
+            //sample_discrete asserts u < 1
+            us[i] = (std::min)(u(rng),real(0.99999f));
+            vs[i] = (std::min)(u(rng),real(0.99999f));
+        }
+
+        for(int n : {64,4096,1 << 20}){
+            const std::string prefix = "sampling/distribution1d_" + std::to_string(n);
+            if(!bench.enabled(prefix + "/"))
+                continue;
+            const auto func = create_func(n,1,rng);
+            bench.run(prefix + "/build",n,[&](){
+                Distribution1D d(func.data(),n);
+                return d.func_int;
+            });
+            const Distribution1D d(func.data(),n);
+            bench.run(prefix + "/sample_continuous",sample_count,[&](){
+                real sum = 0, pdf;
+                for(int i = 0; i < sample_count; ++i)
+                    sum += d.sample_continuous(us[i],&pdf) + pdf;
+                return sum;
+            });
+            bench.run(prefix + "/sample_discrete",sample_count,[&](){
+                real sum = 0, pdf;
+                for(int i = 0; i < sample_count; ++i)
+                    sum += d.sample_discrete(us[i],&pdf) + pdf;
+                return sum;
+            });
+        }
+
+        //sizes of small and large environment maps
+        for(auto [nu,nv] : {std::pair{256,128},std::pair{2048,1024}}){
+            const std::string prefix = "sampling/distribution2d_" + std::to_string(nu) + "x" + std::to_string(nv);
+            if(!bench.enabled(prefix + "/"))
+                continue;
+            const auto func = create_func(nu,nv,rng);
+            bench.run(prefix + "/build",static_cast<size_t>(nu) * nv,[&](){
+                Distribution2D d(func.data(),nu,nv);
+                return d.pdf(0.5f,0.5f);
+            });
+            const Distribution2D d(func.data(),nu,nv);
+            bench.run(prefix + "/sample_continuous",sample_count,[&](){
+                real sum = 0;
+                float pdf;
+                for(int i = 0; i < sample_count; ++i){
+                    const auto [x,y] = d.sample_continuous(us[i],vs[i],&pdf);
+                    sum += x + y + pdf;
+                }
+                return sum;
+            });
+            bench.run(prefix + "/pdf",sample_count,[&](){
+                real sum = 0;
+                for(int i = 0; i < sample_count; ++i)
+                    sum += d.pdf(us[i],vs[i]);
+                return sum;
+            });
+        }
+    }
+
+}
+
+TRACER_END
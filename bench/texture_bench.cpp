@@ -0,0 +1,95 @@
+//
+// Created by wyz on 2022/6/25.
+//
+#include "bench.hpp"
+#include <random>
+#include "factory/texture.hpp"
+#include "core/intersection.hpp"
+
+TRACER_BEGIN
+
+namespace bench{
+
+    namespace{
+        constexpr int lookup_count = 1 << 14;
+        constexpr int image_size = 1024;
+        constexpr int volume_size = 64;
+    }
+
+    void run_texture_benchmarks(Bench& bench){
+        if(!bench.enabled("texture/"))
+            return;
+        std::mt19937 rng(6);
+        std::uniform_real_distribution<real> u(0,1);
+        //random uv miss the cache like secondary rays, scanline uv hit it like camera rays
+        std::vector<Point2f> random_uv(lookup_count), coherent_uv(lookup_count);
+        std::vector<Point3f> random_uvw(lookup_count);
+        const int row = static_cast<int>(std::sqrt(lookup_count));
+        for(int i = 0; i < lookup_count; ++i){
+            random_uv[i] = Point2f(u(rng),u(rng));
+            coherent_uv[i] = Point2f((i % row + 0.5f) / row,(i / row + 0.5f) / row);
+            random_uvw[i] = Point3f(u(rng),u(rng),u(rng));
+        }
+
+        auto run_2d = [&](const std::string& prefix,const RC<Texture2D>& texture){
+            if(!bench.enabled(prefix + "/"))
+                return;
+            bench.run(prefix + "/random",lookup_count,[&](){
+                Spectrum sum;
+                for(const auto& uv:random_uv)
+                    sum += texture->evaluate(uv);
+                return sum.lum();
+            });
+            bench.run(prefix + "/coherent",lookup_count,[&](){
+                Spectrum sum;
+                for(const auto& uv:coherent_uv)
+                    sum += texture->evaluate(uv);
+                return sum.lum();
+            });
+            //footprint of a pixel covering about 4x4 texels, filtered between mip levels
+            bench.run(prefix + "/filtered",lookup_count,[&](){
+                SurfaceIntersection isect{};
+                isect.uv_footprint = real(4.5) / image_size;
+                Spectrum sum;
+                for(const auto& uv:random_uv){
+                    isect.uv = uv;
+                    sum += texture->evaluate(isect);
+                }
+                return sum.lum();
+            });
+        };
+
+        run_2d("texture/constant",create_constant_texture2d(Spectrum(0.5f)));
+        if(bench.enabled("texture/image_ldr/") || bench.enabled("texture/image_ldr_gamma/")){
+            auto image = newRC<Image2D<Color3b>>(image_size,image_size);
+            std::uniform_int_distribution<int> byte(0,255);
+            for(int y = 0; y < image_size; ++y)
+                for(int x = 0; x < image_size; ++x)
+                    image->at(x,y) = Color3b(byte(rng),byte(rng),byte(rng));
+            run_2d("texture/image_ldr",create_image_texture2d(image,false,Spectrum(1)));
+            run_2d("texture/image_ldr_gamma",create_image_texture2d(image,true,Spectrum(1)));
+        }
+        if(bench.enabled("texture/image_hdr/")){
+            auto image = newRC<Image2D<Color3f>>(image_size,image_size);
+            for(int y = 0; y < image_size; ++y)
+                for(int x = 0; x < image_size; ++x)
+                    image->at(x,y) = Color3f(u(rng),u(rng),u(rng));
+            run_2d("texture/image_hdr",create_hdr_texture2d(image));
+        }
+        if(bench.enabled("texture/volume/")){
+            std::vector<real> voxels(static_cast<size_t>(volume_size) * volume_size * volume_size);
+            for(auto& v:voxels)
+                v = u(rng);
+            auto volume = create_image_texture3d(newRC<Image3D<real>>(volume_size,volume_size,volume_size,voxels.data()));
+            bench.run("texture/volume/random",lookup_count,[&](){
+                real sum = 0;
+                for(const auto& uvw:random_uvw)
+                    sum += volume->evaluate_s(uvw);
+                return sum;
+            });
+        }
+    }
+
+}
+
+TRACER_END
@@ -5,11 +5,20 @@
 #include "utility/geometry.hpp"
 #include "utility/memory.hpp"
 #include "utility/logger.hpp"
+#include "utility/stats.hpp"
 #include "core/primitive.hpp"
 #include <algorithm>
+#include <mutex>
 #include <stack>
+#include <unordered_map>
 TRACER_BEGIN
 
+//flush per ray tallies of a traversal
+#define BVH_FLUSH_STATS() \
+    STATS_ADD(BVHNodesVisited,nodes_visited); \
+    STATS_ADD(BVHPrimitiveTests,primitive_tests); \
+    STATS_HISTOGRAM(BVHNodesPerRay,nodes_visited)
+
 namespace {
 
     struct BVHPrimitiveInfo{
@@ -78,6 +87,7 @@ namespace {
         void build(std::vector<RC<Primitive>> prims) override{
             if(prims.empty()) return;
             primitives = std::move(prims);
+            build_material_groups();
             size_t n = primitives.size();
             std::vector<BVHPrimitiveInfo> primitive_infos;
             primitive_infos.reserve(n);
@@ -111,22 +121,28 @@ namespace {
 
         bool intersect(const Ray& ray) const noexcept override{
             if(!linear_nodes) return false;
+            STATS_INC(ShadowRays);
 
             Vector3f inv_dir(1.0 / ray.d.x, 1.0 / ray.d.y, 1.0 / ray.d.z);
             int dir_is_neg[3] = {inv_dir.x < 0,inv_dir.y < 0,inv_dir.z < 0};
 
             std::stack<size_t> s;
             s.push(0);
+            STATS_LOCAL(nodes_visited);
+            STATS_LOCAL(primitive_tests);
             while(!s.empty()){
                 assert(s.size() < 64);
                 auto node_index = s.top();
                 s.pop();
                 const auto node = linear_nodes + node_index;
+                STATS_LOCAL_INC(nodes_visited);
                 if(!node->bounds.intersect_p(ray,inv_dir,dir_is_neg)) continue;
                 if(node->is_leaf_node()){
                     for(int i = 0; i < node->primitive_count; i++){
+                        STATS_LOCAL_INC(primitive_tests);
                         if(primitives[node->primitive_offset + i]->intersect(ray)){
                             //if find one just return true
+                            BVH_FLUSH_STATS();
                             return true;
                         }
                     }
@@ -143,25 +159,31 @@ namespace {
                     }
                 }
             }
+            BVH_FLUSH_STATS();
             return false;
         }
 
         bool intersect_p(const Ray& ray,SurfaceIntersection* isect) const noexcept override{
             if(!linear_nodes) return false;
+            STATS_INC(ClosestHitRays);
 
             Vector3f inv_dir(1.0 / ray.d.x, 1.0 / ray.d.y, 1.0 / ray.d.z);
             int dir_is_neg[3] = {inv_dir.x < 0,inv_dir.y < 0,inv_dir.z < 0};
             bool hit = false;
             std::stack<size_t> s;
             s.push(0);
+            STATS_LOCAL(nodes_visited);
+            STATS_LOCAL(primitive_tests);
             while(!s.empty()){
                 assert(s.size() < 64);
                 auto node_index = s.top();
                 s.pop();
                 const auto node = linear_nodes + node_index;
+                STATS_LOCAL_INC(nodes_visited);
                 if(!node->bounds.intersect_p(ray,inv_dir,dir_is_neg)) continue;
                 if(node->is_leaf_node()){
                     for(int i = 0; i < node->primitive_count; i++){
+                        STATS_LOCAL_INC(primitive_tests);
                         //note intersect_p will change ray.max_t which is mutable
                         //in order to find closet intersection
                         if(primitives[node->primitive_offset + i]->intersect_p(ray,isect)){
@@ -181,9 +203,88 @@ namespace {
                     }
                 }
             }
+            BVH_FLUSH_STATS();
             return hit;
         }
+
+        void intersect_all(const Ray& ray,const Material* material,
+                           const std::function<void(const SurfaceIntersection&)>& callback) const noexcept override{
+            if(!linear_nodes) return;
+            if(material && !material_groups.empty()){
+                //traverse the sub-bvh of the material instead of the whole scene
+                auto it = material_groups.find(material);
+                if(it == material_groups.end()) return;
+                auto& group = *it->second;
+                std::call_once(group.built,[&]{
+                    group.bvh = newBox<BVHAccel>(max_leaf_prims);
+                    group.bvh->build(std::move(group.primitives));
+                });
+                group.bvh->intersect_all(ray,nullptr,callback);
+                return;
+            }
+
+            Vector3f inv_dir(1.0 / ray.d.x, 1.0 / ray.d.y, 1.0 / ray.d.z);
+            int dir_is_neg[3] = {inv_dir.x < 0,inv_dir.y < 0,inv_dir.z < 0};
+            size_t s[64];
+            int s_top = 0;
+            s[s_top++] = 0;
+            STATS_LOCAL(nodes_visited);
+            STATS_LOCAL(primitive_tests);
+            while(s_top > 0){
+                auto node_index = s[--s_top];
+                const auto node = linear_nodes + node_index;
+                STATS_LOCAL_INC(nodes_visited);
+                if(!node->bounds.intersect_p(ray,inv_dir,dir_is_neg)) continue;
+                if(node->is_leaf_node()){
+                    for(int i = 0; i < node->primitive_count; i++){
+                        const auto& primitive = primitives[node->primitive_offset + i];
+                        if(material && primitive->get_material() != material) continue;
+                        STATS_LOCAL_INC(primitive_tests);
+                        //a primitive may be hit more than once, e.g. both sides of a sphere
+                        Ray probe = ray;
+                        SurfaceIntersection isect;
+                        while(primitive->intersect_p(probe,&isect)){
+                            callback(isect);
+                            probe.t_min = probe.t_max + eps;
+                            probe.t_max = ray.t_max;
+                            if(probe.t_min >= probe.t_max) break;
+                        }
+                    }
+                }
+                else{
+                    assert(s_top + 2 <= 64);
+                    if(dir_is_neg[node->axis]){
+                        s[s_top++] = node_index + 1;
+                        s[s_top++] = node->second_child_offset;
+                    }
+                    else{
+                        s[s_top++] = node->second_child_offset;
+                        s[s_top++] = node_index + 1;
+                    }
+                }
+            }
+            BVH_FLUSH_STATS();
+        }
     private:
+        //primitives of one material, its bvh is built on the first intersect_all asking for it
+        struct MaterialGroup{
+            std::vector<RC<Primitive>> primitives;
+            std::once_flag built;
+            Box<BVHAccel> bvh;
+        };
+
+        //only needed if the scene has more than one material, otherwise the whole bvh is the group
+        void build_material_groups(){
+            material_groups.clear();
+            for(auto& primitive:primitives){
+                auto& group = material_groups[primitive->get_material()];
+                if(!group) group = newBox<MaterialGroup>();
+                group->primitives.emplace_back(primitive);
+            }
+            if(material_groups.size() < 2)
+                material_groups.clear();
+        }
+
         struct BucketInfo{
             size_t count = 0;
             Bounds3f bounds;
@@ -310,6 +411,8 @@ namespace {
 
         std::vector<RC<Primitive>> primitives;
         LinearBVHNode* linear_nodes = nullptr;
+
+        std::unordered_map<const Material*,Box<MaterialGroup>> material_groups;
     };
 
     RC<Aggregate> create_bvh_accel(int max_leaf_primitives){
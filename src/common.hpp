@@ -14,6 +14,12 @@
 #define TRACER_BEGIN namespace tracer{
 #define TRACER_END }
 
+//TRACER_SIMD enables sse spectrum arithmetic, ignored on non x86 targets
+#if defined(TRACER_SIMD) && (defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64))
+#define TRACER_SSE
+#include <xmmintrin.h>
+#endif
+
 TRACER_BEGIN
 
 class Scene;
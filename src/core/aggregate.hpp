@@ -4,6 +4,7 @@
 
 #ifndef TRACER_AGGREGATE_HPP
 #define TRACER_AGGREGATE_HPP
+#include <functional>
 #include <vector>
 #include "utility/geometry.hpp"
 
@@ -23,6 +24,12 @@ public:
     virtual bool intersect(const Ray& ray) const noexcept = 0;
 
     virtual bool intersect_p(const Ray& ray,SurfaceIntersection* isect) const noexcept = 0;
+
+    //report every intersection in [ray.t_min,ray.t_max] in one traversal, in no particular order
+    //only primitives with the given material are tested unless material is nullptr
+    //ray is not changed
+    virtual void intersect_all(const Ray& ray,const Material* material,
+                               const std::function<void(const SurfaceIntersection&)>& callback) const noexcept = 0;
 };
 
 TRACER_END
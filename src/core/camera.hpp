@@ -39,6 +39,24 @@ public:
 
     virtual real generate_ray(const CameraSample&,Ray&) const noexcept = 0;
 
+    //offset rays are generated with film position shifted by film_delta and the same lens sample
+    virtual real generate_ray_differential(const CameraSample& sample,const Vector2f& film_delta,
+                                           Ray& ray,RayDifferential& diff) const noexcept{
+        const real weight = generate_ray(sample,ray);
+        CameraSample sample_x = sample, sample_y = sample;
+        sample_x.p_film.x += film_delta.x;
+        sample_y.p_film.y += film_delta.y;
+        Ray rx, ry;
+        diff.valid = weight > 0 && generate_ray(sample_x,rx) > 0 && generate_ray(sample_y,ry) > 0;
+        if(diff.valid){
+            diff.rx_o = rx.o;
+            diff.rx_d = rx.d;
+            diff.ry_o = ry.o;
+            diff.ry_d = ry.d;
+        }
+        return weight;
+    }
+
     virtual CameraEvalWeResult eval_we(const Point3f& pos_on_cam,const Vector3f& pos_to_out) const noexcept = 0;
 
     virtual CameraPdfWeResult pdf_we(const Point3f& pos_on_cam,const Vector3f& pos_to_out) const noexcept = 0;
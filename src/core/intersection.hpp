@@ -32,6 +32,11 @@ TRACER_BEGIN
         const Material* material     = nullptr;
         const Medium* medium_inside  = nullptr;
         const Medium* medium_outside = nullptr;
+        //not normalized, zero if the shape does not provide them
+        Vector3f dpdu;
+        Vector3f dpdv;
+        //max length of uv change over a pixel, 0 means unknown and textures use the finest level
+        real uv_footprint = 0;
 
         const Medium* wo_medium() const{
             return dot(wo,geometry_coord.z) >= 0 ? medium_outside : medium_inside;
@@ -40,7 +45,7 @@ TRACER_BEGIN
             return dot(d,geometry_coord.z) >= 0 ? medium_outside : medium_inside;
         }
     };
-    static_assert(sizeof(SurfaceIntersection) == 136,"");
+    static_assert(sizeof(SurfaceIntersection) == 168,"");
 
     struct MediumPoint{
         Point3f pos;
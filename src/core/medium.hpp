@@ -24,7 +24,13 @@ struct MediumSampleResult{
         return phase_func != nullptr;
     }
 };
-static_assert(sizeof(MediumSampleResult) == 56,"");
+static_assert(sizeof(MediumSampleResult) == (SPECTRUM_PADDED ? 64 : 56),"");
+
+struct HomogeneousMediumProperty{
+    Spectrum sigma_s;
+    Spectrum sigma_t;
+    real g = 0;
+};
 
 class Medium{
 public:
@@ -36,6 +42,11 @@ public:
 
     virtual MediumSampleResult sample(const Point3f& a,const Point3f& b,Sampler& sampler,MemoryArena& arena,bool indirect_scattering = false) const = 0;
 
+    //constant coefficients for analytic sampling along a segment, nullptr if not homogeneous
+    virtual const HomogeneousMediumProperty* get_homogeneous_property() const noexcept{
+        return nullptr;
+    }
+
 };
 
 struct MediumInterface{
@@ -27,6 +27,8 @@ public:
     virtual Bounds3f world_bound()  const noexcept = 0;
 
     virtual const AreaLight* as_area_light() const noexcept = 0;
+
+    virtual const Material* get_material() const noexcept = 0;
 };
 
 
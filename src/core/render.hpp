@@ -13,9 +13,46 @@
 #include "utility/logger.hpp"
 TRACER_BEGIN
 
+//extra channels a film may accumulate besides color
+enum AOVChannel : uint32_t{
+    //first hit albedo, shading normal and distance along the camera ray
+    AOVAlbedo      = 1u << 0,
+    AOVNormal      = 1u << 1,
+    AOVDepth       = 1u << 2,
+    //ids of the first hit primitive and material, 0 for a miss
+    AOVPrimitiveId = 1u << 3,
+    AOVMaterialId  = 1u << 4,
+    //light reaching the camera after at most one bounce and the rest of color
+    AOVDirect      = 1u << 5,
+    AOVIndirect    = 1u << 6
+};
+
+constexpr uint32_t AOVSurfaceChannels = AOVAlbedo | AOVNormal | AOVDepth | AOVPrimitiveId | AOVMaterialId;
+constexpr uint32_t AOVLightingChannels = AOVDirect | AOVIndirect;
+
+//what a renderer records for one camera sample when the film has aov channels
+struct AOVSample{
+    Spectrum albedo;
+    Vector3f normal;
+    real depth = 0;
+    //see Scene::primitive_id and Scene::material_id
+    uint32_t primitive_id = 0;
+    uint32_t material_id = 0;
+    Spectrum direct;
+};
+
 struct RenderTarget{
 //todo image2d
     Image2D<Spectrum> color;
+    //aov channels of the film, images of other channels are empty
+    Image2D<Spectrum> albedo;
+    //world space shading normal in r, g and b
+    Image2D<Spectrum> normal;
+    Image2D<real> depth;
+    Image2D<real> primitive_id;
+    Image2D<real> material_id;
+    Image2D<Spectrum> direct;
+    Image2D<Spectrum> indirect;
 };
 
 
@@ -25,18 +62,65 @@ struct RenderTarget{
             Spectrum contrib_sum;
             real filter_weight_sum = 0;
         };
+        //sums of the aov channels of a pixel, normalized by the filter weight of its TilePixel
+        struct AOVPixel{
+            Spectrum albedo_sum;
+            Vector3f normal_sum;
+            real depth_sum = 0;
+            Spectrum direct_sum;
+            //ids can not be averaged, keep those of the sample closest to the pixel center
+            real id_filter_weight = -1;
+            uint32_t primitive_id = 0;
+            uint32_t material_id = 0;
+        };
         class Tile{
         public:
             //use int int replace Bounds2i as interface exposed
-            Tile(const Bounds2i& tile_bound,const RC<Filter>& filter)
-            : tile_pixel_bound(tile_bound),filter(filter),
-            tile_pixels(newBox<TilePixel[]>(tile_bound.area()))
+            Tile(const Bounds2i& tile_bound,const RC<Filter>& filter,uint32_t aov_channels = 0)
+            : tile_pixels(newBox<TilePixel[]>(tile_bound.area())),aov_channels(aov_channels),
+            tile_pixel_bound(tile_bound),filter(filter)
             {
-
+                if(aov_channels)
+                    aov_pixels = newBox<AOVPixel[]>(tile_bound.area());
             }
             void add_sample(const Point2f& pos,Spectrum li,real sample_weight = 1.0){
                 //todo check is li is infinite
+                splat<false,false>(pos,li,nullptr,sample_weight);
+            }
+            //aov is ignored if the film has no aov channels
+            void add_sample(const Point2f& pos,const Spectrum& li,const AOVSample& aov,real sample_weight = 1.0){
+                const bool surface = aov_channels & AOVSurfaceChannels;
+                const bool lighting = aov_channels & AOVLightingChannels;
+                if(surface && lighting)
+                    splat<true,true>(pos,li,&aov,sample_weight);
+                else if(surface)
+                    splat<true,false>(pos,li,&aov,sample_weight);
+                else if(lighting)
+                    splat<false,true>(pos,li,&aov,sample_weight);
+                else
+                    splat<false,false>(pos,li,nullptr,sample_weight);
+            }
+            Bounds2i get_pixel_bound() const{
+                return tile_pixel_bound;
+            }
+            //传入的是相对于整个film的坐标
+            TilePixel& get_pixel(const Point2i& p){
+                return tile_pixels[pixel_offset(p)];
+            }
+            //only valid if the film has aov channels
+            AOVPixel& get_aov_pixel(const Point2i& p){
+                return aov_pixels[pixel_offset(p)];
+            }
+        private:
+            int pixel_offset(const Point2i& p) const{
+                Point2i dp = p - tile_pixel_bound.low;
+                return dp.x + dp.y * (tile_pixel_bound.high.x - tile_pixel_bound.low.x);
+            }
 
+            //the channel groups are template arguments so that a film without aov channels
+            //runs the same loop as before
+            template<bool Surface,bool Lighting>
+            void splat(const Point2f& pos,const Spectrum& li,const AOVSample* aov,real sample_weight){
                 Point2f discrete_pos = pos - Point2f(0.5,0.5);
                 Point2i p0 = (Point2i)ceil(discrete_pos - filter->radius());
                 Point2i p1 = (Point2i)floor(discrete_pos + filter->radius()) + Point2i(1,1);
@@ -50,32 +134,47 @@ struct RenderTarget{
                         auto& tile_pixel = get_pixel(Point2i(x,y));
                         tile_pixel.contrib_sum += li * filter_weight * sample_weight;
                         tile_pixel.filter_weight_sum += filter_weight;
+
+                        if constexpr(Surface || Lighting){
+                            auto& aov_pixel = get_aov_pixel(Point2i(x,y));
+                            if constexpr(Surface){
+                                aov_pixel.albedo_sum += aov->albedo * filter_weight;
+                                aov_pixel.normal_sum += aov->normal * filter_weight;
+                                aov_pixel.depth_sum += aov->depth * filter_weight;
+                                if(filter_weight > aov_pixel.id_filter_weight){
+                                    aov_pixel.id_filter_weight = filter_weight;
+                                    aov_pixel.primitive_id = aov->primitive_id;
+                                    aov_pixel.material_id = aov->material_id;
+                                }
+                            }
+                            if constexpr(Lighting){
+                                aov_pixel.direct_sum += aov->direct * filter_weight * sample_weight;
+                            }
+                        }
                     }
                 }
-                //ok
-
-            }
-            Bounds2i get_pixel_bound() const{
-                return tile_pixel_bound;
             }
-            //传入的是相对于整个film的坐标
-            TilePixel& get_pixel(const Point2i& p){
-                Point2i dp = p - tile_pixel_bound.low;
-                int offset = dp.x + dp.y * (tile_pixel_bound.high.x - tile_pixel_bound.low.x);
-                return tile_pixels[offset];
-            }
-        private:
+
             //todo replace with Image2D
             Box<TilePixel[]> tile_pixels;
+            //empty if the film has no aov channels
+            Box<AOVPixel[]> aov_pixels;
+            uint32_t aov_channels;
             //存储的是相对于整个film的相对坐标
             const Bounds2i tile_pixel_bound;
             RC<Filter> filter;
         };
-        Film(const Point2i& res,const RC<Filter>& filter)
-        : resolution(res),filter(filter),pixels(newBox<Pixel[]>(res.x * res.y))
-        {}
+        //aov_channels is a mask of AOVChannel, the aov storage is only allocated if it is not 0
+        Film(const Point2i& res,const RC<Filter>& filter,uint32_t aov_channels = 0)
+        : resolution(res),filter(filter),pixels(res.x,res.y),aov_channels(aov_channels)
+        {
+            if(aov_channels)
+                aov_pixels = BlockImage2D<AOVPixel>(res.x,res.y);
+        }
         int width() const { return resolution.x; }
         int height() const { return resolution.y; }
+        uint32_t get_aov_channels() const { return aov_channels; }
+        bool has_aov() const { return aov_channels != 0; }
         Box<Tile> get_film_tile(const Bounds2i& pixel_bounds){
             Point2f half_pixel(0.5,0.5);
             Bounds2f sample_bounds = (Bounds2f)pixel_bounds;
@@ -84,7 +183,7 @@ struct RenderTarget{
             Point2i high = (Point2i)floor(sample_bounds.high - half_pixel + filter->radius()) + Point2i(1,1);
             Bounds2i film_bounds = get_film_bounds();
             Bounds2i tile_bounds = intersect(Bounds2i(low,high),film_bounds);
-            return newBox<Tile>(tile_bounds,filter);
+            return newBox<Tile>(tile_bounds,filter,aov_channels);
         }
 
         void merge_film_tile(const Box<Tile>& tile){
@@ -96,7 +195,21 @@ struct RenderTarget{
                 film_pixel.color += tile_pixel.contrib_sum;
                 film_pixel.weight += tile_pixel.filter_weight_sum;
             }
-
+            if(!aov_channels)
+                return;
+            for(Point2i pixel:tile->get_pixel_bound()){
+                const auto& tile_pixel = tile->get_aov_pixel(pixel);
+                auto& film_pixel = aov_pixels.unchecked(pixel.x,pixel.y);
+                film_pixel.albedo_sum += tile_pixel.albedo_sum;
+                film_pixel.normal_sum += tile_pixel.normal_sum;
+                film_pixel.depth_sum += tile_pixel.depth_sum;
+                film_pixel.direct_sum += tile_pixel.direct_sum;
+                if(tile_pixel.id_filter_weight > film_pixel.id_filter_weight){
+                    film_pixel.id_filter_weight = tile_pixel.id_filter_weight;
+                    film_pixel.primitive_id = tile_pixel.primitive_id;
+                    film_pixel.material_id = tile_pixel.material_id;
+                }
+            }
         }
         Bounds2i get_film_bounds() const{
             return Bounds2i(Point2i(0,0),resolution);
@@ -112,6 +225,45 @@ struct RenderTarget{
                         render_target.color.at(x,y) = pixel.color / pixel.weight;
                 }
             }
+            if(!aov_channels)
+                return;
+            auto channel_image = [&](uint32_t channel,auto& image){
+                using Image = std::remove_reference_t<decltype(image)>;
+                image = (aov_channels & channel) ? Image(resolution.x,resolution.y) : Image();
+            };
+            channel_image(AOVAlbedo,render_target.albedo);
+            channel_image(AOVNormal,render_target.normal);
+            channel_image(AOVDepth,render_target.depth);
+            channel_image(AOVPrimitiveId,render_target.primitive_id);
+            channel_image(AOVMaterialId,render_target.material_id);
+            channel_image(AOVDirect,render_target.direct);
+            channel_image(AOVIndirect,render_target.indirect);
+            for(int y = 0; y < resolution.y; ++y){
+                for(int x = 0; x < resolution.x; ++x){
+                    const auto& pixel = get_pixel({x,y});
+                    const auto& aov_pixel = aov_pixels.unchecked(x,y);
+                    if(pixel.weight <= 0)
+                        continue;
+                    const real inv_weight = 1 / pixel.weight;
+                    if(aov_channels & AOVAlbedo)
+                        render_target.albedo.at(x,y) = aov_pixel.albedo_sum * inv_weight;
+                    if(aov_channels & AOVNormal){
+                        const Vector3f n = aov_pixel.normal_sum.length_squared() > 0 ?
+                                normalize(aov_pixel.normal_sum) : Vector3f();
+                        render_target.normal.at(x,y) = Spectrum(n.x,n.y,n.z);
+                    }
+                    if(aov_channels & AOVDepth)
+                        render_target.depth.at(x,y) = aov_pixel.depth_sum * inv_weight;
+                    if(aov_channels & AOVPrimitiveId)
+                        render_target.primitive_id.at(x,y) = static_cast<real>(aov_pixel.primitive_id);
+                    if(aov_channels & AOVMaterialId)
+                        render_target.material_id.at(x,y) = static_cast<real>(aov_pixel.material_id);
+                    if(aov_channels & AOVDirect)
+                        render_target.direct.at(x,y) = aov_pixel.direct_sum * inv_weight;
+                    if(aov_channels & AOVIndirect)
+                        render_target.indirect.at(x,y) = (pixel.color - aov_pixel.direct_sum) * inv_weight;
+                }
+            }
         }
         const RC<Filter>& get_filter() const{
             return filter;
@@ -125,10 +277,56 @@ struct RenderTarget{
             Spectrum color;
             real weight = 0;
         };
-        Box<Pixel[]> pixels;
+        //block layout keeps the rows of a tile close together for merging
+        BlockImage2D<Pixel> pixels;
+        uint32_t aov_channels;
+        BlockImage2D<AOVPixel> aov_pixels;
         Pixel& get_pixel(const Point2i& p){
-            int offset = p.x + p.y * resolution.x;
-            return pixels[offset];
+            return pixels.unchecked(p.x,p.y);
+        }
+    };
+
+
+    //camera samples of a film and what they hit first, kept by an interactive session between renders
+    //so that a render after an edit only re-shades or re-traces the samples marked dirty
+    //and the others keep their radiance, sizeof(Record) bytes per sample plus one byte for the mark
+    struct PrimaryHitBuffer{
+        static constexpr uint32_t miss = ~0u;
+        enum Mark : uint8_t{
+            Keep = 0,
+            //primary hit is still valid, evaluate radiance again starting from it
+            Reshade = 1,
+            //geometry along the camera ray changed, find the primary hit again
+            Retrace = 2
+        };
+        struct Record{
+            //film position in pixels
+            Point2f pixel;
+            Point2f lens;
+            //id of the first hit primitive in Scene::primitives or miss
+            uint32_t primitive = miss;
+            Spectrum radiance;
+        };
+        int width = 0;
+        int height = 0;
+        int spp = 0;
+        //spp records of a pixel are consecutive, pixels in row major order
+        std::vector<Record> records;
+        std::vector<uint8_t> marks;
+
+        bool empty() const noexcept{
+            return records.empty();
+        }
+        void clear(){
+            records.clear();
+            marks.clear();
+            width = height = spp = 0;
+        }
+        void mark_all(Mark mark){
+            std::fill(marks.begin(),marks.end(),static_cast<uint8_t>(mark));
+        }
+        void mark(size_t index,Mark mark){
+            marks[index] = (std::max)(marks[index],static_cast<uint8_t>(mark));
         }
     };
 
@@ -15,6 +15,14 @@ public:
 
     virtual RenderTarget render(const Scene& scene,Film film) = 0;
 
+    //render keeping primary hits in buffer, an empty buffer or one of other film size is filled by a full render,
+    //otherwise only samples marked in buffer are evaluated again and the marks are reset
+    //renderers not built on camera samples per pixel render fully and leave buffer empty
+    virtual RenderTarget render_cached(const Scene& scene,Film film,PrimaryHitBuffer& buffer){
+        buffer.clear();
+        return render(scene,std::move(film));
+    }
+
 };
 
 
@@ -5,8 +5,34 @@
 #include "factory/scene.hpp"
 #include "core/aggregate.hpp"
 #include "core/light.hpp"
+#include "core/primitive.hpp"
 TRACER_BEGIN
 
+    uint32_t Scene::primitive_id(const Primitive* primitive) const noexcept{
+        if(!id_lookup) return 0;
+        auto it = id_lookup->primitive_ids.find(primitive);
+        return it == id_lookup->primitive_ids.end() ? 0 : it->second;
+    }
+
+    uint32_t Scene::material_id(const Material* material) const noexcept{
+        if(!id_lookup) return 0;
+        auto it = id_lookup->material_ids.find(material);
+        return it == id_lookup->material_ids.end() ? 0 : it->second;
+    }
+
+    void Scene::build_ids(){
+        auto lookup = newRC<IdLookup>();
+        lookup->primitive_ids.reserve(primitives.size());
+        materials.clear();
+        for(size_t i = 0; i < primitives.size(); ++i){
+            lookup->primitive_ids[primitives[i]] = static_cast<uint32_t>(i + 1);
+            const Material* material = primitives[i]->get_material();
+            if(material && lookup->material_ids.emplace(material,static_cast<uint32_t>(materials.size() + 1)).second)
+                materials.push_back(material);
+        }
+        id_lookup = std::move(lookup);
+    }
+
     class GeneralScene:public Scene{
     private:
     RC<const Camera> scene_camera;
@@ -39,6 +65,11 @@ TRACER_BEGIN
             return accel->intersect_p(ray,isect);
         }
 
+        void intersect_all(const Ray& ray,const Material* material,
+                           const std::function<void(const SurfaceIntersection&)>& callback) const override{
+            accel->intersect_all(ray,material,callback);
+        }
+
         bool visible(const Point3f& p,const Point3f& q) const override{
             const real dist = (p - q).length();
             Ray r(q,normalize(p - q),eps,dist - eps);
@@ -57,6 +88,57 @@ TRACER_BEGIN
         }
     };
 
+    //shares geometry and lights of a prepared scene and only owns its camera,
+    //so several views of one scene can be rendered at the same time
+    class SceneView:public Scene{
+    private:
+        RC<const Scene> scene;
+        RC<const Camera> view_camera;
+
+    public:
+        SceneView(const RC<const Scene>& scene,RC<const Camera> camera)
+        :scene(scene),view_camera(std::move(camera))
+        {
+            lights = scene->lights;
+            primitives = scene->primitives;
+            materials = scene->materials;
+            id_lookup = scene->id_lookup;
+            environment_light = scene->environment_light;
+        }
+
+        void set_camera(RC<const Camera> cam) override{
+            view_camera = cam;
+        }
+
+        RC<const Camera> get_camera() const noexcept override{
+            return view_camera;
+        }
+
+        bool intersect(const Ray& ray) const override{
+            return scene->intersect(ray);
+        }
+
+        bool intersect_p(const Ray& ray,SurfaceIntersection* isect) const override{
+            return scene->intersect_p(ray,isect);
+        }
+
+        void intersect_all(const Ray& ray,const Material* material,
+                           const std::function<void(const SurfaceIntersection&)>& callback) const override{
+            scene->intersect_all(ray,material,callback);
+        }
+
+        bool visible(const Point3f& p,const Point3f& q) const override{
+            return scene->visible(p,q);
+        }
+
+        Bounds3f world_bounds() const noexcept override{
+            return scene->world_bounds();
+        }
+
+        //the viewed scene is already prepared
+        void prepare_to_render() override{}
+    };
+
     RC<Scene> create_general_scene(){
         return newRC<GeneralScene>();
     }
@@ -65,4 +147,8 @@ TRACER_BEGIN
         return newRC<GeneralScene>(accel);
     }
 
+    RC<Scene> create_scene_view(const RC<const Scene>& scene,RC<const Camera> camera){
+        return newRC<SceneView>(scene,std::move(camera));
+    }
+
 TRACER_END
\ No newline at end of file
@@ -4,6 +4,8 @@
 
 #ifndef TRACER_SCENE_HPP
 #define TRACER_SCENE_HPP
+#include <functional>
+#include <unordered_map>
 #include "common.hpp"
 #include "core/intersection.hpp"
 TRACER_BEGIN
@@ -20,6 +22,10 @@ public:
 
     virtual bool intersect_p(const Ray& ray,SurfaceIntersection* isect) const = 0;
 
+    //see Aggregate::intersect_all
+    virtual void intersect_all(const Ray& ray,const Material* material,
+                               const std::function<void(const SurfaceIntersection&)>& callback) const = 0;
+
     virtual bool visible(const Point3f& p,const Point3f& q) const = 0;
 
     virtual Bounds3f world_bounds() const noexcept = 0;
@@ -28,8 +34,30 @@ public:
 
     Span<const Light*> lights;
 
+    //primitives by an id stable across rebuilds of the same shapes, filled by the scene file loader
+    //for cached primary hits, empty otherwise
+    Span<const Primitive*> primitives;
+
+    //materials of primitives in order of first use, so their indices are stable like those of primitives
+    Span<const Material*> materials;
+
+    //index + 1 in primitives and materials, 0 if the pointer is not listed, used by aov channels
+    uint32_t primitive_id(const Primitive* primitive) const noexcept;
+
+    uint32_t material_id(const Material* material) const noexcept;
+
+    //fills materials and the id lookup from primitives
+    void build_ids();
+
     RC<EnvironmentLight> environment_light;
 
+    struct IdLookup{
+        std::unordered_map<const Primitive*,uint32_t> primitive_ids;
+        std::unordered_map<const Material*,uint32_t> material_ids;
+    };
+    //shared by views of the scene
+    RC<const IdLookup> id_lookup;
+
 };
 
 TRACER_END
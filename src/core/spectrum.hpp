@@ -13,7 +13,14 @@ TRACER_BEGIN
     class Color3{
     public:
 
+#ifdef TRACER_SSE
+    alignas(4 * sizeof(T)) T r;
+    T g,b;
+    //4th lane so a float color is one aligned sse register, never read
+    T pad = 0;
+#else
     T r,g,b;
+#endif
 
      Color3(): Color3(0){}
      Color3(T r,T g,T b):r(r),g(g),b(b){}
@@ -42,32 +49,21 @@ TRACER_BEGIN
          return is_back();
      }
 
+     //forward to binary operators which have sse overloads for float
      Color3& operator+=(const Color3& rhs){
-         r += rhs.r;
-         g += rhs.g;
-         b += rhs.b;
-         return *this;
+         return *this = *this + rhs;
      }
 
      Color3& operator/=(T t){
-         r /= t;
-         g /= t;
-         b /= t;
-         return *this;
+         return *this = *this / t;
      }
 
         Color3& operator*=(T t){
-            r *= t;
-            g *= t;
-            b *= t;
-            return *this;
+            return *this = *this * t;
         }
 
         Color3& operator*=(const Color3& t){
-            r *= t.r;
-            g *= t.g;
-            b *= t.b;
-            return *this;
+            return *this = *this * t;
         }
 
      T& operator[](int idx){
@@ -158,8 +154,69 @@ TRACER_BEGIN
         return Color3<T>(std::exp(c.r),std::exp(c.g),std::exp(c.b));
     }
 
+#ifdef TRACER_SSE
+    //non-template overloads are preferred over the templates above for Color3<float>
+    //pad lane may hold garbage after these, it is never read
+    namespace simd{
+        inline __m128 load(const Color3<float>& c) noexcept{
+            return _mm_load_ps(&c.r);
+        }
+
+        inline Color3<float> store(__m128 v) noexcept{
+            Color3<float> c;
+            _mm_store_ps(&c.r,v);
+            return c;
+        }
+    }
+
+    inline Color3<float> operator-(const Color3<float>& lhs){
+        return simd::store(_mm_sub_ps(_mm_setzero_ps(),simd::load(lhs)));
+    }
+
+    inline Color3<float> operator+(const Color3<float>& lhs,float rhs){
+        return simd::store(_mm_add_ps(simd::load(lhs),_mm_set1_ps(rhs)));
+    }
+
+    inline Color3<float> operator+(const Color3<float>& lhs,const Color3<float>& rhs){
+        return simd::store(_mm_add_ps(simd::load(lhs),simd::load(rhs)));
+    }
+
+    inline Color3<float> operator-(const Color3<float>& lhs,const Color3<float>& rhs){
+        return simd::store(_mm_sub_ps(simd::load(lhs),simd::load(rhs)));
+    }
+
+    inline Color3<float> operator*(const Color3<float>& lhs,const Color3<float>& rhs){
+        return simd::store(_mm_mul_ps(simd::load(lhs),simd::load(rhs)));
+    }
+
+    inline Color3<float> operator/(const Color3<float>& lhs,const Color3<float>& rhs){
+        return simd::store(_mm_div_ps(simd::load(lhs),simd::load(rhs)));
+    }
+
+    inline Color3<float> operator*(const Color3<float>& lhs,const float& rhs){
+        return simd::store(_mm_mul_ps(simd::load(lhs),_mm_set1_ps(rhs)));
+    }
+
+    inline Color3<float> operator*(const float& lhs,const Color3<float>& rhs){
+        return rhs * lhs;
+    }
+
+    inline Color3<float> operator/(const Color3<float>& lhs,const float& rhs){
+        return simd::store(_mm_div_ps(simd::load(lhs),_mm_set1_ps(rhs)));
+    }
+
+    inline Color3<float> sqrt(const Color3<float>& c){
+        return simd::store(_mm_sqrt_ps(simd::load(c)));
+    }
+#endif
+
     using Spectrum = Color3<real>;
     constexpr int SPECTRUM_COMPONET_COUNT = 3;
+#ifdef TRACER_SSE
+    constexpr bool SPECTRUM_PADDED = true;
+#else
+    constexpr bool SPECTRUM_PADDED = false;
+#endif
 
 TRACER_END
 
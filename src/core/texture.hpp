@@ -63,6 +63,11 @@ protected:
     TextureWrapFunc wrapper_u = &wrap_repeat;
     TextureWrapFunc wrapper_v = &wrap_repeat;
     virtual Spectrum evaluate_impl(const Point2f& uv) const noexcept = 0;
+
+    //uv_footprint is max length of uv change over a pixel, used by filtered textures
+    virtual Spectrum evaluate_impl(const Point2f& uv,real) const noexcept{
+        return evaluate_impl(uv);
+    }
 public:
     virtual ~Texture2D() = default;
 
@@ -74,34 +79,28 @@ public:
     virtual real evaluate_s(const Point2f& uv) const noexcept{
         const real u = wrapper_u(uv.x);
         const real v = wrapper_v(uv.y);
-        auto ret = evaluate_impl({u,v});
-        if(inv_gamma != 1){
-            for(int i=0;i<SPECTRUM_COMPONET_COUNT;++i)
-                ret[i] = std::pow(ret[i],inv_gamma);
-        }
-        return ret.r;
+        return evaluate_impl({u,v}).r;
     }
 
     virtual Spectrum evaluate(const Point2f& uv) const noexcept {
         const real u = wrapper_u(uv.x);
         const real v = wrapper_v(uv.y);
-        auto ret = evaluate_impl({u,v});
-        if(inv_gamma != 1){
-            for(int i=0;i<SPECTRUM_COMPONET_COUNT;++i)
-                ret[i] = std::pow(ret[i],inv_gamma);
-        }
-        return ret;
+        return evaluate_impl({u,v});
     }
 
     virtual Spectrum evaluate(const SurfaceIntersection& isect) const noexcept {
-        return evaluate(isect.uv);
+        if(isect.uv_footprint <= 0)
+            return evaluate(isect.uv);
+        const real u = wrapper_u(isect.uv.x);
+        const real v = wrapper_v(isect.uv.y);
+        return evaluate_impl({u,v},isect.uv_footprint);
     }
 
     virtual real evaluate_s(const SurfaceIntersection& isect) const noexcept {
-        return evaluate_s(isect.uv);
+        if(isect.uv_footprint <= 0)
+            return evaluate_s(isect.uv);
+        return evaluate(isect).r;
     }
-protected:
-    real inv_gamma = 1;
 };
 
 
@@ -156,6 +155,16 @@ public:
     virtual Spectrum max_spectrum() const noexcept = 0;
 
     virtual real max_real() const noexcept = 0;
+
+    //upper bound of evaluate_s over uvw box [low,high] without wrapping
+    virtual real max_real(const Point3f&,const Point3f&) const noexcept{
+        return max_real();
+    }
+
+    //lower bound of evaluate_s over uvw box [low,high] without wrapping
+    virtual real min_real(const Point3f&,const Point3f&) const noexcept{
+        return 0;
+    }
 protected:
     real inv_gamma = 1;
 };
@@ -16,7 +16,9 @@ RC<Medium> create_heterogeneous_medium(
         RC<const Texture3D> albedo,
         RC<const Texture3D> g,
         int max_scattering_count,
-        bool white_for_indirect);
+        bool white_for_indirect,
+        int majorant_grid_resolution = 16,
+        bool residual_ratio_tracking = true);
 
 RC<Medium> create_homogeneous_medium(
         const Spectrum &sigma_a,
@@ -16,6 +16,21 @@ struct PTRendererParams{
     int min_depth = 3;
     int max_depth = 10;
     int direct_light_sample_num = 1;
+
+    //practical path guiding, trained with 1,2,4,... spp passes before the final spp
+    bool use_path_guiding = false;
+    int guiding_training_iterations = 5;
+    real guiding_bsdf_fraction = real(0.5);
+
+    //adjoint-driven russian roulette and splitting, keeps expected contribution of a path
+    //around the pixel radiance estimated by a coarse pass of adjoint_rr_estimate_spp
+    bool use_adjoint_rr = false;
+    int adjoint_rr_estimate_spp = 4;
+    real adjoint_rr_window_size = 5;
+    int adjoint_rr_max_split = 8;
+
+    //direct light in homogeneous media by equiangular and distance sampling mis
+    bool use_equiangular_sampling = false;
 };
 
 RC<Renderer> create_pt_renderer(const PTRendererParams& params);
@@ -30,6 +45,11 @@ struct SPPMRendererParams{
 
     int photon_min_depth = 5;
     int photon_max_depth = 10;
+    //keep photon power within a window around its emitted power by roulette and splitting,
+    //otherwise photons are killed with fixed probability after photon_min_depth
+    bool photon_weight_window = false;
+    real photon_window_size = 4;
+    int photon_max_split = 4;
 
     real update_alpha = real(2) / 3;
 };
@@ -43,10 +63,40 @@ struct BDPTRendererParams{
     int max_light_vertex_count = 10;
     int spp = 1;
 
+    //trace a pool of light sub-paths per pass and connect each camera vertex
+    //to cache_connection_count vertices chosen from the pool randomly
+    bool use_light_vertex_cache = false;
+    int light_path_pool_count = 0;//0 means film pixel count capped at 2^18
+    int cache_connection_count = 1;
 };
 
 RC<Renderer> create_bdpt_renderer(const BDPTRendererParams& params);
 
+struct MLTRendererParams{
+    int worker_count = 0;
+    int max_depth = 8;
+    int bootstrap_count = 100000;
+    int chain_count = 1000;
+    int mutations_per_pixel = 100;
+    real sigma = real(0.01);
+    real large_step_prob = real(0.3);
+};
+
+RC<Renderer> create_mlt_renderer(const MLTRendererParams& params);
+
+struct VCMRendererParams{
+    real init_search_radius = 0;
+    int worker_count = 0;
+    int task_tile_size = 16;
+    int iteration_count = 64;
+    int max_camera_vertex_count = 10;
+    int max_light_vertex_count = 10;
+    //radius of iteration i is init_search_radius * i ^ ((alpha - 1) / 2)
+    real radius_alpha = real(0.75);
+};
+
+RC<Renderer> create_vcm_renderer(const VCMRendererParams& params);
+
 TRACER_END
 
 #endif //TRACER_FACTORY_RENDERER_HPP
@@ -13,6 +13,9 @@ TRACER_BEGIN
 
 RC<Scene> create_general_scene(const RC<Aggregate>& accel);
 
+//another camera on a prepared scene, sharing its geometry and lights
+RC<Scene> create_scene_view(const RC<const Scene>& scene,RC<const Camera> camera);
+
 TRACER_END
 
 
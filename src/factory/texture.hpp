@@ -7,14 +7,31 @@
 
 #include "core/texture.hpp"
 #include "utility/image.hpp"
+#include "utility/texture_cache.hpp"
 TRACER_BEGIN
 
 RC<Texture2D> create_constant_texture2d(const Spectrum& constant);
 
 RC<Texture2D> create_image_texture2d(const RC<Image2D<Color3b>>& image);
 
+//gamma encoded texels are kept as is and decoded by table at lookup, scale is applied after decoding
+RC<Texture2D> create_image_texture2d(const RC<Image2D<Color3b>>& image,bool gamma_encoded,const Spectrum& scale);
+
+//mip chain of an 8 bit image, gamma encoded images are averaged in linear space
+RC<const MipMap2D<Color3b>> create_texture_mipmap(const Image2D<Color3b>& image,bool gamma_encoded);
+
+//textures sharing one mip chain only differ in scale
+RC<Texture2D> create_image_texture2d(const RC<const MipMap2D<Color3b>>& mipmap,bool gamma_encoded,const Spectrum& scale);
+
 RC<Texture2D> create_hdr_texture2d(const RC<Image2D<Color3f>>& image);
 
+//image in block layout may be shared by textures of different scales
+RC<Texture2D> create_hdr_texture2d(const RC<const BlockImage2D<Color3f>>& image,const Spectrum& scale);
+
+//texels are read from a file written by write_tiled_texture through the shared cache
+RC<Texture2D> create_tiled_texture2d(const RC<TiledTextureFile>& file,const RC<TextureCache>& cache,
+                                     const Spectrum& scale = Spectrum(1));
+
 RC<Texture3D> create_constant_texture3d(const Spectrum& constant);
 
 RC<Texture3D> create_image_texture3d(const RC<Image3D<real>>& image);
@@ -25,6 +42,9 @@ RC<Texture3D> create_image_texture3d(const RC<Image3D<Color3f>>& image);
 
 RC<Texture3D> create_image_texture3d(const RC<Image3D<Color3b>>& image);
 
+//load a volume written by write_sparse_volume, bricks are paged in on demand
+RC<Texture3D> create_sparse_texture3d(const std::string& filename);
+
 TRACER_END
 
 #endif //TRACER_FACTORY_TEXTURE_HPP
@@ -77,17 +77,7 @@
      auto gamma_corrector = create_gamma_corrector(1.0/2.2);
      auto aces_tone_mapper = create_aces_tone_mapper(1);
 //    aces_tone_mapper->process(render_target);
-     auto& imgf = render_target.color;
-     Image2D<Color3b> imgu8(imgf.width(),imgf.height());
-     real inv_gamma = 1.0 / 2.2;
-     for(int i = 0; i < imgf.width(); i++){
-         for(int j = 0; j < imgf.height(); j++){
-             imgu8.at(i,j).x = std::clamp<int>(std::pow(imgf.at(i,j).r,inv_gamma) * 255,0,255);
-             imgu8.at(i,j).y = std::clamp<int>(std::pow(imgf.at(i,j).g,inv_gamma) * 255,0,255);
-             imgu8.at(i,j).z = std::clamp<int>(std::pow(imgf.at(i,j).b,inv_gamma) * 255,0,255);
-         }
-     }
-     write_image_to_png(imgu8,params.render_result_name+".png");
+     write_image_to_png(render_target.color,params.render_result_name+".png");
      LOG_INFO("write png...");
      LOG_INFO("finish task");
  }
@@ -195,17 +185,7 @@ void run_scene_test(const RenderParams& params){
     auto gamma_corrector = create_gamma_corrector(1.0/2.2);
     auto aces_tone_mapper = create_aces_tone_mapper(1);
 //    aces_tone_mapper->process(render_target);
-    auto& imgf = render_target.color;
-    Image2D<Color3b> imgu8(imgf.width(),imgf.height());
-    real inv_gamma = 1.0 / 2.2;
-    for(int i = 0; i < imgf.width(); i++){
-        for(int j = 0; j < imgf.height(); j++){
-            imgu8.at(i,j).x = std::clamp<int>(std::pow(imgf.at(i,j).r,inv_gamma) * 255,0,255);
-            imgu8.at(i,j).y = std::clamp<int>(std::pow(imgf.at(i,j).g,inv_gamma) * 255,0,255);
-            imgu8.at(i,j).z = std::clamp<int>(std::pow(imgf.at(i,j).b,inv_gamma) * 255,0,255);
-        }
-    }
-    write_image_to_png(imgu8,params.render_result_name+".png");
+    write_image_to_png(render_target.color,params.render_result_name+".png");
     LOG_INFO("write png...");
     LOG_INFO("finish task");
 }
@@ -217,6 +197,8 @@ void run(const RenderParams& params){
                                           {params.camera.up[0],params.camera.up[1],params.camera.up[2]},
                                           params.camera.fov,
                                           params.camera.lens_radius,params.camera.fov);
+    if(params.texture_cache_memory > 0)
+        enable_texture_cache(params.texture_cache_dir,params.texture_cache_memory);
     auto model = load_model_from_file(params.obj_file_name);
     std::vector<RC<Primitive>> primitives;
     LOG_INFO("load model's mesh count: {}",model.mesh.size());
@@ -224,6 +206,7 @@ void run(const RenderParams& params){
     std::vector<MaterialTexture> materials_res;
     std::vector<RC<Material>> materials;
     Span<const Light*> area_lights;
+    preload_material_textures(model.material);
     for(auto& m:model.material){
         auto material = create_texture_from_file(m);
         materials_res.emplace_back(material);
@@ -288,30 +271,65 @@ void run(const RenderParams& params){
     //create renderer
 //    auto renderer = create_pt_renderer(pt_params);
 //    auto renderer = create_sppm_renderer(sppm_params);
+//    auto renderer = create_mlt_renderer(mlt_params);
+//    auto renderer = create_vcm_renderer(vcm_params);
     auto renderer = create_bdpt_renderer(bdpt_params);
 
     AutoTimer timer("render","s");
     auto render_target = renderer->render(*scene.get(), Film({params.render_target_width, params.render_target_height}, filter));
+    if(auto cache = get_texture_cache())
+        cache->log_stats();
+#ifdef TRACER_STATS
+    stats::report(params.stats_file.empty() ? params.render_result_name + "_stats.json" : params.stats_file);
+#endif
     write_image_to_hdr(render_target.color, params.render_result_name+".hdr");
     LOG_INFO("write hdr...");
     auto gamma_corrector = create_gamma_corrector(1.0/2.2);
     auto aces_tone_mapper = create_aces_tone_mapper(1);
 //    aces_tone_mapper->process(render_target);
-    auto& imgf = render_target.color;
-    Image2D<Color3b> imgu8(imgf.width(),imgf.height());
-    real inv_gamma = 1.0 / 2.2;
-    for(int i = 0; i < imgf.width(); i++){
-        for(int j = 0; j < imgf.height(); j++){
-            imgu8.at(i,j).x = std::clamp<int>(std::pow(imgf.at(i,j).r,inv_gamma) * 255,0,255);
-            imgu8.at(i,j).y = std::clamp<int>(std::pow(imgf.at(i,j).g,inv_gamma) * 255,0,255);
-            imgu8.at(i,j).z = std::clamp<int>(std::pow(imgf.at(i,j).b,inv_gamma) * 255,0,255);
-        }
-    }
-    write_image_to_png(imgu8,params.render_result_name+".png");
+    write_image_to_png(render_target.color,params.render_result_name+".png");
     LOG_INFO("write png...");
     LOG_INFO("finish task");
 }
+void run_scene_file(const std::string& filename){
+    auto desc = load_scene_file(filename);
+
+    AutoTimer timer("render","s");
+    if(desc.views.empty()){
+        auto render_target = desc.renderer->render(*desc.scene, Film({desc.width, desc.height}, desc.filter, desc.aov_channels));
+        write_scene_outputs(desc.output,render_target);
+    }
+    else{
+        render_scene_views(desc);
+    }
+    if(auto cache = get_texture_cache())
+        cache->log_stats();
+#ifdef TRACER_STATS
+    stats::report(desc.output.stats_file.empty() ? desc.output.name + "_stats.json" : desc.output.stats_file);
+#endif
+    LOG_INFO("finish task");
+}
 int main(int argc,char** argv){
+    //Tracer scene.json renders a scene file, Tracer --server serves render jobs on stdin and stdout,
+    //otherwise one of the built-in scenes below
+    if(argc > 1){
+        try{
+            if(std::string(argv[1]) == "--server"){
+#ifdef _WIN32
+                //inline images are binary
+                _setmode(_fileno(stdout),_O_BINARY);
+#endif
+                run_render_server(std::cin,std::cout);
+            }
+            else
+                run_scene_file(argv[1]);
+        }
+        catch(const std::exception& e){
+            LOG_CRITICAL("exception: {}",e.what());
+            return 1;
+        }
+        return 0;
+    }
     RenderParams bedroom = {
         .render_result_name = "tracer_bedroom_pt_test",
         .filter = {.radius = 0.5,.alpha = 0.6},
@@ -16,10 +16,17 @@
 #include "factory/medium.hpp"
 #include "factory/texture.hpp"
 #include "utility/image_file.hpp"
+#include "utility/render_server.hpp"
+#include "utility/scene_file.hpp"
 #include "utility/logger.hpp"
+#include "utility/stats.hpp"
 #include "utility/timer.hpp"
 #include <stdexcept>
 #include <array>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 using namespace tracer;
 
 struct RenderParams{
@@ -39,7 +46,12 @@ struct RenderParams{
         real focal_dist;
     }camera;
     std::string obj_file_name;
-    mutable std::string ibl_file_name;
+    mutable std::string ibl_file_name = {};
+    //0 loads material textures into memory, otherwise they are paged through a tiled cache
+    size_t texture_cache_memory = 0;
+    std::string texture_cache_dir = "texture_cache";
+    //json report of hot path stats when built with TRACER_STATS, empty uses render_result_name
+    std::string stats_file = {};
 
 };
 
@@ -84,6 +96,26 @@ BDPTRendererParams bdpt_params{
         .spp =  1024
 };
 
+MLTRendererParams mlt_params{
+        .worker_count = 18,
+        .max_depth = 8,
+        .bootstrap_count = 100000,
+        .chain_count = 1000,
+        .mutations_per_pixel = 1024,
+        .sigma = real(0.01),
+        .large_step_prob = real(0.3)
+};
+
+VCMRendererParams vcm_params{
+        .init_search_radius = 0.01,
+        .worker_count = 18,
+        .task_tile_size = 16,
+        .iteration_count = 1024,
+        .max_camera_vertex_count = 10,
+        .max_light_vertex_count = 10,
+        .radius_alpha = real(0.75)
+};
+
 DisneyBRDFParams disney_brdf_params = {
         .base_color = {0.82,0.82,0.82},
         .subsurface = 1.0,
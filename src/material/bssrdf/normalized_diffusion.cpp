@@ -405,7 +405,7 @@ public:
     {}
 
     BSSRDF* create(const SurfaceIntersection& isect, MemoryArena& arena) const override{
-        return arena.alloc_object<NormalizedDiffusionBSSRDF>(isect,eta->evaluate_s(isect.uv),A->evaluate(isect.uv),dmfp->evaluate(isect.uv));
+        return arena.alloc_object<NormalizedDiffusionBSSRDF>(isect,eta->evaluate_s(isect),A->evaluate(isect),dmfp->evaluate(isect));
     }
 private:
     RC<const Texture2D> A;
@@ -1,11 +1,11 @@
 #include "separable.hpp"
 #include "core/sampling.hpp"
-#include <list>
 #include "core/scene.hpp"
 #include "utility/memory.hpp"
 #include "core/bsdf.hpp"
 #include "core/material.hpp"
 #include "utility/reflection.hpp"
+#include "utility/stats.hpp"
 TRACER_BEGIN
 
 namespace {
@@ -134,50 +134,34 @@ BSSRDFSampleResult SeparableBSSRDF::sample_pi(const Scene& scene,const Sample3 &
 
     Ray isect_ray(po.pos + proj_coord.local_to_global(isect_ray_offset),-proj_coord.z,eps,std::max(eps,isect_ray_len));
 
-    //not use std::list because we will use arena to alloc memory
-    struct IsectListNode{
-        SurfaceIntersection isect;
-        IsectListNode* next;
-    }* isect_list = nullptr;
-
+    //all probe hits on this material are found in one traversal, one of them is chosen uniformly
+    //by reservoir sampling so that hits need not be stored
     int isect_count = 0;
-    do{
-        SurfaceIntersection new_isect;
-        if(!scene.intersect_p(isect_ray,&new_isect))
-            break;
-
-        if(new_isect.material == po.material)//may use primitive?
-        {
-            auto node = arena.alloc_object<IsectListNode>();
-            node->isect = new_isect;
-            node->next = isect_list;
-            isect_list = node;
-            isect_count++;
+    SurfaceIntersection chosen_isect;
+    real select_u = sample.w;
+    STATS_INC(BSSRDFProbes);
+    scene.intersect_all(isect_ray,po.material,[&](const SurfaceIntersection& new_isect){
+        ++isect_count;
+        //keep the new hit with probability 1 / isect_count and remap select_u to [0,1)
+        const real keep_prob = real(1) / isect_count;
+        if(select_u < keep_prob){
+            chosen_isect = new_isect;
+            select_u = select_u / keep_prob;
         }
-
-        isect_ray.o = isect_ray(isect_ray.t_max + eps);
-
-        if(isect_ray.t_max >= isect_ray_len)
-            break;
-
-    }while(true);
+        else{
+            select_u = (select_u - keep_prob) / (1 - keep_prob);
+        }
+    });
 
     if(isect_count == 0)
         return {};
+    assert(chosen_isect.material == po.material);
 
-    auto [isect_index,sample_w] = extract_uniform_int(sample.w,0,isect_count);
-    for(int i = 0; i < isect_index; ++i){
-        assert(isect_list);
-        isect_list = isect_list->next;
-    }
-    assert(isect_list);
-    assert(isect_list->isect.material == po.material);
-
-    const real pdf_r = pdf_pi(isect_list->isect);
+    const real pdf_r = pdf_pi(chosen_isect);
 
-    const BSDF* bsdf = arena.alloc_object<SeparableBSDF>(isect_list->isect.geometry_coord,eta);
+    const BSDF* bsdf = arena.alloc_object<SeparableBSDF>(chosen_isect.geometry_coord,eta);
 
-    SurfaceIntersection isect = isect_list->isect;
+    SurfaceIntersection isect = chosen_isect;
     isect.material = arena.alloc_object<SeparableBSDFMaterial>(bsdf);
 
     real cos_theta_o = cos(po.wo,po.geometry_coord.z);
@@ -601,22 +601,26 @@ public:
         bssrdf_ = std::move(bssrdf);
     }
 
+    Spectrum evaluate(const Point2f& uv) const override{
+        return base_color_->evaluate(uv);
+    }
+
     SurfaceShadingPoint shading(const SurfaceIntersection &inct, MemoryArena &arena) const override
     {
         const Point2f uv = inct.uv;
-        const Spectrum base_color             = base_color_      ->evaluate(uv);
-        const real     metallic               = metallic_        ->evaluate_s(uv);
-        const real     roughness              = roughness_       ->evaluate_s(uv);
-        const real     transmission           = transmission_    ->evaluate_s(uv);
-        const real     transmission_roughness = transmission_roughness_->evaluate_s(uv);
-        const real     ior                    = IOR_             ->evaluate_s(uv);
-        const Spectrum specular_scale         = specular_scale_  ->evaluate(uv);
-        const real     specular_tint          = specular_tint_   ->evaluate_s(uv);
-        const real     anisotropic            = anisotropic_     ->evaluate_s(uv);
-        const real     sheen                  = sheen_           ->evaluate_s(uv);
-        const real     sheen_tint             = sheen_tint_      ->evaluate_s(uv);
-        const real     clearcoat              = clearcoat_       ->evaluate_s(uv);
-        const real     clearcoat_gloss        = clearcoat_gloss_ ->evaluate_s(uv);
+        const Spectrum base_color             = base_color_      ->evaluate(inct);
+        const real     metallic               = metallic_        ->evaluate_s(inct);
+        const real     roughness              = roughness_       ->evaluate_s(inct);
+        const real     transmission           = transmission_    ->evaluate_s(inct);
+        const real     transmission_roughness = transmission_roughness_->evaluate_s(inct);
+        const real     ior                    = IOR_             ->evaluate_s(inct);
+        const Spectrum specular_scale         = specular_scale_  ->evaluate(inct);
+        const real     specular_tint          = specular_tint_   ->evaluate_s(inct);
+        const real     anisotropic            = anisotropic_     ->evaluate_s(inct);
+        const real     sheen                  = sheen_           ->evaluate_s(inct);
+        const real     sheen_tint             = sheen_tint_      ->evaluate_s(inct);
+        const real     clearcoat              = clearcoat_       ->evaluate_s(inct);
+        const real     clearcoat_gloss        = clearcoat_gloss_ ->evaluate_s(inct);
 
         const Coord shading_coord = normal_mapper_->reorient(uv, inct.shading_coord);
         const BSDF *bsdf = arena.alloc_object<DisneyBSDF>(
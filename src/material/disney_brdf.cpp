@@ -275,19 +275,22 @@ public:
 
     }
 
+    Spectrum evaluate(const Point2f& uv) const override{
+        return base_color->evaluate(uv);
+    }
+
     SurfaceShadingPoint shading(const SurfaceIntersection& isect,MemoryArena& arena) const override{
-        const Point2f uv = isect.uv;
-        const Spectrum base_color_ = base_color->evaluate(uv);
-        const real subsurface_ = subsurface->evaluate_s(uv);
-        const real metallic_ = metallic->evaluate_s(uv);
-        const real specular_ = specular->evaluate_s(uv);
-        const real specular_tint_ = specular_tint->evaluate_s(uv);
-        const real roughness_ = roughness->evaluate_s(uv);
-        const real anisotropic_ = anisotropic->evaluate_s(uv);
-        const real sheen_ = sheen->evaluate_s(uv);
-        const real sheen_tint_ = sheen_tint->evaluate_s(uv);
-        const real clearcoat_ = clearcoat->evaluate_s(uv);
-        const real clearcoat_gloss_ = clearcoat_gloss->evaluate_s(uv);
+        const Spectrum base_color_ = base_color->evaluate(isect);
+        const real subsurface_ = subsurface->evaluate_s(isect);
+        const real metallic_ = metallic->evaluate_s(isect);
+        const real specular_ = specular->evaluate_s(isect);
+        const real specular_tint_ = specular_tint->evaluate_s(isect);
+        const real roughness_ = roughness->evaluate_s(isect);
+        const real anisotropic_ = anisotropic->evaluate_s(isect);
+        const real sheen_ = sheen->evaluate_s(isect);
+        const real sheen_tint_ = sheen_tint->evaluate_s(isect);
+        const real clearcoat_ = clearcoat->evaluate_s(isect);
+        const real clearcoat_gloss_ = clearcoat_gloss->evaluate_s(isect);
 
         const BSDF* bsdf = arena.alloc_object<DisneyBRDF>(
                 isect.geometry_coord,isect.shading_coord,
@@ -612,23 +612,27 @@ public:
 
     }
 
+    Spectrum evaluate(const Point2f& uv) const override{
+        return base_color->evaluate(uv);
+    }
+
     SurfaceShadingPoint shading(const SurfaceIntersection& isect, MemoryArena& arena) const override{
         auto uv = isect.uv;
-        Spectrum base_color_ = base_color->evaluate(uv);
-        real metallic_ = metallic->evaluate_s(uv);
-        real ior_ = ior->evaluate_s(uv);
-        real roughness_ = roughness->evaluate_s(uv);
-        real specular_ = specular->evaluate_s(uv);
-        real specular_tint_ = specular_tint->evaluate_s(uv);
-        real anisotropic_ = anisotropic->evaluate_s(uv);
-        real sheen_ = sheen->evaluate_s(uv);
-        real sheen_tint_ = sheen_tint->evaluate_s(uv);
-        real clearcoat_ = clearcoat->evaluate_s(uv);
-        real clearcoat_gloss_ = clearcoat_gloss->evaluate_s(uv);
-        real spec_trans_ = spec_trans->evaluate_s(uv);
-        real scatter_dist_ = scatter_dist->evaluate_s(uv);
-        real flatness_ = flatness->evaluate_s(uv);
-        real diffuse_trans_ = diffuse_trans->evaluate_s(uv) / 2; // 0: all diffuse is reflected -> 1: transmitted
+        Spectrum base_color_ = base_color->evaluate(isect);
+        real metallic_ = metallic->evaluate_s(isect);
+        real ior_ = ior->evaluate_s(isect);
+        real roughness_ = roughness->evaluate_s(isect);
+        real specular_ = specular->evaluate_s(isect);
+        real specular_tint_ = specular_tint->evaluate_s(isect);
+        real anisotropic_ = anisotropic->evaluate_s(isect);
+        real sheen_ = sheen->evaluate_s(isect);
+        real sheen_tint_ = sheen_tint->evaluate_s(isect);
+        real clearcoat_ = clearcoat->evaluate_s(isect);
+        real clearcoat_gloss_ = clearcoat_gloss->evaluate_s(isect);
+        real spec_trans_ = spec_trans->evaluate_s(isect);
+        real scatter_dist_ = scatter_dist->evaluate_s(isect);
+        real flatness_ = flatness->evaluate_s(isect);
+        real diffuse_trans_ = diffuse_trans->evaluate_s(isect) / 2; // 0: all diffuse is reflected -> 1: transmitted
         const BSDF* bsdf = nullptr;
         const auto shading_coord = normal_mapper->reorient(uv,isect.shading_coord);
         if(thin){
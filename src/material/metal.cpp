@@ -26,18 +26,18 @@ public:
           {}
 
     virtual Spectrum evaluate(const Point2f& uv) const  override{
-        return {};
+        return color_->evaluate(uv);
     }
 
     virtual SurfaceShadingPoint shading(const SurfaceIntersection& isect,MemoryArena& arena) const override{
         const Coord shading_coord = normal_mapper_->reorient(
                 isect.uv, isect.shading_coord);
 
-        const Spectrum color   = color_->evaluate(isect.uv);
-        const Spectrum k       = k_->evaluate(isect.uv);
-        const Spectrum eta     = eta_->evaluate(isect.uv);
-        const real roughness   = roughness_->evaluate_s(isect.uv);
-        const real anisotropic = anisotropic_->evaluate_s(isect.uv);
+        const Spectrum color   = color_->evaluate(isect);
+        const Spectrum k       = k_->evaluate(isect);
+        const Spectrum eta     = eta_->evaluate(isect);
+        const real roughness   = roughness_->evaluate_s(isect);
+        const real anisotropic = anisotropic_->evaluate_s(isect);
 
         const auto fresnel = arena.alloc_object<PaintedConductorFresnelPoint>(
                 color, Spectrum(1), eta, k);
@@ -28,9 +28,9 @@ TRACER_BEGIN
 
         SurfaceShadingPoint shading(const SurfaceIntersection& isect,MemoryArena& arena) const override{
             SurfaceShadingPoint shading_p;
-            Spectrum diffuse = map_kd->evaluate(isect.uv);
-            Spectrum specular = map_ks->evaluate(isect.uv);
-            const real ns = map_ns->evaluate_s(isect.uv);
+            Spectrum diffuse = map_kd->evaluate(isect);
+            Spectrum specular = map_ks->evaluate(isect);
+            const real ns = map_ns->evaluate_s(isect);
 
             // ensure energy conservation
 
@@ -6,6 +6,8 @@
 #include "../core/sampler.hpp"
 #include "utility/memory.hpp"
 #include "core/texture.hpp"
+#include "majorant_grid.hpp"
+#include "utility/stats.hpp"
 TRACER_BEGIN
 
 class HeterogeneousMedium:public Medium{
@@ -15,17 +17,19 @@ public:
                         RC<const Texture3D> albedo,
                         RC<const Texture3D> g,
                         int max_scattering_count,
-                        bool white_for_indirect)
+                        bool white_for_indirect,
+                        int majorant_grid_resolution,
+                        bool residual_ratio_tracking)
                         :local_to_world(local_to_world),world_to_local(inverse(local_to_world)),
                         density(std::move(density)),
                         albedo(std::move(albedo)),
                         g(std::move(g)),
+                        majorant_grid(*this->density,majorant_grid_resolution),
                         max_scattering_count(max_scattering_count),
-                        white_for_indirect(white_for_indirect)
+                        white_for_indirect(white_for_indirect),
+                        residual_ratio_tracking(residual_ratio_tracking)
                         {
-        this->max_density = density->max_real();
-        this->max_density = std::max(this->max_density,eps);
-        this->inv_max_density = 1 / this->max_density;
+
     }
 
     int get_max_scattering_count() const noexcept override{
@@ -33,52 +37,102 @@ public:
     }
 
     Spectrum tr(const Point3f& a,const Point3f& b,Sampler& sampler) const noexcept override{
+        STATS_INC(MediumTransmittanceCalls);
+        STATS_LOCAL(steps);
         real res = 1;
-        real t = 0;
-        real t_max = (b - a).length();
-        Vector3f dir = (b - a).normalize();
-
-        do{
-            real delta = - std::log(1- sampler.sample1().u) * inv_max_density;
-            t += delta;
-            if(t >= t_max)
-                break;
-
-            Point3f pos = a + dir * t;
-            Point3f local_pos = world_to_local(pos);
-            real _density = density->evaluate_s(local_pos);
-            res *= 1 - _density * inv_max_density;
-        } while (true);
+        const real t_max = (b - a).length();
+        const Vector3f dir = (b - a).normalize();
+        const Point3f local_a = world_to_local(a);
+        const Vector3f local_dir = world_to_local(dir);
+
+        //russian roulette once transmittance is negligible
+        auto roulette = [&](){
+            if(res >= tr_rr_threshold)
+                return true;
+            if(sampler.sample1().u < tr_rr_prob){
+                res = 0;
+                return false;
+            }
+            res /= 1 - tr_rr_prob;
+            return true;
+        };
+
+        majorant_grid.traverse(local_a,local_dir,0,t_max,[&](real t0,real t1,real majorant,real minorant){
+            //residual ratio tracking: control density of the cell is integrated analytically,
+            //the residual part is estimated by ratio tracking with majorant - control
+            const real control = residual_ratio_tracking ? minorant : real(0);
+            if(control > 0){
+                res *= std::exp(-control * (t1 - t0));
+                if(!roulette())
+                    return false;
+            }
+            const real residual_majorant = majorant - control;
+            //homogeneous or empty cell
+            if(residual_majorant <= 0)
+                return true;
+            const real inv_residual_majorant = 1 / residual_majorant;
+            real t = t0;
+            do{
+                real delta = - std::log(1- sampler.sample1().u) * inv_residual_majorant;
+                t += delta;
+                if(t >= t1)
+                    break;
+
+                STATS_LOCAL_INC(steps);
+                Point3f local_pos = local_a + local_dir * t;
+                real _density = density->evaluate_s(local_pos);
+                res *= 1 - (_density - control) * inv_residual_majorant;
+                if(!roulette())
+                    return false;
+            } while (true);
+            return true;
+        });
+        STATS_ADD(MediumTrackingSteps,steps);
         return Spectrum(res);
     }
 
     MediumSampleResult sample(const Point3f& a,const Point3f& b,Sampler& sampler,MemoryArena& arena,bool indirect_scattering = false) const override{
+        STATS_INC(MediumSamples);
+        STATS_LOCAL(steps);
         const real t_max = (a-b).length();
         const Vector3f dir = (b - a).normalize();
-        real t = 0;
-        do{
-            real delta_t = - std::log(1 - sampler.sample1().u) * inv_max_density;
-            t += delta_t;
-            if(t >= t_max)
-                break;
-            Point3f pos = a + dir * t;
-            Point3f local_pos = world_to_local(pos);
-            real _density = density->evaluate_s(local_pos);
-            if(sampler.sample1().u < _density * inv_max_density){
-                Spectrum _albedo = indirect_scattering && white_for_indirect ? Spectrum(1) : albedo->evaluate(local_pos);
-                real _g = g->evaluate_s(local_pos);
-
-                MediumScatteringP p ;
-                p.pos = pos;
-                p.medium = this;
-                p.wo = -dir;
-
-                auto phase_func = arena.alloc_object<HenyeyGreensteinPhaseFunction>(_g,_albedo);
-
-                return MediumSampleResult{p,phase_func,_albedo};
-            }
-        } while (true);
-        return MediumSampleResult{{},nullptr,Spectrum(1)};
+        const Point3f local_a = world_to_local(a);
+        const Vector3f local_dir = world_to_local(dir);
+
+        MediumSampleResult ret{{},nullptr,Spectrum(1)};
+        majorant_grid.traverse(local_a,local_dir,0,t_max,[&](real t0,real t1,real majorant,real){
+            if(majorant <= 0)
+                return true;
+            const real inv_majorant = 1 / majorant;
+            real t = t0;
+            do{
+                real delta_t = - std::log(1 - sampler.sample1().u) * inv_majorant;
+                t += delta_t;
+                if(t >= t1)
+                    return true;
+                STATS_LOCAL_INC(steps);
+                Point3f local_pos = local_a + local_dir * t;
+                real _density = density->evaluate_s(local_pos);
+                if(sampler.sample1().u < _density * inv_majorant){
+                    Spectrum _albedo = indirect_scattering && white_for_indirect ? Spectrum(1) : albedo->evaluate(local_pos);
+                    real _g = g->evaluate_s(local_pos);
+
+                    MediumScatteringP p ;
+                    p.pos = a + dir * t;
+                    p.medium = this;
+                    p.wo = -dir;
+
+                    auto phase_func = arena.alloc_object<HenyeyGreensteinPhaseFunction>(_g,_albedo);
+
+                    ret = MediumSampleResult{p,phase_func,_albedo};
+                    STATS_INC(MediumScatterings);
+                    return false;
+                }
+            } while (true);
+        });
+        STATS_ADD(MediumTrackingSteps,steps);
+        STATS_HISTOGRAM(MediumStepsPerSample,steps);
+        return ret;
     }
 
 
@@ -88,10 +142,12 @@ private:
     RC<const Texture3D> density;
     RC<const Texture3D> albedo;
     RC<const Texture3D> g;
-    real max_density;
-    real inv_max_density;
+    MajorantGrid majorant_grid;
     int max_scattering_count;
     bool white_for_indirect;
+    bool residual_ratio_tracking;
+    static constexpr real tr_rr_threshold = real(0.05);
+    static constexpr real tr_rr_prob = real(0.75);
 };
 
 RC<Medium> create_heterogeneous_medium(
@@ -100,8 +156,11 @@ RC<Medium> create_heterogeneous_medium(
         RC<const Texture3D> albedo,
         RC<const Texture3D> g,
         int max_scattering_count,
-        bool white_for_indirect){
-    return newRC<HeterogeneousMedium>(local_to_world,density,albedo,g,max_scattering_count,white_for_indirect);
+        bool white_for_indirect,
+        int majorant_grid_resolution,
+        bool residual_ratio_tracking){
+    return newRC<HeterogeneousMedium>(local_to_world,density,albedo,g,max_scattering_count,white_for_indirect,
+                                      majorant_grid_resolution,residual_ratio_tracking);
 }
 
 TRACER_END
@@ -5,6 +5,7 @@
 #include "phase_function.hpp"
 #include "../core/sampler.hpp"
 #include "utility/memory.hpp"
+#include "utility/stats.hpp"
 TRACER_BEGIN
 
 class HomogeneousMedium: public Medium{
@@ -15,6 +16,7 @@ public:
         this->sigma_t = sigma_a + sigma_s;
         assert(g > -1 && g < 1);
         this->g = std::clamp<real>(g,-1 + eps,1 - eps);
+        this->property = {this->sigma_s,this->sigma_t,this->g};
     }
 
     ~HomogeneousMedium() = default;
@@ -24,11 +26,13 @@ public:
     }
 
     Spectrum tr(const Point3f& a,const Point3f& b,Sampler& sampler) const noexcept override{
+        STATS_INC(MediumTransmittanceCalls);
         Spectrum exp = -sigma_t * (real)(a - b).length();
         return Spectrum(std::exp(exp.r),std::exp(exp.g),std::exp(exp.b));
     }
 
     MediumSampleResult sample(const Point3f& a,const Point3f& b,Sampler& sampler,MemoryArena& arena,bool indirect_scattering) const override{
+        STATS_INC(MediumSamples);
         if(!sigma_s){
             return {{},nullptr,tr(a,b,sampler)};//no scattering and just absorb
         }
@@ -41,8 +45,8 @@ public:
         Spectrum tr;
         for(int i = 0; i < SPECTRUM_COMPONET_COUNT; ++i)
             tr[i] = std::exp(-sigma_t[i] * std::min(dist,t_max));
-        //todo ???
-        Spectrum density = sample_medium ? sigma_s * tr : tr;
+        //pdf of scattering at dist is sigma_t * tr, passing through is tr
+        Spectrum density = sample_medium ? sigma_t * tr : tr;
 
         real pdf = 0;
         for(int i = 0; i < SPECTRUM_COMPONET_COUNT; i++)
@@ -55,6 +59,7 @@ public:
             throughout *= sigma_s;
 
         if(sample_medium){
+            STATS_INC(MediumScatterings);
             MediumScatteringP p;
             p.pos = a + dist * dir;
             p.medium = this;
@@ -64,6 +69,10 @@ public:
         }
         return MediumSampleResult{{},nullptr,throughout};
     }
+
+    const HomogeneousMediumProperty* get_homogeneous_property() const noexcept override{
+        return &property;
+    }
 private:
     Spectrum get_albedo() const{
         return !sigma_t ? Spectrum(1) : sigma_s / sigma_t;
@@ -74,6 +83,7 @@ private:
     Spectrum sigma_t;
     real g = 0;
     int max_scattering_count = 0;
+    HomogeneousMediumProperty property;
 };
 
 
@@ -0,0 +1,132 @@
+//
+// Created by wyz on 2022/6/20.
+//
+
+#ifndef TRACER_MAJORANT_GRID_HPP
+#define TRACER_MAJORANT_GRID_HPP
+
+#include <vector>
+#include "core/texture.hpp"
+
+TRACER_BEGIN
+
+//coarse grid of max and min density over local [0,1]^3 of a density texture
+//delta tracking walks it with dda and samples free flight by local majorant
+//min density serves as control variate of residual ratio tracking
+class MajorantGrid{
+public:
+    MajorantGrid(const Texture3D& density,int resolution){
+        const int size[3] = {density.width(),density.height(),density.depth()};
+        for(int i = 0; i < 3; ++i)
+            res[i] = std::clamp(resolution,1,(std::max)(size[i],1));
+        global_max = density.max_real();
+        cells.resize((size_t)res[0] * res[1] * res[2]);
+        min_cells.resize(cells.size());
+        for(int z = 0; z < res[2]; ++z){
+            for(int y = 0; y < res[1]; ++y){
+                for(int x = 0; x < res[0]; ++x){
+                    const Point3f low = {real(x) / res[0],real(y) / res[1],real(z) / res[2]};
+                    const Point3f high = {real(x + 1) / res[0],real(y + 1) / res[1],real(z + 1) / res[2]};
+                    cells[index(x,y,z)] = density.max_real(low,high);
+                    min_cells[index(x,y,z)] = (std::min)(density.min_real(low,high),cells[index(x,y,z)]);
+                }
+            }
+        }
+    }
+
+    real max_density() const noexcept{
+        return global_max;
+    }
+
+    //visit segments of local ray o + d * t in [t_min,t_max) with their majorants in order
+    //f(t0,t1,majorant,minorant) returns false to stop traversal
+    //parts outside [0,1]^3 repeat the texture so use the global max and zero min
+    template<typename F>
+    void traverse(const Point3f& o,const Vector3f& d,real t_min,real t_max,F&& f) const{
+        real t_enter = t_min, t_exit = t_max;
+        for(int i = 0; i < 3; ++i){
+            if(d[i] == 0){
+                if(o[i] < 0 || o[i] > 1){
+                    t_enter = t_max;
+                    break;
+                }
+                continue;
+            }
+            const real inv_d = 1 / d[i];
+            real t0 = -o[i] * inv_d;
+            real t1 = (1 - o[i]) * inv_d;
+            if(t0 > t1)
+                std::swap(t0,t1);
+            t_enter = (std::max)(t_enter,t0);
+            t_exit = (std::min)(t_exit,t1);
+        }
+        if(t_enter >= t_exit){
+            f(t_min,t_max,global_max,0);
+            return;
+        }
+        if(t_enter > t_min && !f(t_min,t_enter,global_max,0))
+            return;
+
+        int cell[3], step[3], exit[3];
+        real t_next[3], t_delta[3];
+        const Point3f p = o + d * t_enter;
+        for(int i = 0; i < 3; ++i){
+            cell[i] = std::clamp(static_cast<int>(p[i] * res[i]),0,res[i] - 1);
+            if(d[i] > 0){
+                step[i] = 1;
+                exit[i] = res[i];
+                t_next[i] = t_enter + (real(cell[i] + 1) / res[i] - p[i]) / d[i];
+                t_delta[i] = 1 / (d[i] * res[i]);
+            }
+            else if(d[i] < 0){
+                step[i] = -1;
+                exit[i] = -1;
+                t_next[i] = t_enter + (real(cell[i]) / res[i] - p[i]) / d[i];
+                t_delta[i] = -1 / (d[i] * res[i]);
+            }
+            else{
+                step[i] = 0;
+                exit[i] = -1;
+                t_next[i] = std::numeric_limits<real>::infinity();
+                t_delta[i] = 0;
+            }
+        }
+
+        real t = t_enter;
+        for(;;){
+            int axis = 0;
+            if(t_next[1] < t_next[axis]) axis = 1;
+            if(t_next[2] < t_next[axis]) axis = 2;
+            const real t1 = (std::min)(t_next[axis],t_exit);
+            const size_t cell_index = index(cell[0],cell[1],cell[2]);
+            if(t1 > t && !f(t,t1,cells[cell_index],min_cells[cell_index]))
+                return;
+            t = t1;
+            if(t >= t_exit)
+                break;
+            cell[axis] += step[axis];
+            if(cell[axis] == exit[axis])
+                break;
+            t_next[axis] += t_delta[axis];
+        }
+        //left by rounding error
+        if(t < t_exit && !f(t,t_exit,global_max,0))
+            return;
+        if(t_exit < t_max)
+            f(t_exit,t_max,global_max,0);
+    }
+
+private:
+    size_t index(int x,int y,int z) const noexcept{
+        return ((size_t)z * res[1] + y) * res[0] + x;
+    }
+
+    int res[3] = {1,1,1};
+    real global_max = 0;
+    std::vector<real> cells;
+    std::vector<real> min_cells;
+};
+
+TRACER_END
+
+#endif //TRACER_MAJORANT_GRID_HPP
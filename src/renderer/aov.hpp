@@ -0,0 +1,37 @@
+//
+// Created by wyz on 2022/6/30.
+//
+
+#ifndef TRACER_AOV_HPP
+#define TRACER_AOV_HPP
+
+#include <type_traits>
+#include "core/render.hpp"
+#include "core/intersection.hpp"
+#include "core/material.hpp"
+#include "core/scene.hpp"
+
+TRACER_BEGIN
+
+//surface channels of the first hit of a camera ray starting at ray_origin
+inline void record_surface_aov(AOVSample& aov,const Scene& scene,const SurfaceIntersection& isect,const Point3f& ray_origin){
+    aov.albedo = isect.material->evaluate(isect.uv);
+    aov.normal = isect.shading_coord.z;
+    aov.depth = (isect.pos - ray_origin).length();
+    aov.primitive_id = scene.primitive_id(isect.primitive);
+    aov.material_id = scene.material_id(isect.material);
+}
+
+//calls f with std::true_type if the film records aov channels and std::false_type otherwise,
+//so that the per sample code is compiled once with and once without aov recording
+template<typename F>
+inline void dispatch_aov(const Film& film,F&& f){
+    if(film.has_aov())
+        f(std::true_type{});
+    else
+        f(std::false_type{});
+}
+
+TRACER_END
+
+#endif //TRACER_AOV_HPP
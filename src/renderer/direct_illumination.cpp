@@ -5,7 +5,10 @@
 #include "core/scene.hpp"
 #include "core/sampling.hpp"
 #include "core/primitive.hpp"
+#include "core/medium.hpp"
+#include "medium/phase_function.hpp"
 #include "utility/logger.hpp"
+#include "utility/stats.hpp"
 TRACER_BEGIN
 
     Spectrum sample_light(const Scene& scene,const Light* light,
@@ -38,6 +41,7 @@ TRACER_BEGIN
                                Sampler& sampler){
         const Sample5 sample = sampler.sample5();
 
+        STATS_INC(LightSamples);
         auto light_sample = light->sample_li(isect.pos,sample);
         if(!light_sample.radiance || !light_sample.pdf)
             return {};
@@ -54,7 +58,8 @@ TRACER_BEGIN
 
         const auto medium = isect.medium(isect_to_light);
 
-        const auto bsdf_f = shd_p.bsdf->eval(isect_to_light,isect.wo,TransportMode::Radiance);
+        const auto bsdf_f = STATS_TIMED(BSDFEvals,BSDFEvalNanoseconds,
+                                        shd_p.bsdf->eval(isect_to_light,isect.wo,TransportMode::Radiance));
 
         if(!bsdf_f)
             return {};
@@ -76,6 +81,7 @@ TRACER_BEGIN
                                       Sampler& sampler){
         Sample5 sample = sampler.sample5();
 
+        STATS_INC(LightSamples);
         auto light_sample_ret = light->sample_li(isect.pos,sample);
         if(!light_sample_ret.radiance)
             return {};
@@ -89,7 +95,8 @@ TRACER_BEGIN
         if(scene.intersect(shadow_ray))
             return {};
 
-        const auto bsdf_f = shd_p.bsdf->eval(isect_to_light,isect.wo,TransportMode::Radiance);
+        const auto bsdf_f = STATS_TIMED(BSDFEvals,BSDFEvalNanoseconds,
+                                        shd_p.bsdf->eval(isect_to_light,isect.wo,TransportMode::Radiance));
 
         if(!bsdf_f)
             return {};
@@ -114,6 +121,7 @@ TRACER_BEGIN
                                Sampler& sampler){
         const Sample5 sample = sampler.sample5();
 
+        STATS_INC(LightSamples);
         auto light_sample = light->sample_li(scattering_p.pos,sample);
         if(!light_sample.radiance || !light_sample.pdf)
             return {};
@@ -145,7 +153,8 @@ TRACER_BEGIN
                          const SurfaceShadingPoint& shd_p,Sampler& sampler){
         const Sample3 sample = sampler.sample3();
 
-        auto bsdf_sample_ret = shd_p.bsdf->sample(isect.wo,TransportMode::Radiance,sample);
+        auto bsdf_sample_ret = STATS_TIMED(BSDFSamples,BSDFSampleNanoseconds,
+                                           shd_p.bsdf->sample(isect.wo,TransportMode::Radiance,sample));
         if(!bsdf_sample_ret.is_valid())
             return {};
         bsdf_sample_ret.wi = normalize(bsdf_sample_ret.wi);
@@ -198,7 +207,7 @@ TRACER_BEGIN
     }
 
     Spectrum sample_bsdf(const Scene& scene,const MediumScatteringP& scattering_p,
-                         const BSDF* phase_func,Sampler& sampler){
+                         const BSDF* phase_func,Sampler& sampler,bool skip_area_light){
         const Sample3 sample = sampler.sample3();
 
         auto bsdf_sample_ret = phase_func->sample(scattering_p.wo,TransportMode::Radiance,sample);
@@ -231,7 +240,7 @@ TRACER_BEGIN
         }
 
         auto light = t_isect.primitive->as_area_light();
-        if(!light)
+        if(!light || skip_area_light)
             return {};
 
         Spectrum light_radiance = light->light_emit(t_isect,t_isect.wo);
@@ -254,6 +263,96 @@ TRACER_BEGIN
 
     }
 
+    Spectrum sample_area_light_single_scattering(const Scene& scene,const AreaLight* light,
+                                                 const Ray& ray,real t_max,const Medium* medium,
+                                                 Sampler& sampler){
+        const auto property = medium->get_homogeneous_property();
+        if(!property || !property->sigma_s || t_max <= eps)
+            return {};
+        const Spectrum& sigma_t = property->sigma_t;
+
+        //light point is shared by both strategies so its pdf cancels in mis weights
+        const Point3f mid = ray.o + ray.d * (t_max * real(0.5));
+        STATS_INC(LightSamples);
+        const auto light_sample = light->sample_li(mid,sampler.sample5());
+        if(!light_sample.radiance || light_sample.pdf <= 0)
+            return {};
+        const Vector3f mid_to_light = light_sample.pos - mid;
+        const real mid_dist2 = dot(mid_to_light,mid_to_light);
+        const real mid_cos = abs_dot(light_sample.n,normalize(mid_to_light));
+        if(mid_dist2 <= 0 || mid_cos <= 0)
+            return {};
+        const real pdf_area = light_sample.pdf * mid_cos / mid_dist2;
+
+        //equiangular: closest point on the ray to light point and angles of segment ends
+        const real delta = dot(light_sample.pos - ray.o,ray.d);
+        const real D = (ray.o + ray.d * delta - light_sample.pos).length();
+        const real theta_a = std::atan2(-delta,D);
+        const real theta_b = std::atan2(t_max - delta,D);
+        const bool equiangular_valid = D > eps && theta_b > theta_a;
+        auto equiangular_pdf = [&](real t){
+            if(!equiangular_valid)
+                return real(0);
+            return D / ((theta_b - theta_a) * (D * D + (t - delta) * (t - delta)));
+        };
+
+        //distance: pick a channel then sample exp(-sigma_t * t) truncated in [0,t_max]
+        real channel_cdf_max[SPECTRUM_COMPONET_COUNT];
+        for(int i = 0; i < SPECTRUM_COMPONET_COUNT; ++i)
+            channel_cdf_max[i] = 1 - std::exp(-sigma_t[i] * t_max);
+        auto distance_pdf = [&](real t){
+            real pdf = 0;
+            for(int i = 0; i < SPECTRUM_COMPONET_COUNT; ++i){
+                if(channel_cdf_max[i] > 0)
+                    pdf += sigma_t[i] * std::exp(-sigma_t[i] * t) / channel_cdf_max[i];
+            }
+            return pdf / SPECTRUM_COMPONET_COUNT;
+        };
+
+        const HenyeyGreensteinPhaseFunction phase_func(property->g,Spectrum(1));
+        auto eval = [&](real t)->Spectrum{
+            const Point3f pos = ray.o + ray.d * t;
+            const Vector3f to_light = light_sample.pos - pos;
+            const real dist2 = dot(to_light,to_light);
+            if(dist2 <= eps * eps)
+                return {};
+            const Vector3f wi = to_light / std::sqrt(dist2);
+            const real cos_light = abs_dot(light_sample.n,wi);
+            const Spectrum le = light->light_emit(light_sample.pos,light_sample.n,light_sample.uv,-wi);
+            if(!le || cos_light <= 0)
+                return {};
+            if(!scene.visible(pos,light_sample.pos))
+                return {};
+            Spectrum tr_ray;
+            for(int i = 0; i < SPECTRUM_COMPONET_COUNT; ++i)
+                tr_ray[i] = std::exp(-sigma_t[i] * t);
+            return tr_ray * property->sigma_s * phase_func.eval(wi,-ray.d,TransportMode::Radiance)
+                   * medium->tr(pos,light_sample.pos,sampler) * le * cos_light / dist2;
+        };
+
+        Spectrum L;
+        if(equiangular_valid){
+            const real theta = theta_a + sampler.sample1().u * (theta_b - theta_a);
+            const real t = std::clamp<real>(delta + D * std::tan(theta),0,t_max);
+            const real pe = equiangular_pdf(t);
+            const real pd = distance_pdf(t);
+            if(pe > 0)
+                L += eval(t) * PowerHeuristic(1,pe,1,pd) / (pe * pdf_area);
+        }
+        {
+            const auto [u,v] = sampler.sample2();
+            const int channel = std::min<int>(u * SPECTRUM_COMPONET_COUNT,SPECTRUM_COMPONET_COUNT - 1);
+            if(channel_cdf_max[channel] > 0){
+                const real t = std::clamp<real>(-std::log(1 - v * channel_cdf_max[channel]) / sigma_t[channel],0,t_max);
+                const real pd = distance_pdf(t);
+                const real pe = equiangular_pdf(t);
+                if(pd > 0)
+                    L += eval(t) * PowerHeuristic(1,pd,1,pe) / (pd * pdf_area);
+            }
+        }
+        return L;
+    }
+
 Box<Distribution1D> compute_light_power_distribution(const Scene& scene){
     if(scene.lights.empty()) return nullptr;
     std::vector<real> light_power;
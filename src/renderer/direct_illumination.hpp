@@ -46,7 +46,13 @@ Spectrum sample_bsdf(const Scene& scene,const SurfaceIntersection& isect,
                      const SurfaceShadingPoint& shd_p,Sampler& sampler);
 
 Spectrum sample_bsdf(const Scene& scene,const MediumScatteringP& scattering_p,
-                     const BSDF* phase_func,Sampler& sampler);
+                     const BSDF* phase_func,Sampler& sampler,bool skip_area_light = false);
+
+//single scattered light of an area light over segment [0,t_max] of ray in a homogeneous medium
+//equiangular sampling toward a light point and distance sampling are combined by mis
+Spectrum sample_area_light_single_scattering(const Scene& scene,const AreaLight* light,
+                                             const Ray& ray,real t_max,const Medium* medium,
+                                             Sampler& sampler);
 
 Box<Distribution1D> compute_light_power_distribution(const Scene& scene);
 
@@ -0,0 +1,390 @@
+//
+// Created by wyz on 2022/6/10.
+//
+#include "core/renderer.hpp"
+#include "core/sampling.hpp"
+#include "core/light.hpp"
+#include "core/scene.hpp"
+#include "core/spectrum.hpp"
+#include "core/camera.hpp"
+#include "core/sampler.hpp"
+#include "utility/parallel.hpp"
+#include "utility/timer.hpp"
+#include "utility/stats.hpp"
+#include "factory/renderer.hpp"
+#include "direct_illumination.hpp"
+#include "bdpt.hpp"
+
+TRACER_BEGIN
+
+namespace mlt{
+
+    //primary sample space sampler
+    //each sample1() returns a coordinate in [0,1) of the current state vector,
+    //coordinates are mutated lazily when they are first touched in an iteration
+    class PSSSampler: public Sampler{
+    public:
+        enum Stream : int{
+            CameraStream     = 0,
+            LightStream      = 1,
+            ConnectionStream = 2,
+            StreamCount      = 3
+        };
+
+        PSSSampler(int seed,real sigma,real large_step_prob)
+        :rng(seed),sigma(sigma),large_step_prob(large_step_prob)
+        {}
+
+        Sample1 sample1() override{
+            const int index = stream_index + StreamCount * sample_index++;
+            ensure_ready(index);
+            return { X[index].value };
+        }
+        Sample2 sample2() override{
+            const real u = sample1().u;
+            const real v = sample1().u;
+            return { u, v };
+        }
+        Sample3 sample3() override{
+            const real u = sample1().u;
+            const real v = sample1().u;
+            const real w = sample1().u;
+            return { u, v, w };
+        }
+        Sample4 sample4() override{
+            const real u = sample1().u;
+            const real v = sample1().u;
+            const real w = sample1().u;
+            const real r = sample1().u;
+            return { u, v, w, r };
+        }
+        Sample5 sample5() override{
+            const real u = sample1().u;
+            const real v = sample1().u;
+            const real w = sample1().u;
+            const real r = sample1().u;
+            const real s = sample1().u;
+            return { u, v, w, r, s };
+        }
+
+        Box<Sampler> clone(int seed) override{
+            return newBox<PSSSampler>(seed,sigma,large_step_prob);
+        }
+
+        void start_iteration(){
+            ++cur_iteration;
+            is_large_step = uniform() < large_step_prob;
+        }
+
+        void start_stream(Stream stream){
+            stream_index = stream;
+            sample_index = 0;
+        }
+
+        void accept(){
+            if(is_large_step)
+                last_large_step_iteration = cur_iteration;
+        }
+
+        void reject(){
+            for(auto& x:X){
+                if(x.last_modify_iteration == cur_iteration)
+                    x.restore();
+            }
+            --cur_iteration;
+        }
+
+        //uniform random number not belong to the state vector
+        real uniform(){
+            return distribution(rng);
+        }
+
+    private:
+        struct PrimarySample{
+            real value = 0;
+            int64_t last_modify_iteration = 0;
+
+            real value_backup = 0;
+            int64_t modify_backup = 0;
+
+            void backup(){
+                value_backup = value;
+                modify_backup = last_modify_iteration;
+            }
+            void restore(){
+                value = value_backup;
+                last_modify_iteration = modify_backup;
+            }
+        };
+
+        void ensure_ready(int index){
+            if(index >= static_cast<int>(X.size()))
+                X.resize(index + 1);
+            auto& x = X[index];
+            //catch up with the last accepted large step
+            if(x.last_modify_iteration < last_large_step_iteration){
+                x.value = uniform();
+                x.last_modify_iteration = last_large_step_iteration;
+            }
+
+            x.backup();
+            if(is_large_step){
+                x.value = uniform();
+            }
+            else{
+                //n small steps in a row is equal to one step with sigma * sqrt(n)
+                const int64_t small_step_count = cur_iteration - x.last_modify_iteration;
+                const real eff_sigma = sigma * std::sqrt(real(small_step_count));
+                x.value += normal(rng) * eff_sigma;
+                x.value -= std::floor(x.value);
+                if(x.value >= 1)
+                    x.value = 0;
+            }
+            x.last_modify_iteration = cur_iteration;
+        }
+
+        pcg32 rng;
+        std::uniform_real_distribution<real> distribution;
+        std::normal_distribution<real> normal;
+
+        const real sigma;
+        const real large_step_prob;
+
+        std::vector<PrimarySample> X;
+        int64_t cur_iteration = 0;
+        int64_t last_large_step_iteration = 0;
+        bool is_large_step = true;
+
+        int stream_index = 0;
+        int sample_index = 0;
+    };
+
+    struct MLTEvalContext{
+        const Scene& scene;
+        const Film& film;
+        const Distribution1D* scene_light_distribution;
+        const std::unordered_map<const Light*,int>& light_index;
+    };
+
+    //evaluate a single (t,s) strategy for a path with depth + 2 vertices
+    //returned radiance is already divided by the strategy selection pdf
+    Spectrum eval_path(const MLTEvalContext& ctx,PSSSampler& sampler,int depth,
+                       MemoryArena& arena,Point2f& pixel_coord){
+        const auto& scene = ctx.scene;
+        const auto& film  = ctx.film;
+        const int film_width  = film.width();
+        const int film_height = film.height();
+
+        sampler.start_stream(PSSSampler::CameraStream);
+        //pick strategy: s ~ [0, depth + 1], t = depth + 2 - s
+        //t = 1 && s = 1 is not a valid connection, so depth 0 only has s = 0 && t = 2
+        const int strategy_count = depth == 0 ? 1 : depth + 2;
+        const int s = (std::min)(static_cast<int>(sampler.sample1().u * strategy_count),strategy_count - 1);
+        const int t = depth + 2 - s;
+
+        const Sample2 film_sample = sampler.sample2();
+        const Sample2 lens_sample = sampler.sample2();
+        pixel_coord = {
+                (std::min)(film_sample.u * film_width,real(film_width) - eps),
+                (std::min)(film_sample.v * film_height,real(film_height) - eps)
+        };
+        CameraSample camera_sample{{film_sample.u,film_sample.v},{lens_sample.u,lens_sample.v}};
+        Ray ray;
+        scene.get_camera()->generate_ray(camera_sample,ray);
+        STATS_INC(CameraRays);
+
+        auto camera_subpath = arena.alloc<bdpt::Vertex>(t);
+        const int camera_v_cnt = bdpt::generate_camera_subpath(scene,sampler,arena,ray,camera_subpath,t);
+        if(camera_v_cnt != t)
+            return {};
+
+        sampler.start_stream(PSSSampler::LightStream);
+        auto light_subpath = arena.alloc<bdpt::Vertex>((std::max)(s,1));
+        if(s > 0){
+            const int light_v_cnt = bdpt::generate_light_subpath(scene,sampler,arena,
+                                                                 *ctx.scene_light_distribution,
+                                                                 light_subpath,s);
+            if(light_v_cnt != s)
+                return {};
+        }
+
+        sampler.start_stream(PSSSampler::ConnectionStream);
+        if(t > 1 && s != 0 && camera_subpath[t - 1].type == bdpt::VertexType::EnvLight)
+            return {};
+
+        Spectrum L;
+        if(t == 2 && s == 0){
+            L = bdpt::t2_s0_path_contrib(scene,camera_subpath);
+        }
+        else if(t == 1){
+            Point2f film_pixel_coord;
+            const Spectrum Ld = bdpt::t1_sx_path_contrib(scene,camera_subpath,light_subpath,s,
+                                                          (Bounds2f)film.get_film_bounds(),
+                                                          {film_width,film_height},
+                                                          film_pixel_coord,sampler);
+            if(!Ld.is_meaningful())
+                return {};
+            pixel_coord = {
+                    (std::min)(film_pixel_coord.x,real(film_width) - eps),
+                    (std::min)(film_pixel_coord.y,real(film_height) - eps)
+            };
+            L = Ld * bdpt::mis_weight_t1_sx(scene,camera_subpath,light_subpath,s);
+        }
+        else if(s == 0){
+            const Spectrum Ld = bdpt::tx_s0_path_contrib(scene,camera_subpath,t);
+            if(!Ld.is_meaningful())
+                return {};
+            L = Ld * bdpt::mis_weight_tx_s0(scene,camera_subpath,t,
+                                            ctx.scene_light_distribution,ctx.light_index);
+        }
+        else if(s == 1){
+            const Spectrum Ld = bdpt::tx_s1_path_contrib(scene,camera_subpath,t,light_subpath,sampler);
+            if(!Ld.is_meaningful())
+                return {};
+            L = Ld * bdpt::mis_weight_tx_s1(scene,camera_subpath,t,light_subpath);
+        }
+        else{
+            const Spectrum Ld = bdpt::tx_sx_path_contrib(scene,camera_subpath,t,light_subpath,s,sampler);
+            if(!Ld.is_meaningful())
+                return {};
+            L = Ld * bdpt::mis_weight_tx_sx(scene,camera_subpath,t,light_subpath,s);
+        }
+        if(!L.is_valid())
+            return {};
+        return L * real(strategy_count);
+    }
+
+}
+
+class MLTRenderer: public Renderer{
+public:
+    MLTRenderer(const MLTRendererParams& params): params(params){
+        assert(params.max_depth >= 0 && params.bootstrap_count > 0 && params.chain_count > 0);
+    }
+
+    RenderTarget render(const Scene& scene,Film film) override;
+
+private:
+    MLTRendererParams params;
+    using SplatImage = Image2D<bdpt::AtomicSpectrum>;
+};
+
+RenderTarget MLTRenderer::render(const Scene& scene,Film film){
+    AutoTimer timer("mlt render");
+
+    auto scene_light_distribution = compute_light_power_distribution(scene);
+    std::unordered_map<const Light*,int> light_index;
+    for(int i = 0; i < static_cast<int>(scene.lights.size()); ++i){
+        light_index[scene.lights[i]] = i;
+    }
+
+    const mlt::MLTEvalContext ctx{
+        scene,film,scene_light_distribution.get(),light_index
+    };
+
+    const int thread_count = actual_worker_count(params.worker_count);
+    const int film_width = film.width();
+    const int film_height = film.height();
+    const int depth_count = params.max_depth + 1;
+
+    auto luminance = [](const Spectrum& L){
+        return (std::max)(real(0),L.lum());
+    };
+
+    //bootstrap: estimate normalization b and the initial state for each chain
+    const int bootstrap_count = params.bootstrap_count * depth_count;
+    std::vector<real> bootstrap_weights(bootstrap_count,0);
+    parallel_for_1d_grid(thread_count,bootstrap_count,4096,[&](int,int beg,int end){
+        MemoryArena arena;
+        for(int i = beg; i < end; ++i){
+            const int depth = i % depth_count;
+            mlt::PSSSampler sampler(i,params.sigma,params.large_step_prob);
+            Point2f pixel_coord;
+            bootstrap_weights[i] = luminance(mlt::eval_path(ctx,sampler,depth,arena,pixel_coord));
+            arena.reset();
+        }
+    });
+
+    Distribution1D bootstrap(bootstrap_weights.data(),bootstrap_count);
+    const real b = bootstrap.func_int * depth_count;
+    if(b <= 0){
+        LOG_ERROR("mlt bootstrap found no contribution path");
+        RenderTarget ret;
+        film.write_render_target(ret);
+        return ret;
+    }
+
+    SplatImage splat_image(film_width,film_height);
+
+    const int64_t total_mutations = int64_t(params.mutations_per_pixel) * film_width * film_height;
+    const int chain_count = params.chain_count;
+
+    auto splat = [&](const Point2f& coord,const Spectrum& v){
+        splat_image.at(std::min<int>(film_width - 1,coord.x),
+                       std::min<int>(film_height - 1,coord.y)).add(v);
+    };
+
+    parallel_for_1d_grid(thread_count,chain_count,1,[&](int,int beg,int end){
+        MemoryArena arena;
+        for(int chain_index = beg; chain_index < end; ++chain_index){
+            const int64_t chain_mutations =
+                    (std::min)((chain_index + 1) * total_mutations / chain_count,total_mutations)
+                    - chain_index * total_mutations / chain_count;
+
+            SimpleUniformSampler rng(chain_index + bootstrap_count);
+            const int bootstrap_index = bootstrap.sample_discrete(rng.sample1().u);
+            const int depth = bootstrap_index % depth_count;
+
+            //replay the bootstrap sample with the same seed to recover the initial state
+            mlt::PSSSampler sampler(bootstrap_index,params.sigma,params.large_step_prob);
+            Point2f cur_coord;
+            Spectrum cur_L = mlt::eval_path(ctx,sampler,depth,arena,cur_coord);
+            arena.reset();
+
+            for(int64_t j = 0; j < chain_mutations; ++j){
+                sampler.start_iteration();
+                Point2f proposed_coord;
+                const Spectrum proposed_L = mlt::eval_path(ctx,sampler,depth,arena,proposed_coord);
+                STATS_MAX(ArenaBytes,arena.total_allocated());
+                arena.reset();
+                STATS_INC(MLTMutations);
+
+                const real cur_y = luminance(cur_L);
+                const real proposed_y = luminance(proposed_L);
+                const real accept = cur_y > 0 ? (std::min)(real(1),proposed_y / cur_y) : real(1);
+
+                //expected values: splat both states weighted by the acceptance
+                if(accept > 0 && proposed_y > 0)
+                    splat(proposed_coord,proposed_L * accept / proposed_y);
+                if(cur_y > 0)
+                    splat(cur_coord,cur_L * (1 - accept) / cur_y);
+
+                if(rng.sample1().u < accept){
+                    STATS_INC(MLTAcceptedMutations);
+                    cur_coord = proposed_coord;
+                    cur_L = proposed_L;
+                    sampler.accept();
+                }
+                else{
+                    sampler.reject();
+                }
+            }
+        }
+    });
+
+    RenderTarget ret;
+    ret.color = Image2D<Spectrum>(film_width,film_height);
+    const real scale = b / params.mutations_per_pixel;
+    for(int y = 0; y < film_height; ++y){
+        for(int x = 0; x < film_width; ++x){
+            ret.color(x,y) = splat_image.at(x,y).to_spectrum() * scale;
+        }
+    }
+    return ret;
+}
+
+RC<Renderer> create_mlt_renderer(const MLTRendererParams& params){
+    return newRC<MLTRenderer>(params);
+}
+
+TRACER_END
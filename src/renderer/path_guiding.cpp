@@ -0,0 +1,321 @@
+//
+// Created by wyz on 2022/6/14.
+//
+#include "path_guiding.hpp"
+#include "utility/memory.hpp"
+
+TRACER_BEGIN
+
+namespace guiding{
+
+    constexpr real one_minus_epsilon = real(0x1.fffffep-1);
+
+    Point2f dir_to_square(const Vector3f& dir){
+        const real cos_theta = std::clamp<real>(dir.z,-1,1);
+        real phi = std::atan2(dir.y,dir.x);
+        if(phi < 0)
+            phi += 2 * PI_r;
+        return {
+            std::clamp<real>((cos_theta + 1) * real(0.5),0,1),
+            std::clamp<real>(phi * inv2PI_r,0,1)
+        };
+    }
+
+    Vector3f square_to_dir(const Point2f& p){
+        const real cos_theta = 2 * p.x - 1;
+        const real sin_theta = std::sqrt((std::max<real>)(0,1 - cos_theta * cos_theta));
+        const real phi = 2 * PI_r * p.y;
+        return {sin_theta * std::cos(phi),sin_theta * std::sin(phi),cos_theta};
+    }
+
+    DTree::Node::Node(){
+        for(auto& s:sum)
+            s = 0;
+    }
+
+    DTree::Node::Node(const Node& node){
+        for(int i = 0; i < 4; ++i){
+            sum[i] = node.sum[i].load();
+            child[i] = node.child[i];
+        }
+    }
+
+    DTree::Node& DTree::Node::operator=(const Node& node){
+        for(int i = 0; i < 4; ++i){
+            sum[i] = node.sum[i].load();
+            child[i] = node.child[i];
+        }
+        return *this;
+    }
+
+    DTree::DTree(){
+        nodes.emplace_back();
+    }
+
+    int DTree::quadrant(Point2f& p){
+        //remap p into the chosen quadrant
+        int q = 0;
+        if(p.x >= real(0.5)){
+            q |= 1;
+            p.x = p.x * 2 - 1;
+        }
+        else
+            p.x *= 2;
+        if(p.y >= real(0.5)){
+            q |= 2;
+            p.y = p.y * 2 - 1;
+        }
+        else
+            p.y *= 2;
+        return q;
+    }
+
+    void DTree::record(Point2f p,real value){
+        if(!std::isfinite(value) || value <= 0)
+            return;
+        int node_index = 0;
+        for(;;){
+            auto& node = nodes[node_index];
+            const int q = quadrant(p);
+            atomic_add(node.sum[q],value);
+            if(!node.child[q])
+                return;
+            node_index = node.child[q];
+        }
+    }
+
+    real DTree::total() const{
+        const auto& root = nodes[0];
+        return root.sum[0] + root.sum[1] + root.sum[2] + root.sum[3];
+    }
+
+    Vector3f DTree::sample(const Sample2& sample,real* pdf) const{
+        Point2f u = {sample.u,sample.v};
+        Point2f origin = {0,0};
+        real size = 1;
+        real pdf_square = 1;
+        int node_index = 0;
+        for(;;){
+            const auto& node = nodes[node_index];
+            real s[4];
+            for(int i = 0; i < 4; ++i)
+                s[i] = node.sum[i];
+            const real total = s[0] + s[1] + s[2] + s[3];
+            if(total <= 0){
+                //no energy recorded below, uniform in current node
+                origin = origin + Vector2f(u.x * size,u.y * size);
+                break;
+            }
+            //choose x half then y half
+            const real left = s[0] + s[2];
+            int q = 0;
+            real px;
+            if(u.x < left / total){
+                u.x = u.x * total / left;
+                px = left / total;
+            }
+            else{
+                u.x = (u.x - left / total) * total / (total - left);
+                q |= 1;
+                px = (total - left) / total;
+            }
+            const real bottom = s[q];
+            const real top = s[q | 2];
+            real py;
+            if(u.y * (bottom + top) < bottom){
+                u.y = u.y * (bottom + top) / bottom;
+                py = bottom / (bottom + top);
+            }
+            else{
+                u.y = (u.y * (bottom + top) - bottom) / top;
+                q |= 2;
+                py = top / (bottom + top);
+            }
+            u.x = (std::min<real>)(u.x,one_minus_epsilon);
+            u.y = (std::min<real>)(u.y,one_minus_epsilon);
+
+            pdf_square *= 4 * px * py;
+            size *= real(0.5);
+            if(q & 1) origin.x += size;
+            if(q & 2) origin.y += size;
+            if(!node.child[q]){
+                origin = origin + Vector2f(u.x * size,u.y * size);
+                break;
+            }
+            node_index = node.child[q];
+        }
+        if(pdf)
+            *pdf = pdf_square / (4 * PI_r);
+        return square_to_dir(origin);
+    }
+
+    real DTree::pdf(const Vector3f& dir) const{
+        Point2f p = dir_to_square(dir);
+        real pdf_square = 1;
+        int node_index = 0;
+        for(;;){
+            const auto& node = nodes[node_index];
+            const real total = node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+            if(total <= 0)
+                break;
+            const int q = quadrant(p);
+            pdf_square *= 4 * node.sum[q] / total;
+            if(!node.child[q] || pdf_square <= 0)
+                break;
+            node_index = node.child[q];
+        }
+        return pdf_square / (4 * PI_r);
+    }
+
+    void DTree::refine(const DTree& prev,real threshold,int max_depth){
+        struct Item{
+            int node_index;
+            int prev_index;//-1 if the node is new subdivided
+            real sums[4];
+            int depth;
+        };
+        nodes.clear();
+        nodes.emplace_back();
+
+        const real total = prev.total();
+        if(total <= 0){
+            //keep the old structure but nothing to sample
+            nodes = prev.nodes;
+            for(auto& node:nodes)
+                for(auto& s:node.sum)
+                    s = 0;
+            return;
+        }
+
+        std::vector<Item> stack;
+        {
+            Item root{0,0,{},1};
+            for(int i = 0; i < 4; ++i)
+                root.sums[i] = prev.nodes[0].sum[i];
+            stack.push_back(root);
+        }
+        while(!stack.empty()){
+            const Item item = stack.back();
+            stack.pop_back();
+            for(int q = 0; q < 4; ++q){
+                if(item.depth >= max_depth || item.sums[q] / total <= threshold)
+                    continue;
+                Item child{static_cast<int>(nodes.size()),-1,{},item.depth + 1};
+                const int prev_child = item.prev_index >= 0 ? prev.nodes[item.prev_index].child[q] : 0;
+                if(prev_child){
+                    child.prev_index = prev_child;
+                    for(int i = 0; i < 4; ++i)
+                        child.sums[i] = prev.nodes[prev_child].sum[i];
+                }
+                else{
+                    for(int i = 0; i < 4; ++i)
+                        child.sums[i] = item.sums[q] / 4;
+                }
+                nodes.emplace_back();
+                nodes[item.node_index].child[q] = child.node_index;
+                stack.push_back(child);
+            }
+        }
+    }
+
+    GuidingLeaf::GuidingLeaf(const GuidingLeaf& leaf)
+    :sampling(leaf.sampling),building(leaf.building),record_count(leaf.record_count.load())
+    {}
+
+    GuidingLeaf& GuidingLeaf::operator=(const GuidingLeaf& leaf){
+        sampling = leaf.sampling;
+        building = leaf.building;
+        record_count = leaf.record_count.load();
+        return *this;
+    }
+
+    SDTree::SDTree(const Bounds3f& world_bounds)
+    :bounds(world_bounds)
+    {
+        //use cube bounds so splitting along axes keeps cells isotropic
+        const Vector3f extent = bounds.high - bounds.low;
+        const real max_extent = (std::max)({extent.x,extent.y,extent.z});
+        bounds.high = bounds.low + Vector3f(max_extent);
+        nodes.emplace_back();
+    }
+
+    GuidingLeaf* SDTree::lookup(const Point3f& pos){
+        const Vector3f extent = bounds.high - bounds.low;
+        Point3f p = {
+            std::clamp<real>((pos.x - bounds.low.x) / extent.x,0,1),
+            std::clamp<real>((pos.y - bounds.low.y) / extent.y,0,1),
+            std::clamp<real>((pos.z - bounds.low.z) / extent.z,0,1)
+        };
+        int node_index = 0;
+        for(;;){
+            auto& node = nodes[node_index];
+            if(!node.child[0])
+                return &node.leaf;
+            const int axis = node.axis;
+            if(p[axis] < real(0.5)){
+                p[axis] *= 2;
+                node_index = node.child[0];
+            }
+            else{
+                p[axis] = p[axis] * 2 - 1;
+                node_index = node.child[1];
+            }
+        }
+    }
+
+    void SDTree::split(int node_index,int threshold,int depth){
+        if(depth >= 48 || nodes[node_index].leaf.record_count <= threshold)
+            return;
+        const int axis = depth % 3;
+        const int c0 = static_cast<int>(nodes.size());
+        //children inherit directional distributions and half of records
+        GuidingLeaf leaf = nodes[node_index].leaf;
+        leaf.record_count = leaf.record_count / 2;
+        nodes.emplace_back();
+        nodes.emplace_back();
+        nodes[c0].leaf = leaf;
+        nodes[c0 + 1].leaf = leaf;
+        nodes[node_index].axis = axis;
+        nodes[node_index].child[0] = c0;
+        nodes[node_index].child[1] = c0 + 1;
+        nodes[node_index].leaf = GuidingLeaf();
+
+        split(c0,threshold,depth + 1);
+        split(c0 + 1,threshold,depth + 1);
+    }
+
+    void SDTree::refine(int iteration,int spatial_split_factor,real directional_threshold){
+        const int threshold = static_cast<int>(spatial_split_factor * std::sqrt(real(1 << iteration)));
+
+        //depth of each node is needed for the split axis
+        std::vector<std::pair<int,int>> leaves;
+        {
+            std::vector<std::pair<int,int>> stack = {{0,0}};
+            while(!stack.empty()){
+                auto [index,depth] = stack.back();
+                stack.pop_back();
+                if(!nodes[index].child[0]){
+                    leaves.emplace_back(index,depth);
+                    continue;
+                }
+                stack.emplace_back(nodes[index].child[0],depth + 1);
+                stack.emplace_back(nodes[index].child[1],depth + 1);
+            }
+        }
+        for(auto [index,depth]:leaves){
+            split(index,threshold,depth);
+        }
+
+        for(auto& node:nodes){
+            if(node.child[0])
+                continue;
+            auto& leaf = node.leaf;
+            leaf.sampling = leaf.building;
+            leaf.building.refine(leaf.sampling,directional_threshold);
+            leaf.record_count = 0;
+        }
+    }
+
+}
+
+TRACER_END
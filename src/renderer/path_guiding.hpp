@@ -0,0 +1,93 @@
+//
+// Created by wyz on 2022/6/14.
+//
+
+#ifndef TRACER_PATH_GUIDING_HPP
+#define TRACER_PATH_GUIDING_HPP
+
+#include <atomic>
+#include <vector>
+#include "common.hpp"
+#include "utility/geometry.hpp"
+
+TRACER_BEGIN
+
+//practical path guiding: a spatial binary tree whose leaves hold
+//quadtree distributions over directions, learned progressively
+namespace guiding{
+
+    //equal-area mapping between unit sphere and [0,1]^2
+    Point2f dir_to_square(const Vector3f& dir);
+
+    Vector3f square_to_dir(const Point2f& p);
+
+    class DTree{
+    public:
+        DTree();
+
+        //add value at p of [0,1]^2
+        void record(Point2f p,real value);
+
+        //returned pdf is per unit solid angle
+        Vector3f sample(const Sample2& sample,real* pdf) const;
+
+        real pdf(const Vector3f& dir) const;
+
+        real total() const;
+
+        //rebuild structure from sums of prev and reset all sums to zero
+        //quadrant with energy fraction over threshold is subdivided
+        void refine(const DTree& prev,real threshold,int max_depth = 20);
+
+    private:
+        struct Node{
+            Node();
+            Node(const Node& node);
+            Node& operator=(const Node& node);
+
+            std::atomic<real> sum[4];
+            //0 means leaf because root can't be a child
+            int child[4] = {0,0,0,0};
+        };
+        static int quadrant(Point2f& p);
+
+        std::vector<Node> nodes;
+    };
+
+    struct GuidingLeaf{
+        GuidingLeaf() = default;
+        GuidingLeaf(const GuidingLeaf& leaf);
+        GuidingLeaf& operator=(const GuidingLeaf& leaf);
+
+        DTree sampling;
+        DTree building;
+        std::atomic<int> record_count = 0;
+    };
+
+    class SDTree{
+    public:
+        explicit SDTree(const Bounds3f& world_bounds);
+
+        GuidingLeaf* lookup(const Point3f& pos);
+
+        //called between passes: split spatial leaves which received enough records,
+        //then building distributions become sampling distributions
+        void refine(int iteration,int spatial_split_factor = 12000,real directional_threshold = real(0.01));
+
+    private:
+        struct Node{
+            int axis = 0;
+            int child[2] = {0,0};
+            GuidingLeaf leaf;
+        };
+        void split(int node_index,int threshold,int depth);
+
+        Bounds3f bounds;
+        std::vector<Node> nodes;
+    };
+
+}
+
+TRACER_END
+
+#endif //TRACER_PATH_GUIDING_HPP
@@ -10,21 +10,220 @@
 #include "core/bssrdf.hpp"
 #include "core/primitive.hpp"
 #include "utility/logger.hpp"
+#include "utility/hash.hpp"
+#include "utility/timer.hpp"
+#include "utility/stats.hpp"
 #include "direct_illumination.hpp"
+#include "path_guiding.hpp"
+#include "aov.hpp"
 
 TRACER_BEGIN
+
+//mean luminance of incident radiance in hashed grid cells, learned from a coarse pass
+class RadianceCache{
+public:
+    RadianceCache(const Bounds3f& bounds,int resolution)
+    :low(bounds.low),sum(table_size),count(table_size)
+    {
+        const Vector3f extent = bounds.high - bounds.low;
+        const real max_extent = (std::max)({extent.x,extent.y,extent.z});
+        inv_cell_size = max_extent > 0 ? resolution / max_extent : 1;
+    }
+
+    int cell(const Point3f& pos) const{
+        const int ix = static_cast<int>(std::floor((pos.x - low.x) * inv_cell_size));
+        const int iy = static_cast<int>(std::floor((pos.y - low.y) * inv_cell_size));
+        const int iz = static_cast<int>(std::floor((pos.z - low.z) * inv_cell_size));
+        return static_cast<int>(hash(ix,iy,iz) % table_size);
+    }
+
+    void record(int cell,real value){
+        if(!std::isfinite(value) || value < 0)
+            return;
+        atomic_add(sum[cell],value);
+        ++count[cell];
+    }
+
+    //return 0 if nothing recorded in the cell
+    real lookup(const Point3f& pos) const{
+        const int c = cell(pos);
+        const int n = count[c];
+        return n > 0 ? sum[c] / n : real(0);
+    }
+
+private:
+    static constexpr int table_size = 1 << 20;
+    Point3f low;
+    real inv_cell_size = 1;
+    std::vector<std::atomic<real>> sum;
+    std::vector<std::atomic<int>> count;
+};
+
 class PathTraceRenderer:public PixelSamplerRenderer{
     int min_depth = 5;
     int max_depth = 10;
     int direct_light_sample_num = 1;
     int max_specular_depth = 20;
+
+    bool use_path_guiding = false;
+    int guiding_training_iterations = 5;
+    real guiding_bsdf_fraction = real(0.5);
+    Box<guiding::SDTree> sd_tree;
+    bool guiding_recording = false;
+
+    bool use_adjoint_rr = false;
+    int adjoint_rr_estimate_spp = 4;
+    real adjoint_rr_window_size = 5;
+    int adjoint_rr_max_split = 8;
+
+    bool use_equiangular_sampling = false;
+
+    Box<RadianceCache> radiance_cache;
+    Image2D<real> pixel_estimate;
+    bool adjoint_recording = false;
+    static constexpr int radiance_cache_resolution = 128;
+
+    struct VertexRecord{
+        guiding::GuidingLeaf* leaf = nullptr;
+        int cache_cell = -1;
+        Vector3f wi;
+        real pdf = 0;
+        //coef after this vertex, radiance / throughput is the incident radiance along wi
+        Spectrum throughput;
+        Spectrum radiance;
+    };
+    static constexpr int max_vertex_record_count = 32;
+
+    //state of a path before tracing its next ray, a split path continues from a copy
+    struct PathState{
+        Ray ray;
+        RayDifferential ray_diff;
+        Spectrum coef = Spectrum(1);
+        bool specular_sample = false;
+        int scattering_count = 0;
+        int depth = 0;
+        int s_depth = 0;
+        int split_budget = 1;
+        //first hit is already known, primary is nullptr for a miss
+        bool primary_known = false;
+        const SurfaceIntersection* primary = nullptr;
+    };
 public:
     PathTraceRenderer(const PTRendererParams& params)
     : PixelSamplerRenderer(params.worker_count,params.task_tile_size,params.spp),
-    min_depth(params.min_depth),max_depth(params.max_depth),direct_light_sample_num(params.direct_light_sample_num)
+    min_depth(params.min_depth),max_depth(params.max_depth),direct_light_sample_num(params.direct_light_sample_num),
+    use_path_guiding(params.use_path_guiding),guiding_training_iterations(params.guiding_training_iterations),
+    guiding_bsdf_fraction(params.guiding_bsdf_fraction),
+    use_adjoint_rr(params.use_adjoint_rr),adjoint_rr_estimate_spp(params.adjoint_rr_estimate_spp),
+    adjoint_rr_window_size(params.adjoint_rr_window_size),adjoint_rr_max_split(params.adjoint_rr_max_split),
+    use_equiangular_sampling(params.use_equiangular_sampling)
     {}
 
-    Spectrum eval_pixel_li(const Scene& scene,const Ray& r,Sampler& sampler,MemoryArena& arena) const override{
+    RenderTarget render(const Scene& scene,Film film) override{
+        if(!use_path_guiding && !use_adjoint_rr)
+            return PixelSamplerRenderer::render(scene,std::move(film));
+
+        if(use_path_guiding){
+            //train guiding distributions with 1,2,4,... spp passes
+            //images of training passes are discarded
+            sd_tree = newBox<guiding::SDTree>(scene.world_bounds());
+            guiding_recording = true;
+            for(int i = 0; i < guiding_training_iterations; ++i){
+                Film training_film(Point2i(film.width(),film.height()),film.get_filter());
+                render_film(scene,training_film,1 << i);
+                sd_tree->refine(i);
+                LOG_INFO("path guiding training iteration {} finished",i);
+            }
+            guiding_recording = false;
+        }
+
+        if(use_adjoint_rr)
+            estimate_adjoint(scene,film);
+
+        render_film(scene,film,get_spp());
+
+        RenderTarget render_target;
+        film.write_render_target(render_target);
+        sd_tree.reset();
+        radiance_cache.reset();
+        pixel_estimate = Image2D<real>();
+        return render_target;
+    }
+
+private:
+    //coarse pass for pixel radiance and incident radiance in the cache
+    void estimate_adjoint(const Scene& scene,const Film& film){
+        AutoTimer timer("adjoint estimate pass");
+        radiance_cache = newBox<RadianceCache>(scene.world_bounds(),radiance_cache_resolution);
+        Film estimate_film(Point2i(film.width(),film.height()),film.get_filter());
+        adjoint_recording = true;
+        render_film(scene,estimate_film,adjoint_rr_estimate_spp);
+        adjoint_recording = false;
+
+        RenderTarget estimate;
+        estimate_film.write_render_target(estimate);
+        //3x3 box filter to suppress noise of the few samples
+        const int w = film.width(), h = film.height();
+        pixel_estimate = Image2D<real>(w,h);
+        for(int y = 0; y < h; ++y){
+            for(int x = 0; x < w; ++x){
+                real sum = 0;
+                int n = 0;
+                for(int dy = -1; dy <= 1; ++dy){
+                    for(int dx = -1; dx <= 1; ++dx){
+                        const int px = x + dx, py = y + dy;
+                        if(px < 0 || py < 0 || px >= w || py >= h)
+                            continue;
+                        const auto& color = estimate.color.at(px,py);
+                        if(color.is_finite()){
+                            sum += color.lum();
+                            ++n;
+                        }
+                    }
+                }
+                pixel_estimate.at(x,y) = n > 0 ? sum / n : real(0);
+            }
+        }
+    }
+
+    //weight window of adjoint-driven russian roulette and splitting
+    //return how many copies the path continues with, 0 means killed
+    //coef of the survived path is divided by survival probability
+    int adjoint_russian_roulette(const Point3f& pos,Spectrum& coef,int depth,real pixel_radiance,
+                                 int split_budget,Sampler& sampler) const{
+        const real li = radiance_cache->lookup(pos);
+        if(li <= 0 || pixel_radiance <= 0){
+            //no estimate here, use fixed probability
+            if(depth > min_depth){
+                if(sampler.sample1().u > 0.9)
+                    return 0;
+                coef /= 0.9;
+            }
+            return 1;
+        }
+        //expected contribution coef * li should stay around pixel radiance
+        const real center = pixel_radiance / li;
+        const real lower = 2 * center / (1 + adjoint_rr_window_size);
+        const real upper = lower * adjoint_rr_window_size;
+        const real weight = coef.lum();
+        if(weight < lower){
+            const real q = weight / lower;
+            if(sampler.sample1().u >= q)
+                return 0;
+            coef /= q;
+            return 1;
+        }
+        if(weight > upper && split_budget > 1){
+            const int n = (std::min)({static_cast<int>(std::ceil(weight / upper)),
+                                      adjoint_rr_max_split,split_budget});
+            return (std::max)(n,1);
+        }
+        return 1;
+    }
+
+public:
+    Spectrum eval_pixel_li(const Scene& scene,const Point2i& pixel,const Ray& r,const RayDifferential& ray_diff,
+                           Sampler& sampler,MemoryArena& arena,AOVSample* aov) const override{
         if(0){
             SurfaceIntersection isect;
             if (scene.intersect_p(r, &isect)) {
@@ -35,15 +234,110 @@ public:
             } else
                 return Spectrum(0.0, 0.0, 0.0);
         }
+        PathState state;
+        state.ray = r;
+        state.ray_diff = ray_diff;
+        state.split_budget = adjoint_rr_max_split;
+        real pixel_radiance = 0;
+        if(radiance_cache && !adjoint_recording)
+            pixel_radiance = pixel_estimate.at(pixel.x,pixel.y);
+        if(aov)
+            return trace_path<true>(scene,state,pixel_radiance,sampler,arena,aov);
+        return trace_path<false>(scene,state,pixel_radiance,sampler,arena);
+    }
+
+    Spectrum eval_primary_li(const Scene& scene,const Point2i&,const Ray& r,const RayDifferential& ray_diff,
+                             const SurfaceIntersection* primary,Sampler& sampler,MemoryArena& arena) const override{
+        PathState state;
+        state.ray = r;
+        state.ray_diff = ray_diff;
+        state.split_budget = adjoint_rr_max_split;
+        state.primary_known = true;
+        state.primary = primary;
+        return trace_path<false>(scene,state,0,sampler,arena);
+    }
+
+    //guiding and adjoint passes learn from the full image, cached hits would leave them without samples
+    RenderTarget render_cached(const Scene& scene,Film film,PrimaryHitBuffer& buffer) override{
+        if(use_path_guiding || use_adjoint_rr)
+            return Renderer::render_cached(scene,std::move(film),buffer);
+        return PixelSamplerRenderer::render_cached(scene,std::move(film),buffer);
+    }
 
-        Spectrum coef(1);
-        Ray ray = r;
+private:
+    //intersect offset rays with the tangent plane at isect
+    static bool differential_offsets(const SurfaceIntersection& isect,const RayDifferential& diff,
+                                     Vector3f& dpdx,Vector3f& dpdy){
+        const Vector3f n = isect.geometry_coord.z;
+        const real dx = dot(n,diff.rx_d), dy = dot(n,diff.ry_d);
+        if(dx == 0 || dy == 0)
+            return false;
+        const real tx = dot(n,isect.pos - diff.rx_o) / dx;
+        const real ty = dot(n,isect.pos - diff.ry_o) / dy;
+        if(!std::isfinite(tx) || !std::isfinite(ty))
+            return false;
+        dpdx = diff.rx_o + diff.rx_d * tx - isect.pos;
+        dpdy = diff.ry_o + diff.ry_d * ty - isect.pos;
+        return true;
+    }
+
+    //max uv change over the offsets, least squares of dpdu * du + dpdv * dv = dp
+    static real uv_footprint(const SurfaceIntersection& isect,const Vector3f& dpdx,const Vector3f& dpdy){
+        const real a = dot(isect.dpdu,isect.dpdu);
+        const real b = dot(isect.dpdu,isect.dpdv);
+        const real c = dot(isect.dpdv,isect.dpdv);
+        const real det = a * c - b * b;
+        if(!(std::abs(det) > 0))
+            return 0;
+        auto uv_length = [&](const Vector3f& dp){
+            const real pu = dot(isect.dpdu,dp), pv = dot(isect.dpdv,dp);
+            const real du = (c * pu - b * pv) / det;
+            const real dv = (a * pv - b * pu) / det;
+            return std::sqrt(du * du + dv * dv);
+        };
+        const real footprint = (std::max)(uv_length(dpdx),uv_length(dpdy));
+        return std::isfinite(footprint) ? footprint : 0;
+    }
+
+    //pixel_radiance > 0 enables adjoint-driven russian roulette and splitting
+    //RecordAOV writes the first hit and the light of the first vertex into aov
+    template<bool RecordAOV>
+    Spectrum trace_path(const Scene& scene,const PathState& state,real pixel_radiance,
+                        Sampler& sampler,MemoryArena& arena,AOVSample* aov = nullptr) const{
+        Spectrum coef = state.coef;
+        Ray ray = state.ray;
+        RayDifferential ray_diff = state.ray_diff;
         Spectrum L(0);
-        bool specular_sample = false;
+        bool specular_sample = state.specular_sample;
+
+        int scattering_count = state.scattering_count;
+        bool primary_pending = state.primary_known;
+
+        const bool recording = guiding_recording || adjoint_recording;
+        VertexRecord vertex_records[max_vertex_record_count];
+        int vertex_record_count = 0;
+        auto add_radiance = [&](const Spectrum& radiance){
+            L += radiance;
+            if(!recording)
+                return;
+            for(int i = 0; i < vertex_record_count; ++i){
+                auto& record = vertex_records[i];
+                for(int c = 0; c < SPECTRUM_COMPONET_COUNT; ++c){
+                    if(record.throughput[c] > 0)
+                        record.radiance[c] += radiance[c] / record.throughput[c];
+                }
+            }
+        };
 
-        int scattering_count = 0;
+        //counts loop iterations since depth steps back at specular vertices
+        //aov direct is the emission seen by the camera plus light sampled at the first surface,
+        //medium scattering and bssrdf exits before it are indirect
+        int path_vertex = 0;
 
-        for(int depth = 0, s_depth = 0; depth < max_depth; ++depth){
+        STATS_LOCAL(path_vertices);
+        for(int depth = state.depth, s_depth = state.s_depth; depth < max_depth; ++depth){
+            if constexpr(RecordAOV)
+                ++path_vertex;
             //apply russian roulette
             Spectrum rr_coef = coef;
 //            if(depth > min_depth){
@@ -51,7 +345,21 @@ public:
 //                if(sampler.sample1().u < q) break;
 //                coef /= 1 - q;
 //            }
-            if(depth > min_depth){
+            if(pixel_radiance > 0 && depth > 0){
+                const int n = adjoint_russian_roulette(ray.o,coef,depth,pixel_radiance,state.split_budget,sampler);
+                if(n == 0)
+                    break;
+                if(n > 1){
+                    //continue n copies of this path with 1/n weight each
+                    PathState split_state{ray,ray_diff,coef / real(n),specular_sample,scattering_count,
+                                          depth,s_depth,state.split_budget / n};
+                    for(int i = 0; i < n; ++i){
+                        add_radiance(trace_path<false>(scene,split_state,pixel_radiance,sampler,arena));
+                    }
+                    break;
+                }
+            }
+            else if(depth > min_depth){
                 if(sampler.sample1().u > 0.9)
                     break;
                 coef /= 0.9;
@@ -61,7 +369,22 @@ public:
                 break;
             }
             SurfaceIntersection isect;
-            bool found_intersection = scene.intersect_p(ray,&isect);
+            bool found_intersection;
+            //cached first hit, depth can not tell the first vertex since specular vertices step it back
+            if(primary_pending){
+                primary_pending = false;
+                found_intersection = state.primary != nullptr;
+                if(found_intersection)
+                    isect = *state.primary;
+            }
+            else
+                found_intersection = scene.intersect_p(ray,&isect);
+            if(found_intersection)
+                STATS_LOCAL_INC(path_vertices);
+            if constexpr(RecordAOV){
+                if(path_vertex == 1 && found_intersection)
+                    record_surface_aov(*aov,scene,isect,ray.o);
+            }
 
             if(depth == 0  || specular_sample)//todo specular ?
             {
@@ -69,17 +392,21 @@ public:
                     //if intersect with emit object
                     if(auto light = isect.primitive->as_area_light()){
                         //add emission radiance from hit area light
-                        L += coef * light->light_emit(isect,-ray.d);
+                        add_radiance(coef * light->light_emit(isect,-ray.d));
                     }
                 }
                 else{
                     //sample from environment light
                     if(auto light = scene.environment_light.get()){
 
-                        L += coef * light->light_emit(ray.o,ray.d);
+                        add_radiance(coef * light->light_emit(ray.o,ray.d));
                     }
                 }
             }
+            if constexpr(RecordAOV){
+                if(path_vertex == 1)
+                    aov->direct = L;
+            }
 
             if(!found_intersection){
                 break;
@@ -87,7 +414,25 @@ public:
 
             const auto medium = isect.wo_medium();
             if(scattering_count < medium->get_max_scattering_count()){
-                const auto medium_sample_ret = medium->sample(r.o,isect.pos,sampler,arena,scattering_count > 0);
+                //single scattered light of area lights over this segment is estimated here
+                //instead of at the scattering point sampled below
+                const bool segment_direct = use_equiangular_sampling && medium->get_homogeneous_property();
+                if(segment_direct){
+                    const Ray segment(ray.o,normalize(ray.d));
+                    const real t_max = (isect.pos - ray.o).length();
+                    Spectrum segment_illum;
+                    for(int i = 0; i < direct_light_sample_num; ++i){
+                        for(auto light:scene.lights){
+                            if(auto area_light = light->as_area_light()){
+                                segment_illum += coef * sample_area_light_single_scattering(
+                                        scene,area_light,segment,t_max,medium,sampler);
+                            }
+                        }
+                    }
+                    add_radiance(real(1) / direct_light_sample_num * segment_illum);
+                }
+
+                const auto medium_sample_ret = medium->sample(ray.o,isect.pos,sampler,arena,scattering_count > 0);
 
                 coef *= medium_sample_ret.throughout;
 
@@ -99,17 +444,20 @@ public:
                     Spectrum direct_illum;
                     for(int i = 0; i < direct_light_sample_num; ++i){
                         for(auto light:scene.lights){
+                            if(segment_direct && light->as_area_light())
+                                continue;
                             direct_illum += coef * sample_light(scene,light,scattering_p,phase_func,sampler);
                         }
-                        direct_illum += coef * sample_bsdf(scene,scattering_p,phase_func,sampler);
+                        direct_illum += coef * sample_bsdf(scene,scattering_p,phase_func,sampler,segment_direct);
                     }
-                    L += real(1) / direct_light_sample_num * direct_illum;
+                    add_radiance(real(1) / direct_light_sample_num * direct_illum);
 
                     const auto bsdf_sample_ret = phase_func->sample(scattering_p.wo,TransportMode::Radiance,sampler.sample3());
                     if(!bsdf_sample_ret.is_valid())
                         break;
 
                     ray = Ray(scattering_p.pos,bsdf_sample_ret.wi);
+                    ray_diff.valid = false;
                     coef *= bsdf_sample_ret.f / bsdf_sample_ret.pdf;
                     continue;
                 }
@@ -122,10 +470,47 @@ public:
             }
 
 
+            Vector3f dpdx, dpdy;
+            const bool has_differentials = ray_diff.valid && differential_offsets(isect,ray_diff,dpdx,dpdy);
+            if(has_differentials)
+                isect.uv_footprint = uv_footprint(isect,dpdx,dpdy);
+
             auto shading_p = isect.material->shading(isect,arena);
 
+            guiding::GuidingLeaf* guiding_leaf = nullptr;
+            if(sd_tree && !shading_p.bsdf->is_delta()){
+                guiding_leaf = sd_tree->lookup(isect.pos);
+            }
+
             //sample bsdf to get new path direction
-            auto bsdf_sample = shading_p.bsdf->sample(isect.wo,TransportMode::Radiance,sampler.sample3());
+            BSDFSampleResult bsdf_sample;
+            if(guiding_leaf && guiding_leaf->sampling.total() > 0){
+                //one-sample mis between bsdf and learned distribution
+                const real alpha = guiding_bsdf_fraction;
+                Sample3 bsdf_sample3 = sampler.sample3();
+                if(bsdf_sample3.u < alpha){
+                    bsdf_sample3.u /= alpha;
+                    bsdf_sample = STATS_TIMED(BSDFSamples,BSDFSampleNanoseconds,
+                                              shading_p.bsdf->sample(isect.wo,TransportMode::Radiance,bsdf_sample3));
+                    if(bsdf_sample.is_valid()){
+                        bsdf_sample.pdf = alpha * bsdf_sample.pdf +
+                                (1 - alpha) * guiding_leaf->sampling.pdf(bsdf_sample.wi);
+                    }
+                }
+                else{
+                    real guiding_pdf = 0;
+                    bsdf_sample.wi = guiding_leaf->sampling.sample({bsdf_sample3.v,bsdf_sample3.w},&guiding_pdf);
+                    bsdf_sample.f = STATS_TIMED(BSDFEvals,BSDFEvalNanoseconds,
+                                                shading_p.bsdf->eval(bsdf_sample.wi,isect.wo,TransportMode::Radiance));
+                    bsdf_sample.pdf = alpha * shading_p.bsdf->pdf(bsdf_sample.wi,isect.wo) +
+                            (1 - alpha) * guiding_pdf;
+                    bsdf_sample.is_delta = false;
+                }
+            }
+            else{
+                bsdf_sample = STATS_TIMED(BSDFSamples,BSDFSampleNanoseconds,
+                                          shading_p.bsdf->sample(isect.wo,TransportMode::Radiance,sampler.sample3()));
+            }
 
             if(bsdf_sample.f.is_back() || bsdf_sample.pdf < eps)
                 break;
@@ -149,7 +534,11 @@ public:
                     }
                     direct_illum += coef * sample_bsdf(scene,isect,shading_p,sampler);
                 }
-                L += real(1) / direct_light_sample_num * direct_illum;
+                add_radiance(real(1) / direct_light_sample_num * direct_illum);
+                if constexpr(RecordAOV){
+                    if(path_vertex == 1)
+                        aov->direct += real(1) / direct_light_sample_num * direct_illum;
+                }
             }
 
             coef *= bsdf_sample.f * abs_cos(isect.geometry_coord.z,bsdf_sample.wi) / bsdf_sample.pdf;
@@ -159,9 +548,38 @@ public:
                 LOG_CRITICAL("bsdf sample pdf: {}",bsdf_sample.pdf);
                 break;
             }
+            if(has_differentials && specular_sample){
+                //treat the surface as locally flat: offset directions are mirrored for reflection
+                //and kept for transmission, curvature and ior differentials are ignored
+                const Vector3f n = isect.geometry_coord.z;
+                const Vector3f wi = normalize(bsdf_sample.wi);
+                const bool reflected = dot(wi,n) * dot(isect.wo,n) > 0;
+                auto transfer = [&](const Vector3f& offset_d){
+                    Vector3f dd = offset_d - ray.d;
+                    if(reflected)
+                        dd = dd - 2 * dot(dd,n) * n;
+                    return normalize(wi + dd);
+                };
+                ray_diff.rx_o = isect.pos + dpdx;
+                ray_diff.ry_o = isect.pos + dpdy;
+                ray_diff.rx_d = transfer(ray_diff.rx_d);
+                ray_diff.ry_d = transfer(ray_diff.ry_d);
+            }
+            else{
+                ray_diff.valid = false;
+            }
             ray = Ray(isect.eps_offset(bsdf_sample.wi),
                      normalize(bsdf_sample.wi));
 
+            if(recording && vertex_record_count < max_vertex_record_count){
+                const auto leaf = guiding_recording ? guiding_leaf : nullptr;
+                const int cache_cell = adjoint_recording ? radiance_cache->cell(isect.pos) : -1;
+                if(leaf || cache_cell >= 0){
+                    vertex_records[vertex_record_count++] = {leaf,cache_cell,normalize(bsdf_sample.wi),
+                                                             bsdf_sample.pdf,coef,Spectrum(0)};
+                }
+            }
+
             if(!shading_p.bssrdf)
                 continue;
 
@@ -187,26 +605,41 @@ public:
                     }
                     new_direct_illum += coef * sample_bsdf(scene,new_isect,new_shading_p,sampler);
                 }
-                L += real(1) / direct_light_sample_num * new_direct_illum;
+                add_radiance(real(1) / direct_light_sample_num * new_direct_illum);
 
-                const auto new_bsdf_sample_ret = new_shading_p.bsdf->sample(new_isect.wo,TransportMode::Radiance,sampler.sample3());
+                const auto new_bsdf_sample_ret = STATS_TIMED(BSDFSamples,BSDFSampleNanoseconds,
+                                                             new_shading_p.bsdf->sample(new_isect.wo,TransportMode::Radiance,sampler.sample3()));
                 if(new_bsdf_sample_ret.f.is_back())
                     break;
 
                 coef *= new_bsdf_sample_ret.f * abs_cos(new_isect.geometry_coord.z,new_bsdf_sample_ret.wi) / new_bsdf_sample_ret.pdf;
 
                 ray = Ray(new_isect.eps_offset(new_bsdf_sample_ret.wi),new_bsdf_sample_ret.wi);
+                ray_diff.valid = false;
 
                 specular_sample = new_bsdf_sample_ret.is_delta;
             }
 
         }
+        STATS_ADD(PathVertices,path_vertices);
+        STATS_HISTOGRAM(PathLength,path_vertices);
         if(!L.is_valid()){
             LOG_CRITICAL("L get infinite: {} {} {}",L.r,L.g,L.b);
             return {};
         }
-        else
-            return L;
+        for(int i = 0; i < vertex_record_count; ++i){
+            const auto& record = vertex_records[i];
+            if(record.leaf){
+                //estimate of incident radiance over its sampling pdf
+                record.leaf->building.record(guiding::dir_to_square(record.wi),
+                                             record.radiance.lum() / record.pdf);
+                ++record.leaf->record_count;
+            }
+            if(record.cache_cell >= 0){
+                radiance_cache->record(record.cache_cell,record.radiance.lum());
+            }
+        }
+        return L;
     }
 
 };
@@ -8,7 +8,11 @@
 #include "core/sampler.hpp"
 #include "core/camera.hpp"
 #include "core/scene.hpp"
+#include "core/primitive.hpp"
 #include "utility/memory.hpp"
+#include "utility/stats.hpp"
+#include "utility/timer.hpp"
+#include "aov.hpp"
 TRACER_BEGIN
 
     PixelSamplerRenderer::PixelSamplerRenderer(int worker_count, int tile_size, int spp)
@@ -23,14 +27,127 @@ TRACER_BEGIN
 
     RenderTarget PixelSamplerRenderer::render(
             const Scene &scene,Film film) {
+        render_film(scene,film,spp);
+
+        RenderTarget render_target;
+        film.write_render_target(render_target);
+
+        return render_target;
+    }
+
+    RenderTarget PixelSamplerRenderer::render_cached(
+            const Scene &scene,Film film,PrimaryHitBuffer& buffer) {
+        if(scene.primitives.empty() || film.has_aov()){
+            buffer.clear();
+            return render(scene,std::move(film));
+        }
+        AutoTimer timer("render with cached primary hits");
+        const int film_width = film.width();
+        const int film_height = film.height();
+        const bool fresh = buffer.empty() || buffer.width != film_width || buffer.height != film_height || buffer.spp != spp;
+        if(fresh){
+            buffer.width = film_width;
+            buffer.height = film_height;
+            buffer.spp = spp;
+            buffer.records.assign((size_t)film_width * film_height * spp,PrimaryHitBuffer::Record{});
+            buffer.marks.assign(buffer.records.size(),PrimaryHitBuffer::Retrace);
+        }
+        size_t reshade_count = 0, retrace_count = 0;
+        for(auto mark:buffer.marks){
+            reshade_count += mark == PrimaryHitBuffer::Reshade;
+            retrace_count += mark == PrimaryHitBuffer::Retrace;
+        }
+        LOG_INFO("primary hits {}, re-shade {} and re-trace {} of {} samples",fresh ? "built" : "reused",
+                 reshade_count,retrace_count,buffer.records.size());
+
+        //records keep the index in scene.primitives
+        auto primitive_id = [&](const Primitive* primitive){
+            const uint32_t id = scene.primitive_id(primitive);
+            return id == 0 ? PrimaryHitBuffer::miss : id - 1;
+        };
+
+        const int thread_count = actual_worker_count(worker_count);
+        const auto scene_camera = scene.get_camera();
+        const real diff_scale = (std::max)(real(0.125),1 / std::sqrt(real(spp)));
+        const Vector2f film_delta = {diff_scale / film_width,diff_scale / film_height};
+        auto sampler_prototype = newRC<SimpleUniformSampler>(42 + (pass_count++) * thread_count, false);
+        PerThreadNativeSamplers perthread_sampler(
+                thread_count, *sampler_prototype);
+        parallel_for_2d(
+                thread_count,film_width,film_height,
+                tile_size,tile_size,
+                [&](int thread_idx,const Bounds2i& tile_bound)
+                {
+                    auto sampler = perthread_sampler.get_sampler(thread_idx);
+                    auto film_tile = film.get_film_tile(tile_bound);
+                    MemoryArena arena;
+
+                    for(Point2i pixel:tile_bound){
+                        const size_t first = ((size_t)pixel.y * film_width + pixel.x) * spp;
+                        for(int i = 0; i < spp; ++i){
+                            auto& record = buffer.records[first + i];
+                            const auto mark = buffer.marks[first + i];
+                            if(mark != PrimaryHitBuffer::Keep){
+                                if(fresh){
+                                    const Sample2 film_sample = sampler->sample2();
+                                    const Sample2 lens_sample = sampler->sample2();
+                                    record.pixel = {pixel.x + film_sample.u,pixel.y + film_sample.v};
+                                    record.lens = {lens_sample.u,lens_sample.v};
+                                }
+                                CameraSample camera_sample{{record.pixel.x / film_width,record.pixel.y / film_height},
+                                                           record.lens};
+                                Ray ray;
+                                RayDifferential ray_diff;
+                                real ray_weight = scene_camera->generate_ray_differential(camera_sample,film_delta,ray,ray_diff);
+                                STATS_INC(CameraRays);
+
+                                Spectrum L(0.0);
+                                if(ray_weight > 0.0){
+                                    SurfaceIntersection isect;
+                                    bool found = false;
+                                    if(mark == PrimaryHitBuffer::Reshade && record.primitive != PrimaryHitBuffer::miss){
+                                        //only the recorded primitive is tested instead of traversing the scene
+                                        found = record.primitive < scene.primitives.size()
+                                                && scene.primitives[record.primitive]->intersect_p(ray,&isect);
+                                    }
+                                    if(mark == PrimaryHitBuffer::Retrace || (!found && record.primitive != PrimaryHitBuffer::miss)){
+                                        found = scene.intersect_p(ray,&isect);
+                                        record.primitive = found ? primitive_id(isect.primitive) : PrimaryHitBuffer::miss;
+                                    }
+                                    L = eval_primary_li(scene,pixel,ray,ray_diff,found ? &isect : nullptr,*sampler,arena);
+                                }
+                                record.radiance = L;
+                                STATS_MAX(ArenaBytes,arena.total_allocated());
+                                arena.reset();
+                            }
+                            const auto& L = record.radiance;
+                            if(std::isfinite(L.r) && std::isfinite(L.g) && std::isfinite(L.b))
+                                film_tile->add_sample(record.pixel,L);
+                        }
+                    }
+                    film.merge_film_tile(film_tile);
+                });
+        buffer.mark_all(PrimaryHitBuffer::Keep);
+
+        RenderTarget render_target;
+        film.write_render_target(render_target);
+        return render_target;
+    }
+
+    void PixelSamplerRenderer::render_film(
+            const Scene &scene,Film& film,int spp) {
         const int thread_count = actual_worker_count(worker_count);
         const int film_width = film.width();
         const int film_height = film.height();
         const auto scene_camera = scene.get_camera();
         const size_t total_pixels = (size_t)film_width * film_height * spp;
         std::atomic<size_t> finish_count = 0;
+        //offset of differential rays shrinks as more samples are taken per pixel
+        const real diff_scale = (std::max)(real(0.125),1 / std::sqrt(real(spp)));
+        const Vector2f film_delta = {diff_scale / film_width,diff_scale / film_height};
 
-        auto sampler_prototype = newRC<SimpleUniformSampler>(42, false);
+        //different seeds for multiple passes on the same renderer
+        auto sampler_prototype = newRC<SimpleUniformSampler>(42 + (pass_count++) * thread_count, false);
         PerThreadNativeSamplers perthread_sampler(
                 thread_count, *sampler_prototype);
         parallel_for_2d(
@@ -38,74 +155,78 @@ TRACER_BEGIN
                 tile_size,tile_size,
                 [&](int thread_idx,const Bounds2i& tile_bound)
                 {
+                    dispatch_aov(film,[&](auto record_aov){
+                        constexpr bool RecordAOV = decltype(record_aov)::value;
 
-                    //get sampler
-                    auto sampler = perthread_sampler.get_sampler(thread_idx);
+                        //get sampler
+                        auto sampler = perthread_sampler.get_sampler(thread_idx);
 
 
-                    //get tile
-                    //tile_bound is [)
-                    //比如tile size是16 那么第一个区间是[0,16) 即[0,15] 第二个是[16,32) 即[16,31]
-                    //但是真正的tile bounds会根据filter的radius进行校正
-                    //注意传入的tile_bound是没有重叠的
-                    auto film_tile = film.get_film_tile(tile_bound);
+                        //get tile
+                        //tile_bound is [)
+                        //比如tile size是16 那么第一个区间是[0,16) 即[0,15] 第二个是[16,32) 即[16,31]
+                        //但是真正的tile bounds会根据filter的radius进行校正
+                        //注意传入的tile_bound是没有重叠的
+                        auto film_tile = film.get_film_tile(tile_bound);
 
-                    //create arena for each tile
-                    MemoryArena arena;
+                        //create arena for each tile
+                        MemoryArena arena;
 
-                    for(Point2i pixel:tile_bound){
-                        //todo re-generate sample for each spp
-                        Spectrum Ls;
+                        for(Point2i pixel:tile_bound){
+                            //todo re-generate sample for each spp
+                            Spectrum Ls;
 //                        if(pixel != Point2i(1000,1700)) continue;
-                        for(int i = 0; i < spp; ++i){
-                            //get camera sample to generate ray
-                            const Sample2 film_sample = sampler->sample2();
-                            const Sample2 lens_sample = sampler->sample2();
-                            assert(film_sample.u <= 1 && film_sample.u >= 0);
-                            const real pixel_x = pixel.x + film_sample.u;//uv is 0 ~ 1
-                            const real pixel_y = pixel.y + film_sample.v;
-                            const real film_x = pixel_x / film_width;
-                            const real film_y = pixel_y / film_height;
-                            CameraSample camera_sample{{film_x,film_y},{lens_sample.u,lens_sample.v}};
-                            Ray ray;
-                            real ray_weight = scene_camera->generate_ray(camera_sample,ray);
-
-                            //evaluate radiance along ray
-                            Spectrum L(0.0);
-                            if(ray_weight > 0.0){
-
-                                L = eval_pixel_li(scene,ray,*sampler,arena);
+                            for(int i = 0; i < spp; ++i){
+                                //get camera sample to generate ray
+                                const Sample2 film_sample = sampler->sample2();
+                                const Sample2 lens_sample = sampler->sample2();
+                                assert(film_sample.u <= 1 && film_sample.u >= 0);
+                                const real pixel_x = pixel.x + film_sample.u;//uv is 0 ~ 1
+                                const real pixel_y = pixel.y + film_sample.v;
+                                const real film_x = pixel_x / film_width;
+                                const real film_y = pixel_y / film_height;
+                                CameraSample camera_sample{{film_x,film_y},{lens_sample.u,lens_sample.v}};
+                                Ray ray;
+                                RayDifferential ray_diff;
+                                real ray_weight = scene_camera->generate_ray_differential(camera_sample,film_delta,ray,ray_diff);
+                                STATS_INC(CameraRays);
+
+                                //evaluate radiance along ray
+                                Spectrum L(0.0);
+                                AOVSample aov;
+                                if(ray_weight > 0.0){
+
+                                    L = eval_pixel_li(scene,pixel,ray,ray_diff,*sampler,arena,RecordAOV ? &aov : nullptr);
 //                                L = {std::max(0.f,ray.d.x),std::max(0.f,ray.d.y),std::max(0.f,ray.d.z)};
-                                Ls += L;
+                                    Ls += L;
+                                }
+                                //add camera ray's contribution to pixel
+                                //todo replace Spectrum Class
+                                if(std::isfinite(L.r) && std::isfinite(L.g) && std::isfinite(L.b)){
+
+                                    if constexpr(RecordAOV)
+                                        film_tile->add_sample({pixel_x,pixel_y},L,aov);
+                                    else
+                                        film_tile->add_sample({pixel_x,pixel_y},L);
+
+                                }
+                                STATS_MAX(ArenaBytes,arena.total_allocated());
+                                arena.reset();
+                                finish_count++;
+                                if(total_pixels >= 10 && finish_count % (total_pixels / 10) == 0){
+                                    LOG_INFO("finish {}",finish_count * 1.0 / total_pixels);
+                                }
                             }
-                            //add camera ray's contribution to pixel
-                            //todo replace Spectrum Class
-                            if(std::isfinite(L.r) && std::isfinite(L.g) && std::isfinite(L.b)){
-
-                                film_tile->add_sample({pixel_x,pixel_y},L);
-
-                            }
-                            arena.reset();
-                            finish_count++;
-                            int percent = finish_count % (total_pixels / 10);
-                            if( percent == 0){
-                                LOG_INFO("finish {}",finish_count * 1.0 / total_pixels);
-                            }
-                        }
 
 //                        if(!Ls.is_meaningful()){
 //                            LOG_CRITICAL("{} {} get invalid L: {} {} {}",
 //                                         pixel.x,pixel.y,Ls.r,Ls.g,Ls.b);
 //                        }
 
-                    }
-                    film.merge_film_tile(film_tile);
+                        }
+                        film.merge_film_tile(film_tile);
+                    });
                 });
-
-        RenderTarget render_target;
-        film.write_render_target(render_target);
-
-        return render_target;
     }
 
 
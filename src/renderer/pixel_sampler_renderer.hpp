@@ -18,12 +18,31 @@ public:
 
     RenderTarget render(const Scene& scene,Film film) override;
 
+    //needs Scene::primitives, falls back to a full render without them or if the film has aov channels
+    RenderTarget render_cached(const Scene& scene,Film film,PrimaryHitBuffer& buffer) override;
+
 protected:
-    virtual Spectrum eval_pixel_li(const Scene& scene,const Ray& ray,Sampler& sampler,MemoryArena& arena) const = 0;
+    //accumulate spp samples per pixel into film
+    void render_film(const Scene& scene,Film& film,int spp);
+
+    int get_spp() const noexcept { return spp; }
+
+    //ray_diff holds offset rays about one sample spacing away for texture filtering
+    //aov is nullptr unless the film has aov channels, then the first hit and direct light are recorded into it
+    virtual Spectrum eval_pixel_li(const Scene& scene,const Point2i& pixel,const Ray& ray,const RayDifferential& ray_diff,
+                                   Sampler& sampler,MemoryArena& arena,AOVSample* aov) const = 0;
+
+    //same as eval_pixel_li for a ray whose first hit is known, primary is nullptr if the ray hits nothing
+    //the default ignores primary and intersects the ray again
+    virtual Spectrum eval_primary_li(const Scene& scene,const Point2i& pixel,const Ray& ray,const RayDifferential& ray_diff,
+                                     const SurfaceIntersection*,Sampler& sampler,MemoryArena& arena) const{
+        return eval_pixel_li(scene,pixel,ray,ray_diff,sampler,arena,nullptr);
+    }
 private:
     int worker_count;
     int tile_size;
     int spp;
+    int pass_count = 0;
 };
 
 TRACER_END
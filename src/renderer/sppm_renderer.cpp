@@ -11,8 +11,10 @@
 #include "core/primitive.hpp"
 #include "utility/parallel.hpp"
 #include "utility/hash.hpp"
+#include "utility/stats.hpp"
 #include "factory/renderer.hpp"
 #include "direct_illumination.hpp"
+#include "aov.hpp"
 #include <atomic>
 TRACER_BEGIN
 
@@ -103,7 +105,8 @@ public:
             auto& pixel = *node->sppm_pixel;
             if((photon_pos - pixel.vp.p).length_squared() > pixel.radius * pixel.radius)
                 continue;
-            Spectrum delta_phi = phi * pixel.vp.bsdf->eval(wi,pixel.vp.wo,TransportMode::Radiance);
+            Spectrum delta_phi = phi * STATS_TIMED(BSDFEvals,BSDFEvalNanoseconds,
+                                                   pixel.vp.bsdf->eval(wi,pixel.vp.wo,TransportMode::Radiance));
             if(!delta_phi.is_finite())
                 continue;
 
@@ -202,77 +205,103 @@ RenderTarget SPPMRenderer::render(const Scene &scene, Film film) {
                         params.task_tile_size,params.task_tile_size,
                         [&](int thread_index,const Bounds2i& tile_bounds)
         {
-            auto sampler = perthread_sample.get_sampler(thread_index);
-            auto& arena = perthread_vp_arenas[thread_index];
-
-            for(Point2i pixel:tile_bounds){
-                const Sample2 film_sample = sampler->sample2();
-                const Sample2 lens_sample = sampler->sample2();
-                const Point2f film_coord = {
-                        (pixel.x + film_sample.u) / film_width,
-                        (pixel.y + film_sample.v) / film_height
-                };
-                CameraSample camera_sample{film_coord,{lens_sample.u,lens_sample.v}};
-                Ray ray;
-                const auto ray_weight = scene_camera->generate_ray(camera_sample,ray);
-                assert(ray_weight == 1.f);
-                Spectrum coef(1.f);
-                coef *= ray_weight;
-
-                auto& sppm_pixel = sppm_pixels(pixel.x,pixel.y);
-                bool specular_bounce = false;
-                for(int depth = 0; depth < params.ray_trace_max_depth; ++depth){
-                    SurfaceIntersection isect;
-                    bool found_intersection = scene.intersect_p(ray,&isect);
-
-                    if(!found_intersection){
-                        //todo test depth == 0 ?
-                        if(auto light = scene.environment_light.get()){
-                            sppm_pixel.direct_illum += coef * light->light_emit(ray.o,ray.d);
+            dispatch_aov(film,[&](auto record_aov){
+                constexpr bool RecordAOV = decltype(record_aov)::value;
+
+                auto sampler = perthread_sample.get_sampler(thread_index);
+                auto& arena = perthread_vp_arenas[thread_index];
+                //only aov channels are accumulated in film, color is computed from sppm pixels
+                Box<Film::Tile> film_tile;
+                if constexpr(RecordAOV)
+                    film_tile = film.get_film_tile(tile_bounds);
+
+                for(Point2i pixel:tile_bounds){
+                    const Sample2 film_sample = sampler->sample2();
+                    const Sample2 lens_sample = sampler->sample2();
+                    const Point2f film_coord = {
+                            (pixel.x + film_sample.u) / film_width,
+                            (pixel.y + film_sample.v) / film_height
+                    };
+                    CameraSample camera_sample{film_coord,{lens_sample.u,lens_sample.v}};
+                    Ray ray;
+                    const auto ray_weight = scene_camera->generate_ray(camera_sample,ray);
+                    assert(ray_weight == 1.f);
+                    STATS_INC(CameraRays);
+                    Spectrum coef(1.f);
+                    coef *= ray_weight;
+
+                    auto& sppm_pixel = sppm_pixels(pixel.x,pixel.y);
+                    AOVSample aov;
+                    //direct light of the first vertex goes to aov too
+                    auto add_direct_illum = [&](int depth,const Spectrum& illum){
+                        sppm_pixel.direct_illum += illum;
+                        if(RecordAOV && depth == 0)
+                            aov.direct += illum;
+                    };
+                    bool specular_bounce = false;
+                    for(int depth = 0; depth < params.ray_trace_max_depth; ++depth){
+                        SurfaceIntersection isect;
+                        bool found_intersection = scene.intersect_p(ray,&isect);
+
+                        if(!found_intersection){
+                            //todo test depth == 0 ?
+                            if(auto light = scene.environment_light.get()){
+                                add_direct_illum(depth,coef * light->light_emit(ray.o,ray.d));
+                            }
+                            break;
+                        }
+                        if constexpr(RecordAOV){
+                            if(depth == 0)
+                                record_surface_aov(aov,scene,isect,ray.o);
                         }
-                        break;
-                    }
 
-                    const SurfaceShadingPoint shd_p = isect.material->shading(isect,arena);
+                        const SurfaceShadingPoint shd_p = isect.material->shading(isect,arena);
 
-                    if(depth == 0 || specular_bounce){
-                        if(auto light = isect.primitive->as_area_light()){
-                            sppm_pixel.direct_illum += coef * light->light_emit(isect,-ray.d);
+                        if(depth == 0 || specular_bounce){
+                            if(auto light = isect.primitive->as_area_light()){
+                                add_direct_illum(depth,coef * light->light_emit(isect,-ray.d));
+                            }
                         }
-                    }
 
-                    //direct illumination
-                    Spectrum next_direct_illum;
-                    for(auto light:scene.lights){
-                        next_direct_illum += sample_light(scene,light,isect,shd_p,*sampler);
-                    }
-                    next_direct_illum += sample_bsdf(scene,isect,shd_p,*sampler);
+                        //direct illumination
+                        Spectrum next_direct_illum;
+                        for(auto light:scene.lights){
+                            next_direct_illum += sample_light(scene,light,isect,shd_p,*sampler);
+                        }
+                        next_direct_illum += sample_bsdf(scene,isect,shd_p,*sampler);
 
-                    sppm_pixel.direct_illum += coef * next_direct_illum;
+                        add_direct_illum(depth,coef * next_direct_illum);
 
-                    if(shd_p.bsdf->has_diffuse() || depth == params.ray_trace_max_depth - 1){
-                        if(!coef.is_finite()){
+                        if(shd_p.bsdf->has_diffuse() || depth == params.ray_trace_max_depth - 1){
+                            if(!coef.is_finite()){
+                                break;
+                            }
+                            sppm_pixel.vp = {isect.pos,isect.wo,coef,shd_p.bsdf};
                             break;
                         }
-                        sppm_pixel.vp = {isect.pos,isect.wo,coef,shd_p.bsdf};
-                        break;
-                    }
 
-                    if(depth == params.ray_trace_max_depth - 1) break;
-                    const auto bsdf_sample_ret = shd_p.bsdf->sample(isect.wo,TransportMode::Radiance,sampler->sample3());
-                    if(!bsdf_sample_ret.f || bsdf_sample_ret.pdf < eps)
-                        break;
-                    specular_bounce = bsdf_sample_ret.is_delta;
-                    coef *= bsdf_sample_ret.f / bsdf_sample_ret.pdf * abs_cos(bsdf_sample_ret.wi,isect.geometry_coord.z);
-                    ray = Ray(isect.eps_offset(bsdf_sample_ret.wi),bsdf_sample_ret.wi);
+                        if(depth == params.ray_trace_max_depth - 1) break;
+                        const auto bsdf_sample_ret = STATS_TIMED(BSDFSamples,BSDFSampleNanoseconds,
+                                                                 shd_p.bsdf->sample(isect.wo,TransportMode::Radiance,sampler->sample3()));
+                        if(!bsdf_sample_ret.f || bsdf_sample_ret.pdf < eps)
+                            break;
+                        specular_bounce = bsdf_sample_ret.is_delta;
+                        coef *= bsdf_sample_ret.f / bsdf_sample_ret.pdf * abs_cos(bsdf_sample_ret.wi,isect.geometry_coord.z);
+                        ray = Ray(isect.eps_offset(bsdf_sample_ret.wi),bsdf_sample_ret.wi);
 
-                    //todo apply rr?
-                }
-                // add visible points to grid
-                if(sppm_pixel.vp.is_valid()){
-                    vp_container.add_visible_point(sppm_pixel,arena);
+                        //todo apply rr?
+                    }
+                    if constexpr(RecordAOV){
+                        film_tile->add_sample({pixel.x + film_sample.u,pixel.y + film_sample.v},Spectrum(0),aov);
+                    }
+                    // add visible points to grid
+                    if(sppm_pixel.vp.is_valid()){
+                        vp_container.add_visible_point(sppm_pixel,arena);
+                    }
                 }
-            }
+                if constexpr(RecordAOV)
+                    film.merge_film_tile(film_tile);
+            });
         });
 
         // trace photon
@@ -283,6 +312,14 @@ RenderTarget SPPMRenderer::render(const Scene &scene, Film film) {
         {
             auto sampler = perthread_sample.get_sampler(thread_index);
             auto& arena = photon_arenas[thread_index];
+            //photons split from the same emitted one
+            struct PhotonBranch{
+                Ray ray;
+                Spectrum coef;
+                int depth;
+                int split_budget;
+            };
+            std::vector<PhotonBranch> branches;
             for(int i = begin; i < end; ++i){
                 //emit a photon
                 real light_pdf;
@@ -302,45 +339,77 @@ RenderTarget SPPMRenderer::render(const Scene &scene, Film film) {
                 Spectrum coef = emit.radiance * abs_dot(emit.n,emit.dir)
                         / (light_pdf * emit.pdf_pos * emit.pdf_dir);
 
-                Ray ray(emit.pos,emit.dir,eps);
-                //trace the photon emitted
-                for(int depth = 1; depth <= params.photon_max_depth; ++depth){
-                    if(!coef.is_finite()){
-                        break;
-                    }
-                    SurfaceIntersection isect;
-                    if(!scene.intersect_p(ray,&isect)){
-                        break;
-                    }
-                    //add photon contribution to nearby visible points
-                    //but ignore if this hit is direct illumination
-                    if(depth > 1){
-                        vp_container.add_photon(isect.pos,coef,isect.wo);
-                    }
-
-                    auto shd_p = isect.material->shading(isect,arena);
-                    //todo importance sample
-                    auto bsdf_sample_ret = shd_p.bsdf->sample(isect.wo,TransportMode::Importance,sampler->sample3());
-                    if(bsdf_sample_ret.f.is_back() || bsdf_sample_ret.pdf < eps){
-                        break;
-                    }
+                //weight window is centered at emitted photon power
+                const real window_lower = 2 * coef.lum() / (1 + params.photon_window_size);
+                const real window_upper = window_lower * params.photon_window_size;
+
+                STATS_INC(PhotonsTraced);
+                branches.clear();
+                branches.push_back({Ray(emit.pos,emit.dir,eps),coef,1,params.photon_max_split});
+                while(!branches.empty()){
+                    const auto branch = branches.back();
+                    branches.pop_back();
+                    Ray ray = branch.ray;
+                    coef = branch.coef;
+                    int split_budget = branch.split_budget;
+                    //trace the photon emitted
+                    for(int depth = branch.depth; depth <= params.photon_max_depth; ++depth){
+                        if(!coef.is_finite()){
+                            break;
+                        }
+                        SurfaceIntersection isect;
+                        if(!scene.intersect_p(ray,&isect)){
+                            break;
+                        }
+                        //add photon contribution to nearby visible points
+                        //but ignore if this hit is direct illumination
+                        if(depth > 1){
+                            vp_container.add_photon(isect.pos,coef,isect.wo);
+                        }
 
-                    coef *= bsdf_sample_ret.f *
-                            abs_cos(bsdf_sample_ret.wi,isect.geometry_coord.z) / bsdf_sample_ret.pdf;
-//                    if(coef.r > 1 || coef.g > 1 || coef.b > 1){
-//                        LOG_CRITICAL("invalid coef");
-//                        break;
-//                    }
-                    //apply russian roulette
-                    if(depth >= params.photon_min_depth){
-                        if(sampler->sample1().u > 0.9)
+                        auto shd_p = isect.material->shading(isect,arena);
+                        //todo importance sample
+                        auto bsdf_sample_ret = STATS_TIMED(BSDFSamples,BSDFSampleNanoseconds,
+                                                           shd_p.bsdf->sample(isect.wo,TransportMode::Importance,sampler->sample3()));
+                        if(bsdf_sample_ret.f.is_back() || bsdf_sample_ret.pdf < eps){
                             break;
-                        coef /= 0.9;
-                    }
+                        }
 
-                    ray = Ray(isect.eps_offset(bsdf_sample_ret.wi),bsdf_sample_ret.wi);
+                        coef *= bsdf_sample_ret.f *
+                                abs_cos(bsdf_sample_ret.wi,isect.geometry_coord.z) / bsdf_sample_ret.pdf;
+//                        if(coef.r > 1 || coef.g > 1 || coef.b > 1){
+//                            LOG_CRITICAL("invalid coef");
+//                            break;
+//                        }
+                        ray = Ray(isect.eps_offset(bsdf_sample_ret.wi),bsdf_sample_ret.wi);
+
+                        //apply russian roulette
+                        if(params.photon_weight_window){
+                            const real weight = coef.lum();
+                            if(weight < window_lower){
+                                const real q = weight / window_lower;
+                                if(sampler->sample1().u >= q)
+                                    break;
+                                coef /= q;
+                            }
+                            else if(weight > window_upper && split_budget > 1){
+                                const int n = (std::min)(static_cast<int>(std::ceil(weight / window_upper)),split_budget);
+                                coef /= real(n);
+                                split_budget /= n;
+                                for(int k = 1; k < n; ++k){
+                                    branches.push_back({ray,coef,depth + 1,split_budget});
+                                }
+                            }
+                        }
+                        else if(depth >= params.photon_min_depth){
+                            if(sampler->sample1().u > 0.9)
+                                break;
+                            coef /= 0.9;
+                        }
+                    }
                 }
                 if(arena.used_bytes() > (4 << 20)){
+                    STATS_MAX(ArenaBytes,arena.total_allocated());
                     arena.reset();
                 }
             }
@@ -400,6 +469,9 @@ RenderTarget SPPMRenderer::render(const Scene &scene, Film film) {
     }
 
     RenderTarget ret;
+    //aov channels come from film, its color is left black
+    if(film.has_aov())
+        film.write_render_target(ret);
     size_t photon_count = (size_t)params.iteration_count * params.photons_per_iteration;
     int direct_illum_count = params.iteration_count;
     ret.color = Image2D<Spectrum>(film_width,film_height);
@@ -412,6 +484,14 @@ RenderTarget SPPMRenderer::render(const Scene &scene, Film film) {
             ret.color(x,y) =  direct_illum + photon_illum;//Spectrum(pixel.total_count * 1.0 / 500);
         }
     }
+    if(film.get_aov_channels() & AOVIndirect){
+        //film wrote black color minus direct
+        for(int y = 0; y < film_height; ++y){
+            for(int x = 0; x < film_width; ++x){
+                ret.indirect(x,y) += ret.color(x,y);
+            }
+        }
+    }
     return ret;
 }
 
@@ -0,0 +1,315 @@
+//
+// Created by wyz on 2022/6/12.
+//
+#include "core/renderer.hpp"
+#include "core/sampling.hpp"
+#include "core/light.hpp"
+#include "core/scene.hpp"
+#include "core/spectrum.hpp"
+#include "core/camera.hpp"
+#include "core/sampler.hpp"
+#include "utility/parallel.hpp"
+#include "utility/hash.hpp"
+#include "utility/timer.hpp"
+#include "utility/stats.hpp"
+#include "factory/renderer.hpp"
+#include "direct_illumination.hpp"
+#include "bdpt.hpp"
+
+TRACER_BEGIN
+
+namespace vcm{
+
+    struct LightVertexRef{
+        Point3f pos;
+        //offset of the first vertex of its sub-path in LightSubpathPool
+        uint32_t path_offset = 0;
+        int vertex_index = 0;
+    };
+
+    //hashed grid of light vertices, rebuilt every iteration
+    //cell length is 2 * radius so a query sphere overlaps at most 2x2x2 cells
+    class LightVertexGrid{
+    public:
+        void build(const Bounds3f& world_bounds,real radius,std::vector<LightVertexRef>&& refs){
+            world_bound = world_bounds;
+            grid_ele_len = 2 * radius;
+            bucket_count = (std::max<size_t>)(refs.size(),1);
+
+            std::vector<size_t> bucket_of(refs.size());
+            cell_starts.assign(bucket_count + 1,0);
+            for(size_t i = 0; i < refs.size(); ++i){
+                bucket_of[i] = grid_to_bucket(pos_to_grid(refs[i].pos));
+                ++cell_starts[bucket_of[i] + 1];
+            }
+            for(size_t i = 0; i < bucket_count; ++i){
+                cell_starts[i + 1] += cell_starts[i];
+            }
+            vertices.resize(refs.size());
+            std::vector<size_t> fill(cell_starts.begin(),cell_starts.end() - 1);
+            for(size_t i = 0; i < refs.size(); ++i){
+                vertices[fill[bucket_of[i]]++] = refs[i];
+            }
+        }
+
+        template<typename F>
+        void query(const Point3f& pos,real radius,F&& f) const{
+            if(vertices.empty())
+                return;
+            const Point3i low_grid = pos_to_grid(pos - (Vector3f)radius);
+            const Point3i high_grid = pos_to_grid(pos + (Vector3f)radius);
+            const real radius2 = radius * radius;
+
+            //different cells may be hashed into the same bucket
+            size_t visited[8];
+            int visited_count = 0;
+            for(int z = low_grid.z; z <= high_grid.z; ++z){
+                for(int y = low_grid.y; y <= high_grid.y; ++y){
+                    for(int x = low_grid.x; x <= high_grid.x; ++x){
+                        const size_t bucket = grid_to_bucket({x,y,z});
+                        if(std::find(visited,visited + visited_count,bucket) != visited + visited_count)
+                            continue;
+                        if(visited_count < 8)
+                            visited[visited_count++] = bucket;
+                        for(size_t i = cell_starts[bucket]; i < cell_starts[bucket + 1]; ++i){
+                            const auto& ref = vertices[i];
+                            if((ref.pos - pos).length_squared() > radius2)
+                                continue;
+                            f(ref);
+                        }
+                    }
+                }
+            }
+        }
+
+    private:
+        Point3i pos_to_grid(const Point3f& world_pos) const{
+            auto offset = world_pos - world_bound.low;
+            return Point3i(static_cast<int>(std::max<real>(offset.x,0) / grid_ele_len),
+                           static_cast<int>(std::max<real>(offset.y,0) / grid_ele_len),
+                           static_cast<int>(std::max<real>(offset.z,0) / grid_ele_len));
+        }
+        size_t grid_to_bucket(const Point3i& grid_idx) const{
+            return hash(grid_idx.x,grid_idx.y,grid_idx.z) % bucket_count;
+        }
+
+        Bounds3f world_bound;
+        real grid_ele_len = 1;
+        size_t bucket_count = 1;
+        std::vector<size_t> cell_starts;
+        std::vector<LightVertexRef> vertices;
+    };
+
+    real mis_weight_merge(bdpt::Vertex* camera_subpath,int t,
+                          bdpt::Vertex* light_subpath,int s,
+                          real merge_eta){
+        // [ ... , a , b ] ~ [ c , d , ... ]
+        // b and c are merged, so the path is equal to connect b with d
+        // and both camera and light sub-path sampled the merged vertex
+        assert(t >= 2 && s >= 2);
+        auto& a = camera_subpath[t - 2];
+        auto& b = camera_subpath[t - 1];
+        auto& c = light_subpath[s - 1];
+        auto& d = light_subpath[s - 2];
+
+        const Point3f b_pos = b.surface_pt.pos;
+        const Vector3f camera_wo = b.surface_pt.wo;
+        const Vector3f light_wo = c.surface_pt.wo;
+        const BSDF* bsdf = b.surface_pt.bsdf;
+
+        // b.pdf_bwd
+        // light sub-path arrive at b
+        ScopedAssignment<real> scope_b_pdf_bwd = {
+                &b.pdf_bwd, c.pdf_bwd
+        };
+        // a.pdf_bwd
+        // b -> a with light incoming from d
+        const real a_pdf_bwd_sa = bsdf->pdf(camera_wo,light_wo);
+        ScopedAssignment<real> scope_a_pdf_bwd = {
+                &a.pdf_bwd, bdpt::pdf_solid_angle_to_area(a_pdf_bwd_sa,b_pos,a)
+        };
+        // d.pdf_fwd
+        // b -> d with camera incoming from a
+        const real d_pdf_fwd_sa = bsdf->pdf(light_wo,camera_wo);
+        ScopedAssignment<real> scope_d_pdf_fwd = {
+                &d.pdf_fwd, bdpt::pdf_solid_angle_to_area(d_pdf_fwd_sa,b_pos,d)
+        };
+
+        return merge_eta * bdpt::remap(c.pdf_bwd) *
+               bdpt::compute_mis_weight(camera_subpath,t,light_subpath,s - 1,merge_eta);
+    }
+
+}
+
+class VCMRenderer: public Renderer{
+public:
+    VCMRenderer(const VCMRendererParams& params): params(params){
+        assert(params.max_camera_vertex_count >= 2 && params.max_light_vertex_count >= 1);
+    }
+
+    RenderTarget render(const Scene& scene,Film film) override;
+
+private:
+    VCMRendererParams params;
+    using SplatImage = Image2D<bdpt::AtomicSpectrum>;
+};
+
+RenderTarget VCMRenderer::render(const Scene& scene,Film film){
+    AutoTimer timer("vcm render");
+
+    auto scene_light_distribution = compute_light_power_distribution(scene);
+    std::unordered_map<const Light*,int> light_index;
+    for(int i = 0; i < static_cast<int>(scene.lights.size()); ++i){
+        light_index[scene.lights[i]] = i;
+    }
+
+    auto scene_camera = scene.get_camera();
+
+    auto world_bounds = scene.world_bounds();
+    real init_search_radius = params.init_search_radius;
+    if(init_search_radius <= 0){
+        init_search_radius = (world_bounds.high - world_bounds.low).length() / 1000;
+    }
+
+    const int thread_count = actual_worker_count(params.worker_count);
+    auto sampler_prototype = newBox<SimpleUniformSampler>(42, false);
+    PerThreadNativeSamplers perthread_samplers(thread_count, *sampler_prototype);
+
+    const int film_width = film.width();
+    const int film_height = film.height();
+    const int light_path_count = film_width * film_height;
+    const int max_light_v = params.max_light_vertex_count;
+    const int max_camera_v = params.max_camera_vertex_count;
+
+    //one light sub-path per pixel, bsdf of vertices is alive until arenas reset
+    bdpt::LightSubpathPool light_paths;
+    std::vector<MemoryArena> light_arenas(thread_count);
+
+    SplatImage splat_image(film_width,film_height);
+
+    vcm::LightVertexGrid grid;
+
+    for(int iter = 0; iter < params.iteration_count; ++iter){
+        //progressive radius shared by all pixels
+        const real radius = init_search_radius *
+                std::pow(real(iter + 1),(params.radius_alpha - 1) * real(0.5));
+        const real merge_eta = PI_r * radius * radius * light_path_count;
+
+        //trace light sub-paths
+        light_paths.generate(scene,perthread_samplers,light_arenas,*scene_light_distribution,
+                             light_path_count,max_light_v);
+
+        //build hashed grid for vertex merging
+        {
+            std::vector<vcm::LightVertexRef> refs;
+            for(int i = 0; i < light_path_count; ++i){
+                //vertex 0 is on the light
+                const auto path = light_paths.path(i);
+                for(int j = 1; j < light_paths.vertex_count(i); ++j){
+                    const auto& v = path[j];
+                    if(bdpt::is_mergeable(v))
+                        refs.push_back({v.surface_pt.pos,light_paths.path_offset(i),j});
+                }
+            }
+            grid.build(world_bounds,radius,std::move(refs));
+        }
+
+        //trace camera sub-paths, connect and merge
+        parallel_for_2d(thread_count,film_width,film_height,params.task_tile_size,params.task_tile_size,
+                        [&](int thread_index,const Bounds2i& tile_bounds)
+        {
+            auto sampler = perthread_samplers.get_sampler(thread_index);
+            MemoryArena arena;
+            auto film_tile = film.get_film_tile(tile_bounds);
+
+            const bdpt::BDPTEvalParams eval_params(scene,film,scene_light_distribution.get(),light_index,merge_eta);
+
+            for(const Point2i& pixel:tile_bounds){
+                const Sample2 film_sample = sampler->sample2();
+                const Sample2 lens_sample = sampler->sample2();
+                const Point2f pixel_coord = {
+                        (pixel.x + film_sample.u),
+                        (pixel.y + film_sample.v)
+                };
+                const Point2f film_coord = {
+                        (pixel.x + film_sample.u) / film_width,
+                        (pixel.y + film_sample.v) / film_height
+                };
+                CameraSample camera_sample{film_coord,{lens_sample.u,lens_sample.v}};
+                Ray ray;
+                scene_camera->generate_ray(camera_sample,ray);
+                STATS_INC(CameraRays);
+
+                auto camera_subpath = arena.alloc<bdpt::Vertex>(max_camera_v);
+                const int camera_v_cnt = bdpt::generate_camera_subpath(scene,*sampler,arena,ray,
+                                                                       camera_subpath,max_camera_v);
+
+                //copy the light sub-path of this pixel because mis modifies vertices temporarily
+                const int path_index = pixel.y * film_width + pixel.x;
+                const int light_v_cnt = light_paths.vertex_count(path_index);
+                auto light_subpath = arena.alloc<bdpt::Vertex>(max_light_v);
+                std::copy_n(light_paths.path(path_index),light_v_cnt,light_subpath);
+
+                //vertex connection
+                Spectrum L = bdpt::evaluate_bdpt_path(eval_params,
+                                                      camera_subpath,camera_v_cnt,
+                                                      light_subpath,light_v_cnt,*sampler,
+                                                      [&](const Point2f& coord,const Spectrum& v){
+                    splat_image.at(std::min<int>(film_width - 1,coord.x),
+                                   std::min<int>(film_height - 1,coord.y)).add(v);
+                });
+
+                //vertex merging
+                Spectrum Lm;
+                auto merge_subpath = arena.alloc<bdpt::Vertex>(max_light_v);
+                for(int t = 2; t <= camera_v_cnt; ++t){
+                    const auto& b = camera_subpath[t - 1];
+                    if(!bdpt::is_mergeable(b))
+                        continue;
+                    grid.query(b.surface_pt.pos,radius,[&](const vcm::LightVertexRef& ref){
+                        const auto& c = light_paths.vertex(ref.path_offset + ref.vertex_index);
+                        const Spectrum f = STATS_TIMED(BSDFEvals,BSDFEvalNanoseconds,
+                                                       b.surface_pt.bsdf->eval(c.surface_pt.wo,b.surface_pt.wo,TransportMode::Radiance));
+                        if(!f)
+                            return;
+                        const int s = ref.vertex_index + 1;
+                        std::copy_n(&light_paths.vertex(ref.path_offset),s,merge_subpath);
+                        const real weight = vcm::mis_weight_merge(camera_subpath,t,merge_subpath,s,merge_eta);
+                        const Spectrum contrib = b.accu_coef * f * c.accu_coef;
+                        if(contrib.is_finite())
+                            Lm += weight * contrib;
+                    });
+                }
+                L += Lm / merge_eta;
+
+                film_tile->add_sample(pixel_coord,L);
+
+                STATS_MAX(ArenaBytes,arena.total_allocated());
+                arena.reset();
+            }
+            film.merge_film_tile(film_tile);
+        });
+
+        for(auto& arena:light_arenas){
+            arena.reset();
+        }
+    }
+
+    RenderTarget ret;
+
+    film.write_render_target(ret);
+
+    const real splat_scale = real(1) / params.iteration_count;
+    for(int y = 0; y < film_height; ++y){
+        for(int x = 0; x < film_width; ++x){
+            ret.color(x,y) += splat_image.at(x,y).to_spectrum() * splat_scale;
+        }
+    }
+    return ret;
+}
+
+RC<Renderer> create_vcm_renderer(const VCMRendererParams& params){
+    return newRC<VCMRenderer>(params);
+}
+
+TRACER_END
@@ -23,6 +23,8 @@ TRACER_BEGIN
         Bounds3f world_bound()  const noexcept override;
 
         const AreaLight* as_area_light() const noexcept override;
+
+        const Material* get_material() const noexcept override;
     private:
         RC<const Shape> shape;
         RC<const Material> material;
@@ -67,6 +69,10 @@ TRACER_BEGIN
         return diffuse_light.get();
     }
 
+    const Material *GeometricPrimitive::get_material() const noexcept {
+        return material.get();
+    }
+
     RC<Primitive> create_geometric_primitive(
             const RC<Shape>& shape,const RC<Material>& material,
             const MediumInterface& mi,const Spectrum& emission){
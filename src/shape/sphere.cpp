@@ -100,6 +100,7 @@ public:
         real t;
         if(!sphere::intersect_p(local_ray,&t,radius))
             return false;
+        *hit_t = t * local_to_world_scale_ratio;
 
         const Point3f pos = local_ray(t);
 
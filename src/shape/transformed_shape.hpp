@@ -14,10 +14,12 @@ protected:
         local_to_world_scale_ratio = local_to_world(Vector3f(1,0,0)).length();
     }
 
+    //local ray direction is normalized, so t is scaled by the inverse of local_to_world_scale_ratio
     Ray to_local(const Ray& wr) const noexcept{
         const Point3f local_origin = world_to_local(wr.o);
         const Vector3f local_dir = world_to_local(wr.d);
-        return Ray(local_origin,local_dir,wr.t_min,wr.t_max);
+        const real inv_scale = 1 / local_to_world_scale_ratio;
+        return Ray(local_origin,local_dir,wr.t_min * inv_scale,wr.t_max * inv_scale);
     }
 
     void to_world(SurfacePoint& spt) const noexcept{
@@ -33,6 +35,8 @@ protected:
     void to_world(SurfaceIntersection& isect) const noexcept{
         to_world(static_cast<SurfacePoint&>(isect));
         isect.wo = local_to_world(isect.wo);
+        isect.dpdu = local_to_world(isect.dpdu);
+        isect.dpdv = local_to_world(isect.dpdv);
     }
 
     Bounds3f to_world(const Bounds3f &local_bounds) const noexcept{
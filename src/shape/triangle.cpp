@@ -193,6 +193,8 @@ TRACER_BEGIN
         Vector3f gn = cross(AB,AC).normalize();
         Vector3f dpdu,dpdv;
         compute_ss_ts(AB,AC,Vector2f(uvB - uvA),Vector2f(uvC-uvA),gn,dpdu,dpdv);
+        isect->dpdu = dpdu;
+        isect->dpdv = dpdv;
         dpdu = cross(dpdv,gn);
         dpdv = cross(gn,dpdu);
         isect->geometry_coord = Coord(dpdu,dpdv,gn);
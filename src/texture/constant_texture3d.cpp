@@ -39,6 +39,14 @@ public:
         return constant.r;
     }
 
+    real max_real(const Point3f&,const Point3f&) const noexcept override{
+        return constant.r;
+    }
+
+    real min_real(const Point3f&,const Point3f&) const noexcept override{
+        return constant.r;
+    }
+
 private:
     Spectrum constant;
 };
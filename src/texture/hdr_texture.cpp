@@ -8,10 +8,10 @@ TRACER_BEGIN
 
     class HDRTexture2D: public Texture2D{
     public:
-        HDRTexture2D(const RC<Image2D<Color3f>>& image,real gamma = 1)
-        :data(image)
+        HDRTexture2D(const RC<const BlockImage2D<Color3f>>& image,const Spectrum& scale = Spectrum(1))
+        :data(image),scale(scale)
         {
-            this->inv_gamma = 1.0 / gamma;
+
         }
 
         ~HDRTexture2D() override {}
@@ -26,16 +26,21 @@ TRACER_BEGIN
 
         Spectrum evaluate_impl(const Point2f& uv) const noexcept override{
             auto v = LinearSampler::Sample2D(*data.get(),uv.x,uv.y);
-            return Spectrum(v.x,v.y,v.z);
+            return Spectrum(v.x,v.y,v.z) * scale;
         }
 
     private:
-        RC<Image2D<Color3f>> data;
+        RC<const BlockImage2D<Color3f>> data;
+        Spectrum scale;
 
     };
 
     RC<Texture2D> create_hdr_texture2d(const RC<Image2D<Color3f>>& image){
-        return newRC<HDRTexture2D>(image);
+        return newRC<HDRTexture2D>(newRC<BlockImage2D<Color3f>>(*image));
+    }
+
+    RC<Texture2D> create_hdr_texture2d(const RC<const BlockImage2D<Color3f>>& image,const Spectrum& scale){
+        return newRC<HDRTexture2D>(image,scale);
     }
 
 TRACER_END
\ No newline at end of file
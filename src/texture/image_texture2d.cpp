@@ -3,38 +3,95 @@
 //
 #include "core/texture.hpp"
 #include "utility/image.hpp"
-#include "utility/sampler.hpp"
 #include "utility/logger.hpp"
 TRACER_BEGIN
 
     class ImageTexture2D:public Texture2D{
     public:
-        ImageTexture2D(const RC<Image2D<Color3b>>& image)
-        :data(image)
-        {}
+        //gamma encoded texels are decoded by gamma_table at lookup and scale is applied after decoding
+        //mipmap may be shared by textures of different scales
+        ImageTexture2D(const RC<const MipMap2D<Color3b>>& mipmap,bool gamma_encoded,const Spectrum& scale)
+        :mipmap(mipmap),gamma_encoded(gamma_encoded),scale(scale)
+        {
+            assert(mipmap && mipmap->valid());
+        }
 
         int width() const noexcept {
-            return data->width();
+            return mipmap->get_level(0).width();
         };
 
         int height() const noexcept {
-            return data->height();
+            return mipmap->get_level(0).height();
         }
 
         Spectrum evaluate_impl(const Point2f& uv) const noexcept override{
-            auto v =  LinearSampler::Sample2D(*data.get(),uv.x,uv.y);
-            //todo convert color3b to color3f
-            return Spectrum(v.x/real(255.0),v.y/real(255.0),v.z/real(255.0));
+            return sample(mipmap->get_level(0),uv);
+        }
+
+        Spectrum evaluate_impl(const Point2f& uv,real uv_footprint) const noexcept override{
+            //level where a pixel covers about one texel
+            const real texel_footprint = uv_footprint * (std::max)(width(),height());
+            const real level = (std::min)(std::log2((std::max)(texel_footprint,real(1))),real(mipmap->levels() - 1));
+            if(level <= 0)
+                return sample(mipmap->get_level(0),uv);
+            const int l0 = static_cast<int>(level);
+            const int l1 = (std::min)(l0 + 1,mipmap->levels() - 1);
+            const real t = level - l0;
+            return sample(mipmap->get_level(l0),uv) * (1 - t) + sample(mipmap->get_level(l1),uv) * t;
         }
     private:
-        RC<Image2D<Color3b>> data;
+        Spectrum texel(const BlockImage2D<Color3b>& image,int x,int y) const noexcept{
+            const auto& c = image.unchecked(x,y);
+            if(gamma_encoded){
+                return Spectrum(gamma_table.decode(c.x),gamma_table.decode(c.y),gamma_table.decode(c.z));
+            }
+            return Spectrum(c.x / real(255),c.y / real(255),c.z / real(255));
+        }
+
+        //bilinear in linear space, same addressing as LinearSampler
+        Spectrum sample(const BlockImage2D<Color3b>& image,const Point2f& uv) const noexcept{
+            const int w = image.width(), h = image.height();
+            const real u = std::clamp<real>(uv.x,0,1) * (w - 1);
+            const real v = std::clamp<real>(uv.y,0,1) * (h - 1);
+            const int u0 = std::clamp(static_cast<int>(u),0,w - 1);
+            const int v0 = std::clamp(static_cast<int>(v),0,h - 1);
+            const int u1 = (std::min)(u0 + 1,w - 1);
+            const int v1 = (std::min)(v0 + 1,h - 1);
+            const real du = u - u0, dv = v - v0;
+            return ((texel(image,u0,v0) * (1 - du) + texel(image,u1,v0) * du) * (1 - dv) +
+                    (texel(image,u0,v1) * (1 - du) + texel(image,u1,v1) * du) * dv) * scale;
+        }
+
+        //level 0 is the image itself, so the source image need not be kept
+        RC<const MipMap2D<Color3b>> mipmap;
+        bool gamma_encoded;
+        Spectrum scale;
     };
 
+    RC<const MipMap2D<Color3b>> create_texture_mipmap(const Image2D<Color3b>& image,bool gamma_encoded){
+        auto mipmap = newRC<MipMap2D<Color3b>>();
+        if(gamma_encoded){
+            mipmap->generate(image,[](const Color3b& t00,const Color3b& t01,const Color3b& t10,const Color3b& t11){
+                return gamma_table.mip_average(t00,t01,t10,t11);
+            });
+        }
+        else{
+            mipmap->generate(image);
+        }
+        return mipmap;
+    }
+
     RC<Texture2D> create_image_texture2d(const RC<Image2D<Color3b>>& image){
-        return newRC<ImageTexture2D>(image);
+        return newRC<ImageTexture2D>(create_texture_mipmap(*image,false),false,Spectrum(1));
     }
 
+    RC<Texture2D> create_image_texture2d(const RC<Image2D<Color3b>>& image,bool gamma_encoded,const Spectrum& scale){
+        return newRC<ImageTexture2D>(create_texture_mipmap(*image,gamma_encoded),gamma_encoded,scale);
+    }
 
+    RC<Texture2D> create_image_texture2d(const RC<const MipMap2D<Color3b>>& mipmap,bool gamma_encoded,const Spectrum& scale){
+        return newRC<ImageTexture2D>(mipmap,gamma_encoded,scale);
+    }
 
 
-TRACER_END
\ No newline at end of file
+TRACER_END
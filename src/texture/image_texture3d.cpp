@@ -90,7 +90,55 @@ public:
     real max_real() const noexcept override{
         return max_real_;
     }
+
+    real max_real(const Point3f& low,const Point3f& high) const noexcept override{
+        real min_v, max_v;
+        texel_range(low,high,min_v,max_v);
+        return max_v;
+    }
+
+    real min_real(const Point3f& low,const Point3f& high) const noexcept override{
+        real min_v, max_v;
+        texel_range(low,high,min_v,max_v);
+        return min_v;
+    }
 private:
+    //linear sampling is a convex combination of texels covering the box
+    void texel_range(const Point3f& low,const Point3f& high,real& min_v,real& max_v) const noexcept{
+        int lo[3], hi[3];
+        const int size[3] = {data->width(),data->height(),data->depth()};
+        for(int i = 0; i < 3; ++i){
+            const real l = std::clamp<real>(low[i],0,1) * (size[i] - 1);
+            const real h = std::clamp<real>(high[i],0,1) * (size[i] - 1);
+            lo[i] = std::clamp(static_cast<int>(std::floor(l)),0,size[i] - 1);
+            hi[i] = std::clamp(static_cast<int>(std::ceil(h)),0,size[i] - 1);
+        }
+        min_v = std::numeric_limits<real>::max();
+        max_v = 0;
+        for(int z = lo[2]; z <= hi[2]; ++z){
+            for(int y = lo[1]; y <= hi[1]; ++y){
+                for(int x = lo[0]; x <= hi[0]; ++x){
+                    const auto& t = data->at(x,y,z);
+                    real v;
+                    if constexpr(std::is_same_v<T,real>){
+                        v = t;
+                    }
+                    else if constexpr(std::is_same_v<T,uint8_t>){
+                        v = t / real(255);
+                    }
+                    else if constexpr(std::is_same_v<T,Color3b>){
+                        v = t[0] / real(255);
+                    }
+                    else{
+                        v = t[0];
+                    }
+                    min_v = std::min(min_v,v);
+                    max_v = std::max(max_v,v);
+                }
+            }
+        }
+    }
+
     RC<const Image3D<T>> data;
     Spectrum max_spectrum_;
     real max_real_;
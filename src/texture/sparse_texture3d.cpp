@@ -0,0 +1,137 @@
+//
+// Created by wyz on 2022/6/21.
+//
+#include "../core/texture.hpp"
+#include "../utility/sparse_volume.hpp"
+#include "../core/spectrum.hpp"
+
+TRACER_BEGIN
+
+//density texture backed by memory mapped sparse bricks
+//sampling matches ImageTexture3D with linear filter
+class SparseTexture3D: public Texture3D{
+public:
+    explicit SparseTexture3D(const std::string& filename)
+    :volume(filename)
+    {}
+
+    ~SparseTexture3D() = default;
+
+    int width() const noexcept override{
+        return volume.width();
+    }
+
+    int height() const noexcept override{
+        return volume.height();
+    }
+
+    int depth() const noexcept override{
+        return volume.depth();
+    }
+
+    Spectrum evaluate_impl(const Point3f& uvw) const noexcept override{
+        const real u = std::clamp<real>(uvw.x,0,1) * (volume.width() - 1);
+        const real v = std::clamp<real>(uvw.y,0,1) * (volume.height() - 1);
+        const real w = std::clamp<real>(uvw.z,0,1) * (volume.depth() - 1);
+        const int x0 = std::clamp(static_cast<int>(u),0,volume.width() - 1);
+        const int y0 = std::clamp(static_cast<int>(v),0,volume.height() - 1);
+        const int z0 = std::clamp(static_cast<int>(w),0,volume.depth() - 1);
+        const int x1 = (std::min)(x0 + 1,volume.width() - 1);
+        const int y1 = (std::min)(y0 + 1,volume.height() - 1);
+        const int z1 = (std::min)(z0 + 1,volume.depth() - 1);
+        const real du = u - x0, dv = v - y0, dw = w - z0;
+
+        //all corners are in one brick for most lookups
+        constexpr int bs = SparseVolume::brick_size;
+        real c[8];
+        if(x0 / bs == x1 / bs && y0 / bs == y1 / bs && z0 / bs == z1 / bs){
+            const int64_t brick = volume.brick_index(x0 / bs,y0 / bs,z0 / bs);
+            if(brick < 0)
+                return Spectrum(volume.background());
+            const float* data = volume.brick_data(brick);
+            const int lx0 = x0 % bs, ly0 = y0 % bs, lz0 = z0 % bs;
+            const int lx1 = x1 % bs, ly1 = y1 % bs, lz1 = z1 % bs;
+            c[0] = data[(lz0 * bs + ly0) * bs + lx0];
+            c[1] = data[(lz0 * bs + ly0) * bs + lx1];
+            c[2] = data[(lz0 * bs + ly1) * bs + lx0];
+            c[3] = data[(lz0 * bs + ly1) * bs + lx1];
+            c[4] = data[(lz1 * bs + ly0) * bs + lx0];
+            c[5] = data[(lz1 * bs + ly0) * bs + lx1];
+            c[6] = data[(lz1 * bs + ly1) * bs + lx0];
+            c[7] = data[(lz1 * bs + ly1) * bs + lx1];
+        }
+        else{
+            c[0] = volume.voxel(x0,y0,z0);
+            c[1] = volume.voxel(x1,y0,z0);
+            c[2] = volume.voxel(x0,y1,z0);
+            c[3] = volume.voxel(x1,y1,z0);
+            c[4] = volume.voxel(x0,y0,z1);
+            c[5] = volume.voxel(x1,y0,z1);
+            c[6] = volume.voxel(x0,y1,z1);
+            c[7] = volume.voxel(x1,y1,z1);
+        }
+        const real v0 = (c[0] * (1 - du) + c[1] * du) * (1 - dv) + (c[2] * (1 - du) + c[3] * du) * dv;
+        const real v1 = (c[4] * (1 - du) + c[5] * du) * (1 - dv) + (c[6] * (1 - du) + c[7] * du) * dv;
+        return Spectrum(v0 * (1 - dw) + v1 * dw);
+    }
+
+    Spectrum max_spectrum() const noexcept override{
+        return Spectrum(volume.max_value());
+    }
+
+    real max_real() const noexcept override{
+        return volume.max_value();
+    }
+
+    real max_real(const Point3f& low,const Point3f& high) const noexcept override{
+        real min_v, max_v;
+        brick_range(low,high,min_v,max_v);
+        return max_v;
+    }
+
+    real min_real(const Point3f& low,const Point3f& high) const noexcept override{
+        real min_v, max_v;
+        brick_range(low,high,min_v,max_v);
+        return min_v;
+    }
+
+private:
+    //conservative range from min max of bricks touched by linear sampling in the box
+    void brick_range(const Point3f& low,const Point3f& high,real& min_v,real& max_v) const noexcept{
+        constexpr int bs = SparseVolume::brick_size;
+        const int size[3] = {volume.width(),volume.height(),volume.depth()};
+        int lo[3], hi[3];
+        for(int i = 0; i < 3; ++i){
+            const real l = std::clamp<real>(low[i],0,1) * (size[i] - 1);
+            const real h = std::clamp<real>(high[i],0,1) * (size[i] - 1);
+            lo[i] = std::clamp(static_cast<int>(std::floor(l)),0,size[i] - 1) / bs;
+            hi[i] = std::clamp(static_cast<int>(std::ceil(h)),0,size[i] - 1) / bs;
+        }
+        min_v = std::numeric_limits<real>::max();
+        max_v = std::numeric_limits<real>::lowest();
+        for(int bz = lo[2]; bz <= hi[2]; ++bz){
+            for(int by = lo[1]; by <= hi[1]; ++by){
+                for(int bx = lo[0]; bx <= hi[0]; ++bx){
+                    const int64_t brick = volume.brick_index(bx,by,bz);
+                    if(brick < 0){
+                        min_v = (std::min)(min_v,volume.background());
+                        max_v = (std::max)(max_v,volume.background());
+                    }
+                    else{
+                        const auto& range = volume.brick_range(brick);
+                        min_v = (std::min)(min_v,range.min_value);
+                        max_v = (std::max)(max_v,range.max_value);
+                    }
+                }
+            }
+        }
+    }
+
+    SparseVolume volume;
+};
+
+RC<Texture3D> create_sparse_texture3d(const std::string& filename){
+    return newRC<SparseTexture3D>(filename);
+}
+
+TRACER_END
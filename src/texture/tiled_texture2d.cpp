@@ -0,0 +1,84 @@
+//
+// Created by wyz on 2022/6/22.
+//
+#include "core/texture.hpp"
+#include "utility/texture_cache.hpp"
+TRACER_BEGIN
+
+    //image texture whose texels live in a tiled file and are paged in through TextureCache
+    template<typename Texel>
+    class TiledTexture2D: public Texture2D{
+    public:
+        TiledTexture2D(const RC<TiledTextureFile>& file,const RC<TextureCache>& cache,const Spectrum& scale)
+        :file(file),cache(cache),scale(scale),gamma_encoded(file->texel_format() == TexelFormat::Color3bGamma)
+        {}
+
+        int width() const noexcept override{
+            return file->width();
+        }
+
+        int height() const noexcept override{
+            return file->height();
+        }
+
+        Spectrum evaluate_impl(const Point2f& uv) const noexcept override{
+            return sample_level(uv,0);
+        }
+
+        Spectrum evaluate_impl(const Point2f& uv,real uv_footprint) const noexcept override{
+            //same level selection as ImageTexture2D
+            const real texel_footprint = uv_footprint * (std::max)(file->width(),file->height());
+            const real level = (std::min)(std::log2((std::max)(texel_footprint,real(1))),real(file->levels() - 1));
+            if(level <= 0)
+                return sample_level(uv,0);
+            const int l0 = static_cast<int>(level);
+            const int l1 = (std::min)(l0 + 1,file->levels() - 1);
+            const real t = level - l0;
+            return sample_level(uv,l0) * (1 - t) + sample_level(uv,l1) * t;
+        }
+
+    private:
+        Spectrum sample_level(const Point2f& uv,int level) const noexcept{
+            const int w = file->width(level), h = file->height(level);
+            const real u = std::clamp<real>(uv.x,0,1) * (w - 1);
+            const real v = std::clamp<real>(uv.y,0,1) * (h - 1);
+            const int u0 = std::clamp(static_cast<int>(u),0,w - 1);
+            const int v0 = std::clamp(static_cast<int>(v),0,h - 1);
+            const int u1 = (std::min)(u0 + 1,w - 1);
+            const int v1 = (std::min)(v0 + 1,h - 1);
+            const real du = u - u0, dv = v - v0;
+            return (texel(level,u0,v0) * (1 - du) + texel(level,u1,v0) * du) * (1 - dv) +
+                   (texel(level,u0,v1) * (1 - du) + texel(level,u1,v1) * du) * dv;
+        }
+
+        Spectrum texel(int level,int x,int y) const noexcept{
+            const int ts = file->tile_size();
+            const auto tile = cache->get_tile(*file,level,x / ts,y / ts);
+            const auto& t = tile->template at<Texel>(x % ts,y % ts,ts);
+            if constexpr(std::is_same_v<Texel,Color3b>){
+                if(gamma_encoded)
+                    return Spectrum(gamma_table.decode(t.x),gamma_table.decode(t.y),gamma_table.decode(t.z)) * scale;
+                return Spectrum(t.x / real(255),t.y / real(255),t.z / real(255)) * scale;
+            }
+            else
+                return Spectrum(t.x,t.y,t.z) * scale;
+        }
+
+        RC<TiledTextureFile> file;
+        RC<TextureCache> cache;
+        Spectrum scale;
+        bool gamma_encoded;
+    };
+
+    RC<Texture2D> create_tiled_texture2d(const RC<TiledTextureFile>& file,const RC<TextureCache>& cache,const Spectrum& scale){
+        switch(file->texel_format()){
+            case TexelFormat::Color3b:
+            case TexelFormat::Color3bGamma:
+                return newRC<TiledTexture2D<Color3b>>(file,cache,scale);
+            case TexelFormat::Color3f:
+                return newRC<TiledTexture2D<Color3f>>(file,cache,scale);
+        }
+        throw std::runtime_error("invalid texel format");
+    }
+
+TRACER_END
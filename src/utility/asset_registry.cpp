@@ -0,0 +1,108 @@
+//
+// Created by wyz on 2022/6/23.
+//
+#include "asset_registry.hpp"
+#include <filesystem>
+#include "utility/logger.hpp"
+
+TRACER_BEGIN
+
+    namespace{
+        //memory added by the load running on this thread, nullptr outside of loads
+        thread_local size_t* loading_memory = nullptr;
+    }
+
+    void AssetRegistry::add_memory(size_t bytes){
+        if(loading_memory)
+            *loading_memory += bytes;
+        else
+            memory += bytes;
+    }
+
+    RC<void> AssetRegistry::get_impl(const std::string& key,const std::string& version,
+                                     const std::function<RC<void>()>& load){
+        std::promise<RC<void>> promise;
+        std::shared_future<RC<void>> future;
+        uint64_t serial = 0;
+        bool owner = false;
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            auto it = assets.find(key);
+            if(it != assets.end() && it->second.version == version){
+                future = it->second.future;
+            }
+            else{
+                if(it != assets.end()){
+                    LOG_INFO("asset {} changed, drop the old version",key);
+                    memory -= it->second.memory;
+                    assets.erase(it);
+                }
+                future = promise.get_future().share();
+                serial = ++next_serial;
+                assets.emplace(key,Entry{version,future,serial});
+                owner = true;
+            }
+        }
+        if(!owner){
+            ++hits;
+            return future.get();
+        }
+        size_t load_memory = 0;
+        size_t* const outer_memory = loading_memory;
+        loading_memory = &load_memory;
+        try{
+            auto asset = load();
+            loading_memory = outer_memory;
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                auto it = assets.find(key);
+                //counted only if the entry was not dropped or cleared meanwhile
+                if(it != assets.end() && it->second.serial == serial){
+                    it->second.memory = load_memory;
+                    memory += load_memory;
+                }
+            }
+            promise.set_value(std::move(asset));
+            ++loads;
+        }
+        catch(...){
+            loading_memory = outer_memory;
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                auto it = assets.find(key);
+                if(it != assets.end() && it->second.serial == serial)
+                    assets.erase(it);
+            }
+            promise.set_exception(std::current_exception());
+        }
+        return future.get();
+    }
+
+    size_t AssetRegistry::size() const{
+        std::lock_guard<std::mutex> lk(mutex);
+        return assets.size();
+    }
+
+    void AssetRegistry::clear(){
+        std::lock_guard<std::mutex> lk(mutex);
+        assets.clear();
+        memory = 0;
+    }
+
+    void AssetRegistry::log_stats() const{
+        LOG_INFO("asset registry: {} assets, {} loads, {} shared hits, {:.1f} MB",
+                 size(),loads.load(),hits.load(),memory.load() / double(1 << 20));
+    }
+
+    AssetRegistry& asset_registry(){
+        static AssetRegistry registry;
+        return registry;
+    }
+
+    std::string file_version(const std::string& file){
+        std::error_code ec;
+        const auto time = std::filesystem::last_write_time(file,ec);
+        return ec ? std::string() : std::to_string(time.time_since_epoch().count());
+    }
+
+TRACER_END
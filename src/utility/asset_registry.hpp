@@ -0,0 +1,74 @@
+//
+// Created by wyz on 2022/6/23.
+//
+
+#ifndef TRACER_ASSET_REGISTRY_HPP
+#define TRACER_ASSET_REGISTRY_HPP
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "common.hpp"
+
+TRACER_BEGIN
+
+//shares loaded assets by key, each key is loaded at most once
+//different keys may load concurrently from any threads, a thread asking for
+//a key being loaded by another thread waits for it instead of loading again
+class AssetRegistry{
+public:
+    //key should contain everything that changes the loaded result, e.g. path and conversion
+    //a failed load is not kept and the exception is thrown to all waiting callers
+    //an entry of the key with another version, e.g. of a file edited since, is dropped and loaded again,
+    //so only the latest version of an asset stays resident
+    template<typename T,typename F>
+    RC<T> get(const std::string& key,const std::string& version,F&& load){
+        return std::static_pointer_cast<T>(get_impl(key,version,[&]() -> RC<void>{
+            return std::const_pointer_cast<std::remove_const_t<T>>(RC<T>(load()));
+        }));
+    }
+
+    template<typename T,typename F>
+    RC<T> get(const std::string& key,F&& load){
+        return get<T>(key,std::string(),std::forward<F>(load));
+    }
+
+    //bytes is an estimate of memory held by the asset being loaded on this thread, only used by stats
+    void add_memory(size_t bytes);
+
+    size_t size() const;
+
+    void clear();
+
+    void log_stats() const;
+
+private:
+    RC<void> get_impl(const std::string& key,const std::string& version,const std::function<RC<void>()>& load);
+
+    struct Entry{
+        std::string version;
+        std::shared_future<RC<void>> future;
+        //tells a reloaded entry from the one a load was started for
+        uint64_t serial = 0;
+        size_t memory = 0;
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string,Entry> assets;
+    uint64_t next_serial = 0;
+    std::atomic<size_t> hits = 0;
+    std::atomic<size_t> loads = 0;
+    std::atomic<size_t> memory = 0;
+};
+
+AssetRegistry& asset_registry();
+
+//modification time of file as text, empty if it does not exist, used as the version of assets loaded from it
+std::string file_version(const std::string& file);
+
+TRACER_END
+
+#endif //TRACER_ASSET_REGISTRY_HPP
@@ -0,0 +1,345 @@
+//
+// Created by wyz on 2022/6/29.
+//
+#include "exr_file.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include "utility/logger.hpp"
+
+//zlib stream encoder of stb_image_write, defined in image_file.cpp
+extern "C" unsigned char* stbi_zlib_compress(unsigned char* data,int data_len,int* out_len,int quality);
+
+TRACER_BEGIN
+
+namespace{
+
+    //round to nearest even, overflow becomes infinity
+    uint16_t float_to_half(float f){
+        uint32_t x;
+        std::memcpy(&x,&f,sizeof(x));
+        const uint32_t sign = (x >> 16) & 0x8000;
+        const uint32_t mag = x & 0x7fffffff;
+        if(mag >= 0x7f800000)
+            return static_cast<uint16_t>(sign | (mag > 0x7f800000 ? 0x7e00 : 0x7c00));
+        if(mag >= 0x477ff000)
+            return static_cast<uint16_t>(sign | 0x7c00);
+        if(mag < 0x38800000){
+            //subnormal half
+            if(mag < 0x33000000)
+                return static_cast<uint16_t>(sign);
+            const uint32_t e = mag >> 23;
+            const uint32_t m = (mag & 0x7fffff) | 0x800000;
+            const uint32_t shift = 126 - e;
+            uint32_t h = m >> shift;
+            const uint32_t rest = m & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+            if(rest > halfway || (rest == halfway && (h & 1)))
+                ++h;
+            return static_cast<uint16_t>(sign | h);
+        }
+        uint32_t h = (mag - 0x38000000) >> 13;
+        const uint32_t rest = mag & 0x1fff;
+        if(rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+            ++h;
+        return static_cast<uint16_t>(sign | h);
+    }
+
+    //exr is little endian
+    template<typename T>
+    void put(std::string& out,T value){
+        char bytes[sizeof(T)];
+        std::memcpy(bytes,&value,sizeof(T));
+        out.append(bytes,sizeof(T));
+    }
+
+    void put_attribute(std::string& out,const char* name,const char* type,const std::string& value){
+        out.append(name,std::strlen(name) + 1);
+        out.append(type,std::strlen(type) + 1);
+        put<int32_t>(out,static_cast<int32_t>(value.size()));
+        out += value;
+    }
+
+    //interleave low and high halves and store byte deltas, then deflate as the zip compressor of openexr does
+    //return raw if compressing does not make it smaller
+    std::string zip_compress(const std::string& raw){
+        const size_t n = raw.size();
+        std::string tmp(n,'\0');
+        size_t lo = 0, hi = (n + 1) / 2;
+        for(size_t i = 0; i < n; ++i)
+            tmp[(i & 1) ? hi++ : lo++] = raw[i];
+        int prev = static_cast<uint8_t>(tmp[0]);
+        for(size_t i = 1; i < n; ++i){
+            const int cur = static_cast<uint8_t>(tmp[i]);
+            tmp[i] = static_cast<char>((cur - prev + (128 + 256)) & 0xff);
+            prev = cur;
+        }
+        int compressed_size = 0;
+        unsigned char* compressed = stbi_zlib_compress(reinterpret_cast<unsigned char*>(tmp.data()),
+                                                       static_cast<int>(n),&compressed_size,8);
+        if(!compressed)
+            return raw;
+        std::string ret;
+        if(static_cast<size_t>(compressed_size) < n)
+            ret.assign(reinterpret_cast<const char*>(compressed),compressed_size);
+        else
+            ret = raw;
+        std::free(compressed);
+        return ret;
+    }
+
+}
+
+ExrWriter::ExrWriter(const std::string& filename,int width,int height,std::vector<ExrChannel> channels,
+                     ExrCompression compression,int tile_size)
+:filename(filename),image_width(width),image_height(height),channels(std::move(channels)),
+compression(compression),tile_size(tile_size)
+{
+    if(width <= 0 || height <= 0 || tile_size < 0)
+        throw std::runtime_error("invalid exr size of " + filename);
+    if(this->channels.empty())
+        throw std::runtime_error("exr without channels: " + filename);
+    file_channel_order.resize(this->channels.size());
+    std::iota(file_channel_order.begin(),file_channel_order.end(),0);
+    std::sort(file_channel_order.begin(),file_channel_order.end(),[&](int a,int b){
+        return this->channels[a].name < this->channels[b].name;
+    });
+    for(size_t i = 1; i < file_channel_order.size(); ++i){
+        if(this->channels[file_channel_order[i]].name == this->channels[file_channel_order[i - 1]].name)
+            throw std::runtime_error("duplicate exr channel " + this->channels[file_channel_order[i]].name);
+    }
+    const size_t block_count = tile_size > 0 ? (size_t)tile_count_x() * tile_count_y()
+                                             : (size_t)(height + block_rows() - 1) / block_rows();
+    block_offsets.assign(block_count,0);
+
+    file.open(filename,std::ios::binary);
+    if(!file.is_open())
+        throw std::runtime_error("failed to open exr file: " + filename);
+    write_header();
+}
+
+ExrWriter::~ExrWriter(){
+    if(finished)
+        return;
+    try{
+        finish();
+    }
+    catch(const std::exception& e){
+        LOG_ERROR("{}",e.what());
+    }
+}
+
+void ExrWriter::write_header(){
+    std::string header;
+    put<uint32_t>(header,20000630);
+    bool long_names = false;
+    for(auto& c:channels)
+        long_names |= c.name.size() > 31;
+    put<uint32_t>(header,2 | (tile_size > 0 ? 0x200 : 0) | (long_names ? 0x400 : 0));
+
+    std::string chlist;
+    for(int i:file_channel_order){
+        chlist.append(channels[i].name.c_str(),channels[i].name.size() + 1);
+        put<int32_t>(chlist,static_cast<int32_t>(channels[i].type));
+        put<uint32_t>(chlist,0);//linear flag and reserved
+        put<int32_t>(chlist,1);
+        put<int32_t>(chlist,1);
+    }
+    chlist.push_back('\0');
+    put_attribute(header,"channels","chlist",chlist);
+    put_attribute(header,"compression","compression",std::string(1,static_cast<char>(compression)));
+    std::string window;
+    for(int32_t v:{0,0,image_width - 1,image_height - 1})
+        put<int32_t>(window,v);
+    put_attribute(header,"dataWindow","box2i",window);
+    put_attribute(header,"displayWindow","box2i",window);
+    //tiles arrive in any order, scanline blocks are placed by the offset table anyway
+    put_attribute(header,"lineOrder","lineOrder",std::string(1,static_cast<char>(tile_size > 0 ? 2 : 0)));
+    std::string value;
+    put<float>(value,1);
+    put_attribute(header,"pixelAspectRatio","float",value);
+    value.clear();
+    put<float>(value,0);
+    put<float>(value,0);
+    put_attribute(header,"screenWindowCenter","v2f",value);
+    value.clear();
+    put<float>(value,1);
+    put_attribute(header,"screenWindowWidth","float",value);
+    if(tile_size > 0){
+        value.clear();
+        put<uint32_t>(value,tile_size);
+        put<uint32_t>(value,tile_size);
+        value.push_back('\0');//one level
+        put_attribute(header,"tiles","tiledesc",value);
+    }
+    header.push_back('\0');
+
+    file.write(header.data(),static_cast<std::streamsize>(header.size()));
+    offset_table_pos = header.size();
+    const std::vector<uint64_t> zeros(block_offsets.size(),0);
+    file.write(reinterpret_cast<const char*>(zeros.data()),static_cast<std::streamsize>(zeros.size() * sizeof(uint64_t)));
+}
+
+void ExrWriter::write_rows(int y,int row_count,const float* pixels){
+    if(tile_size > 0)
+        throw std::runtime_error("write rows to tiled exr " + filename);
+    if(y < 0 || row_count <= 0 || y + row_count > image_height)
+        throw std::runtime_error("rows out of exr image " + filename);
+    const size_t row_floats = (size_t)image_width * channels.size();
+    const int rows_per_block = block_rows();
+    while(row_count > 0){
+        const int block = y / rows_per_block;
+        const int block_y = block * rows_per_block;
+        const int block_height = (std::min)(rows_per_block,image_height - block_y);
+        const int n = (std::min)(row_count,block_y + block_height - y);
+        if(n == block_height){
+            write_block(block,0,block_y,image_width,block_height,pixels);
+        }
+        else{
+            //wait for the other rows of the block
+            std::vector<float> complete;
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                auto& pending = pending_blocks[block];
+                if(pending.pixels.empty())
+                    pending.pixels.resize(row_floats * block_height);
+                std::copy_n(pixels,row_floats * n,pending.pixels.begin() + (y - block_y) * row_floats);
+                pending.row_count += n;
+                if(pending.row_count >= block_height){
+                    complete = std::move(pending.pixels);
+                    pending_blocks.erase(block);
+                }
+            }
+            if(!complete.empty())
+                write_block(block,0,block_y,image_width,block_height,complete.data());
+        }
+        y += n;
+        row_count -= n;
+        pixels += row_floats * n;
+    }
+}
+
+void ExrWriter::write_tile(int tx,int ty,const float* pixels){
+    if(tile_size <= 0)
+        throw std::runtime_error("write tile to scanline exr " + filename);
+    if(tx < 0 || ty < 0 || tx >= tile_count_x() || ty >= tile_count_y())
+        throw std::runtime_error("tile out of exr image " + filename);
+    const int x = tx * tile_size, y = ty * tile_size;
+    write_block(ty * tile_count_x() + tx,x,y,(std::min)(tile_size,image_width - x),(std::min)(tile_size,image_height - y),pixels);
+}
+
+void ExrWriter::write_block(int index,int x,int y,int width,int height,const float* pixels){
+    //rows of planar channels in file order
+    size_t pixel_bytes = 0;
+    for(auto& c:channels)
+        pixel_bytes += c.type == ExrPixelType::Half ? 2 : 4;
+    std::string raw;
+    raw.reserve(pixel_bytes * width * height);
+    const size_t channel_count = channels.size();
+    for(int row = 0; row < height; ++row){
+        const float* src = pixels + (size_t)row * width * channel_count;
+        for(int c:file_channel_order){
+            if(channels[c].type == ExrPixelType::Half){
+                for(int i = 0; i < width; ++i)
+                    put<uint16_t>(raw,float_to_half(src[i * channel_count + c]));
+            }
+            else{
+                for(int i = 0; i < width; ++i)
+                    put<float>(raw,src[i * channel_count + c]);
+            }
+        }
+    }
+    const std::string data = compression == ExrCompression::Zip ? zip_compress(raw) : raw;
+
+    std::string chunk_header;
+    if(tile_size > 0){
+        put<int32_t>(chunk_header,x / tile_size);
+        put<int32_t>(chunk_header,y / tile_size);
+        put<int32_t>(chunk_header,0);
+        put<int32_t>(chunk_header,0);
+    }
+    else
+        put<int32_t>(chunk_header,y);
+    put<int32_t>(chunk_header,static_cast<int32_t>(data.size()));
+
+    std::lock_guard<std::mutex> lk(mutex);
+    if(finished)
+        throw std::runtime_error("write to finished exr " + filename);
+    if(block_offsets[index])
+        throw std::runtime_error("exr block written twice in " + filename);
+    block_offsets[index] = static_cast<uint64_t>(file.tellp());
+    file.write(chunk_header.data(),static_cast<std::streamsize>(chunk_header.size()));
+    file.write(data.data(),static_cast<std::streamsize>(data.size()));
+}
+
+void ExrWriter::finish(){
+    std::lock_guard<std::mutex> lk(mutex);
+    if(finished)
+        return;
+    finished = true;
+    const auto missing = std::count(block_offsets.begin(),block_offsets.end(),0);
+    file.seekp(static_cast<std::streamoff>(offset_table_pos));
+    file.write(reinterpret_cast<const char*>(block_offsets.data()),
+               static_cast<std::streamsize>(block_offsets.size() * sizeof(uint64_t)));
+    file.close();
+    if(missing > 0)
+        throw std::runtime_error(std::to_string(missing) + " blocks are not written to exr " + filename);
+    if(file.fail())
+        throw std::runtime_error("failed to write exr file: " + filename);
+}
+
+void write_layers_to_exr(const std::vector<ExrLayer>& layers,const std::string& filename,ExrPixelType type){
+    if(layers.empty())
+        throw std::runtime_error("no layer to write to " + filename);
+    auto layer_size = [](const ExrLayer& layer){
+        return layer.scalar ? Point2i(layer.scalar->width(),layer.scalar->height())
+                            : Point2i(layer.image->width(),layer.image->height());
+    };
+    const int w = layer_size(layers.front()).x, h = layer_size(layers.front()).y;
+    std::vector<ExrChannel> channels;
+    for(auto& layer:layers){
+        if(layer_size(layer) != Point2i(w,h))
+            throw std::runtime_error("layers of different sizes in " + filename);
+        if(layer.scalar){
+            if(layer.name.empty())
+                throw std::runtime_error("one channel layer without name in " + filename);
+            channels.push_back({layer.name,ExrPixelType::Float});
+            continue;
+        }
+        const std::string prefix = layer.name.empty() ? std::string() : layer.name + ".";
+        for(auto c:{"R","G","B"})
+            channels.push_back({prefix + c,type});
+    }
+    const size_t channel_count = channels.size();
+    ExrWriter writer(filename,w,h,std::move(channels));
+    const int rows = writer.block_rows();
+    std::vector<float> pixels;
+    for(int y = 0; y < h; y += rows){
+        const int n = (std::min)(rows,h - y);
+        pixels.resize((size_t)w * n * channel_count);
+        float* p = pixels.data();
+        for(int row = y; row < y + n; ++row){
+            for(int x = 0; x < w; ++x){
+                for(auto& layer:layers){
+                    if(layer.scalar){
+                        *p++ = static_cast<float>(layer.scalar->at(x,row));
+                        continue;
+                    }
+                    const auto& c = layer.image->at(x,row);
+                    *p++ = static_cast<float>(c.r);
+                    *p++ = static_cast<float>(c.g);
+                    *p++ = static_cast<float>(c.b);
+                }
+            }
+        }
+        writer.write_rows(y,n,pixels.data());
+    }
+    writer.finish();
+}
+
+void write_image_to_exr(const Image2D<Spectrum>& image,const std::string& filename,ExrPixelType type){
+    write_layers_to_exr({{"",&image}},filename,type);
+}
+
+TRACER_END
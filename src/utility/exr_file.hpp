@@ -0,0 +1,119 @@
+//
+// Created by wyz on 2022/6/29.
+//
+
+#ifndef TRACER_EXR_FILE_HPP
+#define TRACER_EXR_FILE_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common.hpp"
+#include "utility/image.hpp"
+#include "core/spectrum.hpp"
+
+TRACER_BEGIN
+
+enum class ExrPixelType : int32_t{
+    Half = 1,
+    Float = 2
+};
+
+enum class ExrCompression : uint8_t{
+    None = 0,
+    //zlib over 16 scanlines or one tile, blocks that do not shrink are stored as is
+    Zip = 3
+};
+
+struct ExrChannel{
+    //"layer.R" groups channels into layers, compositors show "R", "G", "B" and "A" as the default layer
+    std::string name;
+    ExrPixelType type = ExrPixelType::Half;
+};
+
+//single part OpenEXR file written block by block, only blocks that have not got all their rows
+//are held in memory, so an image never needs to be converted as a whole
+//blocks may arrive in any order and from any thread, the offset table is written by finish
+class ExrWriter{
+public:
+    //tile_size 0 writes scanline blocks, otherwise square tiles of one level
+    ExrWriter(const std::string& filename,int width,int height,std::vector<ExrChannel> channels,
+              ExrCompression compression = ExrCompression::Zip,int tile_size = 0);
+
+    //finishes the file if finish was not called, errors are logged
+    ~ExrWriter();
+
+    ExrWriter(const ExrWriter&) = delete;
+    ExrWriter& operator=(const ExrWriter&) = delete;
+
+    int width() const noexcept{ return image_width; }
+
+    int height() const noexcept{ return image_height; }
+
+    //rows of one scanline block
+    int block_rows() const noexcept{ return compression == ExrCompression::Zip ? 16 : 1; }
+
+    int tile_count_x() const noexcept{ return (image_width + tile_size - 1) / tile_size; }
+
+    int tile_count_y() const noexcept{ return (image_height + tile_size - 1) / tile_size; }
+
+    //row_count rows starting at y, each pixel has one float per channel in the order given to the constructor
+    //a block is compressed and written once all of its rows arrived
+    void write_rows(int y,int row_count,const float* pixels);
+
+    //pixels of tile (tx,ty) row by row in the same layout as write_rows,
+    //tiles on the right and bottom borders are cut to the image
+    void write_tile(int tx,int ty,const float* pixels);
+
+    //writes the offset table and closes the file, throws if a block is missing
+    void finish();
+
+private:
+    void write_header();
+
+    //pixels has rows of width values of all channels
+    void write_block(int index,int x,int y,int width,int height,const float* pixels);
+
+    std::string filename;
+    int image_width;
+    int image_height;
+    std::vector<ExrChannel> channels;
+    //index into channels of the i-th channel sorted by name as stored in the file
+    std::vector<int> file_channel_order;
+    ExrCompression compression;
+    int tile_size;
+
+    std::mutex mutex;
+    std::ofstream file;
+    uint64_t offset_table_pos = 0;
+    std::vector<uint64_t> block_offsets;
+    struct PendingBlock{
+        std::vector<float> pixels;
+        int row_count = 0;
+    };
+    std::map<int,PendingBlock> pending_blocks;
+    bool finished = false;
+};
+
+struct ExrLayer{
+    //empty for the default layer, channels of other layers are named name.R, name.G and name.B
+    std::string name;
+    const Image2D<Spectrum>* image = nullptr;
+    //used instead of image for a layer of one channel called name, always written as float
+    //since depth and ids lose precision in half
+    const Image2D<real>* scalar = nullptr;
+};
+
+//layers of the same size into one file, converted and written in scanline blocks
+void write_layers_to_exr(const std::vector<ExrLayer>& layers,const std::string& filename,
+                         ExrPixelType type = ExrPixelType::Half);
+
+void write_image_to_exr(const Image2D<Spectrum>& image,const std::string& filename,
+                        ExrPixelType type = ExrPixelType::Half);
+
+TRACER_END
+
+#endif //TRACER_EXR_FILE_HPP
@@ -810,6 +810,13 @@ namespace tracer {
         mutable real t_max;
     };
 
+    //offset rays of a film shift in x and y, used to estimate texture footprint
+    struct RayDifferential{
+        Point3f rx_o, ry_o;
+        Vector3f rx_d, ry_d;
+        bool valid = false;
+    };
+
     template <typename T>
     inline bool Bounds3<T>::intersect_p(const Ray &ray, real *hitt0,
                                        real *hitt1) const {
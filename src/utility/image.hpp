@@ -6,7 +6,9 @@
 #define TRACER_IMAGE_HPP
 
 #include "common.hpp"
+#include "utility/geometry.hpp"
 #include "utility/logger.hpp"
+#include "utility/parallel.hpp"
 TRACER_BEGIN
 
     template<typename T>
@@ -65,6 +67,12 @@ TRACER_BEGIN
             return data[x + y * w];
         }
 
+        //no bounds check, for hot paths whose coordinates are already clamped
+        T& unchecked(int x,int y) const noexcept{
+            assert(x >= 0 && x < w && y >= 0 && y < h);
+            return data[x + y * w];
+        }
+
         void destroy(){
             if(data){
                 data.reset();
@@ -86,6 +94,118 @@ TRACER_BEGIN
         int w,h;
     };
 
+    //block-linear layout: 4x4 blocks stored row by row, texels row by row inside a block
+    //horizontal and vertical neighbors mostly share a block, which suits bilinear fetches
+    //at random uv and 2d tile accesses better than row-major
+    //no raw data access, use to_image for consumers expecting row-major
+    template<typename T>
+    class BlockImage2D{
+    public:
+        static constexpr int block_shift = 2;
+        static constexpr int block_size = 1 << block_shift;
+        static constexpr int block_mask = block_size - 1;
+
+        BlockImage2D():w(0),h(0),blocks_x(0){}
+        BlockImage2D(int width,int height)
+        :w(width),h(height),blocks_x((width + block_mask) >> block_shift),
+        data(newBox<T[]>((size_t)blocks_x * ((height + block_mask) >> block_shift) * block_size * block_size))
+        {}
+        explicit BlockImage2D(const Image2D<T>& image)
+        :BlockImage2D(image.width(),image.height())
+        {
+            for(int y = 0; y < h; ++y)
+                for(int x = 0; x < w; ++x)
+                    unchecked(x,y) = image.unchecked(x,y);
+        }
+        BlockImage2D(BlockImage2D&& other) noexcept = default;
+        BlockImage2D& operator=(BlockImage2D&& other) noexcept = default;
+
+        T& operator()(int x,int y) const{
+            return at(x,y);
+        }
+
+        T& at(int x,int y) const{
+            if(x < 0 || x >= w || y < 0 || y >= h){
+                LOG_CRITICAL("invalid x y {} {}",x,y);
+                throw std::out_of_range("invalid x y");
+            }
+            return unchecked(x,y);
+        }
+
+        //no bounds check, for hot paths whose coordinates are already clamped
+        T& unchecked(int x,int y) const noexcept{
+            assert(x >= 0 && x < w && y >= 0 && y < h);
+            const size_t block = (size_t)(y >> block_shift) * blocks_x + (x >> block_shift);
+            return data[(block << (2 * block_shift)) | ((y & block_mask) << block_shift) | (x & block_mask)];
+        }
+
+        Image2D<T> to_image() const{
+            Image2D<T> image(w,h);
+            for(int y = 0; y < h; ++y)
+                for(int x = 0; x < w; ++x)
+                    image.unchecked(x,y) = unchecked(x,y);
+            return image;
+        }
+
+        int width() const {return w;}
+        int height() const{return h;}
+
+    private:
+        int w,h;
+        int blocks_x;
+        Box<T[]> data;
+    };
+
+    template<typename T>
+    T mip_average(const T& t00,const T& t01,const T& t10,const T& t11){
+        return (t00 + t01 + t10 + t11) * 0.25;
+    }
+
+    //sum of 8 bit channels overflows
+    inline Color3b mip_average(const Color3b& t00,const Color3b& t01,const Color3b& t10,const Color3b& t11){
+        return Color3b((t00.x + t01.x + t10.x + t11.x + 2) / 4,
+                       (t00.y + t01.y + t10.y + t11.y + 2) / 4,
+                       (t00.z + t01.z + t10.z + t11.z + 2) / 4);
+    }
+
+    //8 bit ldr texels stay gamma encoded in memory and are decoded through a table
+    //so texture lookups never call pow, gamma 2.2 as ldr textures are loaded with
+    class GammaTable{
+    public:
+        static constexpr real gamma = real(2.2);
+
+        GammaTable(){
+            for(int i = 0; i < 256; ++i)
+                to_linear[i] = std::pow(i / real(255),gamma);
+        }
+
+        real decode(uint8_t c) const noexcept{
+            return to_linear[c];
+        }
+
+        Color3f decode(const Color3b& c) const noexcept{
+            return {to_linear[c.x],to_linear[c.y],to_linear[c.z]};
+        }
+
+        //load time only
+        static Color3b encode(const Color3f& c) noexcept{
+            auto e = [](real x){
+                return static_cast<uint8_t>(std::clamp<real>(std::pow(std::clamp<real>(x,0,1),1 / gamma) * 255 + real(0.5),0,255));
+            };
+            return Color3b(e(c.x),e(c.y),e(c.z));
+        }
+
+        //average in linear space
+        Color3b mip_average(const Color3b& t00,const Color3b& t01,const Color3b& t10,const Color3b& t11) const noexcept{
+            return encode((decode(t00) + decode(t01) + decode(t10) + decode(t11)) * real(0.25));
+        }
+
+    private:
+        real to_linear[256];
+    };
+
+    inline const GammaTable gamma_table;
+
     template<typename T>
     class MipMap2D{
     public:
@@ -93,7 +213,17 @@ TRACER_BEGIN
         explicit MipMap2D(const Image2D<T>& lod0_image){
             generate(lod0_image);
         }
-        void generate(const Image2D<T>& lod0_image);
+        //levels are halved down to 1x1, odd sizes are rounded up and their last row and column
+        //are averaged with themselves, so no texel of the finer level is dropped
+        void generate(const Image2D<T>& lod0_image){
+            generate(lod0_image,[](const T& t00,const T& t01,const T& t10,const T& t11){
+                return mip_average(t00,t01,t10,t11);
+            });
+        }
+
+        //average combines 2x2 texels of the finer level, rows of large levels are built in parallel
+        template<typename F>
+        void generate(const Image2D<T>& lod0_image,F&& average,int worker_count = 0);
 
         int levels() const{
             return images.size();
@@ -101,43 +231,46 @@ TRACER_BEGIN
         bool valid() const{
             return levels() > 0;
         }
-        const Image2D<T>& get_level(int level) const{
+        const BlockImage2D<T>& get_level(int level) const{
             assert(level >=0 && level <levels());
             return images[level];
         }
     private:
-        std::vector<Image2D<T>> images;
+        std::vector<BlockImage2D<T>> images;
     };
 
     template<typename T>
-    void MipMap2D<T>::generate(const Image2D<T> &lod0_image) {
+    template<typename F>
+    void MipMap2D<T>::generate(const Image2D<T> &lod0_image,F&& average,int worker_count) {
         this->images.clear();
         int last_w = lod0_image.width();
         int last_h = lod0_image.height();
         images.emplace_back(lod0_image);
-        while(last_w > 1 && last_h > 1){
-            if((last_w & 1) || (last_h & 1)){
-                this->images.clear();
-                throw std::runtime_error("invalid input image size: must be power of 2");
-            }
-            const int cur_w = last_w >> 1;
-            const int cur_h = last_h >> 1;
-            Image2D<T> cur_lod_image(cur_w,cur_h);
-            auto& last_lod_image = images.back();
-            for(int y = 0; y < cur_h; ++y){
-                const int ly = y << 1;
+        while(last_w > 1 || last_h > 1){
+            const int cur_w = (last_w + 1) >> 1;
+            const int cur_h = (last_h + 1) >> 1;
+            BlockImage2D<T> cur_lod_image(cur_w,cur_h);
+            const auto& last_lod_image = images.back();
+            auto build_row = [&](int,int y){
+                const int y0 = (std::min)(2 * y,last_h - 1);
+                const int y1 = (std::min)(2 * y + 1,last_h - 1);
                 for(int x = 0; x < cur_w; ++x){
-                    const int lx = x << 1;
-                    const auto t00 = last_lod_image.at(lx,ly);
-                    const auto t01 = last_lod_image.at(lx+1,ly);
-                    const auto t10 = last_lod_image.at(lx,ly+1);
-                    const auto t11 = last_lod_image.at(lx+1,ly+1);
-                    cur_lod_image.at(x,y) = (t00 + t01 + t10 + t11) * 0.25;
+                    const int x0 = (std::min)(2 * x,last_w - 1);
+                    const int x1 = (std::min)(2 * x + 1,last_w - 1);
+                    cur_lod_image.unchecked(x,y) = average(last_lod_image.unchecked(x0,y0),last_lod_image.unchecked(x1,y0),
+                                                           last_lod_image.unchecked(x0,y1),last_lod_image.unchecked(x1,y1));
                 }
+            };
+            if(cur_h >= 256){
+                parallel_forrange(0,cur_h,build_row,worker_count);
+            }
+            else{
+                for(int y = 0; y < cur_h; ++y)
+                    build_row(0,y);
             }
             images.emplace_back(std::move(cur_lod_image));
-            last_w >>= 1;
-            last_h >>= 1;
+            last_w = cur_w;
+            last_h = cur_h;
         }
     }
 
@@ -9,75 +9,109 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "factory/texture.hpp"
+#include "utility/asset_registry.hpp"
+#include "utility/parallel.hpp"
+#include <filesystem>
 TRACER_BEGIN
 
     void write_image_to_hdr(const Image2D<Spectrum>& image,
                             const std::string& filename){
-        stbi_write_hdr(filename.c_str(),
-                       image.width(),
-                       image.height(),
-                       3,
-                       reinterpret_cast<const float*>(image.get_raw_data()));
+        if constexpr(SPECTRUM_PADDED){
+            //drop the pad lane
+            std::vector<float> packed;
+            packed.reserve(static_cast<size_t>(image.width()) * image.height() * 3);
+            auto p = image.get_raw_data();
+            for(size_t i = 0, n = static_cast<size_t>(image.width()) * image.height(); i < n; ++i){
+                packed.push_back(p[i].r);
+                packed.push_back(p[i].g);
+                packed.push_back(p[i].b);
+            }
+            stbi_write_hdr(filename.c_str(),image.width(),image.height(),3,packed.data());
+        }
+        else{
+            stbi_write_hdr(filename.c_str(),
+                           image.width(),
+                           image.height(),
+                           3,
+                           reinterpret_cast<const float*>(image.get_raw_data()));
+        }
     }
     void write_image_to_png(const Image2D<Color3b>& image,const std::string& filename){
         stbi_write_png(filename.c_str(),image.width(),image.height(),3,image.get_raw_data(),0);
     }
 
+    void write_image_to_png(const Image2D<Spectrum>& image,const std::string& filename){
+        Image2D<Color3b> imgu8(image.width(),image.height());
+        real inv_gamma = 1.0 / 2.2;
+        for(int i = 0; i < image.width(); i++){
+            for(int j = 0; j < image.height(); j++){
+                imgu8.at(i,j).x = std::clamp<int>(std::pow(image.at(i,j).r,inv_gamma) * 255,0,255);
+                imgu8.at(i,j).y = std::clamp<int>(std::pow(image.at(i,j).g,inv_gamma) * 255,0,255);
+                imgu8.at(i,j).z = std::clamp<int>(std::pow(image.at(i,j).b,inv_gamma) * 255,0,255);
+            }
+        }
+        write_image_to_png(imgu8,filename);
+    }
+
+    //flip flag is set per thread so images can be decoded concurrently
     RC<Image2D<Color3b>> load_image_from_file(const std::string& filename){
-        stbi_set_flip_vertically_on_load(true);
+        stbi_set_flip_vertically_on_load_thread(true);
         int w,h,nComp;
         auto d = stbi_load(filename.c_str(),&w,&h,&nComp,0);
         if(!d){
             throw std::runtime_error("load image failed");
         }
+        RC<Image2D<Color3b>> image;
         if(nComp == 3){
-            return newRC<Image2D<Color3b>>(w,h,reinterpret_cast<Color3b*>(d));
+            image = newRC<Image2D<Color3b>>(w,h,reinterpret_cast<Color3b*>(d));
         }
         else if(nComp == 1){
             LOG_INFO("load image with 1 component");
-            auto image = newRC<Image2D<Color3b>>(w,h);
+            image = newRC<Image2D<Color3b>>(w,h);
             auto p = image->get_raw_data();
             for(int i = 0; i < w * h; ++i){
                 p[i] = {d[i],d[i],d[i]};
             }
-            return image;
         }
         else if(nComp == 4){
             LOG_INFO("load image with 4 component");
-            auto image = newRC<Image2D<Color3b>>(w,h);
+            image = newRC<Image2D<Color3b>>(w,h);
             auto p = image->get_raw_data();
             for(int i = 0; i < w * h; ++i){
                 p[i] = {d[i*4],d[i*4+1],d[i*4+2]};
             }
-            return image;
         }
-        else{
+        stbi_image_free(d);
+        if(!image){
             throw std::runtime_error("invalid image component");
         }
+        return image;
     }
 
     RC<Image2D<Color3f>> load_hdr_from_file(const std::string& filename){
-        stbi_set_flip_vertically_on_load(false);
+        stbi_set_flip_vertically_on_load_thread(false);
         int w,h,nComp;
         auto d = stbi_loadf(filename.c_str(),&w,&h,&nComp,0);
         if(!d){
             throw std::runtime_error("load image failed");
         }
+        RC<Image2D<Color3f>> image;
         if(nComp == 3){
-            return newRC<Image2D<Color3f>>(w,h,reinterpret_cast<Color3f*>(d));
+            image = newRC<Image2D<Color3f>>(w,h,reinterpret_cast<Color3f*>(d));
         }
         else if(nComp == 4){
             LOG_INFO("load image with 4 component");
-            auto image = newRC<Image2D<Color3f>>(w,h);
+            image = newRC<Image2D<Color3f>>(w,h);
             auto p = image->get_raw_data();
             for(int i = 0; i < w * h; ++i){
-                p[i] = {d[i*3],d[i*3+1],d[i*3+2]};
+                p[i] = {d[i*4],d[i*4+1],d[i*4+2]};
             }
-            return image;
         }
-        else{
+        stbi_image_free(d);
+        if(!image){
             throw std::runtime_error("invalid image component");
         }
+        return image;
     }
 
     bool is_float_image(const std::string& filename){
@@ -97,6 +131,73 @@ TRACER_BEGIN
         }
     }
 
+    static RC<TextureCache> texture_cache;
+    static std::string texture_cache_directory;
+
+    void enable_texture_cache(const std::string& directory,size_t max_memory){
+        std::filesystem::create_directories(directory);
+        texture_cache_directory = directory;
+        texture_cache = newRC<TextureCache>(max_memory);
+        LOG_INFO("enable texture cache at {} with {} MB",directory,max_memory >> 20);
+    }
+
+    RC<TextureCache> get_texture_cache(){
+        return texture_cache;
+    }
+
+    //registry key of a decoded file and how its texels are converted,
+    //it is loaded with file_version so an edited file replaces its old decoded data
+    static std::string _asset_key(const char* conversion,const std::string& name){
+        std::error_code ec;
+        const auto path = std::filesystem::weakly_canonical(name,ec);
+        return std::string(conversion) + ":" + (ec ? name : path.string());
+    }
+
+    static RC<const MipMap2D<Color3b>> _load_texture_mipmap(const std::string& name,bool gamma_encoded){
+        return asset_registry().get<const MipMap2D<Color3b>>(_asset_key(gamma_encoded ? "ldr_gamma" : "ldr",name),
+                                                             file_version(name),[&]{
+            auto mipmap = create_texture_mipmap(*load_image_from_file(name),gamma_encoded);
+            size_t bytes = 0;
+            for(int i = 0; i < mipmap->levels(); ++i)
+                bytes += sizeof(Color3b) * mipmap->get_level(i).width() * mipmap->get_level(i).height();
+            asset_registry().add_memory(bytes);
+            return mipmap;
+        });
+    }
+
+    static RC<const BlockImage2D<Color3f>> _load_hdr_image(const std::string& name){
+        return asset_registry().get<const BlockImage2D<Color3f>>(_asset_key("hdr",name),file_version(name),[&]{
+            auto image = newRC<BlockImage2D<Color3f>>(*load_hdr_from_file(name));
+            asset_registry().add_memory(sizeof(Color3f) * image->width() * image->height());
+            return image;
+        });
+    }
+
+    //convert to a tiled file on first use and rebuild it if the source is newer or the format changed
+    static RC<TiledTextureFile> _load_tiled_texture(const std::string& name){
+        return asset_registry().get<TiledTextureFile>(_asset_key("tiled",name),file_version(name),[&]{
+            namespace fs = std::filesystem;
+            const fs::path src(name);
+            char suffix[32];
+            std::snprintf(suffix,sizeof(suffix),"_%016llx.ttx",
+                          static_cast<unsigned long long>(std::hash<std::string>()(fs::absolute(src).string())));
+            const fs::path tiled = fs::path(texture_cache_directory) / (src.stem().string() + suffix);
+            if(!fs::exists(tiled) || fs::last_write_time(tiled) < fs::last_write_time(src)
+            || !TiledTextureFile::is_current(tiled.string())){
+                LOG_INFO("convert texture to tiled file: {}",tiled.string());
+                //write to a temporary file so an interrupted conversion is not picked up
+                const std::string tmp = tiled.string() + ".tmp";
+                if(!is_float_image(name))
+                    write_tiled_texture(tmp,*load_image_from_file(name),64,true);
+                else
+                    write_tiled_texture(tmp,*load_hdr_from_file(name));
+                fs::rename(tmp,tiled);
+            }
+            return newRC<TiledTextureFile>(tiled.string());
+        });
+    }
+
+    //decoded data is shared through the registry, textures only add their own scale
     static RC<Texture2D> _create_texture_from_file(const std::string& name,real scale_r,real scale_g,real scale_b){
         Spectrum constant = {scale_r,scale_g,scale_b};
         if(name.empty()){
@@ -107,24 +208,17 @@ TRACER_BEGIN
             if(!scale_r && !scale_g && !scale_b){
                 scale_r = scale_g = scale_b = 1;
             }
+            const Spectrum scale(scale_r,scale_g,scale_b);
             LOG_INFO("load texture from file: {}, scale: {} {} {}",name,scale_r,scale_g,scale_b);
+            if(texture_cache){
+                return create_tiled_texture2d(_load_tiled_texture(name),texture_cache,scale);
+            }
             if(!is_float_image(name)){
-                auto image = load_image_from_file(name);
-                image->map([](const Color3b& c){
-                   Color3f t{(real)c.x/255,(real)c.y/255,(real)c.z/255};
-                   real gamma =  2.2;
-                   t.x = std::pow(t.x,gamma);
-                   t.y = std::pow(t.y,gamma);
-                   t.z = std::pow(t.z,gamma);
-                   return Color3b(t.x*255,t.y*255,t.z*255);
-                });
-                image->operator*=( Color3f(scale_r,scale_g,scale_b));
-                return create_image_texture2d(image);
+                //ldr texels stay gamma encoded and are linearized by table at lookup
+                return create_image_texture2d(_load_texture_mipmap(name,true),true,scale);
             }
             else{
-                auto image = load_hdr_from_file(name);
-                image->operator*=( Color3f(scale_r,scale_g,scale_b));
-                return create_hdr_texture2d(image);
+                return create_hdr_texture2d(_load_hdr_image(name),scale);
             }
         }
     }
@@ -136,6 +230,29 @@ TRACER_BEGIN
         return _create_texture_from_file(name,scale,scale,scale);
     }
 
+    void preload_material_textures(const std::vector<material_t>& materials,int worker_count){
+        std::vector<std::string> names;
+        for(auto& material:materials){
+            for(auto name:{&material.map_ka,&material.map_kd,&material.map_ks,&material.map_ns,&material.map_ke}){
+                if(!name->empty())
+                    names.emplace_back(*name);
+            }
+        }
+        std::sort(names.begin(),names.end());
+        names.erase(std::unique(names.begin(),names.end()),names.end());
+        LOG_INFO("preload {} distinct texture files",names.size());
+        parallel_forrange(size_t(0),names.size(),[&](int,size_t i){
+            const auto& name = names[i];
+            if(texture_cache)
+                _load_tiled_texture(name);
+            else if(!is_float_image(name))
+                _load_texture_mipmap(name,true);
+            else
+                _load_hdr_image(name);
+        },worker_count);
+        asset_registry().log_stats();
+    }
+
     MaterialTexture create_texture_from_file(const material_t& material){
         MaterialTexture textures;
         real one[3] = {1.0,1.0,1.0};
@@ -168,13 +285,20 @@ TRACER_BEGIN
     RC<const Texture2D> create_texture2d_from_file(const std::string& filename){
 
         if(!is_float_image(filename)){
-            auto img = load_image_from_file(filename);
-            return create_image_texture2d(img);
+            return create_image_texture2d(_load_texture_mipmap(filename,false),false,Spectrum(1));
         }
         else{
-            auto img = load_hdr_from_file(filename);
-            return create_hdr_texture2d(img);
+            return create_hdr_texture2d(_load_hdr_image(filename),Spectrum(1));
         }
     }
 
+    RC<Texture2D> create_texture2d_from_file(const std::string& filename,bool gamma_encoded,const Spectrum& scale){
+        const bool hdr = is_float_image(filename);
+        if(texture_cache && (hdr || gamma_encoded))
+            return create_tiled_texture2d(_load_tiled_texture(filename),texture_cache,scale);
+        if(hdr)
+            return create_hdr_texture2d(_load_hdr_image(filename),scale);
+        return create_image_texture2d(_load_texture_mipmap(filename,gamma_encoded),gamma_encoded,scale);
+    }
+
 TRACER_END
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "core/render.hpp"
 #include <string>
 #include "core/texture.hpp"
+#include "utility/texture_cache.hpp"
 TRACER_BEGIN
 
 void write_image_to_hdr(const Image2D<Spectrum>&,
@@ -14,12 +15,26 @@ void write_image_to_hdr(const Image2D<Spectrum>&,
 
     void write_image_to_png(const Image2D<Color3b>& image,const std::string& filename);
 
+//linear radiance encoded with gamma 2.2 and clamped to 8 bit
+void write_image_to_png(const Image2D<Spectrum>& image,const std::string& filename);
+
 RC<Image2D<Color3b>> load_image_from_file(const std::string& filename);
 
 RC<Image2D<Color3f>> load_hdr_from_file(const std::string& filename);
 
 RC<const Texture2D> create_texture2d_from_file(const std::string& filename);
 
+//decoded data is shared through the asset registry and paged through the texture cache if enabled,
+//gamma_encoded only applies to ldr files, linear ldr files bypass the cache
+RC<Texture2D> create_texture2d_from_file(const std::string& filename,bool gamma_encoded,const Spectrum& scale);
+
+//material textures loaded after this are converted to tiled files under directory once
+//and paged in through a cache holding at most max_memory bytes of tiles
+void enable_texture_cache(const std::string& directory,size_t max_memory);
+
+//nullptr if not enabled
+RC<TextureCache> get_texture_cache();
+
 struct MaterialTexture{
     RC<Texture2D> map_ka;
     RC<Texture2D> map_kd;
@@ -44,6 +59,10 @@ struct MaterialTexture{
 struct material_t;
 MaterialTexture create_texture_from_file(const material_t& material);
 
+//decode all distinct texture files of materials concurrently into the shared asset registry,
+//create_texture_from_file then only wraps the shared data
+void preload_material_textures(const std::vector<material_t>& materials,int worker_count = 0);
+
 TRACER_END
 
 #endif //TRACER_IMAGE_FILE_HPP
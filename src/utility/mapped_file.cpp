@@ -0,0 +1,85 @@
+//
+// Created by wyz on 2022/6/21.
+//
+#include "mapped_file.hpp"
+#include <stdexcept>
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+TRACER_BEGIN
+
+#ifdef _WIN32
+
+    MappedFile::MappedFile(const std::string& filename){
+        file_handle = CreateFileA(filename.c_str(),GENERIC_READ,FILE_SHARE_READ,nullptr,
+                                  OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS,nullptr);
+        if(file_handle == INVALID_HANDLE_VALUE){
+            file_handle = nullptr;
+            throw std::runtime_error("open file failed: " + filename);
+        }
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(file_handle,&size)){
+            CloseHandle(file_handle);
+            throw std::runtime_error("get file size failed: " + filename);
+        }
+        file_size = static_cast<size_t>(size.QuadPart);
+        mapping_handle = CreateFileMappingA(file_handle,nullptr,PAGE_READONLY,0,0,nullptr);
+        if(!mapping_handle){
+            CloseHandle(file_handle);
+            throw std::runtime_error("map file failed: " + filename);
+        }
+        ptr = MapViewOfFile(mapping_handle,FILE_MAP_READ,0,0,0);
+        if(!ptr){
+            CloseHandle(mapping_handle);
+            CloseHandle(file_handle);
+            throw std::runtime_error("map file failed: " + filename);
+        }
+    }
+
+    MappedFile::~MappedFile(){
+        if(ptr)
+            UnmapViewOfFile(ptr);
+        if(mapping_handle)
+            CloseHandle(mapping_handle);
+        if(file_handle)
+            CloseHandle(file_handle);
+    }
+
+#else
+
+    MappedFile::MappedFile(const std::string& filename){
+        fd = open(filename.c_str(),O_RDONLY);
+        if(fd < 0)
+            throw std::runtime_error("open file failed: " + filename);
+        struct stat st{};
+        if(fstat(fd,&st) != 0){
+            close(fd);
+            throw std::runtime_error("get file size failed: " + filename);
+        }
+        file_size = static_cast<size_t>(st.st_size);
+        void* p = mmap(nullptr,file_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if(p == MAP_FAILED){
+            close(fd);
+            throw std::runtime_error("map file failed: " + filename);
+        }
+        madvise(p,file_size,MADV_RANDOM);
+        ptr = p;
+    }
+
+    MappedFile::~MappedFile(){
+        if(ptr)
+            munmap(const_cast<void*>(ptr),file_size);
+        if(fd >= 0)
+            close(fd);
+    }
+
+#endif
+
+TRACER_END
@@ -0,0 +1,44 @@
+//
+// Created by wyz on 2022/6/21.
+//
+
+#ifndef TRACER_MAPPED_FILE_HPP
+#define TRACER_MAPPED_FILE_HPP
+
+#include <string>
+#include "common.hpp"
+
+TRACER_BEGIN
+
+//read-only memory mapped file, pages are loaded by os on first access
+class MappedFile{
+public:
+    explicit MappedFile(const std::string& filename);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const void* data() const noexcept{
+        return ptr;
+    }
+
+    size_t size() const noexcept{
+        return file_size;
+    }
+
+private:
+    const void* ptr = nullptr;
+    size_t file_size = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+TRACER_END
+
+#endif //TRACER_MAPPED_FILE_HPP
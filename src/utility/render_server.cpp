@@ -0,0 +1,200 @@
+//
+// Created by wyz on 2022/6/28.
+//
+#include "render_server.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <nlohmann/json.hpp>
+#include <spdlog/sinks/stdout_sinks.h>
+#include "utility/asset_registry.hpp"
+#include "utility/logger.hpp"
+#include "utility/scene_file.hpp"
+
+TRACER_BEGIN
+
+namespace{
+
+    using json = nlohmann::json;
+    using Clock = std::chrono::steady_clock;
+
+    double elapsed_ms(Clock::time_point start){
+        return std::chrono::duration<double,std::milli>(Clock::now() - start).count();
+    }
+
+    //little endian floats, rows from bottom to top
+    std::string encode_pfm(const Image2D<Spectrum>& image){
+        const int w = image.width(), h = image.height();
+        const std::string header = "PF\n" + std::to_string(w) + " " + std::to_string(h) + "\n-1\n";
+        std::string data(header.size() + sizeof(float) * 3 * w * h,'\0');
+        std::memcpy(data.data(),header.data(),header.size());
+        char* p = data.data() + header.size();
+        for(int y = h - 1; y >= 0; --y){
+            for(int x = 0; x < w; ++x){
+                const auto& c = image.at(x,y);
+                const float rgb[3] = {static_cast<float>(c.r),static_cast<float>(c.g),static_cast<float>(c.b)};
+                std::memcpy(p,rgb,sizeof(rgb));
+                p += sizeof(rgb);
+            }
+        }
+        return data;
+    }
+
+    class RenderServer{
+    public:
+        explicit RenderServer(std::ostream& out)
+        :out(out)
+        {}
+
+        //false once a quit command is served
+        bool serve(const std::string& line){
+            json response;
+            try{
+                const auto request = json::parse(line);
+                response["id"] = request.value("id",json());
+                if(auto it = request.find("command"); it != request.end()){
+                    const auto command = it->get<std::string>();
+                    if(command == "quit"){
+                        response["status"] = "ok";
+                        respond(response);
+                        return false;
+                    }
+                    if(command != "clear")
+                        throw std::runtime_error("unknown command: " + command);
+                    scenes.clear();
+                    primary_hit_caches.clear();
+                    asset_registry().clear();
+                    LOG_INFO("clear resident scenes and assets");
+                    response["status"] = "ok";
+                    respond(response);
+                    return true;
+                }
+                render(request,response);
+            }
+            catch(const std::exception& e){
+                LOG_ERROR("render job failed: {}",e.what());
+                response["status"] = "error";
+                response["message"] = e.what();
+                respond(response);
+            }
+            return true;
+        }
+
+    private:
+        void render(const json& request,json& response){
+            auto start = Clock::now();
+            const std::filesystem::path path(request.at("scene").get<std::string>());
+            std::ifstream in(path);
+            if(!in.is_open())
+                throw std::runtime_error("failed to open scene file: " + path.string());
+            auto scene_json = json::parse(in,nullptr,true,true);
+            if(auto it = request.find("patch"); it != request.end())
+                scene_json.merge_patch(*it);
+
+            const std::string key = std::filesystem::weakly_canonical(path).string();
+            auto it = scenes.find(key);
+            const SceneDescription* previous = it == scenes.end() ? nullptr : &it->second;
+            auto desc = load_scene_description(scene_json.dump(),path.parent_path().string(),path.stem().string(),previous);
+            const bool reused = previous && previous->scene == desc.scene;
+            scenes[key] = desc;
+            const bool incremental = request.value("incremental",false);
+            if(incremental && !desc.views.empty())
+                throw std::runtime_error("incremental render is not supported for batch jobs");
+            PrimaryHits* primary_hits = incremental ? &primary_hit_caches[key] : nullptr;
+            if(primary_hits && primary_hits->desc.scene)
+                mark_edited_samples(primary_hits->desc,desc,primary_hits->buffer);
+            //jobs of one scene would overwrite each other unless the patch names the output
+            const auto& id = response["id"];
+            if(!id.is_null() && !request.contains(json::json_pointer("/patch/output/name")))
+                desc.output.name += "_" + (id.is_string() ? id.get<std::string>() : id.dump());
+            //environment lights may be shared with other resident scenes of different bounds
+            desc.scene->prepare_to_render();
+            const double load_ms = elapsed_ms(start);
+
+            const bool send_inline = request.value("inline",false);
+            if(send_inline && !desc.views.empty())
+                throw std::runtime_error("inline images are not supported for batch jobs");
+            start = Clock::now();
+            std::vector<std::string> files;
+            std::string pfm;
+            if(desc.views.empty()){
+                Film film({desc.width,desc.height},desc.filter,desc.aov_channels);
+                RenderTarget render_target;
+                if(primary_hits){
+                    const auto& buffer = primary_hits->buffer;
+                    response["primary_hits"] = buffer.empty() ? "built" : "reused";
+                    response["reshaded_samples"] = std::count(buffer.marks.begin(),buffer.marks.end(),PrimaryHitBuffer::Reshade);
+                    response["retraced_samples"] = std::count(buffer.marks.begin(),buffer.marks.end(),PrimaryHitBuffer::Retrace);
+                    primary_hits->desc = desc;
+                    try{
+                        render_target = desc.renderer->render_cached(*desc.scene,std::move(film),primary_hits->buffer);
+                    }
+                    catch(...){
+                        //the buffer may be half updated
+                        primary_hit_caches.erase(key);
+                        throw;
+                    }
+                }
+                else
+                    render_target = desc.renderer->render(*desc.scene,std::move(film));
+                if(send_inline)
+                    pfm = encode_pfm(render_target.color);
+                files = write_scene_outputs(desc.output,render_target);
+            }
+            else
+                files = render_scene_views(desc);
+            const double render_ms = elapsed_ms(start);
+
+            response["status"] = "ok";
+            response["scene_reused"] = reused;
+            response["load_ms"] = load_ms;
+            response["render_ms"] = render_ms;
+            response["width"] = desc.width;
+            response["height"] = desc.height;
+            response["images"] = files;
+            if(send_inline)
+                response["pfm_bytes"] = pfm.size();
+            LOG_INFO("job {} done, scene reused: {}, load {:.1f}ms, render {:.1f}ms",id.dump(),reused,load_ms,render_ms);
+            respond(response);
+            if(send_inline){
+                out.write(pfm.data(),static_cast<std::streamsize>(pfm.size()));
+                out.flush();
+            }
+        }
+
+        void respond(const json& response){
+            out << response.dump() << '\n';
+            out.flush();
+        }
+
+        std::ostream& out;
+        //by canonical path of the scene file
+        std::unordered_map<std::string,SceneDescription> scenes;
+        //primary hits of the last incremental job of a scene file with the description it rendered
+        struct PrimaryHits{
+            SceneDescription desc;
+            PrimaryHitBuffer buffer;
+        };
+        std::unordered_map<std::string,PrimaryHits> primary_hit_caches;
+    };
+
+}
+
+void run_render_server(std::istream& in,std::ostream& out){
+    spdlog::set_default_logger(spdlog::stderr_logger_mt("tracer_server"));
+    LOG_INFO("render server started");
+    RenderServer server(out);
+    std::string line;
+    while(std::getline(in,line)){
+        if(line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        if(!server.serve(line))
+            break;
+    }
+    LOG_INFO("render server stopped");
+}
+
+TRACER_END
@@ -0,0 +1,29 @@
+//
+// Created by wyz on 2022/6/28.
+//
+
+#ifndef TRACER_RENDER_SERVER_HPP
+#define TRACER_RENDER_SERVER_HPP
+
+#include <iostream>
+#include "common.hpp"
+
+TRACER_BEGIN
+
+//serves render jobs read from in as json lines until in is closed or a quit command arrives
+//job: {"id": "a", "scene": "scenes/cornell_box.json", "patch": {"renderer": {"spp": 64}}, "inline": false}
+//patch is merged into the scene file (json merge patch, null removes a field) and
+//the job id is appended to the output name unless the patch sets it
+//scenes stay resident by path and are only rebuilt if fields other than output, film, camera
+//and renderer change, decoded textures, parsed meshes and environment lights are shared across rebuilds
+//each job answers one json line with status, timings and written images, with inline set
+//the line has pfm_bytes and is followed by the image as a binary pfm of that size
+//with "incremental": true the primary hit of every sample is kept per scene file and the next incremental
+//job only evaluates the samples its edit affects, see mark_edited_samples, the response tells how many
+//{"command": "clear"} drops resident scenes and cached assets, {"command": "quit"} stops serving
+//logs go to stderr so that out only carries responses
+void run_render_server(std::istream& in,std::ostream& out);
+
+TRACER_END
+
+#endif //TRACER_RENDER_SERVER_HPP
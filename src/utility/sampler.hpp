@@ -13,8 +13,9 @@ TRACER_BEGIN
     struct LinearSampler
     {
 
-        template <typename Texel>
-        static auto Sample2D(const Image2D<Texel> &tex, double u, double v) -> Texel
+        //indices are clamped so fetches skip bounds checks
+        template <typename Image>
+        static auto Sample2D(const Image &tex, double u, double v) -> std::remove_reference_t<decltype(tex.unchecked(0,0))>
         {
             u = std::clamp(u, 0.0, 1.0) * (tex.width() - 1);
             v = std::clamp(v, 0.0, 1.0) * (tex.height() - 1);
@@ -24,8 +25,8 @@ TRACER_BEGIN
             int v1 = std::clamp(v0 + 1, 0, static_cast<int>(tex.height() - 1));
             double d_u = u - u0;
             double d_v = v - v0;
-            return (tex(u0, v0) * (1.0 - d_u) + tex(u1, v0) * d_u) * (1.0 - d_v) +
-                   (tex(u0, v1) * (1.0 - d_u) + tex(u1, v1) * d_u) * d_v;
+            return (tex.unchecked(u0, v0) * (1.0 - d_u) + tex.unchecked(u1, v0) * d_u) * (1.0 - d_v) +
+                   (tex.unchecked(u0, v1) * (1.0 - d_u) + tex.unchecked(u1, v1) * d_u) * d_v;
         }
 
         template<typename Texel>
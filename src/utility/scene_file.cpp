@@ -0,0 +1,1216 @@
+//
+// Created by wyz on 2022/6/27.
+//
+#include "scene_file.hpp"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <nlohmann/json.hpp>
+#include "core/bssrdf.hpp"
+#include "core/camera.hpp"
+#include "core/light.hpp"
+#include "core/primitive.hpp"
+#include "factory/accelerator.hpp"
+#include "factory/camera.hpp"
+#include "factory/filter.hpp"
+#include "factory/light.hpp"
+#include "factory/material.hpp"
+#include "factory/medium.hpp"
+#include "factory/post_processor.hpp"
+#include "factory/primivite.hpp"
+#include "factory/renderer.hpp"
+#include "factory/scene.hpp"
+#include "factory/shape.hpp"
+#include "factory/texture.hpp"
+#include "utility/asset_registry.hpp"
+#include "utility/exr_file.hpp"
+#include "utility/image_file.hpp"
+#include "utility/logger.hpp"
+#include "utility/parallel.hpp"
+#include "utility/timer.hpp"
+#include "utility/transform.hpp"
+
+TRACER_BEGIN
+
+using json = nlohmann::json;
+
+namespace{
+
+    using TextureFuture = std::shared_future<RC<const Texture2D>>;
+    using MaterialFuture = std::shared_future<RC<Material>>;
+    using MediumFuture = std::shared_future<RC<Medium>>;
+
+    struct ShapeResult{
+        std::vector<RC<Primitive>> primitives;
+        Span<const Light*> lights;
+        //files the shape depends on besides those in its json
+        std::vector<std::string> files;
+    };
+
+    //parsed obj with the mtl files and textures its materials come from
+    struct ObjModel{
+        model_t model;
+        std::vector<std::string> files;
+    };
+    using ShapeFuture = std::shared_future<ShapeResult>;
+
+    //runs on its own thread right away, for decoding and parsing files
+    template<typename F>
+    auto launch(F&& f){
+        return std::async(std::launch::async,std::forward<F>(f)).share();
+    }
+
+    //runs on the first thread asking for the result, for cheap work waiting on other tasks
+    template<typename F>
+    auto defer(F&& f){
+        return std::async(std::launch::deferred,std::forward<F>(f)).share();
+    }
+
+    template<typename T>
+    std::shared_future<T> ready(T value){
+        std::promise<T> promise;
+        promise.set_value(std::move(value));
+        return promise.get_future().share();
+    }
+
+    [[noreturn]] void error(const std::string& msg){
+        throw std::runtime_error("scene file: " + msg);
+    }
+
+    //reads fields of a json object and reports fields never asked for, which are most likely typos
+    class ObjectReader{
+    public:
+        ObjectReader(const json& object,std::string what)
+        :object(object),what(std::move(what))
+        {
+            if(!object.is_object())
+                error(this->what + " should be an object");
+        }
+
+        const json* find(const std::string& key){
+            used.insert(key);
+            auto it = object.find(key);
+            return it == object.end() ? nullptr : &*it;
+        }
+
+        const json& require(const std::string& key){
+            auto value = find(key);
+            if(!value)
+                error("missing " + key + " of " + what);
+            return *value;
+        }
+
+        template<typename T>
+        void read(const std::string& key,T& value){
+            if(auto v = find(key))
+                value = v->get<T>();
+        }
+
+        template<typename T>
+        T get(const std::string& key,T default_value){
+            read(key,default_value);
+            return default_value;
+        }
+
+        void check() const{
+            for(auto& [key,value]:object.items()){
+                if(!used.count(key))
+                    error("unknown field " + key + " of " + what);
+            }
+        }
+
+        const std::string& name() const{
+            return what;
+        }
+
+    private:
+        const json& object;
+        std::string what;
+        std::set<std::string> used;
+    };
+
+    Spectrum to_spectrum(const json& j){
+        if(j.is_number())
+            return Spectrum(j.get<real>());
+        if(j.is_array() && j.size() == 3)
+            return Spectrum(j[0].get<real>(),j[1].get<real>(),j[2].get<real>());
+        error("expect a number or an array of 3 numbers: " + j.dump());
+    }
+
+    Vector3f to_vector(const json& j){
+        if(!j.is_array() || j.size() != 3)
+            error("expect an array of 3 numbers: " + j.dump());
+        return Vector3f(j[0].get<real>(),j[1].get<real>(),j[2].get<real>());
+    }
+
+    Point3f to_point(const json& j){
+        const auto v = to_vector(j);
+        return Point3f(v.x,v.y,v.z);
+    }
+
+    real to_radians(real degrees){
+        return PI_r * degrees / 180;
+    }
+
+    //list of operations applied to the object in order, angles in degrees
+    //e.g. [{"scale": 2}, {"rotate_y": 30}, {"translate": [0, 1, 0]}]
+    Transform to_transform(const json* j){
+        Transform t;
+        if(!j)
+            return t;
+        if(!j->is_array())
+            error("transform should be an array of operations: " + j->dump());
+        for(auto& op:*j){
+            if(!op.is_object() || op.size() != 1)
+                error("transform operation should be an object of one field: " + op.dump());
+            const auto& [key,value] = *op.items().begin();
+            Transform m;
+            if(key == "translate")
+                m = translate(to_vector(value));
+            else if(key == "scale"){
+                const auto s = to_spectrum(value);
+                m = scale(s.r,s.g,s.b);
+            }
+            else if(key == "rotate_x")
+                m = rotate_x(to_radians(value.get<real>()));
+            else if(key == "rotate_y")
+                m = rotate_y(to_radians(value.get<real>()));
+            else if(key == "rotate_z")
+                m = rotate_z(to_radians(value.get<real>()));
+            else
+                error("unknown transform operation: " + key);
+            t = m * t;
+        }
+        return t;
+    }
+
+    //names of aov channels in film aovs and of their exr layers
+    const std::pair<AOVChannel,const char*> aov_channel_names[] = {
+            {AOVAlbedo,"albedo"},{AOVNormal,"normal"},{AOVDepth,"depth"},
+            {AOVPrimitiveId,"primitive_id"},{AOVMaterialId,"material_id"},
+            {AOVDirect,"direct"},{AOVIndirect,"indirect"}
+    };
+
+    struct TextureParam{
+        const char* name;
+        Spectrum default_value;
+    };
+
+    //texture parameters of each material type in the order of its factory arguments
+    const std::unordered_map<std::string,std::vector<TextureParam>>& material_texture_params(){
+        static const std::unordered_map<std::string,std::vector<TextureParam>> params = {
+                {"phong",{{"ka",Spectrum(0)},{"kd",Spectrum(0.5f)},{"ks",Spectrum(0)},{"ns",Spectrum(1)}}},
+                {"glass",{{"kr",Spectrum(1)},{"kt",Spectrum(1)},{"ior",Spectrum(1.5f)}}},
+                {"metal",{{"color",Spectrum(1)},{"eta",Spectrum(0.2f,0.92f,1.1f)},{"k",Spectrum(3.9f,2.45f,2.14f)},
+                          {"roughness",Spectrum(0.1f)},{"anisotropic",Spectrum(0)}}},
+                {"disney",{{"base_color",Spectrum(0.8f)},{"metallic",Spectrum(0)},{"roughness",Spectrum(0.5f)},
+                           {"transmission",Spectrum(0)},{"transmission_roughness",Spectrum(0)},{"ior",Spectrum(1.5f)},
+                           {"specular_scale",Spectrum(1)},{"specular_tint",Spectrum(0)},{"anisotropic",Spectrum(0)},
+                           {"sheen",Spectrum(0)},{"sheen_tint",Spectrum(0)},{"clearcoat",Spectrum(0)},
+                           {"clearcoat_gloss",Spectrum(1)}}},
+                {"disney_brdf",{{"base_color",Spectrum(0.8f)},{"subsurface",Spectrum(0)},{"metallic",Spectrum(0)},
+                                {"specular",Spectrum(0.5f)},{"specular_tint",Spectrum(0)},{"roughness",Spectrum(0.5f)},
+                                {"anisotropic",Spectrum(0)},{"sheen",Spectrum(0)},{"sheen_tint",Spectrum(0.5f)},
+                                {"clearcoat",Spectrum(0)},{"clearcoat_gloss",Spectrum(1)}}},
+                {"disney_bsdf",{{"base_color",Spectrum(0.8f)},{"metallic",Spectrum(0)},{"ior",Spectrum(1.5f)},
+                                {"roughness",Spectrum(0.5f)},{"specular",Spectrum(1)},{"specular_tint",Spectrum(0)},
+                                {"anisotropic",Spectrum(0)},{"sheen",Spectrum(0)},{"sheen_tint",Spectrum(0.5f)},
+                                {"clearcoat",Spectrum(0)},{"clearcoat_gloss",Spectrum(1)},{"spec_trans",Spectrum(0)},
+                                {"scatter_dist",Spectrum(0)},{"flatness",Spectrum(0)},{"diffuse_trans",Spectrum(0)}}},
+                {"invisible",{}}
+        };
+        return params;
+    }
+
+    const std::vector<TextureParam> bssrdf_texture_params = {
+            {"A",Spectrum(0.8f)},{"dmfp",Spectrum(0.1f)},{"eta",Spectrum(1.3f)}
+    };
+
+    class SceneFileLoader{
+    public:
+        SceneFileLoader(const std::string& text,std::filesystem::path directory,std::string default_name)
+        :root(json::parse(text,nullptr,true,true)),directory(std::move(directory)),default_name(std::move(default_name))
+        {}
+
+        SceneDescription load(const SceneDescription* previous){
+            AutoTimer timer("load scene file");
+            ObjectReader reader(root,"scene");
+            SceneDescription desc;
+
+            //cheap parts first so a broken file fails before any asset is loaded
+            read_output(reader.find("output"),desc);
+            read_film(reader.require("film"),desc);
+            const auto& camera_json = reader.require("camera");
+            RC<const Camera> camera = create_camera(camera_json,desc);
+            if(auto j = reader.find("batch")){
+                read_batch(*j,camera_json,desc);
+                camera = desc.views.front().camera;
+            }
+            const json renderer_json = reader.require("renderer");
+            desc.renderer = create_renderer(renderer_json);
+            desc.create_renderer_share = [renderer_json](int share_count){
+                return create_renderer(renderer_json,share_count);
+            };
+
+            json scene_part = root;
+            for(auto key:{"output","film","camera","renderer","batch"})
+                scene_part.erase(key);
+            desc.scene_key = scene_part.dump() + file_versions(scene_part).dump();
+            const std::string base_scene_key = desc.scene_key;
+            json view_part;
+            for(auto key:{"film","camera","batch"}){
+                if(auto it = root.find(key); it != root.end())
+                    view_part[key] = *it;
+            }
+            desc.view_key = view_part.dump();
+            desc.renderer_key = renderer_json.dump();
+            if(previous && previous->scene
+            && previous->scene_key == base_scene_key + file_versions(previous->dependency_files).dump()){
+                LOG_INFO("reuse resident scene, only camera, film and renderer are rebuilt");
+                desc.scene_key = previous->scene_key;
+                desc.dependency_files = previous->dependency_files;
+                desc.scene = previous->scene;
+                desc.scene->set_camera(camera);
+                desc.shapes = previous->shapes;
+                desc.global_key = previous->global_key;
+                return desc;
+            }
+            json global_part;
+            for(auto key:{"textures","media","lights"}){
+                if(auto it = root.find(key); it != root.end())
+                    global_part[key] = *it;
+            }
+            desc.global_key = global_part.dump() + file_versions(global_part).dump();
+            int max_leaf_primitives = 3;
+            if(auto j = reader.find("accelerator")){
+                ObjectReader r(*j,"accelerator");
+                r.read("max_leaf_primitives",max_leaf_primitives);
+                r.check();
+            }
+            if(auto j = reader.find("texture_cache")){
+                ObjectReader r(*j,"texture_cache");
+                const auto dir = r.get<std::string>("dir","texture_cache");
+                const auto memory_mb = r.get<size_t>("memory_mb",256);
+                r.check();
+                enable_texture_cache(dir,memory_mb << 20);
+            }
+
+            //task graph: textures, media, environment light and meshes start right away,
+            //materials and simple shapes are created by whoever needs them first
+            if(auto j = reader.find("textures")){
+                for(auto& [name,value]:j->items())
+                    textures[name] = launch_texture(value,true,"texture " + name);
+            }
+            media["vacuum"] = ready(create_vacuum());
+            if(auto j = reader.find("media")){
+                for(auto& [name,value]:j->items())
+                    media[name] = launch_medium(value,"medium " + name);
+            }
+            if(auto j = reader.find("materials")){
+                for(auto& [name,value]:j->items())
+                    materials[name] = parse_material(value,"material " + name);
+            }
+            std::shared_future<RC<EnvironmentLight>> environment_light;
+            if(auto j = reader.find("lights")){
+                for(size_t i = 0; i < j->size(); ++i){
+                    if(environment_light.valid())
+                        error("only one environment light is supported");
+                    environment_light = launch_light((*j)[i],"light " + std::to_string(i));
+                }
+            }
+            std::vector<ShapeFuture> shapes;
+            if(auto j = reader.find("shapes")){
+                for(size_t i = 0; i < j->size(); ++i)
+                    shapes.emplace_back(parse_shape((*j)[i],"shape " + std::to_string(i)));
+            }
+            reader.check();
+
+            std::vector<RC<Primitive>> primitives;
+            Span<const Light*> lights;
+            for(size_t i = 0; i < shapes.size(); ++i){
+                const auto& ret = shapes[i].get();
+                auto& shape = desc.shapes.emplace_back(describe_shape(root.at("shapes").at(i),ret.files));
+                desc.dependency_files.insert(desc.dependency_files.end(),ret.files.begin(),ret.files.end());
+                shape.first_primitive = static_cast<uint32_t>(primitives.size());
+                shape.primitive_count = static_cast<uint32_t>(ret.primitives.size());
+                shape.emissive = !ret.lights.empty();
+                for(auto& primitive:ret.primitives)
+                    shape.bounds = Union(shape.bounds,primitive->world_bound());
+                primitives.insert(primitives.end(),ret.primitives.begin(),ret.primitives.end());
+                lights.insert(lights.end(),ret.lights.begin(),ret.lights.end());
+            }
+            desc.scene_key = base_scene_key + file_versions(desc.dependency_files).dump();
+            //ids follow the order of shapes, so they stay the same while no shape is added or removed
+            Span<const Primitive*> primitive_ids;
+            primitive_ids.reserve(primitives.size());
+            for(auto& primitive:primitives)
+                primitive_ids.emplace_back(primitive.get());
+            LOG_INFO("load primitives count: {}, area lights count: {}",primitives.size(),lights.size());
+            auto bvh = create_bvh_accel(max_leaf_primitives);
+            {
+                AutoTimer bvh_timer("bvh build");
+                bvh->build(std::move(primitives));
+            }
+            desc.scene = create_general_scene(bvh);
+            desc.scene->lights = std::move(lights);
+            desc.scene->primitives = std::move(primitive_ids);
+            desc.scene->build_ids();
+            desc.scene->set_camera(camera);
+            if(environment_light.valid()){
+                desc.scene->environment_light = environment_light.get();
+                desc.scene->lights.push_back(desc.scene->environment_light.get());
+            }
+            desc.scene->prepare_to_render();
+            asset_registry().log_stats();
+            return desc;
+        }
+
+    private:
+        //keys to tell geometry edits of a shape from shading edits
+        SceneDescription::Shape describe_shape(const json& j,const std::vector<std::string>& files) const{
+            json geometry = j, shading;
+            for(auto key:{"material","emission","medium"}){
+                if(auto it = geometry.find(key); it != geometry.end()){
+                    shading[key] = *it;
+                    geometry.erase(it);
+                }
+            }
+            if(auto it = shading.find("material"); it != shading.end() && it->is_string())
+                shading["material"] = root.at("materials").at(it->get<std::string>());
+            if(auto it = geometry.find("file"); it != geometry.end() && it->is_string())
+                geometry["version"] = file_version(resolve(it->get<std::string>()));
+            auto versions = file_versions(shading);
+            versions.update(file_versions(files));
+            if(!versions.empty())
+                shading["versions"] = std::move(versions);
+            SceneDescription::Shape shape;
+            shape.geometry_key = geometry.dump();
+            shape.shading_key = shading.dump();
+            return shape;
+        }
+
+        //versions of all files referenced under j: meshes, textures, environment maps and density volumes
+        json file_versions(const json& j) const{
+            json versions = json::object();
+            collect_file_versions(j,versions);
+            return versions;
+        }
+
+        static json file_versions(const std::vector<std::string>& files){
+            json versions = json::object();
+            for(const auto& file:files)
+                versions[file] = file_version(file);
+            return versions;
+        }
+
+        void collect_file_versions(const json& j,json& versions) const{
+            if(j.is_object()){
+                for(auto it = j.begin(); it != j.end(); ++it){
+                    if((it.key() == "file" || it.key() == "density") && it->is_string()){
+                        const auto file = resolve(it->get<std::string>());
+                        versions[file] = file_version(file);
+                    }
+                    else
+                        collect_file_versions(*it,versions);
+                }
+            }
+            else if(j.is_array()){
+                for(const auto& e:j)
+                    collect_file_versions(e,versions);
+            }
+        }
+
+        std::string resolve(const std::string& path) const{
+            const std::filesystem::path p(path);
+            if(p.empty() || p.is_absolute())
+                return path;
+            return (directory / p).string();
+        }
+
+        void read_output(const json* j,SceneDescription& desc){
+            desc.output.name = default_name;
+            if(!j)
+                return;
+            ObjectReader r(*j,"output");
+            r.read("name",desc.output.name);
+            r.read("hdr",desc.output.write_hdr);
+            r.read("png",desc.output.write_png);
+            r.read("exr",desc.output.exr);
+            r.read("tone_mapper",desc.output.tone_mapper);
+            r.read("exposure",desc.output.exposure);
+            r.read("stats_file",desc.output.stats_file);
+            r.check();
+            if(!desc.output.tone_mapper.empty() && desc.output.tone_mapper != "aces")
+                error("unknown tone mapper: " + desc.output.tone_mapper);
+            if(!desc.output.exr.empty() && desc.output.exr != "half" && desc.output.exr != "float")
+                error("exr should be half or float");
+        }
+
+        void read_film(const json& j,SceneDescription& desc){
+            ObjectReader r(j,"film");
+            desc.width = r.require("width").get<int>();
+            desc.height = r.require("height").get<int>();
+            if(desc.width <= 0 || desc.height <= 0)
+                error("film size should be positive");
+            real radius = real(0.5), alpha = real(0.6);
+            if(auto f = r.find("filter")){
+                ObjectReader fr(*f,"filter");
+                if(fr.get<std::string>("type","gaussian") != "gaussian")
+                    error("only gaussian filter is supported");
+                fr.read("radius",radius);
+                fr.read("alpha",alpha);
+                fr.check();
+            }
+            if(auto aovs = r.find("aovs")){
+                if(!aovs->is_array())
+                    error("aovs of film should be an array of channel names");
+                for(auto& aov:*aovs){
+                    const auto name = aov.get<std::string>();
+                    auto it = std::find_if(std::begin(aov_channel_names),std::end(aov_channel_names),
+                                           [&](const auto& channel){ return name == channel.second; });
+                    if(it == std::end(aov_channel_names))
+                        error("unknown aov: " + name);
+                    desc.aov_channels |= it->first;
+                }
+                if(desc.aov_channels && desc.output.exr.empty())
+                    error("aovs are written as layers of the exr output, set exr of output");
+            }
+            r.check();
+            desc.filter = create_gaussin_filter(radius,alpha);
+        }
+
+        //frames are named by their index unless a view has a name
+        //views: camera fields merged over the camera of the file
+        //orbit: the camera turns around its target about axis by degrees over the frames
+        //keyframes: camera fields merged over the camera and linearly interpolated over the frames
+        void read_batch(const json& j,const json& camera_json,SceneDescription& desc){
+            ObjectReader r(j,"batch");
+            r.read("frames_in_flight",desc.frames_in_flight);
+            if(desc.frames_in_flight < 1)
+                error("frames_in_flight of batch should be at least 1");
+            std::vector<std::pair<std::string,json>> cameras;
+            auto frame_name = [&](){
+                char name[16];
+                std::snprintf(name,sizeof(name),"%04d",static_cast<int>(cameras.size()));
+                return std::string(name);
+            };
+            if(auto views = r.find("views")){
+                for(auto view:*views){
+                    if(!view.is_object())
+                        error("view of batch should be an object");
+                    auto name = frame_name();
+                    if(view.contains("name")){
+                        name = view["name"].get<std::string>();
+                        view.erase("name");
+                    }
+                    auto c = camera_json;
+                    c.merge_patch(view);
+                    cameras.emplace_back(name,std::move(c));
+                }
+            }
+            if(auto orbit = r.find("orbit")){
+                ObjectReader o(*orbit,"batch orbit");
+                const int frames = o.require("frames").get<int>();
+                const auto axis = o.find("axis") ? to_vector(*o.find("axis")) : Vector3f(0,1,0);
+                const real degrees = o.get<real>("degrees",360);
+                o.check();
+                const auto pos = to_point(camera_json.at("position"));
+                const auto target = to_point(camera_json.at("target"));
+                const auto up = camera_json.contains("up") ? to_vector(camera_json["up"]) : Vector3f(0,1,0);
+                for(int i = 0; i < frames; ++i){
+                    const auto t = rotate(to_radians(degrees * i / frames),axis);
+                    const auto p = target + t(pos - target);
+                    const auto u = t(up);
+                    auto c = camera_json;
+                    c["position"] = {p.x,p.y,p.z};
+                    c["up"] = {u.x,u.y,u.z};
+                    cameras.emplace_back(frame_name(),std::move(c));
+                }
+            }
+            if(auto keyframes = r.find("keyframes")){
+                ObjectReader k(*keyframes,"batch keyframes");
+                const int frames = k.require("frames").get<int>();
+                const auto& keys_json = k.require("keys");
+                k.check();
+                if(!keys_json.is_array() || keys_json.size() < 2)
+                    error("keyframes of batch need at least 2 keys");
+                std::vector<json> keys;
+                for(auto& key:keys_json){
+                    keys.emplace_back(camera_json);
+                    keys.back().merge_patch(key);
+                }
+                for(int i = 0; i < frames; ++i){
+                    const real t = frames == 1 ? 0 : static_cast<real>(i) * (keys.size() - 1) / (frames - 1);
+                    const size_t key = (std::min)(static_cast<size_t>(t),keys.size() - 2);
+                    cameras.emplace_back(frame_name(),lerp(keys[key],keys[key + 1],t - key));
+                }
+            }
+            r.check();
+            if(cameras.empty())
+                error("batch without any view");
+            for(auto& [name,c]:cameras)
+                desc.views.push_back({name,create_camera(c,desc)});
+        }
+
+        //numbers and arrays of numbers are interpolated, other fields are taken from a
+        static json lerp(const json& a,const json& b,real t){
+            if(a.is_number() && b.is_number())
+                return a.get<real>() + (b.get<real>() - a.get<real>()) * t;
+            if(a.is_array() && b.is_array() && a.size() == b.size()){
+                json ret = json::array();
+                for(size_t i = 0; i < a.size(); ++i)
+                    ret.push_back(lerp(a[i],b[i],t));
+                return ret;
+            }
+            if(a.is_object() && b.is_object()){
+                json ret = a;
+                for(auto& [key,value]:a.items()){
+                    if(b.contains(key))
+                        ret[key] = lerp(value,b[key],t);
+                }
+                return ret;
+            }
+            return a;
+        }
+
+        RC<Camera> create_camera(const json& j,const SceneDescription& desc){
+            ObjectReader r(j,"camera");
+            if(r.get<std::string>("type","thin_lens") != "thin_lens")
+                error("only thin_lens camera is supported");
+            const auto pos = to_point(r.require("position"));
+            const auto target = to_point(r.require("target"));
+            const auto up = r.find("up") ? to_vector(*r.find("up")) : Vector3f(0,1,0);
+            const real fov = to_radians(r.get<real>("fov",45));
+            const real lens_radius = r.get<real>("lens_radius",0);
+            const real focal_distance = r.get<real>("focal_distance",1);
+            r.check();
+            return create_thin_lens_camera((real)desc.width / desc.height,pos,target,up,
+                                           fov,lens_radius,focal_distance);
+        }
+
+        //share_count > 1 gives the renderer a share of the configured workers
+        static RC<Renderer> create_renderer(const json& j,int share_count = 1){
+            auto worker_share = [share_count](int worker_count){
+                return share_count <= 1 ? worker_count : (std::max)(1,actual_worker_count(worker_count) / share_count);
+            };
+            ObjectReader r(j,"renderer");
+            const auto type = r.get<std::string>("type","pt");
+            if(type == "pt"){
+                PTRendererParams params;
+                r.read("worker_count",params.worker_count);
+                r.read("task_tile_size",params.task_tile_size);
+                r.read("spp",params.spp);
+                r.read("min_depth",params.min_depth);
+                r.read("max_depth",params.max_depth);
+                r.read("direct_light_sample_num",params.direct_light_sample_num);
+                r.read("use_path_guiding",params.use_path_guiding);
+                r.read("guiding_training_iterations",params.guiding_training_iterations);
+                r.read("guiding_bsdf_fraction",params.guiding_bsdf_fraction);
+                r.read("use_adjoint_rr",params.use_adjoint_rr);
+                r.read("adjoint_rr_estimate_spp",params.adjoint_rr_estimate_spp);
+                r.read("adjoint_rr_window_size",params.adjoint_rr_window_size);
+                r.read("adjoint_rr_max_split",params.adjoint_rr_max_split);
+                r.read("use_equiangular_sampling",params.use_equiangular_sampling);
+                r.check();
+                params.worker_count = worker_share(params.worker_count);
+                return create_pt_renderer(params);
+            }
+            if(type == "sppm"){
+                //0 radius is derived from the scene bounds
+                SPPMRendererParams params{.init_search_radius = 0};
+                r.read("init_search_radius",params.init_search_radius);
+                r.read("worker_count",params.worker_count);
+                r.read("iteration_count",params.iteration_count);
+                r.read("photons_per_iteration",params.photons_per_iteration);
+                r.read("task_tile_size",params.task_tile_size);
+                r.read("ray_trace_max_depth",params.ray_trace_max_depth);
+                r.read("photon_min_depth",params.photon_min_depth);
+                r.read("photon_max_depth",params.photon_max_depth);
+                r.read("photon_weight_window",params.photon_weight_window);
+                r.read("photon_window_size",params.photon_window_size);
+                r.read("photon_max_split",params.photon_max_split);
+                r.read("update_alpha",params.update_alpha);
+                r.check();
+                params.worker_count = worker_share(params.worker_count);
+                return create_sppm_renderer(params);
+            }
+            if(type == "bdpt"){
+                BDPTRendererParams params;
+                r.read("worker_count",params.worker_count);
+                r.read("task_tile_size",params.task_tile_size);
+                r.read("max_camera_vertex_count",params.max_camera_vertex_count);
+                r.read("max_light_vertex_count",params.max_light_vertex_count);
+                r.read("spp",params.spp);
+                r.read("use_light_vertex_cache",params.use_light_vertex_cache);
+                r.read("light_path_pool_count",params.light_path_pool_count);
+                r.read("cache_connection_count",params.cache_connection_count);
+                r.check();
+                params.worker_count = worker_share(params.worker_count);
+                return create_bdpt_renderer(params);
+            }
+            if(type == "mlt"){
+                MLTRendererParams params;
+                r.read("worker_count",params.worker_count);
+                r.read("max_depth",params.max_depth);
+                r.read("bootstrap_count",params.bootstrap_count);
+                r.read("chain_count",params.chain_count);
+                r.read("mutations_per_pixel",params.mutations_per_pixel);
+                r.read("sigma",params.sigma);
+                r.read("large_step_prob",params.large_step_prob);
+                r.check();
+                params.worker_count = worker_share(params.worker_count);
+                return create_mlt_renderer(params);
+            }
+            if(type == "vcm"){
+                VCMRendererParams params;
+                r.read("init_search_radius",params.init_search_radius);
+                r.read("worker_count",params.worker_count);
+                r.read("task_tile_size",params.task_tile_size);
+                r.read("iteration_count",params.iteration_count);
+                r.read("max_camera_vertex_count",params.max_camera_vertex_count);
+                r.read("max_light_vertex_count",params.max_light_vertex_count);
+                r.read("radius_alpha",params.radius_alpha);
+                r.check();
+                params.worker_count = worker_share(params.worker_count);
+                return create_vcm_renderer(params);
+            }
+            error("unknown renderer type: " + type);
+        }
+
+        //{"file": ..., "srgb": true, "scale": 1} or {"type": "constant", "value": ...}
+        TextureFuture launch_texture(const json& j,bool default_srgb,const std::string& what){
+            ObjectReader r(j,what);
+            const auto type = r.get<std::string>("type","image");
+            if(type == "constant"){
+                auto value = to_spectrum(r.require("value"));
+                r.check();
+                return ready<RC<const Texture2D>>(create_constant_texture2d(value));
+            }
+            if(type != "image")
+                error("unknown type " + type + " of " + what);
+            const auto file = resolve(r.require("file").get<std::string>());
+            const bool srgb = r.get<bool>("srgb",default_srgb);
+            const Spectrum scale = r.find("scale") ? to_spectrum(*r.find("scale")) : Spectrum(1);
+            r.check();
+            return launch([=]() -> RC<const Texture2D>{
+                return create_texture2d_from_file(file,srgb,scale);
+            });
+        }
+
+        //a constant value, name of a texture or an inline texture object
+        TextureFuture parse_texture(const json& j,bool default_srgb,const std::string& what){
+            if(j.is_string()){
+                auto it = textures.find(j.get<std::string>());
+                if(it == textures.end())
+                    error("unknown texture " + j.get<std::string>() + " of " + what);
+                return it->second;
+            }
+            if(j.is_object())
+                return launch_texture(j,default_srgb,what);
+            return ready<RC<const Texture2D>>(create_constant_texture2d(to_spectrum(j)));
+        }
+
+        std::vector<TextureFuture> parse_texture_params(ObjectReader& r,const std::vector<TextureParam>& params){
+            std::vector<TextureFuture> ret;
+            for(auto& param:params){
+                if(auto j = r.find(param.name))
+                    ret.emplace_back(parse_texture(*j,true,r.name() + " " + param.name));
+                else
+                    ret.emplace_back(ready<RC<const Texture2D>>(create_constant_texture2d(param.default_value)));
+            }
+            return ret;
+        }
+
+        MaterialFuture parse_material(const json& j,const std::string& what){
+            ObjectReader r(j,what);
+            const auto type = r.require("type").get<std::string>();
+            auto it = material_texture_params().find(type);
+            if(it == material_texture_params().end())
+                error("unknown type " + type + " of " + what);
+            auto maps = parse_texture_params(r,it->second);
+            //normal maps store directions, so decode them linearly by default
+            TextureFuture normal_map;
+            if(auto n = r.find("normal_map"))
+                normal_map = parse_texture(*n,false,what + " normal_map");
+            std::vector<TextureFuture> bssrdf_maps;
+            if(auto b = r.find("bssrdf")){
+                ObjectReader br(*b,what + " bssrdf");
+                if(br.get<std::string>("type","normalized_diffusion") != "normalized_diffusion")
+                    error("only normalized_diffusion bssrdf is supported");
+                bssrdf_maps = parse_texture_params(br,bssrdf_texture_params);
+                br.check();
+            }
+            const bool thin = r.get<bool>("thin",false);
+            r.check();
+
+            return defer([type,maps = std::move(maps),normal_map,bssrdf_maps = std::move(bssrdf_maps),thin]() -> RC<Material>{
+                auto m = [&](int i){ return maps[i].get(); };
+                auto get_normal_map = [&]() -> RC<const Texture2D>{
+                    return normal_map.valid() ? normal_map.get() : nullptr;
+                };
+                RC<BSSRDFSurface> bssrdf;
+                if(!bssrdf_maps.empty())
+                    bssrdf = create_normalized_diffusion_bssrdf_surface(
+                            bssrdf_maps[0].get(),bssrdf_maps[1].get(),bssrdf_maps[2].get());
+                if(type == "phong")
+                    return create_phong_material(m(0),m(1),m(2),m(3));
+                if(type == "glass")
+                    return create_glass(m(0),m(1),m(2));
+                if(type == "metal")
+                    return create_metal(m(0),m(1),m(2),m(3),m(4),newBox<NormalMapper>(get_normal_map()));
+                if(type == "disney")
+                    return create_disney(m(0),m(1),m(2),m(3),m(4),m(5),m(6),m(7),m(8),m(9),m(10),m(11),m(12),
+                                         newBox<const NormalMapper>(get_normal_map()),
+                                         bssrdf ? bssrdf : newRC<BSSRDFSurface>());
+                if(type == "disney_brdf")
+                    return create_disney_brdf(m(0),m(1),m(2),m(3),m(4),m(5),m(6),m(7),m(8),m(9),m(10));
+                if(type == "disney_bsdf")
+                    return create_disney_bsdf(m(0),m(1),m(2),m(3),m(4),m(5),m(6),m(7),m(8),m(9),m(10),m(11),m(12),
+                                              thin,m(13),m(14),newBox<const NormalMapper>(get_normal_map()));
+                return bssrdf ? create_invisible_surface(bssrdf) : create_invisible_surface();
+            });
+        }
+
+        MediumFuture launch_medium(const json& j,const std::string& what){
+            ObjectReader r(j,what);
+            const auto type = r.require("type").get<std::string>();
+            const int max_scattering_count = r.get<int>("max_scattering_count",25);
+            if(type == "homogeneous"){
+                const auto sigma_a = to_spectrum(r.require("sigma_a"));
+                const auto sigma_s = to_spectrum(r.require("sigma_s"));
+                const real g = r.get<real>("g",0);
+                r.check();
+                return ready(create_homogeneous_medium(sigma_a,sigma_s,g,max_scattering_count));
+            }
+            if(type == "heterogeneous"){
+                //density is a constant or a volume written by write_sparse_volume
+                const auto& density = r.require("density");
+                const std::string density_file = density.is_string() ? resolve(density.get<std::string>()) : "";
+                const real density_value = density.is_string() ? 0 : density.get<real>();
+                const Spectrum albedo = r.find("albedo") ? to_spectrum(*r.find("albedo")) : Spectrum(1);
+                const real g = r.get<real>("g",0);
+                const bool white_for_indirect = r.get<bool>("white_for_indirect",false);
+                const int majorant_grid_resolution = r.get<int>("majorant_grid_resolution",16);
+                const bool residual_ratio_tracking = r.get<bool>("residual_ratio_tracking",true);
+                const Transform local_to_world = to_transform(r.find("transform"));
+                r.check();
+                return launch([=]{
+                    auto density_texture = density_file.empty() ? create_constant_texture3d(Spectrum(density_value))
+                                                                : create_sparse_texture3d(density_file);
+                    return create_heterogeneous_medium(local_to_world,density_texture,
+                                                       create_constant_texture3d(albedo),
+                                                       create_constant_texture3d(Spectrum(g)),
+                                                       max_scattering_count,white_for_indirect,
+                                                       majorant_grid_resolution,residual_ratio_tracking);
+                });
+            }
+            if(type == "vacuum"){
+                r.check();
+                return ready(create_vacuum());
+            }
+            error("unknown type " + type + " of " + what);
+        }
+
+        std::shared_future<RC<EnvironmentLight>> launch_light(const json& j,const std::string& what){
+            ObjectReader r(j,what);
+            if(r.require("type").get<std::string>() != "ibl")
+                error("only ibl light is supported, area lights come from emissive shapes");
+            const auto file = resolve(r.require("file").get<std::string>());
+            const Spectrum scale = r.find("scale") ? to_spectrum(*r.find("scale")) : Spectrum(1);
+            const Transform world_to_light = to_transform(r.find("transform"));
+            r.check();
+            //the light builds its sampling distribution on creation, which overlaps the bvh build
+            //it only depends on the light fields, so scenes reloaded for other changes share it
+            const std::string key = "ibl:" + file + ":" + j.dump();
+            const std::string version = file_version(file);
+            return launch([=]{
+                return asset_registry().get<EnvironmentLight>(key,version,[&]{
+                    return create_ibl_light(create_texture2d_from_file(file,false,scale),world_to_light);
+                });
+            });
+        }
+
+        MediumFuture find_medium(const std::string& name,const std::string& what) const{
+            auto it = media.find(name);
+            if(it == media.end())
+                error("unknown medium " + name + " of " + what);
+            return it->second;
+        }
+
+        ShapeFuture parse_shape(const json& j,const std::string& what){
+            ObjectReader r(j,what);
+            const auto type = r.require("type").get<std::string>();
+            MaterialFuture material;
+            if(auto m = r.find("material")){
+                if(m->is_object())
+                    material = parse_material(*m,what + " material");
+                else{
+                    auto it = materials.find(m->get<std::string>());
+                    if(it == materials.end())
+                        error("unknown material " + m->get<std::string>() + " of " + what);
+                    material = it->second;
+                }
+            }
+            const Spectrum emission = r.find("emission") ? to_spectrum(*r.find("emission")) : Spectrum(0);
+            MediumFuture inside = media.at("vacuum"), outside = media.at("vacuum");
+            if(auto m = r.find("medium")){
+                ObjectReader mr(*m,what + " medium");
+                if(auto in = mr.find("inside"))
+                    inside = find_medium(in->get<std::string>(),what);
+                if(auto out = mr.find("outside"))
+                    outside = find_medium(out->get<std::string>(),what);
+                mr.check();
+            }
+            const Transform local_to_world = to_transform(r.find("transform"));
+
+            //primitives of shapes sharing one material and emission
+            auto create_primitives = [=](const std::vector<RC<Shape>>& shapes){
+                ShapeResult ret;
+                MediumInterface mi;
+                mi.inside = inside.get();
+                mi.outside = outside.get();
+                for(auto& shape:shapes){
+                    ret.primitives.emplace_back(create_geometric_primitive(shape,material.get(),mi,emission));
+                    if(!emission.is_back())
+                        ret.lights.emplace_back(ret.primitives.back()->as_area_light());
+                }
+                return ret;
+            };
+
+            if(type == "obj"){
+                const auto file = resolve(r.require("file").get<std::string>());
+                r.check();
+                const std::string key = "obj:" + file;
+                const std::string version = file_version(file);
+                return launch([=]{
+                    //parsed models stay in the registry, a scene reloaded for other changes skips parsing
+                    auto obj = asset_registry().get<const ObjModel>(key,version,[&]{
+                        auto ret = newRC<ObjModel>();
+                        ret->model = load_model_from_file(file);
+                        ret->files = obj_material_files(file,ret->model);
+                        LOG_INFO("load {} with mesh count: {}, material count: {}",file,ret->model.mesh.size(),
+                                 ret->model.material.size());
+                        return ret;
+                    });
+                    const auto& model = obj->model;
+                    if(material.valid()){
+                        std::vector<RC<Shape>> shapes;
+                        for(auto& mesh:model.mesh){
+                            auto triangles = create_triangle_mesh(mesh,local_to_world);
+                            shapes.insert(shapes.end(),triangles.begin(),triangles.end());
+                        }
+                        return create_primitives(shapes);
+                    }
+                    auto ret = create_obj_primitives(model,std::filesystem::path(file).parent_path(),
+                                                     local_to_world,emission,inside.get(),outside.get());
+                    ret.files = obj->files;
+                    return ret;
+                });
+            }
+            if(!material.valid())
+                error("missing material of " + what);
+            if(type == "sphere"){
+                const real radius = r.get<real>("radius",1);
+                r.check();
+                return defer([=]{
+                    return create_primitives({create_sphere(radius,local_to_world)});
+                });
+            }
+            if(type == "quad"){
+                //counter clockwise seen from the side the normal points to
+                const auto& v = r.require("vertices");
+                if(!v.is_array() || v.size() != 4)
+                    error("quad of " + what + " should have 4 vertices");
+                const Point3f p[4] = {to_point(v[0]),to_point(v[1]),to_point(v[2]),to_point(v[3])};
+                r.check();
+                return defer([=]{
+                    const Vector3f n = cross(p[1] - p[0],p[2] - p[0]).normalize();
+                    const Normal3f vn(n.x,n.y,n.z);
+                    mesh_t mesh;
+                    mesh.vertices = {{p[0],vn,Point2f(0,0)},{p[1],vn,Point2f(1,0)},
+                                     {p[2],vn,Point2f(1,1)},{p[3],vn,Point2f(0,1)}};
+                    mesh.indices = {0,1,2,0,2,3};
+                    mesh.materials = {0,0};
+                    return create_primitives(create_triangle_mesh(mesh,local_to_world));
+                });
+            }
+            error("unknown type " + type + " of " + what);
+        }
+
+        //mtl files named by the obj and the textures of its materials, their edits do not change the obj file
+        static std::vector<std::string> obj_material_files(const std::string& file,const model_t& model){
+            const std::filesystem::path directory = std::filesystem::path(file).parent_path();
+            auto resolve_in_directory = [&](const std::string& name){
+                return std::filesystem::path(name).is_relative() ? (directory / name).string() : name;
+            };
+            std::vector<std::string> files;
+            std::ifstream in(file);
+            std::string line,word;
+            while(std::getline(in,line)){
+                std::istringstream words(line);
+                if(words >> word && word == "mtllib"){
+                    while(words >> word)
+                        files.emplace_back(resolve_in_directory(word));
+                }
+            }
+            for(const auto& m:model.material){
+                for(auto name:{&m.map_ka,&m.map_kd,&m.map_ks,&m.map_ns,&m.map_ke}){
+                    if(!name->empty())
+                        files.emplace_back(resolve_in_directory(*name));
+                }
+            }
+            std::sort(files.begin(),files.end());
+            files.erase(std::unique(files.begin(),files.end()),files.end());
+            return files;
+        }
+
+        //materials from the mtl file, converted as the obj renderer does
+        static ShapeResult create_obj_primitives(const model_t& model,const std::filesystem::path& obj_directory,
+                                                 const Transform& local_to_world,const Spectrum& emission,
+                                                 const RC<Medium>& inside,const RC<Medium>& outside){
+            //texture names in mtl files are relative to the obj file
+            auto model_materials = model.material;
+            for(auto& m:model_materials){
+                for(auto name:{&m.map_ka,&m.map_kd,&m.map_ks,&m.map_ns,&m.map_ke}){
+                    if(!name->empty() && std::filesystem::path(*name).is_relative())
+                        *name = (obj_directory / *name).string();
+                }
+            }
+            preload_material_textures(model_materials);
+            std::vector<MaterialTexture> materials_res;
+            std::vector<RC<Material>> materials;
+            for(auto& m:model_materials){
+                auto material = create_texture_from_file(m);
+                if(material.as_glass)
+                    materials.emplace_back(create_glass(material.map_ks,material.map_kt,material.ior));
+                else
+                    materials.emplace_back(create_phong_material(material.map_ka,material.map_kd,
+                                                                 material.map_ks,material.map_ns));
+                materials_res.emplace_back(std::move(material));
+            }
+            ShapeResult ret;
+            MediumInterface mi;
+            mi.inside = inside;
+            mi.outside = outside;
+            for(auto& mesh:model.mesh){
+                auto triangles = create_triangle_mesh(mesh,local_to_world);
+                for(size_t i = 0; i < triangles.size(); ++i){
+                    const int material_index = mesh.materials[i];
+                    if(material_index < 0 || material_index >= static_cast<int>(materials.size()))
+                        throw std::runtime_error("scene file: obj triangle without material: " + model.name);
+                    const auto& m_res = materials_res[material_index];
+                    //emission of the shape overrides emission in the mtl file
+                    Spectrum le = emission;
+                    if(le.is_back() && m_res.has_emission)
+                        le = m_res.map_ke->evaluate(Point2f());
+                    ret.primitives.emplace_back(create_geometric_primitive(triangles[i],materials[material_index],mi,le));
+                    if(!le.is_back())
+                        ret.lights.emplace_back(ret.primitives.back()->as_area_light());
+                }
+            }
+            return ret;
+        }
+
+        json root;
+        std::filesystem::path directory;
+        std::string default_name;
+        //filled before any task reading them is launched, tasks only look up
+        std::unordered_map<std::string,TextureFuture> textures;
+        std::unordered_map<std::string,MaterialFuture> materials;
+        std::unordered_map<std::string,MediumFuture> media;
+    };
+
+}
+
+SceneDescription load_scene_file(const std::string& filename){
+    LOG_INFO("load scene file: {}",filename);
+    std::ifstream in(filename);
+    if(!in.is_open())
+        throw std::runtime_error("failed to open scene file: " + filename);
+    const std::string text((std::istreambuf_iterator<char>(in)),std::istreambuf_iterator<char>());
+    const std::filesystem::path path(filename);
+    try{
+        return load_scene_description(text,path.parent_path().string(),path.stem().string());
+    }
+    catch(const std::exception& e){
+        throw std::runtime_error(filename + ": " + e.what());
+    }
+}
+
+SceneDescription load_scene_description(const std::string& text,const std::string& directory,
+                                        const std::string& default_name,
+                                        const SceneDescription* previous){
+    try{
+        return SceneFileLoader(text,directory,default_name).load(previous);
+    }
+    catch(const json::exception& e){
+        throw std::runtime_error(std::string("scene file: ") + e.what());
+    }
+}
+
+std::vector<std::string> write_scene_outputs(const SceneDescription::Output& output,RenderTarget& render_target){
+    std::vector<std::string> files;
+    if(output.write_hdr){
+        files.emplace_back(output.name + ".hdr");
+        write_image_to_hdr(render_target.color,files.back());
+        LOG_INFO("write hdr...");
+    }
+    if(!output.exr.empty()){
+        files.emplace_back(output.name + ".exr");
+        std::vector<ExrLayer> layers = {{"",&render_target.color}};
+        for(auto [channel,name]:aov_channel_names){
+            switch(channel){
+                case AOVAlbedo: layers.push_back({name,&render_target.albedo}); break;
+                case AOVNormal: layers.push_back({name,&render_target.normal}); break;
+                case AOVDepth: layers.push_back({name,nullptr,&render_target.depth}); break;
+                case AOVPrimitiveId: layers.push_back({name,nullptr,&render_target.primitive_id}); break;
+                case AOVMaterialId: layers.push_back({name,nullptr,&render_target.material_id}); break;
+                case AOVDirect: layers.push_back({name,&render_target.direct}); break;
+                case AOVIndirect: layers.push_back({name,&render_target.indirect}); break;
+            }
+            //renderers without aov support leave the images empty
+            const auto& layer = layers.back();
+            if((layer.scalar ? layer.scalar->width() : layer.image->width()) == 0)
+                layers.pop_back();
+        }
+        write_layers_to_exr(layers,files.back(),output.exr == "float" ? ExrPixelType::Float : ExrPixelType::Half);
+        LOG_INFO("write exr with {} aov layers...",layers.size() - 1);
+    }
+    if(output.write_png){
+        if(output.tone_mapper == "aces")
+            create_aces_tone_mapper(output.exposure)->process(render_target);
+        files.emplace_back(output.name + ".png");
+        write_image_to_png(render_target.color,files.back());
+        LOG_INFO("write png...");
+    }
+    return files;
+}
+
+void mark_edited_samples(const SceneDescription& previous,const SceneDescription& desc,PrimaryHitBuffer& buffer){
+    if(buffer.empty())
+        return;
+    //the renderer decides spp and so the layout of buffer
+    if(previous.view_key != desc.view_key || previous.renderer_key != desc.renderer_key || !desc.views.empty()){
+        buffer.clear();
+        return;
+    }
+    if(previous.scene == desc.scene)
+        return;
+    bool same_ids = previous.shapes.size() == desc.shapes.size();
+    for(size_t i = 0; same_ids && i < desc.shapes.size(); ++i){
+        same_ids = previous.shapes[i].first_primitive == desc.shapes[i].first_primitive
+                && previous.shapes[i].primitive_count == desc.shapes[i].primitive_count;
+    }
+    if(!same_ids){
+        LOG_INFO("shapes are added or removed, re-trace all samples");
+        buffer.mark_all(PrimaryHitBuffer::Retrace);
+        return;
+    }
+    if(previous.global_key != desc.global_key)
+        buffer.mark_all(PrimaryHitBuffer::Reshade);
+
+    std::vector<uint8_t> primitive_marks(desc.scene->primitives.size(),PrimaryHitBuffer::Keep);
+    std::vector<Bounds3f> moved_bounds;
+    for(size_t i = 0; i < desc.shapes.size(); ++i){
+        const auto& before = previous.shapes[i];
+        const auto& after = desc.shapes[i];
+        auto mark = PrimaryHitBuffer::Keep;
+        if(before.geometry_key != after.geometry_key){
+            mark = PrimaryHitBuffer::Retrace;
+            moved_bounds.emplace_back(before.bounds);
+            moved_bounds.emplace_back(after.bounds);
+        }
+        else if(before.shading_key != after.shading_key){
+            //emission is light for every other sample
+            if(before.emissive || after.emissive)
+                buffer.mark_all(PrimaryHitBuffer::Reshade);
+            mark = PrimaryHitBuffer::Reshade;
+        }
+        std::fill_n(primitive_marks.begin() + after.first_primitive,after.primitive_count,static_cast<uint8_t>(mark));
+    }
+
+    const auto camera = desc.scene->get_camera();
+    parallel_forrange(0,buffer.height,[&](int,int y){
+        const size_t first = (size_t)y * buffer.width * buffer.spp;
+        const size_t last = first + (size_t)buffer.width * buffer.spp;
+        for(size_t i = first; i < last; ++i){
+            const auto& record = buffer.records[i];
+            if(record.primitive < primitive_marks.size())
+                buffer.mark(i,static_cast<PrimaryHitBuffer::Mark>(primitive_marks[record.primitive]));
+            if(moved_bounds.empty() || buffer.marks[i] == PrimaryHitBuffer::Retrace)
+                continue;
+            //a moved shape may now cover or uncover what the camera ray hit
+            Ray ray;
+            const CameraSample sample{{record.pixel.x / buffer.width,record.pixel.y / buffer.height},record.lens};
+            if(camera->generate_ray(sample,ray) <= 0)
+                continue;
+            for(auto& bounds:moved_bounds){
+                if(bounds.intersect_p(ray)){
+                    buffer.mark(i,PrimaryHitBuffer::Retrace);
+                    break;
+                }
+            }
+        }
+    });
+}
+
+std::vector<std::string> render_scene_views(const SceneDescription& desc){
+    const int slot_count = (std::min)(desc.frames_in_flight,static_cast<int>(desc.views.size()));
+    LOG_INFO("render batch of {} views, {} in flight",desc.views.size(),slot_count);
+    std::vector<std::vector<std::string>> files(desc.views.size());
+    std::atomic<size_t> next_view = 0;
+    std::mutex mutex;
+    std::exception_ptr exception;
+    //each slot renders views one after another with its own renderer and stops at the first error
+    auto render_slot = [&](int){
+        try{
+            auto renderer = slot_count > 1 ? desc.create_renderer_share(slot_count) : desc.renderer;
+            for(;;){
+                const size_t i = next_view++;
+                if(i >= desc.views.size())
+                    return;
+                {
+                    std::lock_guard<std::mutex> lk(mutex);
+                    if(exception)
+                        return;
+                }
+                const auto& view = desc.views[i];
+                AutoTimer timer("render view " + view.name,"s");
+                auto scene = create_scene_view(desc.scene,view.camera);
+                auto render_target = renderer->render(*scene,Film({desc.width,desc.height},desc.filter,desc.aov_channels));
+                auto output = desc.output;
+                output.name += "_" + view.name;
+                files[i] = write_scene_outputs(output,render_target);
+            }
+        }
+        catch(...){
+            std::lock_guard<std::mutex> lk(mutex);
+            if(!exception)
+                exception = std::current_exception();
+        }
+    };
+    if(slot_count > 1){
+        std::vector<std::thread> slots;
+        for(int i = 0; i < slot_count; ++i)
+            slots.emplace_back(render_slot,i);
+        for(auto& slot:slots)
+            slot.join();
+    }
+    else
+        render_slot(0);
+    if(exception)
+        std::rethrow_exception(exception);
+    std::vector<std::string> ret;
+    for(auto& f:files)
+        ret.insert(ret.end(),f.begin(),f.end());
+    return ret;
+}
+
+TRACER_END
@@ -0,0 +1,107 @@
+//
+// Created by wyz on 2022/6/27.
+//
+
+#ifndef TRACER_SCENE_FILE_HPP
+#define TRACER_SCENE_FILE_HPP
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "core/render.hpp"
+#include "core/renderer.hpp"
+#include "core/scene.hpp"
+
+TRACER_BEGIN
+
+//everything needed to render one shot described by a json scene file
+struct SceneDescription{
+    RC<Scene> scene;
+    //json of every field the scene is built from, i.e. all but output, film, camera, renderer and batch,
+    //with versions of the files they refer to and of dependency_files
+    std::string scene_key;
+    //files found while loading and not named by the json, e.g. mtl files of obj shapes and their textures
+    std::vector<std::string> dependency_files;
+    //json of film, camera and batch, a change moves every camera sample
+    std::string view_key;
+    std::string renderer_key;
+
+    //parts of scene_key per shape with the range of its ids in Scene::primitives,
+    //used to find the samples an edit affects
+    struct Shape{
+        //json of the shape without material, emission and medium, with the version of its file
+        std::string geometry_key;
+        //json of material, emission and medium with named materials resolved
+        std::string shading_key;
+        uint32_t first_primitive = 0;
+        uint32_t primitive_count = 0;
+        Bounds3f bounds;
+        bool emissive = false;
+    };
+    std::vector<Shape> shapes;
+    //json of textures, media and lights, a change of them may affect every sample
+    std::string global_key;
+    RC<Renderer> renderer;
+    //renderer of the same params with 1 / share_count of its workers
+    std::function<RC<Renderer>(int share_count)> create_renderer_share;
+    RC<Filter> filter;
+    int width = 0;
+    int height = 0;
+    //mask of AOVChannel asked for by film aovs, written as layers of the exr output
+    uint32_t aov_channels = 0;
+
+    //cameras of a batch, empty for a single shot
+    struct View{
+        //appended to the output name
+        std::string name;
+        RC<const Camera> camera;
+    };
+    std::vector<View> views;
+    int frames_in_flight = 1;
+
+    struct Output{
+        std::string name;
+        bool write_hdr = true;
+        bool write_png = true;
+        //empty, "half" or "float", linear color without the tone mapper
+        std::string exr;
+        //empty or "aces", applied to the png only
+        std::string tone_mapper;
+        real exposure = 1;
+        std::string stats_file;
+    }output;
+};
+
+//relative paths in the file are resolved against the directory of the file
+//mesh parsing, texture decoding and medium creation run as concurrent tasks,
+//the bvh is built once all shapes are ready while the environment light is still preprocessing
+//see doc/DOC.MD for the format
+SceneDescription load_scene_file(const std::string& filename);
+
+//text is the json of a scene file, relative paths are resolved against directory
+//and the output name defaults to default_name
+//if previous was built from the same scene_key its scene is kept and only the camera is replaced
+SceneDescription load_scene_description(const std::string& text,const std::string& directory,
+                                        const std::string& default_name,
+                                        const SceneDescription* previous = nullptr);
+
+//writes the hdr, exr and png asked for by the output fields and returns the written file names,
+//aov images of render_target become layers of the exr,
+//the tone mapper of the png is applied to render_target in place
+std::vector<std::string> write_scene_outputs(const SceneDescription::Output& output,RenderTarget& render_target);
+
+//marks the samples of buffer rendered with previous that the edit to desc affects:
+//edited materials re-shade the samples that hit them first, edited textures, media, lights or emission
+//re-shade all, moved shapes re-trace the samples that hit them and those whose camera ray passes
+//their old or new bounds, a new camera, film or renderer empties buffer
+//indirect light reflected off an edited material into other samples is not updated
+void mark_edited_samples(const SceneDescription& previous,const SceneDescription& desc,PrimaryHitBuffer& buffer);
+
+//renders all views of a batch on the loaded scene and writes their outputs, returns the written files
+//frames_in_flight views are rendered at the same time by renderers sharing the workers,
+//so the tail of one frame overlaps the next ones instead of leaving workers idle
+std::vector<std::string> render_scene_views(const SceneDescription& desc);
+
+TRACER_END
+
+#endif //TRACER_SCENE_FILE_HPP
@@ -0,0 +1,166 @@
+//
+// Created by wyz on 2022/6/21.
+//
+#include "sparse_volume.hpp"
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+TRACER_BEGIN
+
+    namespace{
+        constexpr char sparse_volume_magic[4] = {'T','S','V','B'};
+        constexpr uint32_t sparse_volume_version = 1;
+
+        int div_up(int a,int b){
+            return (a + b - 1) / b;
+        }
+    }
+
+    SparseVolume::SparseVolume(const std::string& filename)
+    :file(filename)
+    {
+        if(file.size() < sizeof(SparseVolumeHeader))
+            throw std::runtime_error("invalid sparse volume file: " + filename);
+        const auto base = static_cast<const char*>(file.data());
+        header = reinterpret_cast<const SparseVolumeHeader*>(base);
+        if(std::memcmp(header->magic,sparse_volume_magic,4) != 0 || header->version != sparse_volume_version
+        || header->brick_size != brick_size || header->node_size != node_size)
+            throw std::runtime_error("invalid sparse volume file: " + filename);
+
+        const int size[3] = {header->width,header->height,header->depth};
+        size_t node_total = 1;
+        for(int i = 0; i < 3; ++i){
+            brick_res[i] = div_up(size[i],brick_size);
+            node_res[i] = div_up(brick_res[i],node_size);
+            node_total *= node_res[i];
+        }
+        const size_t end = header->node_index_offset + sizeof(int32_t) * node_brick_count * header->node_count;
+        if(end > file.size() || header->top_index_offset + sizeof(int32_t) * node_total > file.size())
+            throw std::runtime_error("truncated sparse volume file: " + filename);
+
+        brick_voxels = reinterpret_cast<const float*>(base + header->brick_data_offset);
+        brick_ranges = reinterpret_cast<const BrickRange*>(base + header->brick_range_offset);
+        top_index = reinterpret_cast<const int32_t*>(base + header->top_index_offset);
+        node_index = reinterpret_cast<const int32_t*>(base + header->node_index_offset);
+    }
+
+    void write_sparse_volume(const std::string& filename,int width,int height,int depth,
+                             const std::function<void(int,int,int,float*)>& fill_brick,
+                             real background,real empty_threshold){
+        constexpr int bs = SparseVolume::brick_size;
+        constexpr int ns = SparseVolume::node_size;
+        std::ofstream out(filename,std::ios::binary);
+        if(!out.is_open())
+            throw std::runtime_error("open file failed: " + filename);
+
+        SparseVolumeHeader header{};
+        std::memcpy(header.magic,sparse_volume_magic,4);
+        header.version = sparse_volume_version;
+        header.width = width;
+        header.height = height;
+        header.depth = depth;
+        header.brick_size = bs;
+        header.node_size = ns;
+        header.background = background;
+        header.min_value = background;
+        header.max_value = background;
+        //keep brick data aligned to cache line
+        header.brick_data_offset = 128;
+        out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+        out.seekp(static_cast<std::streamoff>(header.brick_data_offset));
+
+        const int brick_res[3] = {div_up(width,bs),div_up(height,bs),div_up(depth,bs)};
+        const int node_res[3] = {div_up(brick_res[0],ns),div_up(brick_res[1],ns),div_up(brick_res[2],ns)};
+        std::vector<int32_t> top_index((size_t)node_res[0] * node_res[1] * node_res[2],-1);
+        std::vector<int32_t> node_index;
+        std::vector<SparseVolume::BrickRange> brick_ranges;
+
+        float voxels[SparseVolume::brick_voxel_count];
+        //visit bricks node by node so node tables are created in order
+        for(int nz = 0; nz < node_res[2]; ++nz){
+        for(int ny = 0; ny < node_res[1]; ++ny){
+        for(int nx = 0; nx < node_res[0]; ++nx){
+            const size_t top = ((size_t)nz * node_res[1] + ny) * node_res[0] + nx;
+            for(int lz = 0; lz < ns; ++lz){
+            for(int ly = 0; ly < ns; ++ly){
+            for(int lx = 0; lx < ns; ++lx){
+                const int bx = nx * ns + lx, by = ny * ns + ly, bz = nz * ns + lz;
+                if(bx >= brick_res[0] || by >= brick_res[1] || bz >= brick_res[2])
+                    continue;
+                std::fill(std::begin(voxels),std::end(voxels),background);
+                fill_brick(bx,by,bz,voxels);
+                //voxels out of volume keep background
+                for(int z = 0; z < bs; ++z){
+                    for(int y = 0; y < bs; ++y){
+                        for(int x = 0; x < bs; ++x){
+                            if(bx * bs + x >= width || by * bs + y >= height || bz * bs + z >= depth)
+                                voxels[(z * bs + y) * bs + x] = background;
+                        }
+                    }
+                }
+                SparseVolume::BrickRange range{std::numeric_limits<float>::max(),std::numeric_limits<float>::lowest()};
+                bool empty = true;
+                for(float v:voxels){
+                    range.min_value = (std::min)(range.min_value,v);
+                    range.max_value = (std::max)(range.max_value,v);
+                    if(std::abs(v - background) > empty_threshold)
+                        empty = false;
+                }
+                if(empty)
+                    continue;
+
+                if(top_index[top] < 0){
+                    top_index[top] = header.node_count++;
+                    node_index.resize(node_index.size() + SparseVolume::node_brick_count,-1);
+                }
+                node_index[(size_t)top_index[top] * SparseVolume::node_brick_count + (lz * ns + ly) * ns + lx]
+                    = static_cast<int32_t>(header.brick_count++);
+                brick_ranges.push_back(range);
+                header.min_value = (std::min)(header.min_value,range.min_value);
+                header.max_value = (std::max)(header.max_value,range.max_value);
+                out.write(reinterpret_cast<const char*>(voxels),sizeof(voxels));
+            }
+            }
+            }
+        }
+        }
+        }
+        if(header.brick_count > (uint64_t)(std::numeric_limits<int32_t>::max)())
+            throw std::runtime_error("too many bricks for sparse volume");
+
+        header.brick_range_offset = header.brick_data_offset
+                + header.brick_count * sizeof(float) * SparseVolume::brick_voxel_count;
+        out.write(reinterpret_cast<const char*>(brick_ranges.data()),
+                  static_cast<std::streamsize>(brick_ranges.size() * sizeof(SparseVolume::BrickRange)));
+        header.top_index_offset = header.brick_range_offset + brick_ranges.size() * sizeof(SparseVolume::BrickRange);
+        out.write(reinterpret_cast<const char*>(top_index.data()),
+                  static_cast<std::streamsize>(top_index.size() * sizeof(int32_t)));
+        header.node_index_offset = header.top_index_offset + top_index.size() * sizeof(int32_t);
+        out.write(reinterpret_cast<const char*>(node_index.data()),
+                  static_cast<std::streamsize>(node_index.size() * sizeof(int32_t)));
+
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+        if(!out.good())
+            throw std::runtime_error("write sparse volume failed: " + filename);
+    }
+
+    void write_sparse_volume(const std::string& filename,const Image3D<real>& volume,
+                             real background,real empty_threshold){
+        constexpr int bs = SparseVolume::brick_size;
+        const int w = volume.width(), h = volume.height(), d = volume.depth();
+        write_sparse_volume(filename,w,h,d,[&](int bx,int by,int bz,float* voxels){
+            for(int z = 0; z < bs; ++z){
+                for(int y = 0; y < bs; ++y){
+                    for(int x = 0; x < bs; ++x){
+                        const int vx = bx * bs + x, vy = by * bs + y, vz = bz * bs + z;
+                        if(vx < w && vy < h && vz < d)
+                            voxels[(z * bs + y) * bs + x] = volume(vx,vy,vz);
+                    }
+                }
+            }
+        },background,empty_threshold);
+    }
+
+TRACER_END
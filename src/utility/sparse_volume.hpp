@@ -0,0 +1,121 @@
+//
+// Created by wyz on 2022/6/21.
+//
+
+#ifndef TRACER_SPARSE_VOLUME_HPP
+#define TRACER_SPARSE_VOLUME_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "common.hpp"
+#include "utility/image.hpp"
+#include "utility/mapped_file.hpp"
+
+TRACER_BEGIN
+
+//sparse scalar volume made of 8^3 bricks, bricks equal to background are not stored
+//two-level index: top level of nodes covering 16^3 bricks, each stored node holds
+//indices of its bricks, so empty regions cost only one top level entry
+//file layout: header | brick data | brick ranges | top index | node tables
+struct SparseVolumeHeader{
+    char magic[4];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t depth;
+    int32_t brick_size;
+    int32_t node_size;
+    int32_t node_count;
+    uint64_t brick_count;
+    float background;
+    float min_value;
+    float max_value;
+    uint32_t padding;
+    uint64_t brick_data_offset;
+    uint64_t brick_range_offset;
+    uint64_t top_index_offset;
+    uint64_t node_index_offset;
+};
+static_assert(sizeof(SparseVolumeHeader) == 88,"");
+
+class SparseVolume{
+public:
+    static constexpr int brick_size = 8;
+    static constexpr int brick_voxel_count = brick_size * brick_size * brick_size;
+    static constexpr int node_size = 16;
+    static constexpr int node_brick_count = node_size * node_size * node_size;
+
+    struct BrickRange{
+        float min_value;
+        float max_value;
+    };
+
+    //bricks are not read until accessed
+    explicit SparseVolume(const std::string& filename);
+
+    int width() const noexcept{ return header->width; }
+    int height() const noexcept{ return header->height; }
+    int depth() const noexcept{ return header->depth; }
+
+    real background() const noexcept{ return header->background; }
+    real min_value() const noexcept{ return header->min_value; }
+    real max_value() const noexcept{ return header->max_value; }
+
+    size_t brick_count() const noexcept{ return header->brick_count; }
+
+    //number of bricks along each axis
+    int brick_dim(int axis) const noexcept{ return brick_res[axis]; }
+
+    //-1 if the brick is empty
+    int64_t brick_index(int bx,int by,int bz) const noexcept{
+        const int nx = bx / node_size, ny = by / node_size, nz = bz / node_size;
+        const int32_t node = top_index[((size_t)nz * node_res[1] + ny) * node_res[0] + nx];
+        if(node < 0)
+            return -1;
+        const int lx = bx % node_size, ly = by % node_size, lz = bz % node_size;
+        return node_index[(size_t)node * node_brick_count + (lz * node_size + ly) * node_size + lx];
+    }
+
+    const BrickRange& brick_range(int64_t brick) const noexcept{
+        return brick_ranges[brick];
+    }
+
+    const float* brick_data(int64_t brick) const noexcept{
+        return brick_voxels + (size_t)brick * brick_voxel_count;
+    }
+
+    //x y z should be in range
+    real voxel(int x,int y,int z) const noexcept{
+        const int64_t brick = brick_index(x / brick_size,y / brick_size,z / brick_size);
+        if(brick < 0)
+            return header->background;
+        const int lx = x % brick_size, ly = y % brick_size, lz = z % brick_size;
+        return brick_data(brick)[(lz * brick_size + ly) * brick_size + lx];
+    }
+
+private:
+    MappedFile file;
+    const SparseVolumeHeader* header = nullptr;
+    const float* brick_voxels = nullptr;
+    const BrickRange* brick_ranges = nullptr;
+    const int32_t* top_index = nullptr;
+    const int32_t* node_index = nullptr;
+    int brick_res[3] = {0,0,0};
+    int node_res[3] = {0,0,0};
+};
+
+//fill_brick(bx,by,bz,voxels) writes 8^3 voxels of the brick in x-fastest order,
+//voxels out of the volume are ignored, bricks are requested one by one so the
+//whole dense volume never needs to be in memory
+//a brick is empty if all its voxels are within empty_threshold of background
+void write_sparse_volume(const std::string& filename,int width,int height,int depth,
+                         const std::function<void(int,int,int,float*)>& fill_brick,
+                         real background = 0,real empty_threshold = 0);
+
+void write_sparse_volume(const std::string& filename,const Image3D<real>& volume,
+                         real background = 0,real empty_threshold = 0);
+
+TRACER_END
+
+#endif //TRACER_SPARSE_VOLUME_HPP
@@ -0,0 +1,179 @@
+//
+// Created by wyz on 2022/6/24.
+//
+#include "stats.hpp"
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include "utility/logger.hpp"
+
+TRACER_BEGIN
+
+namespace stats{
+
+    namespace{
+        constexpr const char* counter_names[counter_count] = {
+                "camera_rays",
+                "closest_hit_rays",
+                "shadow_rays",
+                "bvh_nodes_visited",
+                "bvh_primitive_tests",
+                "bsdf_evals",
+                "bsdf_eval_ns",
+                "bsdf_samples",
+                "bsdf_sample_ns",
+                "light_samples",
+                "path_vertices",
+                "medium_samples",
+                "medium_scatterings",
+                "medium_tracking_steps",
+                "medium_transmittance_calls",
+                "bssrdf_probes",
+                "photons_traced",
+                "bdpt_connections",
+                "mlt_mutations",
+                "mlt_accepted_mutations"
+        };
+
+        constexpr const char* maximum_names[maximum_count] = {
+                "arena_bytes"
+        };
+
+        constexpr const char* histogram_names[histogram_count] = {
+                "bvh_nodes_per_ray",
+                "path_length",
+                "medium_steps_per_sample"
+        };
+
+        struct Registry{
+            std::mutex mutex;
+            std::vector<ThreadStats*> live;
+            StatsData exited;
+        };
+
+        //never destroyed so threads exiting during static destruction can still merge
+        Registry& registry(){
+            static Registry* r = new Registry();
+            return *r;
+        }
+
+        uint64_t get(const StatsData& data,Counter counter){
+            return data.counters[static_cast<int>(counter)];
+        }
+
+        double ratio(uint64_t a,uint64_t b){
+            return b ? double(a) / double(b) : 0.0;
+        }
+    }
+
+    void HistogramData::merge(const HistogramData& rhs) noexcept{
+        for(int i = 0; i < bucket_count; ++i)
+            buckets[i] += rhs.buckets[i];
+        count += rhs.count;
+        sum += rhs.sum;
+        max = (std::max)(max,rhs.max);
+    }
+
+    void StatsData::merge(const StatsData& rhs) noexcept{
+        for(int i = 0; i < counter_count; ++i)
+            counters[i] += rhs.counters[i];
+        for(int i = 0; i < maximum_count; ++i)
+            maximums[i] = (std::max)(maximums[i],rhs.maximums[i]);
+        for(int i = 0; i < histogram_count; ++i)
+            histograms[i].merge(rhs.histograms[i]);
+    }
+
+    ThreadStats::ThreadStats(){
+        auto& r = registry();
+        std::lock_guard<std::mutex> lk(r.mutex);
+        r.live.push_back(this);
+    }
+
+    ThreadStats::~ThreadStats(){
+        auto& r = registry();
+        std::lock_guard<std::mutex> lk(r.mutex);
+        r.exited.merge(data);
+        r.live.erase(std::remove(r.live.begin(),r.live.end(),this),r.live.end());
+    }
+
+    StatsData collect(){
+        auto& r = registry();
+        std::lock_guard<std::mutex> lk(r.mutex);
+        StatsData ret = r.exited;
+        for(auto thread:r.live)
+            ret.merge(thread->data);
+        return ret;
+    }
+
+    void reset(){
+        auto& r = registry();
+        std::lock_guard<std::mutex> lk(r.mutex);
+        r.exited = StatsData();
+        for(auto thread:r.live)
+            thread->data = StatsData();
+    }
+
+    std::string to_json(const StatsData& data){
+        std::ostringstream out;
+        out << "{\n  \"counters\": {";
+        for(int i = 0; i < counter_count; ++i)
+            out << (i ? "," : "") << "\n    \"" << counter_names[i] << "\": " << data.counters[i];
+        out << "\n  },\n  \"maximums\": {";
+        for(int i = 0; i < maximum_count; ++i)
+            out << (i ? "," : "") << "\n    \"" << maximum_names[i] << "\": " << data.maximums[i];
+        out << "\n  },\n  \"histograms\": {";
+        for(int i = 0; i < histogram_count; ++i){
+            const auto& h = data.histograms[i];
+            out << (i ? "," : "") << "\n    \"" << histogram_names[i] << "\": {"
+                << "\"count\": " << h.count << ", \"sum\": " << h.sum << ", \"max\": " << h.max
+                << ", \"mean\": " << ratio(h.sum,h.count) << ", \"buckets\": [";
+            //trailing empty buckets are dropped, bucket i counts values in [2^(i-1),2^i)
+            int last = HistogramData::bucket_count - 1;
+            while(last >= 0 && h.buckets[last] == 0) --last;
+            for(int b = 0; b <= last; ++b)
+                out << (b ? ", " : "") << h.buckets[b];
+            out << "]}";
+        }
+        out << "\n  },\n  \"derived\": {";
+        const uint64_t rays = get(data,Counter::ClosestHitRays) + get(data,Counter::ShadowRays);
+        out << "\n    \"shadow_ray_ratio\": " << ratio(get(data,Counter::ShadowRays),rays)
+            << ",\n    \"bvh_nodes_per_ray\": " << ratio(get(data,Counter::BVHNodesVisited),rays)
+            << ",\n    \"bsdf_eval_ns_avg\": " << ratio(get(data,Counter::BSDFEvalNanoseconds),get(data,Counter::BSDFEvals))
+            << ",\n    \"bsdf_sample_ns_avg\": " << ratio(get(data,Counter::BSDFSampleNanoseconds),get(data,Counter::BSDFSamples))
+            << ",\n    \"medium_steps_per_sample\": " << ratio(get(data,Counter::MediumTrackingSteps),get(data,Counter::MediumSamples))
+            << ",\n    \"mlt_acceptance\": " << ratio(get(data,Counter::MLTAcceptedMutations),get(data,Counter::MLTMutations))
+            << "\n  }\n}\n";
+        return out.str();
+    }
+
+    void log_report(const StatsData& data){
+        const uint64_t rays = get(data,Counter::ClosestHitRays) + get(data,Counter::ShadowRays);
+        LOG_INFO("stats rays: {} camera, {} closest hit, {} shadow ({:.1f}%), {:.1f} bvh nodes per ray",
+                 get(data,Counter::CameraRays),get(data,Counter::ClosestHitRays),get(data,Counter::ShadowRays),
+                 100 * ratio(get(data,Counter::ShadowRays),rays),ratio(get(data,Counter::BVHNodesVisited),rays));
+        LOG_INFO("stats bsdf: {} evals {:.1f} ns avg, {} samples {:.1f} ns avg",
+                 get(data,Counter::BSDFEvals),ratio(get(data,Counter::BSDFEvalNanoseconds),get(data,Counter::BSDFEvals)),
+                 get(data,Counter::BSDFSamples),ratio(get(data,Counter::BSDFSampleNanoseconds),get(data,Counter::BSDFSamples)));
+        LOG_INFO("stats medium: {} samples, {} scatterings, {:.1f} steps per sample, {} transmittance calls",
+                 get(data,Counter::MediumSamples),get(data,Counter::MediumScatterings),
+                 ratio(get(data,Counter::MediumTrackingSteps),get(data,Counter::MediumSamples)),
+                 get(data,Counter::MediumTransmittanceCalls));
+        LOG_INFO("stats arena high water: {:.1f} KB",data.maximums[static_cast<int>(Maximum::ArenaBytes)] / 1024.0);
+    }
+
+    void report(const std::string& filename){
+        const auto data = collect();
+        log_report(data);
+        if(filename.empty()) return;
+        std::ofstream out(filename);
+        if(!out.is_open()){
+            LOG_ERROR("open stats file failed: {}",filename);
+            return;
+        }
+        out << to_json(data);
+        LOG_INFO("write stats to {}",filename);
+    }
+}
+
+TRACER_END
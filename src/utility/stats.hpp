@@ -0,0 +1,190 @@
+//
+// Created by wyz on 2022/6/24.
+//
+
+#ifndef TRACER_STATS_HPP
+#define TRACER_STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "common.hpp"
+
+TRACER_BEGIN
+
+//hot path statistics, enabled by defining TRACER_STATS
+//every thread counts into its own buffer without atomics or locks, a buffer is merged into
+//the global totals when its thread exits, so reports are complete once worker threads are joined
+//when disabled the STATS_* macros expand to nothing and none of this is referenced
+namespace stats{
+
+    enum class Counter : int{
+        CameraRays = 0,
+        ClosestHitRays,
+        ShadowRays,
+        BVHNodesVisited,
+        BVHPrimitiveTests,
+        BSDFEvals,
+        BSDFEvalNanoseconds,
+        BSDFSamples,
+        BSDFSampleNanoseconds,
+        LightSamples,
+        PathVertices,
+        MediumSamples,
+        MediumScatterings,
+        MediumTrackingSteps,
+        MediumTransmittanceCalls,
+        BSSRDFProbes,
+        PhotonsTraced,
+        BDPTConnections,
+        MLTMutations,
+        MLTAcceptedMutations,
+        Count
+    };
+
+    enum class Maximum : int{
+        ArenaBytes = 0,
+        Count
+    };
+
+    //values are counted in power of two buckets: 0, 1, [2,4), [4,8) ...
+    enum class Histogram : int{
+        BVHNodesPerRay = 0,
+        PathLength,
+        MediumStepsPerSample,
+        Count
+    };
+
+    constexpr int counter_count = static_cast<int>(Counter::Count);
+    constexpr int maximum_count = static_cast<int>(Maximum::Count);
+    constexpr int histogram_count = static_cast<int>(Histogram::Count);
+
+    struct HistogramData{
+        static constexpr int bucket_count = 33;
+
+        uint64_t buckets[bucket_count] = {};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+
+        static int bucket_index(uint64_t value) noexcept{
+            int index = 0;
+            while(value && index < bucket_count - 1){
+                value >>= 1;
+                ++index;
+            }
+            return index;
+        }
+
+        void add(uint64_t value) noexcept{
+            ++buckets[bucket_index(value)];
+            ++count;
+            sum += value;
+            if(value > max) max = value;
+        }
+
+        void merge(const HistogramData& rhs) noexcept;
+    };
+
+    struct StatsData{
+        uint64_t counters[counter_count] = {};
+        uint64_t maximums[maximum_count] = {};
+        HistogramData histograms[histogram_count];
+
+        void merge(const StatsData& rhs) noexcept;
+    };
+
+    //registered on first use in a thread and merged into the totals on thread exit
+    class ThreadStats{
+    public:
+        ThreadStats();
+
+        ~ThreadStats();
+
+        ThreadStats(const ThreadStats&) = delete;
+        ThreadStats& operator=(const ThreadStats&) = delete;
+
+        StatsData data;
+    };
+
+    inline thread_local ThreadStats thread_stats;
+
+    inline void add(Counter counter,uint64_t n) noexcept{
+        thread_stats.data.counters[static_cast<int>(counter)] += n;
+    }
+
+    inline void max(Maximum maximum,uint64_t value) noexcept{
+        auto& m = thread_stats.data.maximums[static_cast<int>(maximum)];
+        if(value > m) m = value;
+    }
+
+    inline void histogram(Histogram histogram,uint64_t value) noexcept{
+        thread_stats.data.histograms[static_cast<int>(histogram)].add(value);
+    }
+
+    //adds elapsed nanoseconds to a counter
+    class ScopedTimer{
+    public:
+        explicit ScopedTimer(Counter counter) noexcept
+        :counter(counter),start(std::chrono::steady_clock::now())
+        {}
+
+        ~ScopedTimer(){
+            add(counter,static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count()));
+        }
+    private:
+        Counter counter;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    //counts one call of f and its time
+    template<typename F>
+    auto timed(Counter calls,Counter nanoseconds,F&& f){
+        add(calls,1);
+        ScopedTimer timer(nanoseconds);
+        return f();
+    }
+
+    //totals of exited threads plus the live buffers, call it when no worker is counting
+    StatsData collect();
+
+    //drop all counted values, e.g. between two renders
+    void reset();
+
+    std::string to_json(const StatsData& data);
+
+    void log_report(const StatsData& data);
+
+    //log a summary and write the full report as json if filename is not empty
+    void report(const std::string& filename);
+}
+
+#define TRACER_STATS_CONCAT_IMPL(a,b) a##b
+#define TRACER_STATS_CONCAT(a,b) TRACER_STATS_CONCAT_IMPL(a,b)
+
+#ifdef TRACER_STATS
+#define STATS_INC(counter) ::tracer::stats::add(::tracer::stats::Counter::counter,1)
+#define STATS_ADD(counter,n) ::tracer::stats::add(::tracer::stats::Counter::counter,static_cast<uint64_t>(n))
+#define STATS_MAX(name,value) ::tracer::stats::max(::tracer::stats::Maximum::name,static_cast<uint64_t>(value))
+#define STATS_HISTOGRAM(name,value) ::tracer::stats::histogram(::tracer::stats::Histogram::name,static_cast<uint64_t>(value))
+#define STATS_TIMER(counter) ::tracer::stats::ScopedTimer TRACER_STATS_CONCAT(stats_timer_,__LINE__)(::tracer::stats::Counter::counter)
+//evaluates to the value of the expression, e.g. auto f = STATS_TIMED(BSDFEvals,BSDFEvalNanoseconds,bsdf->eval(wi,wo,mode));
+#define STATS_TIMED(calls,nanoseconds,...) ::tracer::stats::timed(::tracer::stats::Counter::calls,::tracer::stats::Counter::nanoseconds,[&]{ return __VA_ARGS__; })
+//declares a local tally, e.g. nodes visited by one ray, which is flushed by STATS_ADD/STATS_HISTOGRAM
+#define STATS_LOCAL(name) uint64_t name = 0
+#define STATS_LOCAL_INC(name) ++name
+#else
+#define STATS_INC(counter) ((void)0)
+#define STATS_ADD(counter,n) ((void)0)
+#define STATS_MAX(name,value) ((void)0)
+#define STATS_HISTOGRAM(name,value) ((void)0)
+#define STATS_TIMER(counter) ((void)0)
+#define STATS_TIMED(calls,nanoseconds,...) (__VA_ARGS__)
+#define STATS_LOCAL(name) ((void)0)
+#define STATS_LOCAL_INC(name) ((void)0)
+#endif
+
+TRACER_END
+
+#endif //TRACER_STATS_HPP
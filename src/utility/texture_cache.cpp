@@ -0,0 +1,301 @@
+//
+// Created by wyz on 2022/6/22.
+//
+#include "texture_cache.hpp"
+#include <cstring>
+#include "utility/logger.hpp"
+
+TRACER_BEGIN
+
+    namespace{
+        constexpr char tiled_texture_magic[4] = {'T','T','X','T'};
+        //version 2 rounds sizes of mip levels up
+        constexpr uint32_t tiled_texture_version = 2;
+
+        constexpr uint64_t invalid_tile_key = ~uint64_t(0);
+        //lookaside counters are merged into shared stats at this interval
+        constexpr uint64_t stats_flush_interval = 1024;
+
+        std::atomic<uint32_t> next_file_id = 0;
+        std::atomic<uint64_t> next_cache_id = 1;
+
+        size_t texel_size(TexelFormat format){
+            switch(format){
+                case TexelFormat::Color3b:
+                case TexelFormat::Color3bGamma: return sizeof(Color3b);
+                case TexelFormat::Color3f: return sizeof(Color3f);
+            }
+            throw std::runtime_error("invalid texel format");
+        }
+
+        uint64_t tile_key(uint32_t file_id,int level,int tx,int ty){
+            return (uint64_t(file_id & 0xffffff) << 40) | (uint64_t(level & 0xff) << 32)
+                 | (uint64_t(ty & 0xffff) << 16) | uint64_t(tx & 0xffff);
+        }
+
+        size_t mix_key(uint64_t key){
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdull;
+            key ^= key >> 33;
+            return static_cast<size_t>(key);
+        }
+
+        template<typename T,typename F>
+        void write_tiled_texture_impl(const std::string& filename,const Image2D<T>& image,
+                                      int tile_size,TexelFormat format,F&& average){
+            if(tile_size <= 0 || tile_size > 0xffff || image.width() <= 0 || image.height() <= 0)
+                throw std::runtime_error("invalid tiled texture size");
+            std::ofstream out(filename,std::ios::binary);
+            if(!out.is_open())
+                throw std::runtime_error("open file failed: " + filename);
+
+            TiledTextureHeader header{};
+            std::memcpy(header.magic,tiled_texture_magic,4);
+            header.version = tiled_texture_version;
+            header.width = image.width();
+            header.height = image.height();
+            header.tile_size = tile_size;
+            header.texel_format = format;
+            out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+
+            std::vector<T> tile((size_t)tile_size * tile_size);
+            Image2D<T> level_image;
+            const Image2D<T>* src = &image;
+            int level = 0;
+            for(;;){
+                const int w = src->width(), h = src->height();
+                header.level_offset[level] = static_cast<uint64_t>(out.tellp());
+                const int tile_x = (w + tile_size - 1) / tile_size;
+                const int tile_y = (h + tile_size - 1) / tile_size;
+                for(int ty = 0; ty < tile_y; ++ty){
+                    for(int tx = 0; tx < tile_x; ++tx){
+                        for(int y = 0; y < tile_size; ++y){
+                            const int sy = (std::min)(ty * tile_size + y,h - 1);
+                            for(int x = 0; x < tile_size; ++x){
+                                const int sx = (std::min)(tx * tile_size + x,w - 1);
+                                tile[y * tile_size + x] = (*src)(sx,sy);
+                            }
+                        }
+                        out.write(reinterpret_cast<const char*>(tile.data()),sizeof(T) * tile.size());
+                    }
+                }
+                ++level;
+                if((w == 1 && h == 1) || level == TiledTextureHeader::max_level_count)
+                    break;
+
+                //sizes are rounded up, the last row and column of odd sizes are clamped
+                //so they are averaged with themselves instead of being dropped
+                const int nw = (w + 1) / 2, nh = (h + 1) / 2;
+                Image2D<T> next(nw,nh);
+                for(int y = 0; y < nh; ++y){
+                    const int y0 = (std::min)(2 * y,h - 1), y1 = (std::min)(2 * y + 1,h - 1);
+                    for(int x = 0; x < nw; ++x){
+                        const int x0 = (std::min)(2 * x,w - 1), x1 = (std::min)(2 * x + 1,w - 1);
+                        next(x,y) = average((*src)(x0,y0),(*src)(x1,y0),(*src)(x0,y1),(*src)(x1,y1));
+                    }
+                }
+                level_image = std::move(next);
+                src = &level_image;
+            }
+            header.level_count = level;
+            out.seekp(0);
+            out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+            if(!out.good())
+                throw std::runtime_error("write tiled texture failed: " + filename);
+        }
+
+        //tiles recently used by this thread, indexed by hashed key
+        struct Lookaside{
+            struct Slot{
+                uint64_t key = invalid_tile_key;
+                RC<const TextureTile> tile;
+            };
+            uint64_t cache_id = 0;
+            uint64_t pending_lookups = 0;
+            uint64_t pending_hits = 0;
+            Slot slots[TextureCache::lookaside_size];
+
+            void reset(uint64_t id){
+                for(auto& slot:slots){
+                    slot.key = invalid_tile_key;
+                    slot.tile.reset();
+                }
+                cache_id = id;
+                pending_lookups = pending_hits = 0;
+            }
+        };
+        thread_local Lookaside lookaside;
+    }
+
+    void write_tiled_texture(const std::string& filename,const Image2D<Color3b>& image,int tile_size,bool gamma_encoded){
+        if(gamma_encoded){
+            write_tiled_texture_impl(filename,image,tile_size,TexelFormat::Color3bGamma,
+                                     [](const Color3b& t00,const Color3b& t01,const Color3b& t10,const Color3b& t11){
+                return gamma_table.mip_average(t00,t01,t10,t11);
+            });
+        }
+        else{
+            write_tiled_texture_impl(filename,image,tile_size,TexelFormat::Color3b,
+                                     [](const Color3b& t00,const Color3b& t01,const Color3b& t10,const Color3b& t11){
+                return mip_average(t00,t01,t10,t11);
+            });
+        }
+    }
+
+    void write_tiled_texture(const std::string& filename,const Image2D<Color3f>& image,int tile_size){
+        write_tiled_texture_impl(filename,image,tile_size,TexelFormat::Color3f,
+                                 [](const Color3f& t00,const Color3f& t01,const Color3f& t10,const Color3f& t11){
+            return mip_average(t00,t01,t10,t11);
+        });
+    }
+
+    bool TiledTextureFile::is_current(const std::string& filename){
+        std::ifstream in(filename,std::ios::binary);
+        TiledTextureHeader header;
+        in.read(reinterpret_cast<char*>(&header),sizeof(header));
+        return in && std::memcmp(header.magic,tiled_texture_magic,4) == 0 && header.version == tiled_texture_version;
+    }
+
+    TiledTextureFile::TiledTextureFile(const std::string& filename)
+    :file_id(next_file_id++),name(filename),in(filename,std::ios::binary)
+    {
+        if(!in.is_open())
+            throw std::runtime_error("open file failed: " + filename);
+        in.read(reinterpret_cast<char*>(&header),sizeof(header));
+        if(!in || std::memcmp(header.magic,tiled_texture_magic,4) != 0 || header.version != tiled_texture_version
+        || header.width <= 0 || header.height <= 0 || header.tile_size <= 0 || header.level_count <= 0 || header.level_count > TiledTextureHeader::max_level_count)
+            throw std::runtime_error("invalid tiled texture file: " + filename);
+        texel_bytes = texel_size(header.texel_format);
+
+        in.seekg(0,std::ios::end);
+        const auto file_size = static_cast<uint64_t>(in.tellg());
+        const int last = header.level_count - 1;
+        const uint64_t end = header.level_offset[last] + (uint64_t)tile_count_x(last) * tile_count_y(last) * tile_bytes();
+        if(end > file_size)
+            throw std::runtime_error("truncated tiled texture file: " + filename);
+    }
+
+    void TiledTextureFile::read_tile(int level,int tx,int ty,void* dst) const{
+        assert(level >= 0 && level < levels());
+        assert(tx >= 0 && tx < tile_count_x(level) && ty >= 0 && ty < tile_count_y(level));
+        const uint64_t offset = header.level_offset[level] + ((uint64_t)ty * tile_count_x(level) + tx) * tile_bytes();
+        std::lock_guard<std::mutex> lk(mutex);
+        in.seekg(static_cast<std::streamoff>(offset));
+        in.read(static_cast<char*>(dst),static_cast<std::streamsize>(tile_bytes()));
+        if(!in){
+            //lookups can't fail, render on with a black tile
+            in.clear();
+            std::memset(dst,0,tile_bytes());
+            LOG_ERROR("read tile {} {} of level {} failed: {}",tx,ty,level,name);
+        }
+    }
+
+    TextureCache::TextureCache(size_t max_memory)
+    :cache_id(next_cache_id++),max_memory(max_memory),shard_max_memory(max_memory / shard_count),
+    shards(newBox<Shard[]>(shard_count))
+    {}
+
+    TextureCache::~TextureCache(){
+        if(lookaside.cache_id == cache_id)
+            lookaside.reset(0);
+    }
+
+    const TextureTile* TextureCache::get_tile(const TiledTextureFile& file,int level,int tx,int ty){
+        const uint64_t key = tile_key(file.id(),level,tx,ty);
+        auto& table = lookaside;
+        if(table.cache_id != cache_id)
+            table.reset(cache_id);
+
+        auto flush = [&]{
+            lookups += table.pending_lookups;
+            lookaside_hits += table.pending_hits;
+            table.pending_lookups = table.pending_hits = 0;
+        };
+
+        ++table.pending_lookups;
+        auto& slot = table.slots[mix_key(key) % lookaside_size];
+        if(slot.key == key){
+            ++table.pending_hits;
+            if(table.pending_lookups >= stats_flush_interval)
+                flush();
+            return slot.tile.get();
+        }
+        flush();
+        slot.tile = get_shared_tile(file,level,tx,ty,key);
+        slot.key = key;
+        return slot.tile.get();
+    }
+
+    RC<const TextureTile> TextureCache::get_shared_tile(const TiledTextureFile& file,int level,int tx,int ty,uint64_t key){
+        auto& shard = shards[(mix_key(key) / lookaside_size) % shard_count];
+        {
+            std::lock_guard<std::mutex> lk(shard.mutex);
+            auto it = shard.index.find(key);
+            if(it != shard.index.end()){
+                shard.lru.splice(shard.lru.begin(),shard.lru,it->second);
+                ++cache_hits;
+                return it->second->second;
+            }
+        }
+
+        //read without holding the shard lock
+        ++misses;
+        auto tile = newRC<TextureTile>();
+        tile->texels.resize(file.tile_bytes());
+        file.read_tile(level,tx,ty,tile->texels.data());
+        const size_t bytes = tile->texels.size();
+
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        auto it = shard.index.find(key);
+        if(it != shard.index.end()){
+            //loaded by another thread meanwhile
+            shard.lru.splice(shard.lru.begin(),shard.lru,it->second);
+            return it->second->second;
+        }
+        shard.lru.emplace_front(key,tile);
+        shard.index[key] = shard.lru.begin();
+        shard.memory += bytes;
+        add_memory(bytes);
+        while(shard.memory > shard_max_memory && shard.lru.size() > 1){
+            const auto& victim = shard.lru.back();
+            const size_t victim_bytes = victim.second->texels.size();
+            shard.memory -= victim_bytes;
+            memory -= victim_bytes;
+            shard.index.erase(victim.first);
+            shard.lru.pop_back();
+            ++evictions;
+        }
+        return tile;
+    }
+
+    void TextureCache::add_memory(size_t bytes){
+        const size_t cur = memory += bytes;
+        size_t peak = peak_memory;
+        while(cur > peak && !peak_memory.compare_exchange_weak(peak,cur));
+    }
+
+    TextureCacheStats TextureCache::get_stats() const{
+        TextureCacheStats stats;
+        stats.lookups = lookups;
+        stats.lookaside_hits = lookaside_hits;
+        stats.cache_hits = cache_hits;
+        stats.misses = misses;
+        stats.evictions = evictions;
+        stats.memory = memory;
+        stats.peak_memory = peak_memory;
+        stats.max_memory = max_memory;
+        return stats;
+    }
+
+    void TextureCache::log_stats() const{
+        const auto stats = get_stats();
+        const double inv_lookups = stats.lookups ? 100.0 / stats.lookups : 0.0;
+        constexpr double mb = 1.0 / (1 << 20);
+        LOG_INFO("texture cache lookups: {}, lookaside hit {:.2f}%, shared hit {:.2f}%, miss {:.2f}%, evictions: {}",
+                 stats.lookups,stats.lookaside_hits * inv_lookups,stats.cache_hits * inv_lookups,
+                 stats.misses * inv_lookups,stats.evictions);
+        LOG_INFO("texture cache memory: {:.1f} MB, peak {:.1f} MB, cap {:.1f} MB",
+                 stats.memory * mb,stats.peak_memory * mb,stats.max_memory * mb);
+    }
+
+TRACER_END
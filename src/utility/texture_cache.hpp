@@ -0,0 +1,177 @@
+//
+// Created by wyz on 2022/6/22.
+//
+
+#ifndef TRACER_TEXTURE_CACHE_HPP
+#define TRACER_TEXTURE_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "common.hpp"
+#include "utility/image.hpp"
+
+TRACER_BEGIN
+
+enum class TexelFormat : int32_t{
+    Color3b = 0,
+    Color3f = 1,
+    //8 bit decoded by gamma_table
+    Color3bGamma = 2
+};
+
+//mip-mapped image split into fixed size square tiles, tiles on borders are padded by edge texels
+//file layout: header | level 0 tiles | level 1 tiles | ...
+//tiles of a level are stored row by row
+struct TiledTextureHeader{
+    static constexpr int max_level_count = 16;
+
+    char magic[4];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t tile_size;
+    int32_t level_count;
+    TexelFormat texel_format;
+    uint32_t padding;
+    uint64_t level_offset[max_level_count];
+};
+static_assert(sizeof(TiledTextureHeader) == 160,"");
+
+//write image and all its mip levels, non power of 2 sizes are supported
+//gamma encoded images are stored as is and their mip levels are averaged in linear space
+void write_tiled_texture(const std::string& filename,const Image2D<Color3b>& image,int tile_size = 64,
+                         bool gamma_encoded = false);
+
+void write_tiled_texture(const std::string& filename,const Image2D<Color3f>& image,int tile_size = 64);
+
+//only the header is read on open, tiles are read by TextureCache on demand
+class TiledTextureFile{
+public:
+    explicit TiledTextureFile(const std::string& filename);
+
+    //false if the file can not be read or was written by another version
+    static bool is_current(const std::string& filename);
+
+    //sizes of mip levels are rounded up
+    int width(int level = 0) const noexcept{
+        return ((header.width - 1) >> level) + 1;
+    }
+
+    int height(int level = 0) const noexcept{
+        return ((header.height - 1) >> level) + 1;
+    }
+
+    int levels() const noexcept{ return header.level_count; }
+
+    int tile_size() const noexcept{ return header.tile_size; }
+
+    TexelFormat texel_format() const noexcept{ return header.texel_format; }
+
+    int tile_count_x(int level) const noexcept{
+        return (width(level) + header.tile_size - 1) / header.tile_size;
+    }
+
+    int tile_count_y(int level) const noexcept{
+        return (height(level) + header.tile_size - 1) / header.tile_size;
+    }
+
+    size_t tile_bytes() const noexcept{
+        return (size_t)header.tile_size * header.tile_size * texel_bytes;
+    }
+
+    //unique among opened files, used as part of cache keys
+    uint32_t id() const noexcept{ return file_id; }
+
+    void read_tile(int level,int tx,int ty,void* dst) const;
+
+private:
+    TiledTextureHeader header;
+    size_t texel_bytes;
+    uint32_t file_id;
+    std::string name;
+    mutable std::ifstream in;
+    mutable std::mutex mutex;
+};
+
+struct TextureTile{
+    std::vector<uint8_t> texels;
+
+    template<typename Texel>
+    const Texel& at(int x,int y,int tile_size) const noexcept{
+        return reinterpret_cast<const Texel*>(texels.data())[y * tile_size + x];
+    }
+};
+
+struct TextureCacheStats{
+    uint64_t lookups = 0;
+    //hits in per-thread lookaside table, no lock taken
+    uint64_t lookaside_hits = 0;
+    //hits in shared lru
+    uint64_t cache_hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t memory = 0;
+    size_t peak_memory = 0;
+    size_t max_memory = 0;
+};
+
+//fixed size tile cache shared by all tiled textures
+//the lru is split into shards each guarded by its own mutex, and every thread keeps
+//a small direct mapped lookaside table of recently used tiles in front of it
+//tiles evicted from the lru stay alive until dropped by lookaside tables,
+//so memory may exceed max_memory by at most lookaside_size tiles per thread
+class TextureCache{
+public:
+    static constexpr int shard_count = 16;
+    static constexpr int lookaside_size = 64;
+
+    explicit TextureCache(size_t max_memory);
+
+    ~TextureCache();
+
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    //returned tile is valid until the calling thread's next get_tile
+    const TextureTile* get_tile(const TiledTextureFile& file,int level,int tx,int ty);
+
+    TextureCacheStats get_stats() const;
+
+    void log_stats() const;
+
+private:
+    using Entry = std::pair<uint64_t,RC<const TextureTile>>;
+    struct Shard{
+        std::mutex mutex;
+        //front is most recently used
+        std::list<Entry> lru;
+        std::unordered_map<uint64_t,std::list<Entry>::iterator> index;
+        size_t memory = 0;
+    };
+
+    RC<const TextureTile> get_shared_tile(const TiledTextureFile& file,int level,int tx,int ty,uint64_t key);
+
+    void add_memory(size_t bytes);
+
+    uint64_t cache_id;
+    size_t max_memory;
+    size_t shard_max_memory;
+    Box<Shard[]> shards;
+
+    std::atomic<uint64_t> lookups = 0;
+    std::atomic<uint64_t> lookaside_hits = 0;
+    std::atomic<uint64_t> cache_hits = 0;
+    std::atomic<uint64_t> misses = 0;
+    std::atomic<uint64_t> evictions = 0;
+    std::atomic<size_t> memory = 0;
+    std::atomic<size_t> peak_memory = 0;
+};
+
+TRACER_END
+
+#endif //TRACER_TEXTURE_CACHE_HPP
@@ -160,6 +160,26 @@ namespace tracer{
         return Transform(m, transpose(m));
     }
 
+    Transform rotate(real theta, const Vector3f& axis){
+        const Vector3f a = normalize(axis);
+        real sinTheta = std::sin(theta);
+        real cosTheta = std::cos(theta);
+        Matrix4x4 m(a.x * a.x + (1 - a.x * a.x) * cosTheta,
+                    a.x * a.y * (1 - cosTheta) - a.z * sinTheta,
+                    a.x * a.z * (1 - cosTheta) + a.y * sinTheta,
+                    0,
+                    a.x * a.y * (1 - cosTheta) + a.z * sinTheta,
+                    a.y * a.y + (1 - a.y * a.y) * cosTheta,
+                    a.y * a.z * (1 - cosTheta) - a.x * sinTheta,
+                    0,
+                    a.x * a.z * (1 - cosTheta) - a.y * sinTheta,
+                    a.y * a.z * (1 - cosTheta) + a.x * sinTheta,
+                    a.z * a.z + (1 - a.z * a.z) * cosTheta,
+                    0,
+                    0, 0, 0, 1);
+        return Transform(m, transpose(m));
+    }
+
     Transform translate(const Vector3f& delta){
         Matrix4x4 m(1,0,0,delta.x,
                     0,1,0,delta.y,